@@ -555,6 +555,9 @@ static void test_client(void)
     ck_assert_msg(tcp_con_status(conn) == TCP_CLIENT_CONFIRMED, "Wrong status. Expected: %d, is: %d", TCP_CLIENT_CONFIRMED,
                   tcp_con_status(conn));
 
+    // The handshake alone gives us a first round trip time sample.
+    ck_assert_msg(tcp_con_rtt(conn) > 0, "No RTT measured after the handshake.");
+
     uint8_t f2_public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint8_t f2_secret_key[CRYPTO_SECRET_KEY_SIZE];
     crypto_new_keypair(rng, f2_public_key, f2_secret_key);
@@ -114,10 +114,121 @@ static void test_store_data(void)
     logger_kill(log);
 }
 
+static void test_memory_budget(void)
+{
+    const Random *rng = os_random();
+    ck_assert(rng != nullptr);
+    const Network *ns = os_network();
+    ck_assert(ns != nullptr);
+    const Memory *mem = os_memory();
+    ck_assert(mem != nullptr);
+
+    Logger *log = logger_new(mem);
+    ck_assert(log != nullptr);
+    logger_callback_log(log, print_debug_logger, nullptr, nullptr);
+    Mono_Time *mono_time = mono_time_new(mem, nullptr, nullptr);
+    ck_assert(mono_time != nullptr);
+    Networking_Core *net = new_networking_no_udp(log, mem, ns);
+    ck_assert(net != nullptr);
+    DHT *dht = new_dht(log, mem, rng, ns, mono_time, net, true, true);
+    ck_assert(dht != nullptr);
+    Forwarding *forwarding = new_forwarding(log, rng, mono_time, dht);
+    ck_assert(forwarding != nullptr);
+    Announcements *announce = new_announcements(log, mem, rng, mono_time, forwarding);
+    ck_assert(announce != nullptr);
+
+    /* One slab of maximum size chunks. */
+    announce_set_memory_budget(announce, ANNOUNCE_MIN_MEMORY_BUDGET);
+
+    uint8_t data[MAX_ANNOUNCEMENT_SIZE];
+    random_bytes(rng, data, sizeof(data));
+
+    /* Keys differing from ours at a later byte are closer to us. The byte after
+     * that puts each in a bucket of its own.
+     */
+    const uint8_t *const base = dht_get_self_public_key(dht);
+    uint8_t test_keys[13][CRYPTO_PUBLIC_KEY_SIZE];
+
+    for (uint8_t i = 0; i < 13; ++i) {
+        memcpy(test_keys[i], base, CRYPTO_PUBLIC_KEY_SIZE);
+        test_keys[i][i] ^= 1;
+        test_keys[i][i + 1] ^= (uint8_t)(i << 3);
+    }
+
+    for (uint8_t i = 1; i < 9; ++i) {
+        ck_assert_msg(announce_store_data(announce, test_keys[i], data, sizeof(data), MAX_MAX_ANNOUNCEMENT_TIMEOUT),
+                      "Failed to store announcement %d", i);
+    }
+
+    Announce_Stats stats;
+    announce_get_stats(announce, &stats);
+    ck_assert_msg(stats.entries == 8 && stats.data_bytes == 8 * sizeof(data), "Bad occupancy");
+    ck_assert_msg(stats.memory_bytes == ANNOUNCE_MIN_MEMORY_BUDGET, "Bad memory use: %u", stats.memory_bytes);
+
+    /* The slab is full, so the farthest entry makes room. */
+    ck_assert_msg(announce_store_data(announce, test_keys[9], data, sizeof(data), MAX_MAX_ANNOUNCEMENT_TIMEOUT),
+                  "Failed to store closer announcement");
+
+    announce_get_stats(announce, &stats);
+    ck_assert_msg(stats.entries == 8 && stats.evictions == 1, "Evicted %u entries", (unsigned)stats.evictions);
+    ck_assert(!announce_on_stored(announce, test_keys[1], nullptr, nullptr));
+
+    /* A smaller chunk needs a slab of its own, and no eviction of the larger
+     * size class would free one, so nothing is evicted for it.
+     */
+    ck_assert_msg(!announce_store_data(announce, test_keys[10], data, sizeof(data) / 2, MAX_MAX_ANNOUNCEMENT_TIMEOUT),
+                  "Stored a smaller chunk beyond the budget");
+
+    announce_get_stats(announce, &stats);
+    ck_assert_msg(stats.entries == 8 && stats.evictions == 1, "Evicted %u entries", (unsigned)stats.evictions);
+    ck_assert_msg(stats.rejected == 1, "Refused store was not counted");
+
+    /* Room for one more slab of the smaller size class. */
+    announce_set_memory_budget(announce, ANNOUNCE_MIN_MEMORY_BUDGET + ANNOUNCE_MIN_MEMORY_BUDGET / 2);
+    ck_assert(announce_store_data(announce, test_keys[10], data, sizeof(data) / 2, MAX_MAX_ANNOUNCEMENT_TIMEOUT));
+
+    /* The smallest chunk's slab doesn't fit, so the entry alone in its slab of
+     * another size class makes room.
+     */
+    ck_assert_msg(announce_store_data(announce, test_keys[11], data, sizeof(data) / 8, MAX_MAX_ANNOUNCEMENT_TIMEOUT),
+                  "Failed to store smallest announcement");
+
+    announce_get_stats(announce, &stats);
+    ck_assert_msg(stats.entries == 9 && stats.evictions == 2, "Evicted %u entries", (unsigned)stats.evictions);
+    ck_assert(!announce_on_stored(announce, test_keys[10], nullptr, nullptr));
+    ck_assert_msg(stats.memory_bytes <= stats.memory_budget, "Memory budget exceeded");
+
+    /* Shares the slab of the smallest chunk, so no entry is alone in its slab
+     * and lowering the budget can't evict anything to meet it.
+     */
+    ck_assert(announce_store_data(announce, test_keys[12], data, sizeof(data) / 8, MAX_MAX_ANNOUNCEMENT_TIMEOUT));
+    announce_set_memory_budget(announce, ANNOUNCE_MIN_MEMORY_BUDGET);
+
+    announce_get_stats(announce, &stats);
+    ck_assert_msg(stats.entries == 10 && stats.evictions == 2, "Evicted %u entries", (unsigned)stats.evictions);
+    ck_assert_msg(stats.memory_bytes > stats.memory_budget, "Memory use unexpectedly dropped");
+
+    /* Nothing is farther away than the farthest key, so it can't make room. */
+    ck_assert_msg(!announce_store_data(announce, test_keys[0], data, sizeof(data), MAX_MAX_ANNOUNCEMENT_TIMEOUT),
+                  "Farthest announcement evicted a closer one");
+
+    announce_get_stats(announce, &stats);
+    ck_assert_msg(stats.rejected == 2, "Refused store was not counted");
+    ck_assert(announce_on_stored(announce, test_keys[9], nullptr, nullptr));
+
+    kill_announcements(announce);
+    kill_forwarding(forwarding);
+    kill_dht(dht);
+    kill_networking(net);
+    mono_time_free(mem, mono_time);
+    logger_kill(log);
+}
+
 static void basic_announce_tests(void)
 {
     test_bucketnum();
     test_store_data();
+    test_memory_budget();
 }
 
 int main(void)
@@ -0,0 +1,133 @@
+/* Tests that a burst of short messages arrives in order and gets all its read
+ * receipts when friends coalesce them into shared packets.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct State {
+    uint32_t messages_received;
+    uint32_t receipts_received;
+    uint32_t last_receipt;
+} State;
+
+#include "../toxcore/tox_private.h"
+#include "auto_test_support.h"
+
+#define NUM_MESSAGES 200
+/** This message is too long to be coalesced, so it's sent on its own in the middle of the burst. */
+#define LONG_MESSAGE_INDEX 100
+
+/** Whether the current run has `experimental_coalesce_messages` enabled. */
+static bool coalesce_enabled;
+
+static size_t message_for(uint32_t index, uint8_t *message)
+{
+    if (index == LONG_MESSAGE_INDEX) {
+        memset(message, 'L', tox_max_message_length());
+        return tox_max_message_length();
+    }
+
+    return (size_t)snprintf((char *)message, tox_max_message_length(), "message %u", index);
+}
+
+static void friend_message(const Tox_Event_Friend_Message *event, void *user_data)
+{
+    const AutoTox *autotox = (AutoTox *)user_data;
+    State *state = (State *)autotox->state;
+
+    uint8_t expected[TOX_MAX_MESSAGE_LENGTH];
+    const size_t expected_length = message_for(state->messages_received, expected);
+
+    ck_assert_msg(tox_event_friend_message_get_message_length(event) == expected_length
+                  && memcmp(tox_event_friend_message_get_message(event), expected, expected_length) == 0,
+                  "message %u arrived out of order", state->messages_received);
+
+    ++state->messages_received;
+}
+
+static void friend_read_receipt(const Tox_Event_Friend_Read_Receipt *event, void *user_data)
+{
+    const AutoTox *autotox = (AutoTox *)user_data;
+    State *state = (State *)autotox->state;
+
+    const uint32_t message_id = tox_event_friend_read_receipt_get_message_id(event);
+    ck_assert_msg(message_id > state->last_receipt, "receipt for message %u came after the one for %u",
+                  message_id, state->last_receipt);
+
+    state->last_receipt = message_id;
+    ++state->receipts_received;
+}
+
+static void coalesce_messages_test(AutoTox *autotoxes)
+{
+    tox_events_callback_friend_message(autotoxes[1].dispatch, friend_message);
+    tox_events_callback_friend_read_receipt(autotoxes[0].dispatch, friend_read_receipt);
+
+    // Give the capability packets time to arrive.
+    iterate_all_wait(autotoxes, 2, ITERATION_INTERVAL);
+
+    uint8_t message[TOX_MAX_MESSAGE_LENGTH];
+
+    for (uint32_t i = 0; i < NUM_MESSAGES; ++i) {
+        const size_t length = message_for(i, message);
+        Tox_Err_Friend_Send_Message err;
+        tox_friend_send_message(autotoxes[0].tox, 0, TOX_MESSAGE_TYPE_NORMAL, message, length, &err);
+        ck_assert_msg(err == TOX_ERR_FRIEND_SEND_MESSAGE_OK, "failed to send message %u: %d", i, err);
+    }
+
+    tox_self_set_typing(autotoxes[0].tox, 0, true, nullptr);
+
+    const State *sender = (const State *)autotoxes[0].state;
+    const State *receiver = (const State *)autotoxes[1].state;
+
+    do {
+        iterate_all_wait(autotoxes, 2, ITERATION_INTERVAL);
+    } while (receiver->messages_received < NUM_MESSAGES || sender->receipts_received < NUM_MESSAGES
+             || !tox_friend_get_typing(autotoxes[1].tox, 0, nullptr));
+
+    ck_assert_msg(receiver->messages_received == NUM_MESSAGES, "got %u messages", receiver->messages_received);
+    ck_assert_msg(sender->receipts_received == NUM_MESSAGES, "got %u receipts", sender->receipts_received);
+
+    Tox_Coalesce_Stats sent;
+    Tox_Coalesce_Stats received;
+    ck_assert(tox_friend_get_coalesce_stats(autotoxes[0].tox, 0, &sent));
+    ck_assert(tox_friend_get_coalesce_stats(autotoxes[1].tox, 0, &received));
+
+    printf("sent %u coalesced packets, received %u\n", sent.coalesced_packets_sent,
+           received.coalesced_packets_received);
+
+    if (coalesce_enabled) {
+        ck_assert_msg(sent.coalesced_packets_sent > 0, "no messages were coalesced");
+        ck_assert_msg(received.coalesced_packets_received > 0, "no coalesced packets arrived");
+    } else {
+        ck_assert_msg(sent.coalesced_packets_sent == 0 && received.coalesced_packets_received == 0,
+                      "packets were coalesced with the option off");
+    }
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+    struct Tox_Options *tox_options = tox_options_new(nullptr);
+    ck_assert(tox_options != nullptr);
+
+    Run_Auto_Options options = default_run_auto_options();
+    options.graph = GRAPH_LINEAR;
+
+    coalesce_enabled = true;
+    tox_options_set_experimental_coalesce_messages(tox_options, true);
+    run_auto_test(tox_options, 2, coalesce_messages_test, sizeof(State), &options);
+
+    // The same burst without coalescing behaves the same.
+    coalesce_enabled = false;
+    tox_options_set_experimental_coalesce_messages(tox_options, false);
+    run_auto_test(tox_options, 2, coalesce_messages_test, sizeof(State), &options);
+
+    tox_options_free(tox_options);
+
+    return 0;
+}
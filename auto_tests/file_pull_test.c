@@ -0,0 +1,270 @@
+/* File transfer test: pull mode, where toxcore reads the file data itself, with
+ * the receiver batching the chunks it gets.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../testing/misc_tools.h"
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+#include "../toxcore/tox_private.h"
+#include "../toxcore/util.h"
+#include "auto_test_support.h"
+#include "check_compat.h"
+
+#ifndef USE_IPV6
+#define USE_IPV6 1
+#endif
+
+#ifdef TOX_LOCALHOST
+#undef TOX_LOCALHOST
+#endif
+#if USE_IPV6
+#define TOX_LOCALHOST "::1"
+#else
+#define TOX_LOCALHOST "127.0.0.1"
+#endif
+
+#define FILE_SIZE (1024 * 1024 + 123)
+
+static uint8_t file_byte(uint64_t position)
+{
+    return (uint8_t)(position * 31 + (position >> 8));
+}
+
+static void accept_friend_request(Tox *m, const uint8_t *public_key, const uint8_t *data, size_t length, void *userdata)
+{
+    if (length == 7 && memcmp("Gentoo", data, 7) == 0) {
+        tox_friend_add_norequest(m, public_key, nullptr);
+    }
+}
+
+static void tox_file_receive(Tox *tox, uint32_t friend_number, uint32_t file_number, uint32_t kind, uint64_t filesize,
+                             const uint8_t *filename, size_t filename_length, void *userdata)
+{
+    ck_assert_msg(filesize == FILE_SIZE, "bad file size %lu", (unsigned long)filesize);
+
+    Tox_Err_File_Set_Recv_Buffer err_b;
+    ck_assert_msg(!tox_file_set_recv_buffer(tox, friend_number, file_number, TOX_FILE_RECV_BUFFER_MAX_SIZE + 1, &err_b),
+                  "tox_file_set_recv_buffer didn't fail");
+    ck_assert_msg(err_b == TOX_ERR_FILE_SET_RECV_BUFFER_TOO_LARGE, "wrong error");
+    ck_assert_msg(tox_file_set_recv_buffer(tox, friend_number, file_number, 64 * 1024, &err_b),
+                  "tox_file_set_recv_buffer failed");
+    ck_assert_msg(err_b == TOX_ERR_FILE_SET_RECV_BUFFER_OK, "wrong error");
+
+    Tox_Err_File_Control error;
+    ck_assert_msg(tox_file_control(tox, friend_number, file_number, TOX_FILE_CONTROL_RESUME, &error),
+                  "tox_file_control failed. %i", error);
+}
+
+static uint64_t read_pos;
+static uint32_t num_reads;
+static int64_t tox_file_read_chunk(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
+                                   uint8_t *data, size_t length, void *user_data)
+{
+    ck_assert_msg(read_pos == position, "bad read position %lu", (unsigned long)position);
+
+    for (size_t i = 0; i < length; ++i) {
+        data[i] = file_byte(position + i);
+    }
+
+    read_pos += length;
+    ++num_reads;
+    return length;
+}
+
+/** The read that cancels the transfer in the second part of the test. */
+#define CANCEL_AT_READ 10
+
+static uint32_t num_cancel_reads;
+static int64_t tox_file_read_chunk_cancel(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
+        uint8_t *data, size_t length, void *user_data)
+{
+    ++num_cancel_reads;
+    ck_assert_msg(num_cancel_reads <= CANCEL_AT_READ, "file read after the transfer was cancelled");
+
+    for (size_t i = 0; i < length; ++i) {
+        data[i] = file_byte(position + i);
+    }
+
+    if (num_cancel_reads == CANCEL_AT_READ) {
+        // The read itself succeeds, but the data must not be sent anymore.
+        Tox_Err_File_Control error;
+        ck_assert_msg(tox_file_control(tox, friend_number, file_number, TOX_FILE_CONTROL_CANCEL, &error),
+                      "tox_file_control failed. %i", error);
+    }
+
+    return length;
+}
+
+static bool file_sending_done;
+static void tox_file_chunk_request(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
+                                   size_t length, void *user_data)
+{
+    ck_assert_msg(length == 0, "chunk of length %u requested in pull mode", (unsigned)length);
+    ck_assert_msg(position == FILE_SIZE, "bad end position %lu", (unsigned long)position);
+    ck_assert_msg(!file_sending_done, "file sending already done");
+    file_sending_done = true;
+}
+
+static uint64_t size_recv;
+static uint32_t num_recv_chunks;
+static bool file_recv;
+static void write_file(Tox *tox, uint32_t friendnumber, uint32_t filenumber, uint64_t position, const uint8_t *data,
+                       size_t length, void *user_data)
+{
+    ck_assert_msg(size_recv == position, "bad position");
+
+    if (length == 0) {
+        file_recv = true;
+        return;
+    }
+
+    ck_assert_msg(length <= 64 * 1024, "chunk larger than the receive buffer");
+
+    for (size_t i = 0; i < length; ++i) {
+        ck_assert_msg(data[i] == file_byte(position + i), "FILE_CORRUPTED");
+    }
+
+    size_recv += length;
+    ++num_recv_chunks;
+}
+
+static bool file_recv_cancelled;
+static void file_recv_control(Tox *tox, uint32_t friend_number, uint32_t file_number, Tox_File_Control control,
+                              void *user_data)
+{
+    if (control == TOX_FILE_CONTROL_CANCEL) {
+        file_recv_cancelled = true;
+    }
+}
+
+static void iterate_3(Tox *tox1, Tox *tox2, Tox *tox3)
+{
+    tox_iterate(tox1, nullptr);
+    tox_iterate(tox2, nullptr);
+    tox_iterate(tox3, nullptr);
+
+    uint32_t tox1_interval = tox_iteration_interval(tox1);
+    uint32_t tox2_interval = tox_iteration_interval(tox2);
+    uint32_t tox3_interval = tox_iteration_interval(tox3);
+
+    c_sleep(min_u32(tox1_interval, min_u32(tox2_interval, tox3_interval)));
+}
+
+static void file_pull_test(void)
+{
+    uint32_t index[] = { 1, 2, 3 };
+    long long unsigned int cur_time = time(nullptr);
+    Tox_Err_New t_n_error;
+    Tox *tox1 = tox_new_log(nullptr, &t_n_error, &index[0]);
+    ck_assert_msg(t_n_error == TOX_ERR_NEW_OK, "wrong error");
+    Tox *tox2 = tox_new_log(nullptr, &t_n_error, &index[1]);
+    ck_assert_msg(t_n_error == TOX_ERR_NEW_OK, "wrong error");
+    Tox *tox3 = tox_new_log(nullptr, &t_n_error, &index[2]);
+    ck_assert_msg(t_n_error == TOX_ERR_NEW_OK, "wrong error");
+
+    tox_callback_friend_request(tox2, accept_friend_request);
+    uint8_t address[TOX_ADDRESS_SIZE];
+    tox_self_get_address(tox2, address);
+    uint32_t test = tox_friend_add(tox3, address, (const uint8_t *)"Gentoo", 7, nullptr);
+    ck_assert_msg(test == 0, "Failed to add friend error code: %u", test);
+
+    uint8_t dht_key[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(tox1, dht_key);
+    uint16_t dht_port = tox_self_get_udp_port(tox1, nullptr);
+
+    tox_bootstrap(tox2, TOX_LOCALHOST, dht_port, dht_key, nullptr);
+    tox_bootstrap(tox3, TOX_LOCALHOST, dht_port, dht_key, nullptr);
+
+    printf("Waiting for toxes to come online\n");
+
+    do {
+        tox_iterate(tox1, nullptr);
+        tox_iterate(tox2, nullptr);
+        tox_iterate(tox3, nullptr);
+        c_sleep(ITERATION_INTERVAL);
+    } while (tox_self_get_connection_status(tox1) == TOX_CONNECTION_NONE ||
+             tox_self_get_connection_status(tox2) == TOX_CONNECTION_NONE ||
+             tox_self_get_connection_status(tox3) == TOX_CONNECTION_NONE ||
+             tox_friend_get_connection_status(tox2, 0, nullptr) == TOX_CONNECTION_NONE ||
+             tox_friend_get_connection_status(tox3, 0, nullptr) == TOX_CONNECTION_NONE);
+
+    printf("Starting pull mode file transfer test.\n");
+
+    tox_callback_file_recv_chunk(tox3, write_file);
+    tox_callback_file_recv(tox3, tox_file_receive);
+    tox_callback_file_chunk_request(tox2, tox_file_chunk_request);
+    tox_callback_file_read_chunk(tox2, tox_file_read_chunk);
+
+    const Tox_File_Number fnum = tox_file_send(tox2, 0, TOX_FILE_KIND_DATA, FILE_SIZE, nullptr,
+                                 (const uint8_t *)"Gentoo.exe", sizeof("Gentoo.exe"), nullptr);
+    ck_assert_msg(fnum != UINT32_MAX, "tox_file_send failed");
+
+    Tox_Err_File_Set_Pull err_p;
+    ck_assert_msg(!tox_file_set_pull(tox2, 1, fnum, true, &err_p), "tox_file_set_pull didn't fail");
+    ck_assert_msg(err_p == TOX_ERR_FILE_SET_PULL_FRIEND_NOT_FOUND, "wrong error");
+    ck_assert_msg(!tox_file_set_pull(tox2, 0, fnum + 1, true, &err_p), "tox_file_set_pull didn't fail");
+    ck_assert_msg(err_p == TOX_ERR_FILE_SET_PULL_NOT_FOUND, "wrong error");
+    ck_assert_msg(tox_file_set_pull(tox2, 0, fnum, true, &err_p), "tox_file_set_pull failed");
+    ck_assert_msg(err_p == TOX_ERR_FILE_SET_PULL_OK, "wrong error");
+
+    do {
+        iterate_3(tox1, tox2, tox3);
+    } while (!file_sending_done || !file_recv);
+
+    ck_assert_msg(size_recv == FILE_SIZE && read_pos == FILE_SIZE,
+                  "something went wrong in file transfer: received %lu, read %lu",
+                  (unsigned long)size_recv, (unsigned long)read_pos);
+    ck_assert_msg(num_recv_chunks < num_reads, "received chunks were not batched: %u chunks for %u reads",
+                  num_recv_chunks, num_reads);
+
+    printf("file_pull_test succeeded with %u reads and %u received chunks, took %llu seconds\n",
+           num_reads, num_recv_chunks, time(nullptr) - cur_time);
+
+    printf("Starting pull mode file transfer cancelled from the read callback.\n");
+
+    tox_callback_file_recv_control(tox3, file_recv_control);
+    tox_callback_file_read_chunk(tox2, tox_file_read_chunk_cancel);
+    file_sending_done = false;
+    file_recv = false;
+    size_recv = 0;
+
+    const Tox_File_Number cancel_fnum = tox_file_send(tox2, 0, TOX_FILE_KIND_DATA, FILE_SIZE, nullptr,
+                                        (const uint8_t *)"Gentoo.exe", sizeof("Gentoo.exe"), nullptr);
+    ck_assert_msg(cancel_fnum != UINT32_MAX, "tox_file_send failed");
+    ck_assert_msg(tox_file_set_pull(tox2, 0, cancel_fnum, true, &err_p), "tox_file_set_pull failed");
+
+    do {
+        iterate_3(tox1, tox2, tox3);
+    } while (!file_recv_cancelled);
+
+    // Acks for the packets sent before the cancel must not end the transfer
+    // a second time.
+    for (uint32_t i = 0; i < 50; ++i) {
+        iterate_3(tox1, tox2, tox3);
+    }
+
+    ck_assert_msg(num_cancel_reads == CANCEL_AT_READ, "%u reads for the cancelled transfer", num_cancel_reads);
+    ck_assert_msg(!file_sending_done && !file_recv, "cancelled transfer finished");
+    ck_assert_msg(size_recv < FILE_SIZE, "cancelled transfer received all data");
+
+    Tox_Err_File_Control err_c;
+    ck_assert_msg(!tox_file_control(tox2, 0, cancel_fnum, TOX_FILE_CONTROL_RESUME, &err_c),
+                  "cancelled transfer still exists");
+    ck_assert_msg(err_c == TOX_ERR_FILE_CONTROL_NOT_FOUND, "wrong error %i", err_c);
+
+    tox_kill(tox1);
+    tox_kill(tox2);
+    tox_kill(tox3);
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+    file_pull_test();
+    return 0;
+}
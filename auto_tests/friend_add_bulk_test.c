@@ -0,0 +1,136 @@
+/* Tests adding many friends at once, and that they survive a save and load.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../testing/misc_tools.h"
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+#include "../toxcore/tox_private.h"
+#include "auto_test_support.h"
+#include "check_compat.h"
+
+#define NUM_FRIENDS 5000
+
+/** Keys that get an error, at the end of the list passed to the bulk add. */
+#define DUPLICATE_INDEX NUM_FRIENDS
+#define OWN_KEY_INDEX (NUM_FRIENDS + 1)
+#define INVALID_KEY_INDEX (NUM_FRIENDS + 2)
+#define NUM_KEYS (NUM_FRIENDS + 3)
+
+static void make_key(uint32_t index, uint8_t *public_key)
+{
+    memset(public_key, 0, TOX_PUBLIC_KEY_SIZE);
+    memcpy(public_key, &index, sizeof(index));
+    public_key[TOX_PUBLIC_KEY_SIZE - 1] = 0x42;
+}
+
+static void check_friends(const Tox *tox, const uint8_t *public_keys)
+{
+    ck_assert_msg(tox_self_get_friend_list_size(tox) == NUM_FRIENDS, "wrong number of friends: %u",
+                  (unsigned)tox_self_get_friend_list_size(tox));
+
+    for (uint32_t i = 0; i < NUM_FRIENDS; ++i) {
+        const Tox_Friend_Number friend_number =
+            tox_friend_by_public_key(tox, &public_keys[i * TOX_PUBLIC_KEY_SIZE], nullptr);
+        ck_assert_msg(friend_number == i, "friend %u has number %u", i, friend_number);
+    }
+}
+
+static void friend_add_bulk_test(void)
+{
+    uint32_t index[] = { 1, 2 };
+    Tox_Err_New err_new;
+    Tox *tox = tox_new_log(nullptr, &err_new, &index[0]);
+    ck_assert_msg(err_new == TOX_ERR_NEW_OK, "tox_new failed: %d", err_new);
+
+    uint8_t *public_keys = (uint8_t *)malloc(NUM_KEYS * TOX_PUBLIC_KEY_SIZE);
+    ck_assert(public_keys != nullptr);
+
+    for (uint32_t i = 0; i < NUM_FRIENDS; ++i) {
+        make_key(i, &public_keys[i * TOX_PUBLIC_KEY_SIZE]);
+    }
+
+    make_key(7, &public_keys[DUPLICATE_INDEX * TOX_PUBLIC_KEY_SIZE]);
+    tox_self_get_public_key(tox, &public_keys[OWN_KEY_INDEX * TOX_PUBLIC_KEY_SIZE]);
+    make_key(NUM_FRIENDS, &public_keys[INVALID_KEY_INDEX * TOX_PUBLIC_KEY_SIZE]);
+    public_keys[INVALID_KEY_INDEX * TOX_PUBLIC_KEY_SIZE + TOX_PUBLIC_KEY_SIZE - 1] = 0xff;
+
+    Tox_Err_Friend_Add_Bulk err_bulk;
+    ck_assert_msg(tox_friend_add_norequest_bulk(tox, nullptr, 1, nullptr, nullptr, &err_bulk) == 0,
+                  "added friends from NULL");
+    ck_assert_msg(err_bulk == TOX_ERR_FRIEND_ADD_BULK_NULL, "wrong error: %d", err_bulk);
+
+    Tox_Friend_Number *friend_numbers = (Tox_Friend_Number *)malloc(NUM_KEYS * sizeof(Tox_Friend_Number));
+    Tox_Err_Friend_Add *statuses = (Tox_Err_Friend_Add *)malloc(NUM_KEYS * sizeof(Tox_Err_Friend_Add));
+    ck_assert(friend_numbers != nullptr && statuses != nullptr);
+
+    const uint32_t added = tox_friend_add_norequest_bulk(tox, public_keys, NUM_KEYS, friend_numbers, statuses,
+                           &err_bulk);
+    ck_assert_msg(err_bulk == TOX_ERR_FRIEND_ADD_BULK_OK, "wrong error: %d", err_bulk);
+    ck_assert_msg(added == NUM_FRIENDS, "added %u friends", added);
+
+    for (uint32_t i = 0; i < NUM_FRIENDS; ++i) {
+        ck_assert_msg(statuses[i] == TOX_ERR_FRIEND_ADD_OK, "adding friend %u failed: %d", i, statuses[i]);
+        ck_assert_msg(friend_numbers[i] == i, "friend %u got number %u", i, friend_numbers[i]);
+    }
+
+    ck_assert_msg(statuses[DUPLICATE_INDEX] == TOX_ERR_FRIEND_ADD_ALREADY_SENT, "wrong duplicate status: %d",
+                  statuses[DUPLICATE_INDEX]);
+    ck_assert_msg(statuses[OWN_KEY_INDEX] == TOX_ERR_FRIEND_ADD_OWN_KEY, "wrong own key status: %d",
+                  statuses[OWN_KEY_INDEX]);
+    ck_assert_msg(statuses[INVALID_KEY_INDEX] == TOX_ERR_FRIEND_ADD_BAD_CHECKSUM, "wrong invalid key status: %d",
+                  statuses[INVALID_KEY_INDEX]);
+
+    for (uint32_t i = NUM_FRIENDS; i < NUM_KEYS; ++i) {
+        ck_assert_msg(friend_numbers[i] == UINT32_MAX, "failed key %u got friend number %u", i, friend_numbers[i]);
+    }
+
+    check_friends(tox, public_keys);
+
+    // Deleting and adding again reuses the free friend number.
+    ck_assert(tox_friend_delete(tox, 10, nullptr));
+    ck_assert_msg(tox_friend_add_norequest_bulk(tox, &public_keys[10 * TOX_PUBLIC_KEY_SIZE], 1, friend_numbers,
+                  nullptr, nullptr) == 1, "adding the deleted friend again failed");
+    ck_assert_msg(friend_numbers[0] == 10, "friend got number %u", friend_numbers[0]);
+
+    // A few iterations look the friends up on the network.
+    for (uint32_t i = 0; i < 5; ++i) {
+        tox_iterate(tox, nullptr);
+        c_sleep(tox_iteration_interval(tox));
+    }
+
+    const size_t save_size = tox_get_savedata_size(tox);
+    uint8_t *save = (uint8_t *)malloc(save_size);
+    ck_assert(save != nullptr);
+    tox_get_savedata(tox, save);
+    tox_kill(tox);
+
+    struct Tox_Options *const options = tox_options_new(nullptr);
+    ck_assert(options != nullptr);
+    tox_options_set_savedata_type(options, TOX_SAVEDATA_TYPE_TOX_SAVE);
+    tox_options_set_savedata_data(options, save, save_size);
+
+    Tox *const tox_loaded = tox_new_log(options, &err_new, &index[1]);
+    ck_assert_msg(err_new == TOX_ERR_NEW_OK, "loading failed: %d", err_new);
+    check_friends(tox_loaded, public_keys);
+
+    printf("friend_add_bulk_test succeeded with %u friends\n", NUM_FRIENDS);
+
+    tox_kill(tox_loaded);
+    tox_options_free(options);
+    free(save);
+    free(statuses);
+    free(friend_numbers);
+    free(public_keys);
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+    friend_add_bulk_test();
+    return 0;
+}
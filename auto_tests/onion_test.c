@@ -31,6 +31,7 @@ static void do_onion(Mono_Time *mono_time, Onion *onion)
     mono_time_update(mono_time);
 
     networking_poll(onion->net, nullptr);
+    onion_relay_batch(onion);
     do_dht(onion->dht);
 }
 
@@ -240,6 +241,8 @@ static void test_basic(void)
     Onion *onion1 = new_onion(log1, mem, mono_time1, rng, new_dht(log1, mem, rng, ns, mono_time1, new_networking(log1, mem, ns, &ip, 36567), true, false));
     Onion *onion2 = new_onion(log2, mem, mono_time2, rng, new_dht(log2, mem, rng, ns, mono_time2, new_networking(log2, mem, ns, &ip, 36568), true, false));
     ck_assert_msg((onion1 != nullptr) && (onion2 != nullptr), "Onion failed initializing.");
+    // Relay through onion2 on several threads, so the tests below cover the batched path too.
+    ck_assert_msg(onion_set_relay_threads(onion2, 4), "Onion relay threads failed initializing.");
     networking_registerhandler(onion2->net, NET_PACKET_ANNOUNCE_REQUEST, &handle_test_1, onion2);
 
     IP_Port on1 = {ip, net_port(onion1->net)};
@@ -310,8 +313,7 @@ static void test_basic(void)
 
     random_bytes(rng, sb_data, sizeof(sb_data));
     memcpy(&s, sb_data, sizeof(uint64_t));
-    memcpy(onion_announce_entry_public_key(onion2_a, 1), dht_get_self_public_key(onion2->dht), CRYPTO_PUBLIC_KEY_SIZE);
-    onion_announce_entry_set_time(onion2_a, 1, mono_time_get(mono_time2));
+    ck_assert(onion_announce_entry_add(onion2_a, dht_get_self_public_key(onion2->dht)));
     networking_registerhandler(onion1->net, NET_PACKET_ONION_DATA_RESPONSE, &handle_test_4, onion1);
     send_announce_request(log1, onion1->mem, onion1->net, rng, &path, &nodes[3],
                           dht_get_self_public_key(onion1->dht),
@@ -324,9 +326,7 @@ static void test_basic(void)
         do_onion(mono_time1, onion1);
         do_onion(mono_time2, onion2);
         c_sleep(50);
-    } while (memcmp(onion_announce_entry_public_key(onion2_a, ONION_ANNOUNCE_MAX_ENTRIES - 2),
-                    dht_get_self_public_key(onion1->dht),
-                    CRYPTO_PUBLIC_KEY_SIZE) != 0);
+    } while (!onion_announce_entry_exists(onion2_a, dht_get_self_public_key(onion1->dht)));
 
     c_sleep(1000);
     Logger *log3 = logger_new(mem);
@@ -393,6 +393,140 @@ static void test_basic(void)
     }
 }
 
+static uint8_t saved_ret[ONION_RETURN_3];
+static IP_Port saved_source;
+static int handled_save;
+static int handle_save_return_path(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length,
+                                   void *userdata)
+{
+    if (length < 1 + ONION_RETURN_3) {
+        return 1;
+    }
+
+    saved_source = *source;
+    memcpy(saved_ret, packet + length - ONION_RETURN_3, ONION_RETURN_3);
+    handled_save = 1;
+    return 0;
+}
+
+static uint64_t get_test_time(void *user_data)
+{
+    return *(const uint64_t *)user_data;
+}
+
+/** Send a response back along the saved return path and wait a while for it. */
+static bool response_arrives(Mono_Time *mono_time1, Onion *onion1, Mono_Time *mono_time2, Onion *onion2)
+{
+    const char res_message[] = "install gentoo";
+    uint8_t res_packet[1 + sizeof(res_message)];
+    res_packet[0] = NET_PACKET_ANNOUNCE_RESPONSE;
+    memcpy(res_packet + 1, res_message, sizeof(res_message));
+
+    ck_assert(send_onion_response(onion2->log, onion2->net, &saved_source, res_packet, sizeof(res_packet),
+                                  saved_ret) == 0);
+    handled_test_2 = 0;
+
+    for (uint32_t i = 0; i < 100 && handled_test_2 == 0; ++i) {
+        do_onion(mono_time1, onion1);
+        do_onion(mono_time2, onion2);
+        c_sleep(10);
+    }
+
+    return handled_test_2 != 0;
+}
+
+static void test_key_refresh(void)
+{
+    const Network *ns = os_network();
+    ck_assert(ns != nullptr);
+    const Memory *mem = os_memory();
+    ck_assert(mem != nullptr);
+    const Random *rng = os_random();
+    ck_assert(rng != nullptr);
+
+    Logger *log1 = logger_new(mem);
+    Logger *log2 = logger_new(mem);
+
+    uint64_t now1 = 1000;
+    uint64_t now2 = 1000;
+    Mono_Time *mono_time1 = mono_time_new(mem, get_test_time, &now1);
+    Mono_Time *mono_time2 = mono_time_new(mem, get_test_time, &now2);
+
+    IP ip = get_loopback();
+    Onion *onion1 = new_onion(log1, mem, mono_time1, rng, new_dht(log1, mem, rng, ns, mono_time1, new_networking(log1, mem, ns, &ip, 36567), true, false));
+    Onion *onion2 = new_onion(log2, mem, mono_time2, rng, new_dht(log2, mem, rng, ns, mono_time2, new_networking(log2, mem, ns, &ip, 36568), true, false));
+    ck_assert_msg((onion1 != nullptr) && (onion2 != nullptr), "Onion failed initializing.");
+    networking_registerhandler(onion2->net, NET_PACKET_ANNOUNCE_REQUEST, &handle_save_return_path, onion2);
+    networking_registerhandler(onion1->net, NET_PACKET_ANNOUNCE_RESPONSE, &handle_test_2, onion1);
+
+    Node_format nodes[4];
+    memcpy(nodes[0].public_key, dht_get_self_public_key(onion1->dht), CRYPTO_PUBLIC_KEY_SIZE);
+    nodes[0].ip_port.ip = ip;
+    nodes[0].ip_port.port = net_port(onion1->net);
+    memcpy(nodes[1].public_key, dht_get_self_public_key(onion2->dht), CRYPTO_PUBLIC_KEY_SIZE);
+    nodes[1].ip_port.ip = ip;
+    nodes[1].ip_port.port = net_port(onion2->net);
+    nodes[2] = nodes[0];
+    nodes[3] = nodes[1];
+
+    const char req_message[] = "Install Gentoo";
+    uint8_t req_packet[1 + sizeof(req_message)];
+    req_packet[0] = NET_PACKET_ANNOUNCE_REQUEST;
+    memcpy(req_packet + 1, req_message, sizeof(req_message));
+
+    // The second hop of the return path is onion2, so only its key is refreshed,
+    // once relaying on the main thread and once in batches.
+    const uint8_t relay_threads[] = {1, 4};
+
+    for (uint32_t i = 0; i < sizeof(relay_threads); ++i) {
+        ck_assert(onion_set_relay_threads(onion2, relay_threads[i]));
+
+        Onion_Path path;
+        create_onion_path(rng, onion1->dht, &path, nodes);
+        send_onion_packet(onion1->net, onion1->mem, rng, &path, &nodes[3].ip_port, req_packet, sizeof(req_packet));
+
+        handled_save = 0;
+
+        do {
+            do_onion(mono_time1, onion1);
+            do_onion(mono_time2, onion2);
+        } while (handled_save == 0);
+
+        ck_assert_msg(response_arrives(mono_time1, onion1, mono_time2, onion2),
+                      "response didn't arrive before the key refresh");
+
+        // Past the 2 hour key refresh interval.
+        now2 += (2 * 60 * 60 + 1) * 1000;
+
+        ck_assert_msg(!response_arrives(mono_time1, onion1, mono_time2, onion2),
+                      "return path from before the key refresh still works");
+    }
+
+    {
+        Onion *onion = onion2;
+
+        Networking_Core *net = dht_get_net(onion->dht);
+        DHT *dht = onion->dht;
+        kill_onion(onion);
+        kill_dht(dht);
+        kill_networking(net);
+        mono_time_free(mem, mono_time2);
+        logger_kill(log2);
+    }
+
+    {
+        Onion *onion = onion1;
+
+        Networking_Core *net = dht_get_net(onion->dht);
+        DHT *dht = onion->dht;
+        kill_onion(onion);
+        kill_dht(dht);
+        kill_networking(net);
+        mono_time_free(mem, mono_time1);
+        logger_kill(log1);
+    }
+}
+
 typedef struct {
     Logger *log;
     Mono_Time *mono_time;
@@ -654,6 +788,73 @@ static void test_announce(void)
     onion_getfriendip(onions[NUM_LAST]->onion_c, frnum, &ip_port);
     ck_assert_msg(ip_port.port == net_port(onions[NUM_FIRST]->onion->net), "Port in returned ip not correct.");
 
+    uint32_t responses = 0;
+
+    for (uint32_t i = 0; i < NUMBER_ONION_PATHS; ++i) {
+        Onion_Path_Stats path_stats;
+
+        if (onion_get_path_stats(onions[NUM_FIRST]->onion_c, false, i, &path_stats)) {
+            ck_assert_msg(path_stats.responses <= path_stats.requests, "more responses than requests on a path");
+            ck_assert_msg((path_stats.responses == 0) == (path_stats.rtt == 0), "path rtt not tracked");
+            responses += path_stats.responses;
+        }
+    }
+
+    ck_assert_msg(responses > 0, "no announce responses recorded on the self paths");
+
+    uint32_t successes = 0;
+
+    for (uint16_t i = 0; i < onion_get_path_node_count(onions[NUM_FIRST]->onion_c); ++i) {
+        Node_format node;
+        Onion_Path_Node_Stats node_stats;
+        ck_assert(onion_get_path_node_stats(onions[NUM_FIRST]->onion_c, i, &node, &node_stats));
+        successes += node_stats.successes;
+    }
+
+    ck_assert_msg(successes > 0, "no path node successes recorded");
+
+    printf("searching for an offline friend\n");
+
+    // Sends to a friend that is offline fail, which must not make the search
+    // run every second. Time is simulated from here on.
+    uint64_t now = current_time_monotonic(onions[0]->mono_time);
+
+    for (uint32_t i = 0; i < NUM_ONIONS; ++i) {
+        mono_time_set_current_time_callback(onions[i]->mono_time, get_test_time, &now);
+    }
+
+    uint8_t offline_pk[CRYPTO_PUBLIC_KEY_SIZE];
+    random_bytes(rng, offline_pk, sizeof(offline_pk));
+    const int frnum_offline = onion_addfriend(onions[NUM_FIRST]->onion_c, offline_pk);
+    ck_assert(frnum_offline != -1);
+
+    uint64_t last_search = onion_friend_next_search(onions[NUM_FIRST]->onion_c, frnum_offline);
+    uint32_t searches = 0;
+
+    for (uint32_t i = 0; i < 120; ++i) {
+        now += 1000;
+
+        for (uint32_t j = 0; j < 3; ++j) {
+            for (uint32_t k = 0; k < NUM_ONIONS; ++k) {
+                do_onions(onions[k]);
+            }
+
+            c_sleep(5);
+        }
+
+        const uint64_t next_search = onion_friend_next_search(onions[NUM_FIRST]->onion_c, frnum_offline);
+
+        // Count the searches in the second minute, when the friend's nodes
+        // list has settled.
+        if (i >= 60 && next_search != last_search) {
+            ++searches;
+        }
+
+        last_search = next_search;
+    }
+
+    ck_assert_msg(searches < 30, "offline friend searched %u times in 60 seconds", searches);
+
     for (uint32_t i = 0; i < NUM_ONIONS; ++i) {
         kill_onions(mem, onions[i]);
     }
@@ -664,6 +865,7 @@ int main(void)
     setvbuf(stdout, nullptr, _IONBF, 0);
 
     test_basic();
+    test_key_refresh();
     test_announce();
 
     return 0;
@@ -8,6 +8,9 @@
 
 #include "../testing/misc_tools.h"
 #include "../toxcore/ccompat.h"
+#include "../toxcore/friend_connection.h"
+#include "../toxcore/onion_client.h"
+#include "../toxcore/state.h"
 #include "../toxcore/tox.h"
 #include "../toxcore/tox_struct.h"
 #include "../toxcore/util.h"
@@ -172,6 +175,7 @@ static void test_few_clients(void)
     struct Tox_Options *opts3 = tox_options_new(nullptr);
     tox_options_set_ipv6_enabled(opts3, USE_IPV6);
     tox_options_set_local_discovery_enabled(opts3, false);
+    tox_options_set_experimental_warm_start(opts3, true);
     Tox *tox3 = tox_new_log(opts3, &t_n_error, &index[2]);
     ck_assert_msg(t_n_error == TOX_ERR_NEW_OK, "Failed to create tox instance: %d", t_n_error);
 
@@ -306,10 +310,225 @@ static void test_few_clients(void)
     tox_options_free(opts3);
 }
 
+/** Find the contents of the warm start section in savedata. */
+static const uint8_t *find_warm_start(const uint8_t *save, size_t save_size, uint32_t *section_length)
+{
+    // Skip the global header, then walk the [length][cookie and type] sections.
+    size_t offset = 2 * sizeof(uint32_t);
+
+    while (offset + 2 * sizeof(uint32_t) <= save_size) {
+        uint32_t length;
+        uint32_t cookie_type;
+        lendian_bytes_to_host32(&length, save + offset);
+        lendian_bytes_to_host32(&cookie_type, save + offset + sizeof(uint32_t));
+        offset += 2 * sizeof(uint32_t);
+
+        if ((cookie_type & 0xFFFF) == STATE_TYPE_WARM_START) {
+            *section_length = length;
+            return save + offset;
+        }
+
+        offset += length;
+    }
+
+    ck_abort_msg("savedata has no warm start section");
+    return nullptr;
+}
+
+/** Copy savedata with the contents of the warm start section replaced. Returns the new size. */
+static size_t replace_warm_start(const uint8_t *save, size_t save_size, const uint8_t *contents, uint32_t length,
+                                 uint8_t *out)
+{
+    uint32_t old_length;
+    const uint8_t *const old_contents = find_warm_start(save, save_size, &old_length);
+    const size_t before = old_contents - save - 2 * sizeof(uint32_t);
+    const size_t after = save_size - (old_contents + old_length - save);
+
+    memcpy(out, save, before);
+    state_write_section_header(out + before, STATE_COOKIE_TYPE, length, STATE_TYPE_WARM_START);
+    memcpy(out + before + 2 * sizeof(uint32_t), contents, length);
+    memcpy(out + before + 2 * sizeof(uint32_t) + length, old_contents + old_length, after);
+
+    return before + 2 * sizeof(uint32_t) + length + after;
+}
+
+static Tox *load_tox(struct Tox_Options *opts, const uint8_t *save, size_t save_size, void *user_data)
+{
+    tox_options_set_savedata_type(opts, TOX_SAVEDATA_TYPE_TOX_SAVE);
+    tox_options_set_savedata_data(opts, save, save_size);
+
+    Tox_Err_New err;
+    Tox *tox = tox_new_log(opts, &err, user_data);
+    ck_assert_msg(err == TOX_ERR_NEW_OK, "Failed to load savedata: %d", err);
+
+    tox_options_set_savedata_type(opts, TOX_SAVEDATA_TYPE_NONE);
+    return tox;
+}
+
+/** Check that a tox loaded without a usable warm start section has to find everything again. */
+static void check_cold_start(Tox *tox, const uint8_t *friend_key)
+{
+    uint8_t public_key[TOX_PUBLIC_KEY_SIZE];
+    ck_assert_msg(tox_friend_get_public_key(tox, 0, public_key, nullptr)
+                  && memcmp(public_key, friend_key, sizeof(public_key)) == 0, "friend was not loaded");
+
+    const int friendcon_id = tox->m->friendlist[0].friendcon_id;
+    uint8_t dht_key[CRYPTO_PUBLIC_KEY_SIZE];
+    const uint8_t zeroes[CRYPTO_PUBLIC_KEY_SIZE] = {0};
+    ck_assert(get_friendcon_public_keys(nullptr, dht_key, tox->m->fr_c, friendcon_id) == 0);
+    ck_assert_msg(memcmp(dht_key, zeroes, sizeof(dht_key)) == 0, "friend's DHT key known without warm start");
+
+    ck_assert_msg(onion_get_path_node_count(tox->m->onion_c) == 0, "path nodes loaded without warm start");
+}
+
+static void test_warm_start(void)
+{
+    uint32_t index[] = { 4, 5, 6 };
+
+    struct Tox_Options *opts = tox_options_new(nullptr);
+    tox_options_set_ipv6_enabled(opts, USE_IPV6);
+    tox_options_set_local_discovery_enabled(opts, false);
+
+    Tox *tox1 = tox_new_log(opts, nullptr, &index[0]);
+    Tox *tox2 = tox_new_log(opts, nullptr, &index[1]);
+    tox_options_set_experimental_warm_start(opts, true);
+    Tox *tox3 = tox_new_log(opts, nullptr, &index[2]);
+    ck_assert_msg(tox1 && tox2 && tox3, "Failed to create 3 tox instances");
+
+    tox_events_init(tox2);
+    Tox_Dispatch *dispatch2 = tox_dispatch_new(nullptr);
+    ck_assert(dispatch2 != nullptr);
+    tox_events_callback_friend_request(dispatch2, accept_friend_request);
+
+    Time_Data time_data;
+    ck_assert_msg(pthread_mutex_init(&time_data.lock, nullptr) == 0, "Failed to init time_data mutex");
+    time_data.clock = current_time_monotonic(tox1->mono_time);
+    set_current_time_callback(tox1, &time_data);
+    set_current_time_callback(tox2, &time_data);
+    set_current_time_callback(tox3, &time_data);
+
+    uint8_t dht_key[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(tox1, dht_key);
+    const uint16_t dht_port = tox_self_get_udp_port(tox1, nullptr);
+    tox_bootstrap(tox2, "localhost", dht_port, dht_key, nullptr);
+    tox_bootstrap(tox3, "localhost", dht_port, dht_key, nullptr);
+
+    uint8_t address[TOX_ADDRESS_SIZE];
+    tox_self_get_address(tox2, address);
+    ck_assert(tox_friend_add(tox3, address, (const uint8_t *)"Gentoo", 7, nullptr) == 0);
+
+    // tox3 saves its friend's DHT address only once they talk directly.
+    while (tox_friend_get_connection_status(tox3, 0, nullptr) != TOX_CONNECTION_UDP
+            || tox_friend_get_connection_status(tox2, 0, nullptr) != TOX_CONNECTION_UDP) {
+        tox_iterate(tox1, nullptr);
+        {
+            Tox_Err_Events_Iterate err = TOX_ERR_EVENTS_ITERATE_OK;
+            Tox_Events *events = tox_events_iterate(tox2, true, &err);
+            ck_assert(err == TOX_ERR_EVENTS_ITERATE_OK);
+            tox_dispatch_invoke(dispatch2, events, tox2);
+            tox_events_free(events);
+        }
+        tox_iterate(tox3, nullptr);
+
+        increment_clock(&time_data, 200);
+        c_sleep(5);
+    }
+
+    uint8_t friend_key[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_public_key(tox2, friend_key);
+    uint8_t friend_dht_key[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(tox2, friend_dht_key);
+    const uint16_t friend_port = tox_self_get_udp_port(tox2, nullptr);
+
+    const Onion_Client *onion_c = tox3->m->onion_c;
+    const uint16_t num_path_nodes = onion_get_path_node_count(onion_c);
+    ck_assert_msg(num_path_nodes > 0, "no path nodes to save");
+    Node_format path_nodes[MAX_PATH_NODES];
+
+    for (uint16_t i = 0; i < num_path_nodes; ++i) {
+        Onion_Path_Node_Stats stats;
+        ck_assert(onion_get_path_node_stats(onion_c, i, &path_nodes[i], &stats));
+    }
+
+    const size_t save_size = tox_get_savedata_size(tox3);
+    uint8_t *save = (uint8_t *)malloc(save_size);
+    ck_assert(save != nullptr);
+    tox_get_savedata(tox3, save);
+
+    // Before iterating even once, the restored instance knows where its friend
+    // is and which nodes to build onion paths from.
+    Tox *restored = load_tox(opts, save, save_size, &index[2]);
+
+    const int friendcon_id = restored->m->friendlist[0].friendcon_id;
+    uint8_t restored_dht_key[CRYPTO_PUBLIC_KEY_SIZE];
+    ck_assert(get_friendcon_public_keys(nullptr, restored_dht_key, restored->m->fr_c, friendcon_id) == 0);
+    ck_assert_msg(memcmp(restored_dht_key, friend_dht_key, sizeof(friend_dht_key)) == 0,
+                  "friend's DHT key was not restored");
+
+    const IP_Port *friend_ip_port = friend_conn_get_dht_ip_port(get_conn(restored->m->fr_c, friendcon_id));
+    ck_assert_msg(net_family_is_ipv4(friend_ip_port->ip.family) || net_family_is_ipv6(friend_ip_port->ip.family),
+                  "friend's DHT IP was not restored");
+    ck_assert_msg(net_ntohs(friend_ip_port->port) == friend_port, "friend's DHT port was not restored: %u",
+                  net_ntohs(friend_ip_port->port));
+
+    ck_assert_msg(onion_get_path_node_count(restored->m->onion_c) == num_path_nodes,
+                  "restored %u path nodes, saved %u", onion_get_path_node_count(restored->m->onion_c), num_path_nodes);
+
+    for (uint16_t i = 0; i < num_path_nodes; ++i) {
+        Node_format node;
+        Onion_Path_Node_Stats stats;
+        ck_assert(onion_get_path_node_stats(restored->m->onion_c, i, &node, &stats));
+        ck_assert_msg(pk_equal(node.public_key, path_nodes[i].public_key)
+                      && ipport_equal(&node.ip_port, &path_nodes[i].ip_port), "path node %u was not restored", i);
+    }
+
+    tox_kill(restored);
+
+    // A damaged warm start section is ignored, and everything else still loads.
+    uint32_t section_length;
+    const uint8_t *const section = find_warm_start(save, save_size, &section_length);
+    ck_assert(section_length > 1);
+
+    uint8_t *damaged = (uint8_t *)malloc(save_size);
+    ck_assert(damaged != nullptr);
+
+    // Ends in the middle of the first path node.
+    size_t damaged_size = replace_warm_start(save, save_size, section, 1 + 3 * sizeof(uint32_t) + 2, damaged);
+    restored = load_tox(opts, damaged, damaged_size, &index[2]);
+    check_cold_start(restored, friend_key);
+    tox_kill(restored);
+
+    damaged_size = replace_warm_start(save, save_size, section, 0, damaged);
+    restored = load_tox(opts, damaged, damaged_size, &index[2]);
+    check_cold_start(restored, friend_key);
+    tox_kill(restored);
+
+    // 255 path nodes with an invalid address family.
+    uint8_t *garbage = (uint8_t *)malloc(section_length);
+    ck_assert(garbage != nullptr);
+    memset(garbage, 0xff, section_length);
+    damaged_size = replace_warm_start(save, save_size, garbage, section_length, damaged);
+    restored = load_tox(opts, damaged, damaged_size, &index[2]);
+    check_cold_start(restored, friend_key);
+    tox_kill(restored);
+
+    free(garbage);
+    free(damaged);
+    free(save);
+
+    tox_dispatch_free(dispatch2);
+    tox_kill(tox1);
+    tox_kill(tox2);
+    tox_kill(tox3);
+    tox_options_free(opts);
+    pthread_mutex_destroy(&time_data.lock);
+}
+
 int main(void)
 {
     setvbuf(stdout, nullptr, _IONBF, 0);
 
     test_few_clients();
+    test_warm_start();
     return 0;
 }
@@ -0,0 +1,167 @@
+/* Tests that with experimental_thread_safety, other threads can send messages
+ * and read friend info while the main thread runs tox_iterate.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct State {
+    uint32_t messages_received;
+} State;
+
+#include "auto_test_support.h"
+
+#define NUM_MESSAGES 1000
+#define FRIEND_NAME "Alice"
+
+typedef struct Thread_Data {
+    Tox *sender;
+    Tox *reader;
+
+    pthread_mutex_t lock;
+    bool stop;
+    uint32_t reads;
+} Thread_Data;
+
+static size_t message_for(uint32_t index, uint8_t *message, size_t size)
+{
+    return (size_t)snprintf((char *)message, size, "message %u", index);
+}
+
+static void friend_message(const Tox_Event_Friend_Message *event, void *user_data)
+{
+    const AutoTox *autotox = (AutoTox *)user_data;
+    State *state = (State *)autotox->state;
+
+    uint8_t expected[32];
+    const size_t expected_length = message_for(state->messages_received, expected, sizeof(expected));
+
+    ck_assert_msg(tox_event_friend_message_get_message_length(event) == expected_length
+                  && memcmp(tox_event_friend_message_get_message(event), expected, expected_length) == 0,
+                  "message %u arrived out of order", state->messages_received);
+
+    ++state->messages_received;
+}
+
+static void *send_thread(void *arg)
+{
+    const Thread_Data *data = (const Thread_Data *)arg;
+    uint32_t last_id = 0;
+    uint32_t i = 0;
+
+    while (i < NUM_MESSAGES) {
+        uint8_t message[32];
+        const size_t length = message_for(i, message, sizeof(message));
+
+        Tox_Err_Friend_Send_Message err;
+        const uint32_t message_id = tox_friend_send_message(data->sender, 0, TOX_MESSAGE_TYPE_NORMAL, message, length,
+                                    &err);
+
+        if (err == TOX_ERR_FRIEND_SEND_MESSAGE_SENDQ) {
+            c_sleep(1);
+            continue;
+        }
+
+        ck_assert_msg(err == TOX_ERR_FRIEND_SEND_MESSAGE_OK, "failed to send message %u: %d", i, err);
+        ck_assert_msg(message_id == last_id + 1, "message %u got id %u after %u", i, message_id, last_id);
+
+        last_id = message_id;
+        ++i;
+    }
+
+    return nullptr;
+}
+
+static bool should_stop(Thread_Data *data)
+{
+    pthread_mutex_lock(&data->lock);
+    const bool stop = data->stop;
+    pthread_mutex_unlock(&data->lock);
+    return stop;
+}
+
+static void *read_thread(void *arg)
+{
+    Thread_Data *data = (Thread_Data *)arg;
+    uint32_t reads = 0;
+
+    while (!should_stop(data)) {
+        Tox_Err_Friend_Query err;
+        const size_t size = tox_friend_get_name_size(data->reader, 0, &err);
+        ck_assert_msg(err == TOX_ERR_FRIEND_QUERY_OK && size == strlen(FRIEND_NAME), "wrong name size %u: %d",
+                      (unsigned)size, err);
+
+        uint8_t name[TOX_MAX_NAME_LENGTH];
+        ck_assert(tox_friend_get_name(data->reader, 0, name, &err));
+        ck_assert_msg(memcmp(name, FRIEND_NAME, size) == 0, "wrong name");
+
+        ck_assert(tox_friend_exists(data->reader, 0));
+        ck_assert(!tox_friend_exists(data->reader, 1));
+
+        tox_friend_get_status(data->reader, 0, &err);
+        ck_assert(err == TOX_ERR_FRIEND_QUERY_OK);
+
+        ++reads;
+    }
+
+    pthread_mutex_lock(&data->lock);
+    data->reads = reads;
+    pthread_mutex_unlock(&data->lock);
+
+    return nullptr;
+}
+
+static void thread_safety_test(AutoTox *autotoxes)
+{
+    tox_events_callback_friend_message(autotoxes[1].dispatch, friend_message);
+
+    ck_assert(tox_self_set_name(autotoxes[0].tox, (const uint8_t *)FRIEND_NAME, strlen(FRIEND_NAME), nullptr));
+
+    do {
+        iterate_all_wait(autotoxes, 2, ITERATION_INTERVAL);
+    } while (tox_friend_get_name_size(autotoxes[1].tox, 0, nullptr) != strlen(FRIEND_NAME));
+
+    Thread_Data data = {autotoxes[0].tox, autotoxes[1].tox};
+    pthread_mutex_init(&data.lock, nullptr);
+
+    pthread_t sender;
+    pthread_t reader;
+    ck_assert(pthread_create(&sender, nullptr, send_thread, &data) == 0);
+    ck_assert(pthread_create(&reader, nullptr, read_thread, &data) == 0);
+
+    const State *receiver = (const State *)autotoxes[1].state;
+
+    while (receiver->messages_received < NUM_MESSAGES) {
+        iterate_all_wait(autotoxes, 2, ITERATION_INTERVAL);
+    }
+
+    pthread_mutex_lock(&data.lock);
+    data.stop = true;
+    pthread_mutex_unlock(&data.lock);
+
+    ck_assert(pthread_join(sender, nullptr) == 0);
+    ck_assert(pthread_join(reader, nullptr) == 0);
+    pthread_mutex_destroy(&data.lock);
+
+    printf("received %u messages, read friend info %u times\n", receiver->messages_received, data.reads);
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+    struct Tox_Options *tox_options = tox_options_new(nullptr);
+    ck_assert(tox_options != nullptr);
+
+    Run_Auto_Options options = default_run_auto_options();
+    options.graph = GRAPH_LINEAR;
+
+    tox_options_set_experimental_thread_safety(tox_options, true);
+    run_auto_test(tox_options, 2, thread_safety_test, sizeof(State), &options);
+
+    tox_options_free(tox_options);
+
+    return 0;
+}
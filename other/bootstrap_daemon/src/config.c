@@ -20,9 +20,13 @@
 #include <libconfig.h>
 
 #include "../../../toxcore/DHT.h"
+#include "../../../toxcore/announce.h"
 #include "../../../toxcore/ccompat.h"
 #include "../../../toxcore/crypto_core.h"
+#include "../../../toxcore/mono_time.h"
 #include "../../../toxcore/network.h"
+#include "../../../toxcore/onion.h"
+#include "../../../toxcore/rate_limit.h"
 #include "../../bootstrap_node_packets.h"
 
 /**
@@ -151,7 +155,8 @@ static int tox_config_lookup_bool(const config_t *config, const char *path, bool
 
 bool get_general_config(const char *cfg_file_path, char **pid_file_path, char **keys_file_path, int *port,
                         bool *enable_ipv6, bool *enable_ipv4_fallback, bool *enable_lan_discovery, bool *enable_tcp_relay,
-                        uint16_t **tcp_relay_ports, int *tcp_relay_port_count, bool *enable_motd, char **motd)
+                        uint16_t **tcp_relay_ports, int *tcp_relay_port_count, bool *enable_motd, char **motd,
+                        int *metrics_port, int *workers, int *announce_memory_budget, int *onion_threads)
 {
     config_t cfg;
 
@@ -164,6 +169,10 @@ bool get_general_config(const char *cfg_file_path, char **pid_file_path, char **
     const char *const NAME_ENABLE_TCP_RELAY     = "enable_tcp_relay";
     const char *const NAME_ENABLE_MOTD          = "enable_motd";
     const char *const NAME_MOTD                 = "motd";
+    const char *const NAME_METRICS_PORT         = "metrics_port";
+    const char *const NAME_WORKERS              = "workers";
+    const char *const NAME_ANNOUNCE_MEMORY      = "announce_memory_budget";
+    const char *const NAME_ONION_THREADS        = "onion_threads";
 
     config_init(&cfg);
 
@@ -278,6 +287,44 @@ bool get_general_config(const char *cfg_file_path, char **pid_file_path, char **
         snprintf(*motd, motd_length, "%s", tmp_motd);
     }
 
+    // Get metrics port
+    if (config_lookup_int(&cfg, NAME_METRICS_PORT, metrics_port) == CONFIG_FALSE) {
+        *metrics_port = DEFAULT_METRICS_PORT;
+    } else if (*metrics_port != 0 && (*metrics_port < MIN_ALLOWED_PORT || *metrics_port > MAX_ALLOWED_PORT)) {
+        log_write(LOG_LEVEL_WARNING, "Invalid '%s': %d, should be in [%d, %d]. Disabling metrics.\n", NAME_METRICS_PORT,
+                  *metrics_port, MIN_ALLOWED_PORT, MAX_ALLOWED_PORT);
+        *metrics_port = 0;
+    }
+
+    // Get number of worker processes
+    if (config_lookup_int(&cfg, NAME_WORKERS, workers) == CONFIG_FALSE) {
+        *workers = DEFAULT_WORKERS;
+    } else if (*workers < 1 || *workers > MAX_WORKERS) {
+        log_write(LOG_LEVEL_WARNING, "Invalid '%s': %d, should be in [1, %d]. Using %d.\n", NAME_WORKERS, *workers,
+                  MAX_WORKERS, DEFAULT_WORKERS);
+        *workers = DEFAULT_WORKERS;
+    }
+
+    // Get memory budget for stored DHT announcements, in KiB
+    if (config_lookup_int(&cfg, NAME_ANNOUNCE_MEMORY, announce_memory_budget) == CONFIG_FALSE) {
+        *announce_memory_budget = DEFAULT_ANNOUNCE_MEMORY_BUDGET;
+    } else if (*announce_memory_budget < ANNOUNCE_MIN_MEMORY_BUDGET / 1024
+               || *announce_memory_budget > MAX_ANNOUNCE_MEMORY_BUDGET) {
+        log_write(LOG_LEVEL_WARNING, "Invalid '%s': %d, should be in [%d, %d]. Using %d.\n", NAME_ANNOUNCE_MEMORY,
+                  *announce_memory_budget, ANNOUNCE_MIN_MEMORY_BUDGET / 1024, MAX_ANNOUNCE_MEMORY_BUDGET,
+                  DEFAULT_ANNOUNCE_MEMORY_BUDGET);
+        *announce_memory_budget = DEFAULT_ANNOUNCE_MEMORY_BUDGET;
+    }
+
+    // Get number of threads relaying onion packets
+    if (config_lookup_int(&cfg, NAME_ONION_THREADS, onion_threads) == CONFIG_FALSE) {
+        *onion_threads = DEFAULT_ONION_THREADS;
+    } else if (*onion_threads < 1 || *onion_threads > ONION_RELAY_MAX_THREADS) {
+        log_write(LOG_LEVEL_WARNING, "Invalid '%s': %d, should be in [1, %d]. Using %d.\n", NAME_ONION_THREADS,
+                  *onion_threads, ONION_RELAY_MAX_THREADS, DEFAULT_ONION_THREADS);
+        *onion_threads = DEFAULT_ONION_THREADS;
+    }
+
     config_destroy(&cfg);
 
     log_write(LOG_LEVEL_INFO, "Successfully read:\n");
@@ -309,6 +356,11 @@ bool get_general_config(const char *cfg_file_path, char **pid_file_path, char **
         log_write(LOG_LEVEL_INFO, "'%s': %s\n", NAME_MOTD, *motd);
     }
 
+    log_write(LOG_LEVEL_INFO, "'%s': %d\n", NAME_METRICS_PORT,         *metrics_port);
+    log_write(LOG_LEVEL_INFO, "'%s': %d\n", NAME_WORKERS,              *workers);
+    log_write(LOG_LEVEL_INFO, "'%s': %d\n", NAME_ANNOUNCE_MEMORY,      *announce_memory_budget);
+    log_write(LOG_LEVEL_INFO, "'%s': %d\n", NAME_ONION_THREADS,        *onion_threads);
+
     return true;
 }
 
@@ -345,6 +397,64 @@ static uint8_t *bootstrap_hex_string_to_bin(const char *hex_string)
     return ret;
 }
 
+typedef struct Rate_Limit_Setting {
+    const char *name;
+    int default_limit;
+    uint8_t packet_ids[2];
+    uint8_t packet_id_count;
+} Rate_Limit_Setting;
+
+static const Rate_Limit_Setting rate_limit_settings[] = {
+    {"ping_request",       DEFAULT_RATE_LIMIT_PING_REQUEST,       {NET_PACKET_PING_REQUEST},                                 1},
+    {"nodes_request",      DEFAULT_RATE_LIMIT_NODES_REQUEST,      {NET_PACKET_GET_NODES},                                    1},
+    {"onion_send_initial", DEFAULT_RATE_LIMIT_ONION_SEND_INITIAL, {NET_PACKET_ONION_SEND_INITIAL},                           1},
+    {"announce_request",   DEFAULT_RATE_LIMIT_ANNOUNCE_REQUEST,   {NET_PACKET_ANNOUNCE_REQUEST, NET_PACKET_ANNOUNCE_REQUEST_OLD}, 2},
+};
+
+bool rate_limits_from_config(const char *cfg_file_path, Networking_Core *net, const Random *rng,
+                             const Mono_Time *mono_time)
+{
+    const char *const NAME_RATE_LIMITS = "rate_limits";
+
+    config_t cfg;
+
+    config_init(&cfg);
+
+    if (config_read_file(&cfg, cfg_file_path) == CONFIG_FALSE) {
+        log_write(LOG_LEVEL_ERROR, "%s:%d - %s\n", config_error_file(&cfg), config_error_line(&cfg), config_error_text(&cfg));
+        config_destroy(&cfg);
+        return false;
+    }
+
+    const config_setting_t *limits = config_lookup(&cfg, NAME_RATE_LIMITS);
+
+    for (size_t i = 0; i < sizeof(rate_limit_settings) / sizeof(rate_limit_settings[0]); ++i) {
+        const Rate_Limit_Setting *setting = &rate_limit_settings[i];
+        int limit;
+
+        if (limits == nullptr || config_setting_lookup_int(limits, setting->name, &limit) == CONFIG_FALSE) {
+            limit = setting->default_limit;
+        } else if (limit < 0 || limit > RATE_LIMIT_MAX) {
+            log_write(LOG_LEVEL_WARNING, "Invalid '%s.%s': %d, should be in [0, %d]. Using %d.\n", NAME_RATE_LIMITS,
+                      setting->name, limit, RATE_LIMIT_MAX, setting->default_limit);
+            limit = setting->default_limit;
+        }
+
+        for (uint8_t j = 0; j < setting->packet_id_count; ++j) {
+            if (!net_set_rate_limit(net, rng, mono_time, setting->packet_ids[j], (uint32_t)limit)) {
+                config_destroy(&cfg);
+                return false;
+            }
+        }
+
+        log_write(LOG_LEVEL_INFO, "'%s.%s': %d\n", NAME_RATE_LIMITS, setting->name, limit);
+    }
+
+    config_destroy(&cfg);
+
+    return true;
+}
+
 bool bootstrap_from_config(const char *cfg_file_path, DHT *dht, bool enable_ipv6)
 {
     const char *const NAME_BOOTSTRAP_NODES = "bootstrap_nodes";
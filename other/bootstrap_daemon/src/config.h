@@ -11,6 +11,9 @@
 #define C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_CONFIG_H
 
 #include "../../../toxcore/DHT.h"
+#include "../../../toxcore/crypto_core.h"
+#include "../../../toxcore/mono_time.h"
+#include "../../../toxcore/network.h"
 
 /**
  * Gets general config options from the config file.
@@ -18,13 +21,18 @@
  * Important: You are responsible for freeing `pid_file_path` and `keys_file_path`
  *            also, iff `tcp_relay_ports_count` > 0, then you are responsible for freeing `tcp_relay_ports`
  *            and also `motd` iff `enable_motd` is true.
+ *            `metrics_port` is 0 if the metrics endpoint is disabled.
+ *            `workers` is always in [1, MAX_WORKERS].
+ *            `announce_memory_budget` is in KiB.
+ *            `onion_threads` is always in [1, ONION_RELAY_MAX_THREADS].
  *
  * @return true on success,
  *         false on failure, doesn't modify any data pointed by arguments.
  */
 bool get_general_config(const char *cfg_file_path, char **pid_file_path, char **keys_file_path, int *port,
                         bool *enable_ipv6, bool *enable_ipv4_fallback, bool *enable_lan_discovery, bool *enable_tcp_relay,
-                        uint16_t **tcp_relay_ports, int *tcp_relay_port_count, bool *enable_motd, char **motd);
+                        uint16_t **tcp_relay_ports, int *tcp_relay_port_count, bool *enable_motd, char **motd,
+                        int *metrics_port, int *workers, int *announce_memory_budget, int *onion_threads);
 
 /**
  * Bootstraps off nodes listed in the config file.
@@ -34,4 +42,15 @@ bool get_general_config(const char *cfg_file_path, char **pid_file_path, char **
  */
 bool bootstrap_from_config(const char *cfg_file_path, DHT *dht, bool enable_ipv6);
 
+/**
+ * Sets the per source packet rate limits listed in the config file on `net`,
+ * using the defaults for the ones that are missing.
+ *
+ * @return true on success,
+ *         false on failure, an error occurred while parsing the config file or
+ *         allocating the rate limiter.
+ */
+bool rate_limits_from_config(const char *cfg_file_path, Networking_Core *net, const Random *rng,
+                             const Mono_Time *mono_time);
+
 #endif // C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_CONFIG_H
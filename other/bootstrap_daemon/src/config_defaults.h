@@ -24,5 +24,15 @@
 #define DEFAULT_TCP_RELAY_PORTS       443, 3389, 33445 // comma-separated list of ports
 #define DEFAULT_ENABLE_MOTD           true
 #define DEFAULT_MOTD                  DAEMON_NAME
+#define DEFAULT_METRICS_PORT          0 // 0 disables the metrics endpoint
+#define DEFAULT_WORKERS               1
+#define DEFAULT_ANNOUNCE_MEMORY_BUDGET 128 // KiB
+#define DEFAULT_ONION_THREADS         1
+
+// Per source packets per second, 0 disables the limit
+#define DEFAULT_RATE_LIMIT_PING_REQUEST       50
+#define DEFAULT_RATE_LIMIT_NODES_REQUEST      50
+#define DEFAULT_RATE_LIMIT_ONION_SEND_INITIAL 100
+#define DEFAULT_RATE_LIMIT_ANNOUNCE_REQUEST   200
 
 #endif // C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_CONFIG_DEFAULTS_H
@@ -41,4 +41,9 @@
 #define MIN_ALLOWED_PORT 1
 #define MAX_ALLOWED_PORT 65535
 
+#define MAX_WORKERS 64
+
+// In KiB
+#define MAX_ANNOUNCE_MEMORY_BUDGET (1024 * 1024)
+
 #endif // C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_GLOBAL_H
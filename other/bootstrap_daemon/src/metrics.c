@@ -0,0 +1,499 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2024 The TokTok team.
+ */
+
+/*
+ * Tox DHT bootstrap daemon.
+ * Prometheus metrics endpoint.
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include "metrics.h"
+
+// system provided
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// C
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// toxcore
+#include "../../../toxcore/ccompat.h"
+
+#include "log.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Upper bounds of the histogram buckets, in microseconds. An implicit +Inf
+// bucket follows the last one.
+static const uint64_t phase_buckets_us[] = {10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000};
+#define PHASE_BUCKET_COUNT (sizeof(phase_buckets_us) / sizeof(phase_buckets_us[0]))
+
+// Initial size of the response buffer, which grows as needed.
+#define METRICS_BUFFER_SIZE 4096
+
+// Room at the start of the response buffer for the HTTP header, which can
+// only be written once the length of the body that follows it is known.
+#define RESPONSE_HEADER_ROOM 160
+
+// How long a client may take to send its request and read the response before
+// it's dropped (ms).
+#define SCRAPE_TIMEOUT 2000
+
+// Longest request we read. Anything after that is ignored.
+#define REQUEST_SIZE 512
+
+static const char *const phase_names[METRICS_PHASE_COUNT] = {
+    "dht",
+    "tcp_server",
+    "networking",
+};
+
+typedef struct Phase_Histogram {
+    // Non-cumulative counts, one per bucket plus one for +Inf.
+    uint64_t buckets[PHASE_BUCKET_COUNT + 1];
+    uint64_t sum_ns;
+    uint64_t count;
+} Phase_Histogram;
+
+// The scrape being answered. Only one is answered at a time, and the main loop
+// spends at most one non-blocking recv() or send() on it per iteration.
+typedef struct Metrics_Client {
+    int fd;  // -1 if there is none
+    uint64_t deadline_ms;
+
+    char request[REQUEST_SIZE];
+    size_t request_length;
+
+    // nullptr while the request is still being read.
+    char *response;
+    size_t response_length;
+    size_t response_sent;  // starts where the header starts
+} Metrics_Client;
+
+struct Metrics {
+    int listen_fd;
+    Metrics_Client client;
+    Phase_Histogram phases[METRICS_PHASE_COUNT];
+};
+
+// Growable response buffer.
+typedef struct Metrics_Buffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} Metrics_Buffer;
+
+GNU_PRINTF(2, 3)
+static void buffer_printf(Metrics_Buffer *buf, const char *format, ...)
+{
+    if (buf->failed) {
+        return;
+    }
+
+    while (true) {
+        va_list args;
+        va_start(args, format);
+        const int written = vsnprintf(buf->data + buf->length, buf->capacity - buf->length, format, args);
+        va_end(args);
+
+        if (written < 0) {
+            buf->failed = true;
+            return;
+        }
+
+        if ((size_t)written < buf->capacity - buf->length) {
+            buf->length += written;
+            return;
+        }
+
+        const size_t new_capacity = buf->capacity * 2 + written;
+        char *new_data = (char *)realloc(buf->data, new_capacity);
+
+        if (new_data == nullptr) {
+            buf->failed = true;
+            return;
+        }
+
+        buf->data = new_data;
+        buf->capacity = new_capacity;
+    }
+}
+
+static void write_header(Metrics_Buffer *buf, const char *name, const char *type, const char *help)
+{
+    buffer_printf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void write_counter(Metrics_Buffer *buf, const char *name, const char *help, uint64_t value)
+{
+    write_header(buf, name, "counter", help);
+    buffer_printf(buf, "%s %" PRIu64 "\n", name, value);
+}
+
+static void write_gauge(Metrics_Buffer *buf, const char *name, const char *help, uint64_t value)
+{
+    write_header(buf, name, "gauge", help);
+    buffer_printf(buf, "%s %" PRIu64 "\n", name, value);
+}
+
+static void write_metrics(const Metrics *metrics, const Metrics_Sources *sources, Metrics_Buffer *buf)
+{
+    const Net_Stats *net_stats = net_get_stats(sources->net);
+
+    write_header(buf, "tox_bootstrapd_udp_packets_received_total", "counter",
+                 "UDP packets received, by packet id.");
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        if (net_stats->packets_recv[i] != 0) {
+            buffer_printf(buf, "tox_bootstrapd_udp_packets_received_total{packet_id=\"0x%02x\"} %" PRIu64 "\n",
+                          i, net_stats->packets_recv[i]);
+        }
+    }
+
+    write_header(buf, "tox_bootstrapd_udp_packets_rate_limited_total", "counter",
+                 "UDP packets dropped by the per-source rate limiter, by packet id.");
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        if (net_stats->packets_rate_limited[i] != 0) {
+            buffer_printf(buf, "tox_bootstrapd_udp_packets_rate_limited_total{packet_id=\"0x%02x\"} %" PRIu64 "\n",
+                          i, net_stats->packets_rate_limited[i]);
+        }
+    }
+
+    write_counter(buf, "tox_bootstrapd_udp_bytes_received_total", "UDP bytes received.",
+                  net_stats->bytes_recv);
+    write_counter(buf, "tox_bootstrapd_udp_packets_unhandled_total", "UDP packets received without a handler.",
+                  net_stats->packets_unhandled);
+    write_counter(buf, "tox_bootstrapd_udp_packets_sent_total", "UDP packets sent.",
+                  net_stats->packets_sent);
+    write_counter(buf, "tox_bootstrapd_udp_bytes_sent_total", "UDP bytes sent.",
+                  net_stats->bytes_sent);
+
+    write_gauge(buf, "tox_bootstrapd_dht_close_nodes", "Nodes in the DHT close list.",
+                dht_get_num_closelist(sources->dht));
+
+    if (sources->onion_a != nullptr) {
+        write_gauge(buf, "tox_bootstrapd_onion_announce_entries", "Live onion announce entries stored.",
+                    onion_announce_num_entries(sources->onion_a));
+    }
+
+    if (sources->announce != nullptr) {
+        Announce_Stats announce_stats;
+        announce_get_stats(sources->announce, &announce_stats);
+        write_gauge(buf, "tox_bootstrapd_dht_announce_entries", "Live DHT announcements stored.",
+                    announce_stats.entries);
+        write_gauge(buf, "tox_bootstrapd_dht_announce_data_bytes", "Bytes of DHT announcement data stored.",
+                    announce_stats.data_bytes);
+        write_gauge(buf, "tox_bootstrapd_dht_announce_memory_bytes", "Bytes of memory allocated for DHT announcement data.",
+                    announce_stats.memory_bytes);
+        write_gauge(buf, "tox_bootstrapd_dht_announce_memory_budget_bytes", "Memory budget for DHT announcement data.",
+                    announce_stats.memory_budget);
+        write_counter(buf, "tox_bootstrapd_dht_announce_evictions_total",
+                      "DHT announcements evicted to stay within the memory budget.", announce_stats.evictions);
+        write_counter(buf, "tox_bootstrapd_dht_announce_rejected_total",
+                      "DHT announcements refused because nothing could be evicted.", announce_stats.rejected);
+    }
+
+    if (sources->tcp_server != nullptr) {
+        write_gauge(buf, "tox_bootstrapd_tcp_relay_clients", "Clients connected to the TCP relay.",
+                    tcp_server_num_connections(sources->tcp_server));
+    }
+
+    write_header(buf, "tox_bootstrapd_loop_phase_cpu_seconds", "histogram",
+                 "CPU time spent per run of each main loop phase.");
+
+    for (uint32_t p = 0; p < METRICS_PHASE_COUNT; ++p) {
+        const Phase_Histogram *hist = &metrics->phases[p];
+        uint64_t cumulative = 0;
+
+        for (uint32_t i = 0; i < PHASE_BUCKET_COUNT; ++i) {
+            cumulative += hist->buckets[i];
+            buffer_printf(buf, "tox_bootstrapd_loop_phase_cpu_seconds_bucket{phase=\"%s\",le=\"%g\"} %" PRIu64 "\n",
+                          phase_names[p], (double)phase_buckets_us[i] / 1000000.0, cumulative);
+        }
+
+        buffer_printf(buf, "tox_bootstrapd_loop_phase_cpu_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %" PRIu64 "\n",
+                      phase_names[p], hist->count);
+        buffer_printf(buf, "tox_bootstrapd_loop_phase_cpu_seconds_sum{phase=\"%s\"} %.9f\n",
+                      phase_names[p], (double)hist->sum_ns / 1000000000.0);
+        buffer_printf(buf, "tox_bootstrapd_loop_phase_cpu_seconds_count{phase=\"%s\"} %" PRIu64 "\n",
+                      phase_names[p], hist->count);
+    }
+}
+
+static uint64_t monotonic_ms(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        return 0;
+    }
+
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void drop_client(Metrics_Client *client)
+{
+    close(client->fd);
+    free(client->response);
+
+    client->fd = -1;
+    client->request_length = 0;
+    client->response = nullptr;
+    client->response_length = 0;
+    client->response_sent = 0;
+}
+
+static bool accept_client(Metrics *metrics)
+{
+    Metrics_Client *client = &metrics->client;
+
+    const int fd = accept(metrics->listen_fd, nullptr, nullptr);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    // Accepted sockets don't inherit O_NONBLOCK from the listener everywhere.
+    const int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        close(fd);
+        return false;
+    }
+
+    client->fd = fd;
+    client->deadline_ms = monotonic_ms() + SCRAPE_TIMEOUT;
+    return true;
+}
+
+// Writes the header in front of the body, which starts RESPONSE_HEADER_ROOM
+// bytes into `response`, and makes it the client's response. Takes ownership
+// of `response`.
+static bool set_response(Metrics_Client *client, const char *status, char *response, size_t body_length)
+{
+    char header[RESPONSE_HEADER_ROOM];
+    const int header_length = snprintf(header, sizeof(header),
+                                       "HTTP/1.0 %s\r\n"
+                                       "Content-Type: text/plain; version=0.0.4\r\n"
+                                       "Content-Length: %zu\r\n"
+                                       "Connection: close\r\n\r\n", status, body_length);
+
+    if (header_length <= 0 || (size_t)header_length >= sizeof(header)) {
+        free(response);
+        return false;
+    }
+
+    const size_t header_start = RESPONSE_HEADER_ROOM - header_length;
+    memcpy(response + header_start, header, header_length);
+
+    client->response = response;
+    client->response_length = RESPONSE_HEADER_ROOM + body_length;
+    client->response_sent = header_start;
+    return true;
+}
+
+// Reads what has arrived of the request and, once it's complete, prepares the
+// response.
+//
+// returns false if the client should be dropped.
+static bool read_request(const Metrics *metrics, const Metrics_Sources *sources, Metrics_Client *client)
+{
+    const ssize_t received = recv(client->fd, client->request + client->request_length,
+                                  sizeof(client->request) - 1 - client->request_length, 0);
+
+    if (received == 0 || (received == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return false;
+    }
+
+    if (received > 0) {
+        client->request_length += received;
+    }
+
+    client->request[client->request_length] = '\0';
+
+    // We serve the same document for every path, so the only thing that
+    // matters about the request is that it is a GET. It is still read to the
+    // end (or as far as fits) so that closing the socket doesn't reset the
+    // connection before the client got the response.
+    if (strstr(client->request, "\r\n\r\n") == nullptr && client->request_length < sizeof(client->request) - 1) {
+        return true;
+    }
+
+    if (strncmp(client->request, "GET ", 4) != 0) {
+        char *response = (char *)malloc(RESPONSE_HEADER_ROOM);
+
+        if (response == nullptr) {
+            return false;
+        }
+
+        return set_response(client, "405 Method Not Allowed", response, 0);
+    }
+
+    // The body goes after the room for the header, so that the header doesn't
+    // need a buffer of its own.
+    Metrics_Buffer buf = {(char *)malloc(METRICS_BUFFER_SIZE), RESPONSE_HEADER_ROOM, METRICS_BUFFER_SIZE, false};
+    buf.failed = buf.data == nullptr;
+    write_metrics(metrics, sources, &buf);
+
+    if (buf.failed) {
+        log_write(LOG_LEVEL_WARNING, "Couldn't allocate memory for the metrics response.\n");
+        free(buf.data);
+        return false;
+    }
+
+    return set_response(client, "200 OK", buf.data, buf.length - RESPONSE_HEADER_ROOM);
+}
+
+// returns false if the client should be dropped, either because it got the
+// whole response or because sending failed.
+static bool send_response(Metrics_Client *client)
+{
+    const ssize_t sent = send(client->fd, client->response + client->response_sent,
+                              client->response_length - client->response_sent, MSG_NOSIGNAL);
+
+    if (sent == -1) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    client->response_sent += sent;
+    return client->response_sent < client->response_length;
+}
+
+Metrics *metrics_new(uint16_t port)
+{
+    Metrics *metrics = (Metrics *)calloc(1, sizeof(Metrics));
+
+    if (metrics == nullptr) {
+        return nullptr;
+    }
+
+    metrics->client.fd = -1;
+    metrics->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (metrics->listen_fd == -1) {
+        free(metrics);
+        return nullptr;
+    }
+
+    const int one = 1;
+    setsockopt(metrics->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    const int flags = fcntl(metrics->listen_fd, F_GETFL, 0);
+
+    if (bind(metrics->listen_fd, (const struct sockaddr *)&addr, sizeof(addr)) != 0
+            || listen(metrics->listen_fd, 8) != 0
+            || flags == -1
+            || fcntl(metrics->listen_fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        close(metrics->listen_fd);
+        free(metrics);
+        return nullptr;
+    }
+
+    return metrics;
+}
+
+void metrics_kill(Metrics *metrics)
+{
+    if (metrics == nullptr) {
+        return;
+    }
+
+    if (metrics->client.fd != -1) {
+        drop_client(&metrics->client);
+    }
+
+    close(metrics->listen_fd);
+    free(metrics);
+}
+
+int metrics_fd(const Metrics *metrics)
+{
+    return metrics->listen_fd;
+}
+
+bool metrics_busy(const Metrics *metrics)
+{
+    return metrics->client.fd != -1;
+}
+
+uint64_t metrics_thread_time(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void metrics_phase_done(Metrics *metrics, METRICS_PHASE phase, uint64_t begin)
+{
+    const uint64_t now = metrics_thread_time();
+    const uint64_t elapsed_ns = now > begin ? now - begin : 0;
+    const uint64_t elapsed_us = elapsed_ns / 1000;
+
+    Phase_Histogram *hist = &metrics->phases[phase];
+
+    uint32_t bucket = 0;
+
+    while (bucket < PHASE_BUCKET_COUNT && elapsed_us > phase_buckets_us[bucket]) {
+        ++bucket;
+    }
+
+    ++hist->buckets[bucket];
+    hist->sum_ns += elapsed_ns;
+    ++hist->count;
+}
+
+void metrics_serve(Metrics *metrics, const Metrics_Sources *sources)
+{
+    Metrics_Client *client = &metrics->client;
+
+    if (client->fd == -1 && !accept_client(metrics)) {
+        return;
+    }
+
+    if (monotonic_ms() > client->deadline_ms) {
+        drop_client(client);
+        return;
+    }
+
+    if (client->response == nullptr) {
+        if (!read_request(metrics, sources, client)) {
+            drop_client(client);
+            return;
+        }
+
+        if (client->response == nullptr) {
+            return;
+        }
+    }
+
+    if (!send_response(client)) {
+        drop_client(client);
+    }
+}
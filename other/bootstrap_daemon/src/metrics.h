@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2024 The TokTok team.
+ */
+
+/*
+ * Tox DHT bootstrap daemon.
+ * Prometheus metrics endpoint.
+ */
+#ifndef C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_METRICS_H
+#define C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../../../toxcore/DHT.h"
+#include "../../../toxcore/TCP_server.h"
+#include "../../../toxcore/announce.h"
+#include "../../../toxcore/network.h"
+#include "../../../toxcore/onion_announce.h"
+
+// Parts of the main loop whose CPU time is recorded in a histogram.
+typedef enum METRICS_PHASE {
+    METRICS_PHASE_DHT,
+    METRICS_PHASE_TCP_SERVER,
+    METRICS_PHASE_NETWORKING,
+    METRICS_PHASE_COUNT
+} METRICS_PHASE;
+
+// Where the exported values are read from. `tcp_server`, `onion_a` and
+// `announce` are NULL in workers that don't run the TCP relay or store
+// announcements.
+typedef struct Metrics_Sources {
+    const Networking_Core *net;
+    const DHT *dht;
+    const TCP_Server *tcp_server;
+    const Onion_Announce *onion_a;
+    const Announcements *announce;
+} Metrics_Sources;
+
+typedef struct Metrics Metrics;
+
+/**
+ * Starts listening for HTTP scrapes on 127.0.0.1.
+ * @param port TCP port to listen on.
+ * @return the metrics endpoint, or NULL on failure.
+ */
+Metrics *metrics_new(uint16_t port);
+
+/**
+ * Closes the listening socket and releases all used resources.
+ */
+void metrics_kill(Metrics *metrics);
+
+/**
+ * @return the listening socket, which becomes readable when a scrape arrives.
+ */
+int metrics_fd(const Metrics *metrics);
+
+/**
+ * @return the CPU time the calling thread has used so far, in nanoseconds.
+ */
+uint64_t metrics_thread_time(void);
+
+/**
+ * Records the CPU time spent in one run of a main loop phase.
+ * @param begin Value of metrics_thread_time() when the phase started.
+ */
+void metrics_phase_done(Metrics *metrics, METRICS_PHASE phase, uint64_t begin);
+
+/**
+ * @return true while a scrape is being answered. Its socket doesn't wake the
+ *   main loop, so the loop should keep its waits short until this is false.
+ */
+bool metrics_busy(const Metrics *metrics);
+
+/**
+ * Makes progress on answering one scrape, accepting a new one if none is being
+ * answered. Never blocks.
+ */
+void metrics_serve(Metrics *metrics, const Metrics_Sources *sources);
+
+#endif // C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_METRICS_H
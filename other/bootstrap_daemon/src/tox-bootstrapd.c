@@ -14,9 +14,15 @@
 // system provided
 #include <signal.h> // system header, rather than C, because we need it for POSIX sigaction(2)
 #include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 // C
 #include <assert.h>
 #include <stdint.h>
@@ -49,6 +55,11 @@
 #include "config.h"
 #include "global.h"
 #include "log.h"
+#include "metrics.h"
+#include "worker_channels.h"
+
+// How long the main loop may sleep when it can't wait on all of its sockets (ms)
+#define POLL_INTERVAL 30
 
 static void sleep_milliseconds(uint32_t ms)
 {
@@ -58,11 +69,271 @@ static void sleep_milliseconds(uint32_t ms)
     nanosleep(&req, nullptr);
 }
 
+// Creates the epoll instance the main loop waits on. It watches the UDP socket,
+// the metrics listening socket and the channel from the other workers if there
+// are (metrics_socket != -1, worker_socket != -1) and, if the TCP server was
+// built with epoll, the TCP server's own epoll descriptor.
+//
+// returns the epoll descriptor on success
+//         -1 on failure, in which case the main loop falls back to sleeping
+//
+// Sets *tcp_waitable to whether TCP server events also wake the main loop.
+
+static int event_loop_init(const Networking_Core *net, const TCP_Server *tcp_server, int metrics_socket,
+                           int worker_socket, bool *tcp_waitable)
+{
+    *tcp_waitable = tcp_server == nullptr;
+
+#ifdef __linux__
+    const int efd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (efd == -1) {
+        return -1;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.fd = net_socket_to_native(net_udp_socket(net));
+
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+        close(efd);
+        return -1;
+    }
+
+    if (metrics_socket != -1) {
+        ev.data.fd = metrics_socket;
+
+        if (epoll_ctl(efd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+            close(efd);
+            return -1;
+        }
+    }
+
+    if (worker_socket != -1) {
+        ev.data.fd = worker_socket;
+
+        if (epoll_ctl(efd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+            close(efd);
+            return -1;
+        }
+    }
+
+    if (tcp_server != nullptr && tcp_server_event_fd(tcp_server) != -1) {
+        ev.data.fd = tcp_server_event_fd(tcp_server);
+
+        if (epoll_ctl(efd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+            close(efd);
+            return -1;
+        }
+
+        *tcp_waitable = true;
+    }
+
+    return efd;
+#else
+    return -1;
+#endif
+}
+
+// Blocks until a watched socket becomes readable, the next timer is due, or a
+// signal arrives. Waits at most POLL_INTERVAL while the TCP server has output
+// it couldn't send or a metrics scrape is being answered, since neither wakes
+// the loop when its socket becomes ready.
+
+static void event_loop_wait(int efd, bool tcp_waitable, const TCP_Server *tcp_server, const Metrics *metrics,
+                            Mono_Time *mono_time)
+{
+    mono_time_update(mono_time);
+
+    // DHT, onion, TCP relay and LAN discovery timers all count whole seconds
+    // of mono_time, so none of them can become due before the next second
+    // boundary.
+    uint32_t timeout = 1000 - (uint32_t)(mono_time_get_ms(mono_time) % 1000);
+
+    const bool busy = (tcp_server != nullptr && tcp_server_has_pending_output(tcp_server))
+                      || (metrics != nullptr && metrics_busy(metrics));
+
+    if ((!tcp_waitable || busy) && timeout > POLL_INTERVAL) {
+        timeout = POLL_INTERVAL;
+    }
+
+#ifdef __linux__
+
+    if (efd != -1) {
+        struct epoll_event events[4];
+        epoll_wait(efd, events, sizeof(events) / sizeof(events[0]), (int)timeout);
+        return;
+    }
+
+#endif
+
+    sleep_milliseconds(timeout < POLL_INTERVAL ? timeout : POLL_INTERVAL);
+}
+
 // Uses the already existing key or creates one if it didn't exist
 //
 // returns true on success
 //         false on failure - no keys were read or stored
 
+#ifdef SO_REUSEPORT
+static Network_Funcs reuseport_network_funcs;
+static Network reuseport_network;
+
+// Creates sockets like os_network() does, but lets the other worker processes
+// bind them to the same port.
+static Socket reuseport_socket(void *obj, int domain, int type, int proto)
+{
+    const Network *os_ns = os_network();
+    const Socket sock = os_ns->funcs->socket(obj, domain, type, proto);
+
+    if (sock_valid(sock)) {
+        const int set = 1;
+        setsockopt(net_socket_to_native(sock), SOL_SOCKET, SO_REUSEPORT, &set, sizeof(set));
+    }
+
+    return sock;
+}
+
+static const Network *reuseport_network_init(void)
+{
+    const Network *os_ns = os_network();
+
+    reuseport_network_funcs = *os_ns->funcs;
+    reuseport_network_funcs.socket = reuseport_socket;
+    reuseport_network.funcs = &reuseport_network_funcs;
+    reuseport_network.obj = os_ns->obj;
+
+    return &reuseport_network;
+}
+#endif /* SO_REUSEPORT */
+
+// Replaces the UDP socket a worker inherited from the supervisor with one of
+// its own bound to the same port, so that the kernel spreads incoming packets
+// between the workers rather than waking all of them for each one.
+static bool worker_own_udp_socket(const Logger *logger, const Memory *mem, const Network *ns, const IP *ip,
+                                  const Networking_Core *net)
+{
+    const uint16_t port = net_ntohs(net_port(net));
+    Networking_Core *own = new_networking_ex(logger, mem, ns, ip, port, port, nullptr);
+
+    if (own == nullptr) {
+        return false;
+    }
+
+    const bool ok = dup2(net_socket_to_native(net_udp_socket(own)), net_socket_to_native(net_udp_socket(net))) != -1;
+
+    kill_networking(own);
+
+    return ok;
+}
+
+// Swaps the supervisor's UDP socket for an unbound one. The supervisor never
+// reads from it, so while bound it would only take its share of the packets
+// the kernel spreads between the sockets on the port and drop them.
+static bool release_udp_socket(const Networking_Core *net)
+{
+    const int unbound = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (unbound == -1) {
+        return false;
+    }
+
+    const bool ok = dup2(unbound, net_socket_to_native(net_udp_socket(net))) != -1;
+
+    close(unbound);
+
+    return ok;
+}
+
+static volatile sig_atomic_t caught_signal = 0;
+
+static void handle_signal(int signum)
+{
+    caught_signal = signum;
+}
+
+static void log_worker_exit(int worker_index, int status)
+{
+    if (WIFSIGNALED(status)) {
+        log_write(LOG_LEVEL_WARNING, "Worker %d was killed by signal %d. Restarting it.\n", worker_index,
+                  WTERMSIG(status));
+    } else {
+        log_write(LOG_LEVEL_WARNING, "Worker %d exited with status %d. Restarting it.\n", worker_index,
+                  WEXITSTATUS(status));
+    }
+}
+
+// Forks `workers` worker processes, which continue from the point of the call
+// with a copy of everything initialised so far, including all the keys, and
+// restarts each of them that exits until a signal arrives. At most one restart
+// per worker per second, so a worker that can't start doesn't spin.
+//
+// Returns the index of the worker, in [0, workers), in the worker processes,
+// and -1 in the supervisor once a signal arrived and all workers exited.
+static int supervise_workers(int workers)
+{
+    pid_t worker_pids[MAX_WORKERS] = {0};
+    bool started = false;
+
+    while (caught_signal == 0) {
+        for (int i = 0; i < workers; ++i) {
+            if (worker_pids[i] != 0) {
+                continue;
+            }
+
+            const pid_t pid = fork();
+
+            if (pid == 0) {
+                return i;
+            }
+
+            if (pid == -1) {
+                log_write(LOG_LEVEL_WARNING, "Couldn't fork worker %d. Retrying in a second.\n", i);
+                continue;
+            }
+
+            worker_pids[i] = pid;
+        }
+
+        if (!started) {
+            log_write(LOG_LEVEL_INFO, "Started %d worker processes.\n", workers);
+            started = true;
+        }
+
+        // Interrupted by signals regardless of SA_RESTART.
+        sleep_milliseconds(1000);
+
+        int status;
+        pid_t pid;
+
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (int i = 0; i < workers; ++i) {
+                if (worker_pids[i] == pid) {
+                    worker_pids[i] = 0;
+
+                    if (caught_signal == 0) {
+                        log_worker_exit(i, status);
+                    }
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        if (worker_pids[i] != 0) {
+            kill(worker_pids[i], SIGTERM);
+        }
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        if (worker_pids[i] != 0) {
+            waitpid(worker_pids[i], nullptr, 0);
+        }
+    }
+
+    return -1;
+}
+
 static bool manage_keys(DHT *dht, const char *keys_file_path)
 {
     enum { KEYS_SIZE = CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_SECRET_KEY_SIZE };
@@ -206,11 +477,20 @@ static void toxcore_logger_callback(void *context, Logger_Level level, const cha
     log_write(logger_level_to_log_level(level), "%s:%d(%s) %s\n", file, line, func, message);
 }
 
-static volatile sig_atomic_t caught_signal = 0;
-
-static void handle_signal(int signum)
+static void log_caught_signal(void)
 {
-    caught_signal = signum;
+    switch (caught_signal) {
+        case SIGINT:
+            log_write(LOG_LEVEL_INFO, "Received SIGINT (%d) signal. Exiting.\n", SIGINT);
+            break;
+
+        case SIGTERM:
+            log_write(LOG_LEVEL_INFO, "Received SIGTERM (%d) signal. Exiting.\n", SIGTERM);
+            break;
+
+        default:
+            log_write(LOG_LEVEL_INFO, "Received (%ld) signal. Exiting.\n", (long)caught_signal);
+    }
 }
 
 int main(int argc, char *argv[])
@@ -248,9 +528,15 @@ int main(int argc, char *argv[])
     int tcp_relay_port_count = 0;
     bool enable_motd = false;
     char *motd = nullptr;
+    int metrics_port = 0;
+    int workers = 1;
+    int announce_memory_budget = 0;
+    int onion_threads = 1;
 
     if (get_general_config(cfg_file_path, &pid_file_path, &keys_file_path, &start_port, &enable_ipv6, &enable_ipv4_fallback,
-                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &enable_motd, &motd)) {
+                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &enable_motd, &motd,
+                           &metrics_port, &workers, &announce_memory_budget,
+                           &onion_threads)) {
         log_write(LOG_LEVEL_INFO, "General config read successfully\n");
     } else {
         log_write(LOG_LEVEL_ERROR, "Couldn't read config file: %s. Exiting.\n", cfg_file_path);
@@ -287,6 +573,15 @@ int main(int argc, char *argv[])
     const Random *rng = os_random();
     const Network *ns = os_network();
 
+    if (workers > 1) {
+#ifdef SO_REUSEPORT
+        ns = reuseport_network_init();
+#else
+        log_write(LOG_LEVEL_WARNING, "SO_REUSEPORT is not supported on this system. Running a single worker.\n");
+        workers = 1;
+#endif /* SO_REUSEPORT */
+    }
+
     Logger *logger = logger_new(mem);
 
     if (MIN_LOGGER_LEVEL <= LOGGER_LEVEL_DEBUG) {
@@ -377,6 +672,8 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    announce_set_memory_budget(announce, (uint32_t)announce_memory_budget * 1024);
+
     GC_Announces_List *group_announce = new_gca_list();
 
     if (group_announce == nullptr) {
@@ -471,6 +768,111 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    struct sigaction sa;
+
+    sa.sa_handler = handle_signal;
+
+    // Try to restart interrupted system calls if they are restartable
+    sa.sa_flags = SA_RESTART;
+
+    // Prevent the signal handler from being called again before it returns
+    sigfillset(&sa.sa_mask);
+
+    if (sigaction(SIGINT, &sa, nullptr) != 0) {
+        log_write(LOG_LEVEL_WARNING, "Couldn't set signal handler for SIGINT. Continuing without the signal handler set.\n");
+    }
+
+    if (sigaction(SIGTERM, &sa, nullptr) != 0) {
+        log_write(LOG_LEVEL_WARNING, "Couldn't set signal handler for SIGTERM. Continuing without the signal handler set.\n");
+    }
+
+    int worker_index = 0;
+    Worker_Channels *channels = nullptr;
+    int worker_socket = -1;
+
+    if (workers > 1) {
+        channels = worker_channels_new(workers);
+
+        if (channels == nullptr) {
+            log_write(LOG_LEVEL_WARNING, "Couldn't create channels between worker processes. Running a single worker.\n");
+            workers = 1;
+        }
+    }
+
+    if (workers > 1) {
+        // Onion return paths may come back to a different worker than the one
+        // that sent the request, so all workers must derive the same keys.
+        uint8_t onion_key_seed[CRYPTO_SYMMETRIC_KEY_SIZE];
+        random_bytes(rng, onion_key_seed, sizeof(onion_key_seed));
+        onion_set_key_seed(onion, onion_key_seed);
+        crypto_memzero(onion_key_seed, sizeof(onion_key_seed));
+
+        if (!release_udp_socket(net)) {
+            log_write(LOG_LEVEL_WARNING, "Couldn't release the supervisor's UDP socket. Some packets will be lost.\n");
+        }
+
+        worker_index = supervise_workers(workers);
+
+        if (worker_index == -1) {
+            log_caught_signal();
+            worker_channels_kill(channels);
+            kill_onion_announce(onion_a);
+            kill_gca(group_announce);
+            kill_onion(onion);
+            kill_announcements(announce);
+            kill_forwarding(forwarding);
+            kill_dht(dht);
+            mono_time_free(mem, mono_time);
+            kill_networking(net);
+            logger_kill(logger);
+            free(tcp_relay_ports);
+            return 0;
+        }
+
+        if (!worker_own_udp_socket(logger, mem, ns, &ip, net)) {
+            log_write(LOG_LEVEL_ERROR, "Worker %d couldn't open its own UDP socket. Exiting.\n", worker_index);
+            worker_channels_kill(channels);
+            kill_onion_announce(onion_a);
+            kill_gca(group_announce);
+            kill_onion(onion);
+            kill_announcements(announce);
+            kill_forwarding(forwarding);
+            kill_dht(dht);
+            mono_time_free(mem, mono_time);
+            kill_networking(net);
+            logger_kill(logger);
+            free(tcp_relay_ports);
+            return 1;
+        }
+
+        // Clients of the relay can only talk to each other, and announcements
+        // can only be found, within the one process that holds them, so only
+        // worker 0 runs the TCP relay and stores announcements. The others
+        // answer DHT requests and relay onion packets, and pass worker 0 the
+        // packets that need its state.
+        const bool tcp_relay_in_worker_0 = enable_tcp_relay;
+
+        if (worker_index != 0) {
+            enable_tcp_relay = false;
+            free(tcp_relay_ports);
+            tcp_relay_ports = nullptr;
+
+            kill_onion_announce(onion_a);
+            onion_a = nullptr;
+            kill_gca(group_announce);
+            group_announce = nullptr;
+            kill_announcements(announce);
+            announce = nullptr;
+        }
+
+        worker_socket = worker_channels_attach(channels, worker_index, net, onion, tcp_relay_in_worker_0);
+    }
+
+    // Only after forking, as the children would not inherit the threads.
+    if (onion_threads > 1 && !onion_set_relay_threads(onion, onion_threads)) {
+        log_write(LOG_LEVEL_WARNING, "Couldn't start onion relay threads. Relaying on the main thread.\n");
+    }
+
     TCP_Server *tcp_server = nullptr;
 
     if (enable_tcp_relay) {
@@ -484,6 +886,7 @@ int main(int argc, char *argv[])
             kill_dht(dht);
             mono_time_free(mem, mono_time);
             kill_networking(net);
+            worker_channels_kill(channels);
             logger_kill(logger);
             free(tcp_relay_ports);
             return 1;
@@ -531,6 +934,7 @@ int main(int argc, char *argv[])
             kill_dht(dht);
             mono_time_free(mem, mono_time);
             kill_networking(net);
+            worker_channels_kill(channels);
             logger_kill(logger);
             return 1;
         }
@@ -549,6 +953,25 @@ int main(int argc, char *argv[])
         kill_dht(dht);
         mono_time_free(mem, mono_time);
         kill_networking(net);
+        worker_channels_kill(channels);
+        logger_kill(logger);
+        return 1;
+    }
+
+    if (rate_limits_from_config(cfg_file_path, net, rng, mono_time)) {
+        log_write(LOG_LEVEL_INFO, "Rate limits set successfully.\n");
+    } else {
+        log_write(LOG_LEVEL_ERROR, "Couldn't set rate limits from %s. Exiting.\n", cfg_file_path);
+        kill_tcp_server(tcp_server);
+        kill_onion_announce(onion_a);
+        kill_gca(group_announce);
+        kill_onion(onion);
+        kill_announcements(announce);
+        kill_forwarding(forwarding);
+        kill_dht(dht);
+        mono_time_free(mem, mono_time);
+        kill_networking(net);
+        worker_channels_kill(channels);
         logger_kill(logger);
         return 1;
     }
@@ -562,65 +985,101 @@ int main(int argc, char *argv[])
 
     Broadcast_Info *broadcast = nullptr;
 
+    // LAN discovery announcements would only be duplicated by the other workers.
+    if (enable_lan_discovery && worker_index != 0) {
+        enable_lan_discovery = false;
+    }
+
     if (enable_lan_discovery) {
         broadcast = lan_discovery_init(ns);
         log_write(LOG_LEVEL_INFO, "Initialized LAN discovery successfully.\n");
     }
 
-    struct sigaction sa;
+    Metrics *metrics = nullptr;
 
-    sa.sa_handler = handle_signal;
+    // Each worker has its own counters, served on consecutive ports.
+    if (metrics_port != 0 && metrics_port + worker_index <= MAX_ALLOWED_PORT) {
+        metrics_port += worker_index;
+        metrics = metrics_new((uint16_t)metrics_port);
 
-    // Try to restart interrupted system calls if they are restartable
-    sa.sa_flags = SA_RESTART;
+        if (metrics != nullptr) {
+            log_write(LOG_LEVEL_INFO, "Serving metrics on 127.0.0.1:%d.\n", metrics_port);
+        } else {
+            log_write(LOG_LEVEL_WARNING, "Couldn't listen for metrics scrapes on 127.0.0.1:%d. Continuing without metrics.\n",
+                      metrics_port);
+        }
+    }
 
-    // Prevent the signal handler from being called again before it returns
-    sigfillset(&sa.sa_mask);
+    const Metrics_Sources metrics_sources = {dht_get_net(dht), dht, tcp_server, onion_a, announce};
 
-    if (sigaction(SIGINT, &sa, nullptr) != 0) {
-        log_write(LOG_LEVEL_WARNING, "Couldn't set signal handler for SIGINT. Continuing without the signal handler set.\n");
-    }
+    bool tcp_waitable;
+    const int efd = event_loop_init(dht_get_net(dht), tcp_server, metrics != nullptr ? metrics_fd(metrics) : -1,
+                                    worker_socket, &tcp_waitable);
 
-    if (sigaction(SIGTERM, &sa, nullptr) != 0) {
-        log_write(LOG_LEVEL_WARNING, "Couldn't set signal handler for SIGTERM. Continuing without the signal handler set.\n");
+    if (efd == -1) {
+        log_write(LOG_LEVEL_WARNING, "Couldn't set up event notification. Falling back to polling every %d ms.\n",
+                  POLL_INTERVAL);
+    } else if (!tcp_waitable) {
+        log_write(LOG_LEVEL_INFO, "TCP server was built without epoll support. Polling it every %d ms.\n",
+                  POLL_INTERVAL);
     }
 
     while (caught_signal == 0) {
         mono_time_update(mono_time);
 
+        uint64_t phase_begin = metrics != nullptr ? metrics_thread_time() : 0;
+
         do_dht(dht);
 
+        if (metrics != nullptr) {
+            metrics_phase_done(metrics, METRICS_PHASE_DHT, phase_begin);
+        }
+
         if (enable_lan_discovery && mono_time_is_timeout(mono_time, last_lan_discovery, LAN_DISCOVERY_INTERVAL)) {
             lan_discovery_send(dht_get_net(dht), broadcast, dht_get_self_public_key(dht), net_htons_port);
             last_lan_discovery = mono_time_get(mono_time);
         }
 
         if (enable_tcp_relay) {
+            phase_begin = metrics != nullptr ? metrics_thread_time() : 0;
+
             do_tcp_server(tcp_server, mono_time);
+
+            if (metrics != nullptr) {
+                metrics_phase_done(metrics, METRICS_PHASE_TCP_SERVER, phase_begin);
+            }
         }
 
+        phase_begin = metrics != nullptr ? metrics_thread_time() : 0;
+
         networking_poll(dht_get_net(dht), nullptr);
 
+        if (channels != nullptr) {
+            worker_channels_poll(channels);
+        }
+
+        onion_relay_batch(onion);
+
+        if (metrics != nullptr) {
+            metrics_phase_done(metrics, METRICS_PHASE_NETWORKING, phase_begin);
+            metrics_serve(metrics, &metrics_sources);
+        }
+
         if (waiting_for_dht_connection && dht_isconnected(dht)) {
             log_write(LOG_LEVEL_INFO, "Connected to another bootstrap node successfully.\n");
             waiting_for_dht_connection = false;
         }
 
-        sleep_milliseconds(30);
+        event_loop_wait(efd, tcp_waitable, tcp_server, metrics, mono_time);
     }
 
-    switch (caught_signal) {
-        case SIGINT:
-            log_write(LOG_LEVEL_INFO, "Received SIGINT (%d) signal. Exiting.\n", SIGINT);
-            break;
+    if (efd != -1) {
+        close(efd);
+    }
 
-        case SIGTERM:
-            log_write(LOG_LEVEL_INFO, "Received SIGTERM (%d) signal. Exiting.\n", SIGTERM);
-            break;
+    metrics_kill(metrics);
 
-        default:
-            log_write(LOG_LEVEL_INFO, "Received (%ld) signal. Exiting.\n", (long)caught_signal);
-    }
+    log_caught_signal();
 
     lan_discovery_kill(broadcast);
     kill_tcp_server(tcp_server);
@@ -632,6 +1091,7 @@ int main(int argc, char *argv[])
     kill_dht(dht);
     mono_time_free(mem, mono_time);
     kill_networking(net);
+    worker_channels_kill(channels);
     logger_kill(logger);
 
     return 0;
@@ -0,0 +1,250 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2024 The TokTok team.
+ */
+
+/*
+ * Tox DHT bootstrap daemon.
+ * Packets passed between worker processes.
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include "worker_channels.h"
+
+// system provided
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// C
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// toxcore
+#include "../../../toxcore/ccompat.h"
+
+#include "global.h"
+
+// What a message on a channel holds after its kind and the IP_Port.
+typedef enum Worker_Message_Kind {
+    // A packet received from the IP_Port.
+    WORKER_MESSAGE_PACKET,
+    // Onion response data to send to the TCP client the IP_Port stands for.
+    WORKER_MESSAGE_ONION_RECV_1,
+} Worker_Message_Kind;
+
+// All workers are forks of the same process, so an IP_Port is passed as is.
+#define WORKER_MESSAGE_HEADER_SIZE (1 + sizeof(IP_Port))
+#define WORKER_MESSAGE_SIZE (WORKER_MESSAGE_HEADER_SIZE + MAX_UDP_PACKET_SIZE)
+
+typedef struct Worker_Handler {
+    packet_handler_cb *function;
+    void *object;
+} Worker_Handler;
+
+struct Worker_Channels {
+    int workers;
+    int worker_index;
+
+    // One datagram socket pair per worker: it reads from recv_fds[i], the
+    // others write to send_fds[i].
+    int recv_fds[MAX_WORKERS];
+    int send_fds[MAX_WORKERS];
+
+    const Onion *onion;
+
+    // The handlers registered before the worker attached, which handle the
+    // packets passed to it.
+    Worker_Handler handlers[256];
+};
+
+// Packet types whose handlers need state only worker 0 has.
+static const uint8_t worker_0_packets[] = {
+    NET_PACKET_ANNOUNCE_REQUEST,
+    NET_PACKET_ANNOUNCE_REQUEST_OLD,
+    NET_PACKET_ONION_DATA_REQUEST,
+    NET_PACKET_DATA_SEARCH_REQUEST,
+    NET_PACKET_DATA_RETRIEVE_REQUEST,
+    NET_PACKET_STORE_ANNOUNCE_REQUEST,
+    NET_PACKET_FORWARDING,
+};
+
+// Responses to requests any worker may have sent.
+static const uint8_t response_packets[] = {
+    NET_PACKET_PING_RESPONSE,
+    NET_PACKET_SEND_NODES_IPV6,
+};
+
+Worker_Channels *worker_channels_new(int workers)
+{
+    Worker_Channels *channels = (Worker_Channels *)calloc(1, sizeof(Worker_Channels));
+
+    if (channels == nullptr) {
+        return nullptr;
+    }
+
+    channels->workers = workers;
+    channels->worker_index = -1;
+
+    for (int i = 0; i < MAX_WORKERS; ++i) {
+        channels->recv_fds[i] = -1;
+        channels->send_fds[i] = -1;
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == -1) {
+            worker_channels_kill(channels);
+            return nullptr;
+        }
+
+        channels->recv_fds[i] = fds[0];
+        channels->send_fds[i] = fds[1];
+    }
+
+    return channels;
+}
+
+void worker_channels_kill(Worker_Channels *channels)
+{
+    if (channels == nullptr) {
+        return;
+    }
+
+    for (int i = 0; i < MAX_WORKERS; ++i) {
+        if (channels->recv_fds[i] != -1) {
+            close(channels->recv_fds[i]);
+        }
+
+        if (channels->send_fds[i] != -1) {
+            close(channels->send_fds[i]);
+        }
+    }
+
+    free(channels);
+}
+
+static bool send_to_worker(const Worker_Channels *channels, int worker_index, Worker_Message_Kind kind,
+                           const IP_Port *ip_port, const uint8_t *data, uint16_t length)
+{
+    if (length > MAX_UDP_PACKET_SIZE) {
+        return false;
+    }
+
+    uint8_t message[WORKER_MESSAGE_SIZE];
+    message[0] = (uint8_t)kind;
+    memcpy(message + 1, ip_port, sizeof(IP_Port));
+    memcpy(message + WORKER_MESSAGE_HEADER_SIZE, data, length);
+
+    // Like the UDP socket, a channel drops what doesn't fit rather than make
+    // the sender wait for a worker that falls behind or is being restarted.
+    return send(channels->send_fds[worker_index], message, WORKER_MESSAGE_HEADER_SIZE + length, MSG_DONTWAIT) != -1;
+}
+
+static int pass_to_worker_0(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length,
+                            void *userdata)
+{
+    const Worker_Channels *channels = (const Worker_Channels *)object;
+    return send_to_worker(channels, 0, WORKER_MESSAGE_PACKET, source, packet, length) ? 0 : 1;
+}
+
+static int pass_to_all_workers(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length,
+                               void *userdata)
+{
+    const Worker_Channels *channels = (const Worker_Channels *)object;
+
+    for (int i = 0; i < channels->workers; ++i) {
+        if (i != channels->worker_index) {
+            send_to_worker(channels, i, WORKER_MESSAGE_PACKET, source, packet, length);
+        }
+    }
+
+    const Worker_Handler *handler = &channels->handlers[packet[0]];
+
+    if (handler->function == nullptr) {
+        return 1;
+    }
+
+    return handler->function(handler->object, source, packet, length, userdata);
+}
+
+// May be called from onion relay threads, which only ever write to channels.
+static int pass_onion_recv_1(void *object, const IP_Port *dest, const uint8_t *data, uint16_t length)
+{
+    const Worker_Channels *channels = (const Worker_Channels *)object;
+    return send_to_worker(channels, 0, WORKER_MESSAGE_ONION_RECV_1, dest, data, length) ? 0 : 1;
+}
+
+int worker_channels_attach(Worker_Channels *channels, int worker_index, Networking_Core *net, Onion *onion,
+                           bool tcp_relay)
+{
+    channels->worker_index = worker_index;
+    channels->onion = onion;
+
+    // Only the supervisor needs the other workers' ends, to restart them.
+    for (int i = 0; i < channels->workers; ++i) {
+        if (i != worker_index) {
+            close(channels->recv_fds[i]);
+            channels->recv_fds[i] = -1;
+        }
+    }
+
+    for (int i = 0; i < 256; ++i) {
+        Worker_Handler *handler = &channels->handlers[i];
+        handler->function = networking_get_handler(net, (uint8_t)i, &handler->object);
+    }
+
+    if (worker_index != 0) {
+        for (size_t i = 0; i < sizeof(worker_0_packets); ++i) {
+            networking_registerhandler(net, worker_0_packets[i], pass_to_worker_0, channels);
+        }
+
+        if (tcp_relay) {
+            networking_registerhandler(net, NET_PACKET_FORWARD_REPLY, pass_to_worker_0, channels);
+            set_callback_handle_recv_1(onion, pass_onion_recv_1, channels);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(response_packets); ++i) {
+        networking_registerhandler(net, response_packets[i], pass_to_all_workers, channels);
+    }
+
+    return channels->recv_fds[worker_index];
+}
+
+void worker_channels_poll(const Worker_Channels *channels)
+{
+    uint8_t message[WORKER_MESSAGE_SIZE];
+    ssize_t length;
+
+    while ((length = recv(channels->recv_fds[channels->worker_index], message, sizeof(message), MSG_DONTWAIT)) != -1) {
+        if (length <= (ssize_t)WORKER_MESSAGE_HEADER_SIZE) {
+            continue;
+        }
+
+        IP_Port ip_port;
+        memcpy(&ip_port, message + 1, sizeof(IP_Port));
+
+        const uint8_t *data = message + WORKER_MESSAGE_HEADER_SIZE;
+        const uint16_t data_length = (uint16_t)(length - WORKER_MESSAGE_HEADER_SIZE);
+
+        if (message[0] == WORKER_MESSAGE_ONION_RECV_1) {
+            const Onion *onion = channels->onion;
+
+            if (onion->recv_1_function != nullptr) {
+                onion->recv_1_function(onion->callback_object, &ip_port, data, data_length);
+            }
+
+            continue;
+        }
+
+        const Worker_Handler *handler = &channels->handlers[data[0]];
+
+        if (handler->function != nullptr) {
+            handler->function(handler->object, &ip_port, data, data_length, nullptr);
+        }
+    }
+}
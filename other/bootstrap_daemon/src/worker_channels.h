@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2024 The TokTok team.
+ */
+
+/*
+ * Tox DHT bootstrap daemon.
+ * Packets passed between worker processes.
+ */
+#ifndef C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_WORKER_CHANNELS_H
+#define C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_WORKER_CHANNELS_H
+
+#include <stdbool.h>
+
+#include "../../../toxcore/network.h"
+#include "../../../toxcore/onion.h"
+
+// The kernel spreads the packets arriving on the shared UDP port between the
+// workers by source address, so a worker may get packets it can't handle on
+// its own. It passes them to the worker that can through these channels.
+typedef struct Worker_Channels Worker_Channels;
+
+/**
+ * Creates a channel to each worker. Must be called in the supervisor before
+ * forking, so that restarted workers get the same channels.
+ * @param workers Number of workers, in [2, MAX_WORKERS].
+ * @return the channels, or NULL on failure.
+ */
+Worker_Channels *worker_channels_new(int workers);
+
+/**
+ * Closes the channels that are still open in the calling process.
+ */
+void worker_channels_kill(Worker_Channels *channels);
+
+/**
+ * Makes the calling worker pass on the packets it can't handle on its own.
+ * Must be called once in each worker, after all packet handlers are registered.
+ *
+ * Requests to the onion announce, group announce and DHT announcement stores
+ * go to worker 0, which holds them. With `tcp_relay` set, which means worker 0
+ * runs the TCP relay, so do forward replies and the onion responses meant for
+ * the relay's clients. DHT ping and nodes responses go to all workers, as only
+ * the one that sent the request accepts them.
+ *
+ * @return the socket that becomes readable when other workers passed packets
+ *   to this one.
+ */
+int worker_channels_attach(Worker_Channels *channels, int worker_index, Networking_Core *net, Onion *onion,
+                           bool tcp_relay);
+
+/**
+ * Handles the packets other workers passed to this one. Never blocks.
+ */
+void worker_channels_poll(const Worker_Channels *channels);
+
+#endif // C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_WORKER_CHANNELS_H
@@ -0,0 +1,310 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+/*
+ * File transfer throughput benchmark over a simulated link.
+ *
+ * Runs two Tox instances in one process. They talk through an in-process UDP
+ * link built on sim_network.h. The link has a configurable bandwidth,
+ * round trip time, random loss rate and bottleneck queue length. Packets
+ * that would wait in the queue longer than that are dropped, like a
+ * tail-drop router would. Both instances run on a simulated clock that jumps
+ * to the next packet arrival or the next iteration deadline, whichever comes
+ * first. Results don't depend on how fast the machine is, except for the CPU
+ * figures.
+ *
+ * tox1 sends a file to tox2 with the regular chunk request API. Reported at
+ * the end:
+ * - simulated time from tox_file_send() to the last received chunk,
+ * - goodput in MiB/s of simulated time,
+ * - process CPU time per MiB transferred (both instances plus the link),
+ * - retransmission ratio: full-size packets sent by tox1 beyond the number
+ *   needed to carry the file once, relative to that number,
+ * - packets dropped by the link through random loss and queue overflow.
+ *
+ * Usage: file_transfer_bench [file_mib] [bandwidth_kbit] [rtt_ms] [loss_permille] [queue_ms]
+ */
+#ifndef _POSIX_C_SOURCE
+// For clock_gettime().
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+#include "../toxcore/util.h"
+#include "sim_network.h"
+
+#define BENCH_SETUP_TIMEOUT_US (600ULL * 1000 * 1000)
+#define BENCH_TRANSFER_TIMEOUT_US (3600ULL * 1000 * 1000)
+/** Payload of a full file data packet, see MAX_FILE_DATA_SIZE in Messenger.c. */
+#define BENCH_FILE_DATA_SIZE 1371
+/** Packets at least this large sent by tox1 during the transfer count as file data. */
+#define BENCH_BULK_PACKET_SIZE 1000
+/** Both ends have the same address and differ in their ports. */
+#define BENCH_IP 0x7f000002  // 127.0.0.2
+
+typedef struct Link Link;
+
+/** @brief One side of the link: a Tox instance and its outgoing pipe. */
+typedef struct Link_End {
+    Link *link;
+    Sim_Node *node;
+
+    /** When the outgoing pipe has finished serialising everything queued so far. */
+    uint64_t busy_until_us;
+
+    uint64_t sent_packets;
+    uint64_t bulk_packets;
+    uint64_t lost_packets;
+    uint64_t overflow_packets;
+} Link_End;
+
+struct Link {
+    Sim_Network sim;
+    uint64_t bandwidth_bps;
+    uint64_t delay_us;        // one way
+    uint64_t queue_limit_us;
+    uint32_t loss_permille;
+
+    Link_End ends[2];
+};
+
+typedef struct Bench {
+    uint64_t file_size;
+
+    uint64_t bytes_received;
+    bool done;
+} Bench;
+
+static uint64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + (uint64_t)ts.tv_nsec;
+}
+
+static Sim_Node *link_route(Sim_Node *from, uint32_t dest_ip, uint16_t dest_port, Sim_Packet *packet)
+{
+    Link_End *end = (Link_End *)from->obj;
+    Link *link = end->link;
+    const uint64_t now_us = link->sim.now_us;
+    Sim_Node *dest = sim_find(&link->sim, dest_ip, dest_port);
+
+    if (dest == nullptr) {
+        return nullptr;
+    }
+
+    if (dest == from) {
+        // Onion routing with only 2 nodes makes a node send packets to itself.
+        packet->arrival_us = now_us;
+        return dest;
+    }
+
+    ++end->sent_packets;
+
+    if (packet->length >= BENCH_BULK_PACKET_SIZE) {
+        ++end->bulk_packets;
+    }
+
+    const uint64_t start_us = max_u64(now_us, end->busy_until_us);
+
+    if (start_us - now_us > link->queue_limit_us) {
+        ++end->overflow_packets;
+        return nullptr;
+    }
+
+    end->busy_until_us = start_us + (uint64_t)packet->length * 8 * 1000 * 1000 / link->bandwidth_bps;
+
+    if (sim_random(&link->sim) % 1000 < link->loss_permille) {
+        ++end->lost_packets;
+        return nullptr;
+    }
+
+    packet->arrival_us = end->busy_until_us + link->delay_us;
+    return dest;
+}
+
+static Tox *link_tox_new(Link *link, uint32_t index, Bench *bench)
+{
+    Link_End *end = &link->ends[index];
+    end->link = link;
+    end->node = sim_add_node(&link->sim, BENCH_IP, end);
+
+    if (end->node == nullptr) {
+        return nullptr;
+    }
+
+    end->node->userdata = bench;
+    return end->node->tox;
+}
+
+static void friend_request_cb(Tox *tox, const uint8_t *public_key, const uint8_t *message, size_t length,
+                              void *user_data)
+{
+    tox_friend_add_norequest(tox, public_key, nullptr);
+}
+
+static void file_recv_cb(Tox *tox, uint32_t friend_number, uint32_t file_number, uint32_t kind, uint64_t file_size,
+                         const uint8_t *filename, size_t filename_length, void *user_data)
+{
+    tox_file_control(tox, friend_number, file_number, TOX_FILE_CONTROL_RESUME, nullptr);
+}
+
+static void file_chunk_request_cb(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
+                                  size_t length, void *user_data)
+{
+    if (length == 0) {
+        return;
+    }
+
+    uint8_t data[BENCH_FILE_DATA_SIZE];
+
+    for (size_t i = 0; i < length && i < sizeof(data); ++i) {
+        data[i] = (uint8_t)(position + i);
+    }
+
+    tox_file_send_chunk(tox, friend_number, file_number, position, data, length, nullptr);
+}
+
+static void file_recv_chunk_cb(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
+                               const uint8_t *data, size_t length, void *user_data)
+{
+    Bench *bench = (Bench *)user_data;
+
+    if (length == 0) {
+        bench->done = true;
+        return;
+    }
+
+    bench->bytes_received += length;
+}
+
+static uint32_t parse_arg(int argc, char *argv[], int index, uint32_t def)
+{
+    if (argc <= index) {
+        return def;
+    }
+
+    return (uint32_t)strtoul(argv[index], nullptr, 10);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t file_mib = parse_arg(argc, argv, 1, 8);
+    const uint32_t bandwidth_kbit = parse_arg(argc, argv, 2, 10000);
+    const uint32_t rtt_ms = parse_arg(argc, argv, 3, 50);
+    const uint32_t loss_permille = parse_arg(argc, argv, 4, 0);
+    const uint32_t queue_ms = parse_arg(argc, argv, 5, 100);
+
+    if (file_mib == 0 || bandwidth_kbit == 0 || loss_permille >= 1000) {
+        fprintf(stderr, "Usage: %s [file_mib] [bandwidth_kbit] [rtt_ms] [loss_permille] [queue_ms]\n", argv[0]);
+        return 1;
+    }
+
+    Link link = {{0}};
+    sim_init(&link.sim, 0x9e3779b97f4a7c15, link_route);
+    link.bandwidth_bps = (uint64_t)bandwidth_kbit * 1000;
+    link.delay_us = (uint64_t)rtt_ms * 1000 / 2;
+    link.queue_limit_us = (uint64_t)queue_ms * 1000;
+    link.loss_permille = loss_permille;
+
+    Bench bench = {0};
+    bench.file_size = (uint64_t)file_mib * 1024 * 1024;
+
+    Tox *tox1 = link_tox_new(&link, 0, &bench);
+    Tox *tox2 = tox1 != nullptr ? link_tox_new(&link, 1, &bench) : nullptr;
+
+    if (tox2 == nullptr) {
+        fprintf(stderr, "Failed to create Tox instances\n");
+        sim_kill(&link.sim);
+        return 1;
+    }
+
+    tox_callback_friend_request(tox1, friend_request_cb);
+    tox_callback_file_chunk_request(tox1, file_chunk_request_cb);
+    tox_callback_file_recv(tox2, file_recv_cb);
+    tox_callback_file_recv_chunk(tox2, file_recv_chunk_cb);
+
+    uint8_t address1[TOX_ADDRESS_SIZE];
+    tox_self_get_address(tox1, address1);
+    uint8_t dht_key1[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(tox1, dht_key1);
+
+    // Phase 1: bootstrap and become friends. This runs over the same link.
+    const uint64_t setup_start_us = link.sim.now_us;
+    tox_bootstrap(tox2, "127.0.0.2", tox_self_get_udp_port(tox1, nullptr), dht_key1, nullptr);
+    tox_friend_add(tox2, address1, (const uint8_t *)"bench", 5, nullptr);
+
+    while (tox_friend_get_connection_status(tox1, 0, nullptr) != TOX_CONNECTION_UDP
+            || tox_friend_get_connection_status(tox2, 0, nullptr) != TOX_CONNECTION_UDP) {
+        if (link.sim.now_us - setup_start_us > BENCH_SETUP_TIMEOUT_US) {
+            fprintf(stderr, "Friends did not connect within %llu simulated seconds\n",
+                    (unsigned long long)(BENCH_SETUP_TIMEOUT_US / 1000 / 1000));
+            return 1;
+        }
+
+        sim_iterate(&link.sim);
+    }
+
+    printf("link:           %u kbit/s, %u ms rtt, %u/1000 loss, %u ms queue\n",
+           bandwidth_kbit, rtt_ms, loss_permille, queue_ms);
+    printf("setup:          friends connected after %.2f simulated s\n",
+           (double)(link.sim.now_us - setup_start_us) / 1e6);
+
+    // Phase 2: the transfer.
+    Link_End *sender_end = &link.ends[0];
+    sender_end->sent_packets = 0;
+    sender_end->bulk_packets = 0;
+    sender_end->lost_packets = 0;
+    sender_end->overflow_packets = 0;
+
+    const uint64_t transfer_start_us = link.sim.now_us;
+    const uint64_t wall_start = now_ns(CLOCK_MONOTONIC);
+    const uint64_t cpu_start = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    if (tox_file_send(tox1, 0, TOX_FILE_KIND_DATA, bench.file_size, nullptr, (const uint8_t *)"bench", 5,
+                      nullptr) == UINT32_MAX) {
+        fprintf(stderr, "tox_file_send failed\n");
+        return 1;
+    }
+
+    while (!bench.done) {
+        if (link.sim.now_us - transfer_start_us > BENCH_TRANSFER_TIMEOUT_US) {
+            fprintf(stderr, "Transfer did not finish within %llu simulated seconds (%llu bytes received)\n",
+                    (unsigned long long)(BENCH_TRANSFER_TIMEOUT_US / 1000 / 1000),
+                    (unsigned long long)bench.bytes_received);
+            return 1;
+        }
+
+        sim_iterate(&link.sim);
+    }
+
+    const double transfer_s = (double)(link.sim.now_us - transfer_start_us) / 1e6;
+    const double wall_s = (double)(now_ns(CLOCK_MONOTONIC) - wall_start) / 1e9;
+    const double cpu_s = (double)(now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start) / 1e9;
+    const double mib = (double)bench.bytes_received / (1024.0 * 1024.0);
+    const uint64_t needed_packets = (bench.file_size + BENCH_FILE_DATA_SIZE - 1) / BENCH_FILE_DATA_SIZE;
+    const double retransmit_ratio = sender_end->bulk_packets > needed_packets
+                                    ? (double)(sender_end->bulk_packets - needed_packets) / (double)needed_packets
+                                    : 0.0;
+
+    printf("transfer:       %.2f MiB in %.2f simulated s (%.2f s wall)\n", mib, transfer_s, wall_s);
+    printf("goodput:        %.3f MiB/s, %.1f%% of link bandwidth\n", mib / transfer_s,
+           (double)bench.bytes_received * 8 / transfer_s / (double)link.bandwidth_bps * 100.0);
+    printf("cpu:            %.2f s total, %.1f ms per MiB\n", cpu_s, cpu_s * 1000.0 / mib);
+    printf("sender packets: %llu sent, %llu file data (%llu needed), retransmission ratio %.3f\n",
+           (unsigned long long)sender_end->sent_packets, (unsigned long long)sender_end->bulk_packets,
+           (unsigned long long)needed_packets, retransmit_ratio);
+    printf("link drops:     %llu random loss, %llu queue overflow\n",
+           (unsigned long long)sender_end->lost_packets, (unsigned long long)sender_end->overflow_packets);
+
+    sim_kill(&link.sim);
+
+    return bench.bytes_received == bench.file_size ? 0 : 1;
+}
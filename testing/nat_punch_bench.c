@@ -0,0 +1,423 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+/*
+ * Benchmark of how long two friends behind NATs take to connect over UDP.
+ *
+ * Runs a small network in one process: a number of public DHT nodes and two
+ * peers, each behind a simulated NAT. All of them talk through the in-process
+ * UDP network of sim_network.h, with a fixed one way delay plus some jitter,
+ * on a simulated clock that jumps to the next packet arrival or
+ * iteration deadline. There are no TCP relays, so the peers can only connect
+ * by punching a hole through their NATs.
+ *
+ * NAT types:
+ * - open: no NAT.
+ * - cone: one external port per socket, anyone can send to it.
+ * - restricted: one external port per socket, only hosts and ports the peer
+ *   has sent to can send to it (port restricted cone).
+ * - symmetric: a new external port for every destination, allocated
+ *   sequentially, and only that destination can send to it.
+ * Mappings never expire.
+ *
+ * Once both peers are online, they add each other as friends. For every run,
+ * the peers' friend connection timing (see tox_callback_friend_connection_timing)
+ * is reported, along with the number of packets the peers sent until they were
+ * connected.
+ *
+ * Usage: nat_punch_bench [nat_1] [nat_2] [runs] [num_nodes] [rtt_ms]
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+#include "../toxcore/util.h"
+#include "sim_network.h"
+
+#define BENCH_MAX_NODES 32
+#define BENCH_ONLINE_TIMEOUT_US (300ULL * 1000 * 1000)
+#define BENCH_CONNECT_TIMEOUT_US (300ULL * 1000 * 1000)
+/** Public addresses are in 198.18.0.0/15, which isn't treated as LAN. */
+#define BENCH_NODE_IP(i) (0xc6120001 + (uint32_t)(i))
+#define BENCH_PEER_IP(i) (0xc6120101 + (uint32_t)(i))
+
+typedef enum Nat_Type {
+    NAT_OPEN,
+    NAT_CONE,
+    NAT_RESTRICTED,
+    NAT_SYMMETRIC,
+} Nat_Type;
+
+static const char *const nat_type_names[] = {"open", "cone", "restricted", "symmetric"};
+
+typedef struct Sim Sim;
+
+/**
+ * @brief A destination the host sent to through its NAT.
+ *
+ * For symmetric NATs, each one has its own external port. For the others,
+ * they only decide who may send back.
+ */
+typedef struct Nat_Mapping {
+    uint32_t dest_ip;
+    uint16_t dest_port;
+    uint16_t ext_port;
+} Nat_Mapping;
+
+/** @brief A node and its NAT. Addresses and ports are in host byte order. */
+typedef struct Host {
+    Sim *sim;
+    Sim_Node *node;
+    Nat_Type nat;
+
+    uint16_t cone_port;  // the external port of cone and restricted NATs
+    uint16_t next_port;  // the next external port of a symmetric NAT
+    Nat_Mapping *mappings;
+    uint32_t num_mappings;
+
+    uint64_t sent_packets;
+} Host;
+
+struct Sim {
+    Sim_Network net;
+    uint64_t delay_us;  // one way
+
+    Host hosts[BENCH_MAX_NODES + 2];
+    uint32_t num_hosts;
+};
+
+typedef struct Peer_Timing {
+    bool reported;
+    uint32_t dht_pk_ms;
+    uint32_t dht_info_ms;
+    uint32_t udp_ms;
+    uint32_t connected_ms;
+} Peer_Timing;
+
+static const Nat_Mapping *nat_find(const Host *host, uint32_t dest_ip, uint16_t dest_port)
+{
+    for (uint32_t i = 0; i < host->num_mappings; ++i) {
+        if (host->mappings[i].dest_ip == dest_ip && host->mappings[i].dest_port == dest_port) {
+            return &host->mappings[i];
+        }
+    }
+
+    return nullptr;
+}
+
+/** @brief The external port a packet from the host to the destination leaves with, or 0 on allocation failure. */
+static uint16_t nat_outbound(Host *host, uint32_t dest_ip, uint16_t dest_port)
+{
+    if (host->nat == NAT_OPEN) {
+        return host->node->port;
+    }
+
+    const Nat_Mapping *mapping = nat_find(host, dest_ip, dest_port);
+
+    if (mapping != nullptr) {
+        return mapping->ext_port;
+    }
+
+    Nat_Mapping *mappings = (Nat_Mapping *)realloc(host->mappings, (host->num_mappings + 1) * sizeof(Nat_Mapping));
+
+    if (mappings == nullptr) {
+        return 0;
+    }
+
+    host->mappings = mappings;
+
+    Nat_Mapping *new_mapping = &host->mappings[host->num_mappings];
+    ++host->num_mappings;
+    new_mapping->dest_ip = dest_ip;
+    new_mapping->dest_port = dest_port;
+
+    if (host->nat == NAT_SYMMETRIC) {
+        new_mapping->ext_port = host->next_port;
+        host->next_port = host->next_port == UINT16_MAX ? 1024 : host->next_port + 1;
+    } else {
+        new_mapping->ext_port = host->cone_port;
+    }
+
+    return new_mapping->ext_port;
+}
+
+/** @brief Whether the host's NAT lets a packet from the source to the external port through. */
+static bool nat_inbound(const Host *host, uint16_t ext_port, uint32_t src_ip, uint16_t src_port)
+{
+    switch (host->nat) {
+        case NAT_OPEN:
+            return ext_port == host->node->port;
+
+        case NAT_CONE:
+            return ext_port == host->cone_port;
+
+        case NAT_RESTRICTED:
+            return ext_port == host->cone_port && nat_find(host, src_ip, src_port) != nullptr;
+
+        case NAT_SYMMETRIC: {
+            const Nat_Mapping *mapping = nat_find(host, src_ip, src_port);
+            return mapping != nullptr && mapping->ext_port == ext_port;
+        }
+    }
+
+    return false;
+}
+
+static Sim_Node *nat_route(Sim_Node *from, uint32_t dest_ip, uint16_t dest_port, Sim_Packet *packet)
+{
+    Host *host = (Host *)from->obj;
+    Sim *sim = host->sim;
+
+    ++host->sent_packets;
+
+    Sim_Node *dest = sim_find(&sim->net, dest_ip, 0);
+
+    if (dest == nullptr) {
+        return nullptr;
+    }
+
+    const uint16_t src_port = dest == from ? from->port : nat_outbound(host, dest_ip, dest_port);
+
+    // A closed NAT drops the packet.
+    if (src_port == 0 || (dest != from && !nat_inbound((const Host *)dest->obj, dest_port, from->ip, src_port))) {
+        return nullptr;
+    }
+
+    packet->from_port = src_port;
+    packet->arrival_us = sim->net.now_us
+                         + (dest == from ? 0 : sim->delay_us + sim_random(&sim->net) % (sim->delay_us / 10 + 1));
+    return dest;
+}
+
+static Host *sim_add_host(Sim *sim, uint32_t ip, Nat_Type nat)
+{
+    Host *host = &sim->hosts[sim->num_hosts];
+    ++sim->num_hosts;
+
+    host->sim = sim;
+    host->nat = nat;
+    host->cone_port = (uint16_t)(1024 + sim_random(&sim->net) % 60000);
+    host->next_port = host->cone_port;
+    host->node = sim_add_node(&sim->net, ip, host);
+
+    return host->node != nullptr ? host : nullptr;
+}
+
+static void bootstrap_to(const Sim_Node *node, const Sim_Node *to)
+{
+    char ip[INET_ADDRSTRLEN];
+    const struct in_addr addr = {htonl(to->ip)};
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+
+    uint8_t dht_key[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(to->tox, dht_key);
+    tox_bootstrap(node->tox, ip, to->port, dht_key, nullptr);
+}
+
+static void friend_connection_timing_cb(Tox *tox, uint32_t friend_number, uint32_t dht_pk_ms, uint32_t dht_info_ms,
+                                        uint32_t udp_ms, uint32_t connected_ms, void *user_data)
+{
+    Peer_Timing *timing = (Peer_Timing *)user_data;
+
+    if (timing == nullptr || timing->reported) {
+        return;
+    }
+
+    timing->reported = true;
+    timing->dht_pk_ms = dht_pk_ms;
+    timing->dht_info_ms = dht_info_ms;
+    timing->udp_ms = udp_ms;
+    timing->connected_ms = connected_ms;
+}
+
+static void print_ms(uint32_t ms)
+{
+    if (ms == UINT32_MAX) {
+        printf("       -");
+    } else {
+        printf(" %7.2f", (double)ms / 1000.0);
+    }
+}
+
+/** @return simulated milliseconds until both peers were connected over UDP, or UINT32_MAX if they weren't. */
+static uint32_t connect_peers(Sim *sim, Host *peer1, Host *peer2, uint64_t *packets)
+{
+    tox_callback_friend_connection_timing(peer1->node->tox, friend_connection_timing_cb);
+    tox_callback_friend_connection_timing(peer2->node->tox, friend_connection_timing_cb);
+
+    Peer_Timing timings[2] = {{false}};
+    peer1->node->userdata = &timings[0];
+    peer2->node->userdata = &timings[1];
+
+    // Phase 1: wait for the peers to be announced on the onion.
+    const uint64_t online_start_us = sim->net.now_us;
+
+    while (tox_self_get_connection_status(peer1->node->tox) == TOX_CONNECTION_NONE
+            || tox_self_get_connection_status(peer2->node->tox) == TOX_CONNECTION_NONE) {
+        if (sim->net.now_us - online_start_us > BENCH_ONLINE_TIMEOUT_US) {
+            fprintf(stderr, "Peers did not come online within %llu simulated seconds\n",
+                    (unsigned long long)(BENCH_ONLINE_TIMEOUT_US / 1000 / 1000));
+            return UINT32_MAX;
+        }
+
+        sim_iterate(&sim->net);
+    }
+
+    // Phase 2: make them friends and wait for the UDP connection.
+    uint8_t pk1[TOX_PUBLIC_KEY_SIZE];
+    uint8_t pk2[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_public_key(peer1->node->tox, pk1);
+    tox_self_get_public_key(peer2->node->tox, pk2);
+    tox_friend_add_norequest(peer1->node->tox, pk2, nullptr);
+    tox_friend_add_norequest(peer2->node->tox, pk1, nullptr);
+
+    peer1->sent_packets = 0;
+    peer2->sent_packets = 0;
+    const uint64_t connect_start_us = sim->net.now_us;
+
+    while ((!timings[0].reported || !timings[1].reported)
+            && sim->net.now_us - connect_start_us <= BENCH_CONNECT_TIMEOUT_US) {
+        sim_iterate(&sim->net);
+    }
+
+    *packets = peer1->sent_packets + peer2->sent_packets;
+
+    for (uint32_t i = 0; i < 2; ++i) {
+        printf("  peer %u:", i + 1);
+        print_ms(timings[i].reported ? timings[i].dht_pk_ms : UINT32_MAX);
+        print_ms(timings[i].reported ? timings[i].dht_info_ms : UINT32_MAX);
+        print_ms(timings[i].reported ? timings[i].udp_ms : UINT32_MAX);
+        print_ms(timings[i].reported ? timings[i].connected_ms : UINT32_MAX);
+        printf("\n");
+    }
+
+    if (!timings[0].reported || !timings[1].reported) {
+        return UINT32_MAX;
+    }
+
+    return (uint32_t)((sim->net.now_us - connect_start_us) / 1000);
+}
+
+static uint32_t run_once(uint64_t seed, Nat_Type nat1, Nat_Type nat2, uint32_t num_nodes, uint32_t rtt_ms,
+                         uint64_t *packets)
+{
+    Sim *sim = (Sim *)calloc(1, sizeof(Sim));
+
+    if (sim == nullptr) {
+        return UINT32_MAX;
+    }
+
+    sim_init(&sim->net, seed, nat_route);
+    sim->delay_us = (uint64_t)rtt_ms * 1000 / 2;
+
+    bool ok = true;
+
+    for (uint32_t i = 0; i < num_nodes && ok; ++i) {
+        ok = sim_add_host(sim, BENCH_NODE_IP(i), NAT_OPEN) != nullptr;
+    }
+
+    Host *peer1 = ok ? sim_add_host(sim, BENCH_PEER_IP(0), nat1) : nullptr;
+    Host *peer2 = peer1 != nullptr ? sim_add_host(sim, BENCH_PEER_IP(1), nat2) : nullptr;
+    uint32_t result = UINT32_MAX;
+
+    if (peer2 == nullptr) {
+        fprintf(stderr, "Failed to create Tox instances\n");
+    } else {
+        for (uint32_t i = 0; i < sim->num_hosts; ++i) {
+            bootstrap_to(sim->hosts[i].node, sim->hosts[i == 0 ? 1 : 0].node);
+        }
+
+        result = connect_peers(sim, peer1, peer2, packets);
+    }
+
+    sim_kill(&sim->net);
+
+    for (uint32_t i = 0; i < sim->num_hosts; ++i) {
+        free(sim->hosts[i].mappings);
+    }
+
+    free(sim);
+    return result;
+}
+
+static bool parse_nat(int argc, char *argv[], int index, Nat_Type *nat)
+{
+    if (argc <= index) {
+        return true;
+    }
+
+    for (uint32_t i = 0; i < sizeof(nat_type_names) / sizeof(nat_type_names[0]); ++i) {
+        if (strcmp(argv[index], nat_type_names[i]) == 0) {
+            *nat = (Nat_Type)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint32_t parse_arg(int argc, char *argv[], int index, uint32_t def)
+{
+    if (argc <= index) {
+        return def;
+    }
+
+    return (uint32_t)strtoul(argv[index], nullptr, 10);
+}
+
+int main(int argc, char *argv[])
+{
+    Nat_Type nat1 = NAT_SYMMETRIC;
+    Nat_Type nat2 = NAT_RESTRICTED;
+    const uint32_t runs = parse_arg(argc, argv, 3, 5);
+    const uint32_t num_nodes = parse_arg(argc, argv, 4, 8);
+    const uint32_t rtt_ms = parse_arg(argc, argv, 5, 100);
+
+    if (!parse_nat(argc, argv, 1, &nat1) || !parse_nat(argc, argv, 2, &nat2)
+            || runs == 0 || num_nodes < 2 || num_nodes > BENCH_MAX_NODES) {
+        fprintf(stderr, "Usage: %s [nat_1] [nat_2] [runs] [num_nodes] [rtt_ms]\n", argv[0]);
+        fprintf(stderr, "  nat types: open, cone, restricted, symmetric; 2 to %u nodes\n", BENCH_MAX_NODES);
+        return 1;
+    }
+
+    printf("network: peers behind %s and %s NATs, %u DHT nodes, %u ms rtt\n",
+           nat_type_names[nat1], nat_type_names[nat2], num_nodes, rtt_ms);
+    printf("seconds after adding the friend until:\n");
+    printf("         dht key dht info   punched connected\n");
+
+    uint32_t connected = 0;
+    uint64_t total_ms = 0;
+    uint64_t total_packets = 0;
+
+    for (uint32_t i = 0; i < runs; ++i) {
+        printf("run %u:\n", i + 1);
+
+        uint64_t packets = 0;
+        const uint32_t ms = run_once(0x9e3779b97f4a7c15 + i, nat1, nat2, num_nodes, rtt_ms, &packets);
+
+        if (ms == UINT32_MAX) {
+            printf("  not connected within %llu simulated seconds\n",
+                   (unsigned long long)(BENCH_CONNECT_TIMEOUT_US / 1000 / 1000));
+            continue;
+        }
+
+        ++connected;
+        total_ms += ms;
+        total_packets += packets;
+    }
+
+    printf("connected:      %u of %u runs\n", connected, runs);
+
+    if (connected > 0) {
+        printf("mean time:      %.2f simulated s\n", (double)total_ms / connected / 1000.0);
+        printf("mean packets:   %.0f sent by both peers until connected\n", (double)total_packets / connected);
+    }
+
+    return connected == runs ? 0 : 1;
+}
@@ -0,0 +1,331 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+/*
+ * In-process UDP network for benchmarks.
+ */
+#include "sim_network.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/util.h"
+
+#define SIM_SOCKET 42
+
+// Same layout as in network.c, which keeps it private.
+struct Network_Addr {
+    struct sockaddr_storage addr;
+    size_t size;
+};
+
+void sim_init(Sim_Network *sim, uint64_t seed, sim_route_cb *route)
+{
+    memset(sim, 0, sizeof(Sim_Network));
+    sim->now_us = 1000 * 1000;
+    sim->rng_state = seed;
+    sim->route = route;
+}
+
+void sim_kill(Sim_Network *sim)
+{
+    for (uint32_t i = 0; i < sim->num_nodes; ++i) {
+        Sim_Node *node = &sim->nodes[i];
+        tox_kill(node->tox);
+
+        while (node->recvq != nullptr) {
+            Sim_Packet *next = node->recvq->next;
+            free(node->recvq);
+            node->recvq = next;
+        }
+    }
+
+    sim->num_nodes = 0;
+}
+
+uint32_t sim_random(Sim_Network *sim)
+{
+    sim->rng_state ^= sim->rng_state << 13;
+    sim->rng_state ^= sim->rng_state >> 7;
+    sim->rng_state ^= sim->rng_state << 17;
+    return (uint32_t)(sim->rng_state >> 32);
+}
+
+Sim_Node *sim_find(Sim_Network *sim, uint32_t ip, uint16_t port)
+{
+    for (uint32_t i = 0; i < sim->num_nodes; ++i) {
+        Sim_Node *node = &sim->nodes[i];
+
+        if (node->ip == ip && (port == 0 || node->port == port)) {
+            return node;
+        }
+    }
+
+    return nullptr;
+}
+
+static void sim_deliver(Sim_Node *dest, Sim_Packet *packet)
+{
+    Sim_Packet **pos = &dest->recvq;
+
+    while (*pos != nullptr && (*pos)->arrival_us <= packet->arrival_us) {
+        pos = &(*pos)->next;
+    }
+
+    packet->next = *pos;
+    *pos = packet;
+}
+
+/** @brief Time of the next packet arrival, or UINT64_MAX if nothing is in flight. */
+static uint64_t sim_next_arrival(const Sim_Network *sim)
+{
+    uint64_t next = UINT64_MAX;
+
+    for (uint32_t i = 0; i < sim->num_nodes; ++i) {
+        if (sim->nodes[i].recvq != nullptr) {
+            next = min_u64(next, sim->nodes[i].recvq->arrival_us);
+        }
+    }
+
+    return next;
+}
+
+static const struct sockaddr_in *addr_in(const Network_Addr *addr)
+{
+    return (const struct sockaddr_in *)&addr->addr;
+}
+
+static int sim_close(void *obj, Socket sock)
+{
+    return 0;
+}
+
+static Socket sim_accept(void *obj, Socket sock)
+{
+    return net_socket_from_native(-1);
+}
+
+static int sim_bind(void *obj, Socket sock, const Network_Addr *addr)
+{
+    Sim_Node *node = (Sim_Node *)obj;
+    const uint16_t port = ntohs(addr_in(addr)->sin_port);
+
+    if (sim_find(node->sim, node->ip, port) != nullptr) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    node->port = port;
+    return 0;
+}
+
+static int sim_listen(void *obj, Socket sock, int backlog)
+{
+    return 0;
+}
+
+static int sim_connect(void *obj, Socket sock, const Network_Addr *addr)
+{
+    errno = ECONNREFUSED;
+    return -1;
+}
+
+static int sim_recvbuf(void *obj, Socket sock)
+{
+    return 0;
+}
+
+static int sim_recv(void *obj, Socket sock, uint8_t *buf, size_t len)
+{
+    errno = ENOTCONN;
+    return -1;
+}
+
+static int sim_recvfrom(void *obj, Socket sock, uint8_t *buf, size_t len, Network_Addr *addr)
+{
+    Sim_Node *node = (Sim_Node *)obj;
+    Sim_Packet *packet = node->recvq;
+
+    if (packet == nullptr || packet->arrival_us > node->sim->now_us) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    node->recvq = packet->next;
+
+    const uint16_t length = min_u16(packet->length, (uint16_t)len);
+    memcpy(buf, packet->data, length);
+
+    memset(addr, 0, sizeof(Network_Addr));
+    struct sockaddr_in *from = (struct sockaddr_in *)&addr->addr;
+    from->sin_family = AF_INET;
+    from->sin_port = htons(packet->from_port);
+    from->sin_addr.s_addr = htonl(packet->from_ip);
+    addr->size = sizeof(struct sockaddr_in);
+
+    free(packet);
+    return length;
+}
+
+static int sim_send(void *obj, Socket sock, const uint8_t *buf, size_t len)
+{
+    errno = ENOTCONN;
+    return -1;
+}
+
+static int sim_sendto(void *obj, Socket sock, const uint8_t *buf, size_t len, const Network_Addr *addr)
+{
+    Sim_Node *node = (Sim_Node *)obj;
+
+    if (len > MAX_UDP_PACKET_SIZE) {
+        return (int)len;
+    }
+
+    Sim_Packet *packet = (Sim_Packet *)calloc(1, sizeof(Sim_Packet));
+
+    if (packet == nullptr) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    packet->from_ip = node->ip;
+    packet->from_port = node->port;
+    packet->length = (uint16_t)len;
+    memcpy(packet->data, buf, len);
+
+    Sim_Node *dest = node->sim->route(node, ntohl(addr_in(addr)->sin_addr.s_addr), ntohs(addr_in(addr)->sin_port),
+                                      packet);
+
+    // Like a real UDP socket, sending to nowhere silently succeeds.
+    if (dest == nullptr) {
+        free(packet);
+        return (int)len;
+    }
+
+    sim_deliver(dest, packet);
+    return (int)len;
+}
+
+static Socket sim_socket(void *obj, int domain, int type, int proto)
+{
+    if (type != SOCK_DGRAM) {
+        return net_socket_from_native(-1);
+    }
+
+    return net_socket_from_native(SIM_SOCKET);
+}
+
+static int sim_socket_nonblock(void *obj, Socket sock, bool nonblock)
+{
+    return 0;
+}
+
+static int sim_getsockopt(void *obj, Socket sock, int level, int optname, void *optval, size_t *optlen)
+{
+    memset(optval, 0, *optlen);
+    return 0;
+}
+
+static int sim_setsockopt(void *obj, Socket sock, int level, int optname, const void *optval, size_t optlen)
+{
+    return 0;
+}
+
+static int sim_getaddrinfo(void *obj, const Memory *mem, const char *address, int family, int protocol,
+                           Network_Addr **addrs)
+{
+    // No DNS in the simulated network.
+    return 0;
+}
+
+static int sim_freeaddrinfo(void *obj, const Memory *mem, Network_Addr *addrs)
+{
+    return 0;
+}
+
+static const Network_Funcs sim_network_funcs = {
+    sim_close,
+    sim_accept,
+    sim_bind,
+    sim_listen,
+    sim_connect,
+    sim_recvbuf,
+    sim_recv,
+    sim_recvfrom,
+    sim_send,
+    sim_sendto,
+    sim_socket,
+    sim_socket_nonblock,
+    sim_getsockopt,
+    sim_setsockopt,
+    sim_getaddrinfo,
+    sim_freeaddrinfo,
+};
+
+static uint64_t sim_mono_time(void *user_data)
+{
+    const Sim_Network *sim = (const Sim_Network *)user_data;
+    return sim->now_us / 1000;
+}
+
+Sim_Node *sim_add_node(Sim_Network *sim, uint32_t ip, void *obj)
+{
+    if (sim->num_nodes == SIM_MAX_NODES) {
+        return nullptr;
+    }
+
+    Sim_Node *node = &sim->nodes[sim->num_nodes];
+    ++sim->num_nodes;
+
+    node->sim = sim;
+    node->ip = ip;
+    node->obj = obj;
+
+    node->ns.funcs = &sim_network_funcs;
+    node->ns.obj = node;
+
+    node->sys = tox_default_system();
+    node->sys.mono_time_callback = sim_mono_time;
+    node->sys.mono_time_user_data = sim;
+    node->sys.ns = &node->ns;
+
+    struct Tox_Options *opts = tox_options_new(nullptr);
+
+    if (opts == nullptr) {
+        return nullptr;
+    }
+
+    tox_options_set_ipv6_enabled(opts, false);
+    tox_options_set_local_discovery_enabled(opts, false);
+    tox_options_set_experimental_disable_dns(opts, true);
+
+    Tox_Options_Testing testing;
+    testing.operating_system = &node->sys;
+
+    node->tox = tox_new_testing(opts, nullptr, &testing, nullptr);
+    tox_options_free(opts);
+
+    return node->tox != nullptr ? node : nullptr;
+}
+
+void sim_iterate(Sim_Network *sim)
+{
+    uint32_t interval_ms = UINT32_MAX;
+
+    for (uint32_t i = 0; i < sim->num_nodes; ++i) {
+        Sim_Node *node = &sim->nodes[i];
+        tox_iterate(node->tox, node->userdata);
+        interval_ms = min_u32(interval_ms, tox_iteration_interval(node->tox));
+    }
+
+    const uint64_t deadline_us = sim->now_us + max_u64((uint64_t)interval_ms * 1000, 1000);
+    const uint64_t next_us = min_u64(deadline_us, sim_next_arrival(sim));
+
+    sim->now_us = max_u64(next_us, sim->now_us + 1);
+}
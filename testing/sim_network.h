@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+/*
+ * In-process UDP network for benchmarks.
+ *
+ * Tox instances created here talk through Network_Funcs that pass packets
+ * between them in memory, on a simulated clock that jumps to the next packet
+ * arrival or iteration deadline. What happens to a packet on its way, like
+ * delay, loss or NAT, is up to the benchmark's route callback.
+ */
+#ifndef C_TOXCORE_TESTING_SIM_NETWORK_H
+#define C_TOXCORE_TESTING_SIM_NETWORK_H
+
+#include <stdint.h>
+
+#include "../toxcore/network.h"
+#include "../toxcore/tox.h"
+#include "../toxcore/tox_private.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_MAX_NODES 64
+
+typedef struct Sim_Network Sim_Network;
+typedef struct Sim_Node Sim_Node;
+
+/** @brief A packet on its way. Addresses and ports are in host byte order. */
+typedef struct Sim_Packet {
+    struct Sim_Packet *next;
+    uint64_t arrival_us;
+    uint32_t from_ip;
+    uint16_t from_port;
+    uint16_t length;
+    uint8_t data[MAX_UDP_PACKET_SIZE];
+} Sim_Packet;
+
+/**
+ * @brief Decides where and when a packet sent by a node arrives.
+ *
+ * The packet comes from the node's address. The callback may change that, and
+ * must set its arrival time.
+ *
+ * @return the node that receives the packet, or nullptr to drop it.
+ */
+typedef Sim_Node *sim_route_cb(Sim_Node *from, uint32_t dest_ip, uint16_t dest_port, Sim_Packet *packet);
+
+/** @brief A Tox instance on the network. Addresses and ports are in host byte order. */
+struct Sim_Node {
+    Sim_Network *sim;
+    uint32_t ip;
+    uint16_t port;  // bound port, 0 until bound
+
+    /** Packets on their way to this node, ordered by arrival time. */
+    Sim_Packet *recvq;
+
+    void *obj;       // the benchmark's state for this node
+    void *userdata;  // passed to tox_iterate
+
+    Network ns;
+    Tox_System sys;
+    Tox *tox;
+};
+
+struct Sim_Network {
+    uint64_t now_us;
+    uint64_t rng_state;
+    sim_route_cb *route;
+
+    Sim_Node nodes[SIM_MAX_NODES];
+    uint32_t num_nodes;
+};
+
+/** @brief Set up an empty network. The clock starts at 1 second. */
+void sim_init(Sim_Network *sim, uint64_t seed, sim_route_cb *route);
+
+/** @brief Kill all Tox instances and drop the packets in flight. */
+void sim_kill(Sim_Network *sim);
+
+/** Deterministic, so that runs with the same seed see the same network. */
+uint32_t sim_random(Sim_Network *sim);
+
+/**
+ * @brief Add a node with a new Tox instance, IPv4 only, without LAN discovery
+ *   and DNS.
+ *
+ * @return nullptr if the network is full or the Tox instance failed to start.
+ */
+Sim_Node *sim_add_node(Sim_Network *sim, uint32_t ip, void *obj);
+
+/**
+ * @brief The node with the address.
+ * @param port The bound port to match, or 0 for any.
+ */
+Sim_Node *sim_find(Sim_Network *sim, uint32_t ip, uint16_t port);
+
+/**
+ * @brief Run all instances once and move the clock to the next event.
+ *
+ * That is the next packet arrival or the earliest iteration deadline, but at
+ * least 1 microsecond.
+ */
+void sim_iterate(Sim_Network *sim);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // C_TOXCORE_TESTING_SIM_NETWORK_H
@@ -0,0 +1,401 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+/*
+ * TCP relay load generator.
+ *
+ * Starts a TCP_Server on loopback and connects a configurable number of
+ * TCP_Client_Connection pairs to it. Each pair routes to the other through
+ * the relay and then pumps timestamped data packets for the given duration.
+ *
+ * Reported at the end:
+ * - number of clients that completed the handshake and routing setup,
+ * - relayed packets/s and bytes/s,
+ * - p50/p99/max relay latency (send to receive, both ends in this process),
+ * - CPU time spent inside do_tcp_server() relative to wall clock time.
+ *
+ * Clients and server share one thread, so measured latency includes the time
+ * it takes to run one full client loop. Use fewer pairs to get closer to the
+ * raw relay latency, more pairs to measure relay capacity.
+ *
+ * Usage: tcp_relay_bench [pairs] [seconds] [payload_size] [window]
+ *
+ * Thousands of clients need an fd limit of at least 2 * pairs + 64; raise it
+ * with `ulimit -n` first.
+ */
+#ifndef _POSIX_C_SOURCE
+// For clock_gettime().
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/TCP_client.h"
+#include "../toxcore/TCP_server.h"
+#include "../toxcore/ccompat.h"
+#include "../toxcore/crypto_core.h"
+#include "../toxcore/logger.h"
+#include "../toxcore/mem.h"
+#include "../toxcore/mono_time.h"
+#include "../toxcore/network.h"
+#include "../toxcore/util.h"
+#include "misc_tools.h"
+
+#define BENCH_PORT 33460
+#define BENCH_CONNECT_BATCH 128
+#define BENCH_CONNECT_TIMEOUT_NS (15ULL * 1000 * 1000 * 1000)
+#define BENCH_MAX_PAYLOAD 1300
+#define BENCH_MAX_SAMPLES (4 * 1024 * 1024)
+
+typedef struct Bench Bench;
+
+typedef struct Bench_Client {
+    Bench *bench;
+    struct Bench_Client *peer;
+    TCP_Client_Connection *con;
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+
+    uint8_t con_id;
+    bool routed;
+    bool online;
+    uint32_t in_flight;
+} Bench_Client;
+
+struct Bench {
+    const Logger *logger;
+    const Random *rng;
+
+    uint32_t payload_size;
+    uint32_t window;
+
+    uint64_t packets_received;
+    uint64_t bytes_received;
+
+    uint32_t *samples;
+    uint32_t samples_count;
+    uint64_t samples_seen;
+    uint32_t max_latency;  // over all samples, not just the ones in the reservoir
+};
+
+static uint64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + (uint64_t)ts.tv_nsec;
+}
+
+/** Reservoir sampling so that long runs keep a bounded, unbiased sample set. */
+static void record_latency(Bench *bench, uint64_t latency_ns)
+{
+    const uint64_t us = latency_ns / 1000;
+    const uint32_t sample = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+
+    ++bench->samples_seen;
+    bench->max_latency = max_u32(bench->max_latency, sample);
+
+    if (bench->samples_count < BENCH_MAX_SAMPLES) {
+        bench->samples[bench->samples_count] = sample;
+        ++bench->samples_count;
+        return;
+    }
+
+    const uint64_t slot = random_u64(bench->rng) % bench->samples_seen;
+
+    if (slot < BENCH_MAX_SAMPLES) {
+        bench->samples[slot] = sample;
+    }
+}
+
+static int response_cb(void *object, uint8_t connection_id, const uint8_t *public_key)
+{
+    Bench_Client *client = (Bench_Client *)object;
+
+    if (!pk_equal(public_key, client->peer->public_key)) {
+        return -1;
+    }
+
+    client->con_id = connection_id;
+    client->routed = true;
+    return 0;
+}
+
+static int status_cb(void *object, uint32_t number, uint8_t connection_id, uint8_t status)
+{
+    Bench_Client *client = (Bench_Client *)object;
+
+    if (!client->routed || connection_id != client->con_id) {
+        return -1;
+    }
+
+    client->online = status == 2;
+    return 0;
+}
+
+static int data_cb(void *object, uint32_t number, uint8_t connection_id, const uint8_t *data, uint16_t length,
+                   void *userdata)
+{
+    Bench_Client *client = (Bench_Client *)object;
+    Bench *bench = client->bench;
+
+    uint64_t sent_ns;
+
+    if (length < sizeof(sent_ns)) {
+        return -1;
+    }
+
+    memcpy(&sent_ns, data, sizeof(sent_ns));
+    record_latency(bench, now_ns(CLOCK_MONOTONIC) - sent_ns);
+
+    ++bench->packets_received;
+    bench->bytes_received += length;
+
+    if (client->peer->in_flight > 0) {
+        --client->peer->in_flight;
+    }
+
+    return 0;
+}
+
+static void pump_client(Bench *bench, Bench_Client *client, uint8_t *payload)
+{
+    while (client->online && client->in_flight < bench->window) {
+        const uint64_t sent_ns = now_ns(CLOCK_MONOTONIC);
+        memcpy(payload, &sent_ns, sizeof(sent_ns));
+
+        if (send_data(bench->logger, client->con, client->con_id, payload, bench->payload_size) != 1) {
+            break;
+        }
+
+        ++client->in_flight;
+    }
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    const uint32_t x = *(const uint32_t *)a;
+    const uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static uint32_t percentile(const uint32_t *sorted, uint32_t count, uint32_t pct)
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    const uint64_t index = (uint64_t)(count - 1) * pct / 100;
+    return sorted[index];
+}
+
+/** Run one server iteration and add the CPU time it took to `server_cpu_ns`. */
+static void run_server(TCP_Server *tcp_s, Mono_Time *mono_time, uint64_t *server_cpu_ns)
+{
+    const uint64_t start = now_ns(CLOCK_THREAD_CPUTIME_ID);
+    do_tcp_server(tcp_s, mono_time);
+    *server_cpu_ns += now_ns(CLOCK_THREAD_CPUTIME_ID) - start;
+}
+
+static uint32_t parse_arg(int argc, char *argv[], int index, uint32_t def)
+{
+    if (argc <= index) {
+        return def;
+    }
+
+    return (uint32_t)strtoul(argv[index], nullptr, 10);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t num_pairs = parse_arg(argc, argv, 1, 1000);
+    const uint32_t seconds = parse_arg(argc, argv, 2, 10);
+    uint32_t payload_size = parse_arg(argc, argv, 3, 1024);
+    const uint32_t window = parse_arg(argc, argv, 4, 8);
+
+    if (payload_size < sizeof(uint64_t)) {
+        payload_size = sizeof(uint64_t);
+    }
+
+    if (payload_size > BENCH_MAX_PAYLOAD) {
+        payload_size = BENCH_MAX_PAYLOAD;
+    }
+
+    if (num_pairs == 0 || window == 0) {
+        fprintf(stderr, "Usage: %s [pairs] [seconds] [payload_size] [window]\n", argv[0]);
+        return 1;
+    }
+
+    const Memory *mem = os_memory();
+    const Random *rng = os_random();
+    const Network *ns = os_network();
+
+    if (mem == nullptr || rng == nullptr || ns == nullptr) {
+        fprintf(stderr, "Failed to initialise system abstractions\n");
+        return 1;
+    }
+
+    Logger *logger = logger_new(mem);
+    Mono_Time *mono_time = mono_time_new(mem, nullptr, nullptr);
+
+    uint8_t server_pk[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t server_sk[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(rng, server_pk, server_sk);
+
+    const uint16_t port = BENCH_PORT;
+    TCP_Server *tcp_s = new_tcp_server(logger, mem, rng, ns, false, 1, &port, server_sk, nullptr, nullptr);
+
+    if (tcp_s == nullptr || tcp_server_listen_count(tcp_s) != 1) {
+        fprintf(stderr, "Failed to start TCP relay on port %u\n", port);
+        return 1;
+    }
+
+    Bench bench = {nullptr};
+    bench.logger = logger;
+    bench.rng = rng;
+    bench.payload_size = payload_size;
+    bench.window = window;
+    bench.samples = (uint32_t *)calloc(BENCH_MAX_SAMPLES, sizeof(uint32_t));
+
+    const uint32_t num_clients = num_pairs * 2;
+    Bench_Client *clients = (Bench_Client *)calloc(num_clients, sizeof(Bench_Client));
+
+    if (bench.samples == nullptr || clients == nullptr) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    IP_Port relay;
+    ip_init(&relay.ip, false);
+    relay.ip.ip.v4 = get_ip4_loopback();
+    relay.port = net_htons(port);
+
+    uint64_t server_cpu_ns = 0;
+
+    // Phase 1: connect clients in batches so the relay's handshake queue
+    // (MAX_INCOMING_CONNECTIONS) does not drop pending connections.
+    const uint64_t connect_start = now_ns(CLOCK_MONOTONIC);
+    uint32_t connected = 0;
+
+    for (uint32_t batch = 0; batch < num_clients; batch += BENCH_CONNECT_BATCH) {
+        const uint32_t batch_end = min_u32(batch + BENCH_CONNECT_BATCH, num_clients);
+
+        for (uint32_t i = batch; i < batch_end; ++i) {
+            Bench_Client *client = &clients[i];
+            client->bench = &bench;
+            client->peer = &clients[i ^ 1];
+            crypto_new_keypair(rng, client->public_key, client->secret_key);
+            client->con = new_tcp_connection(logger, mem, mono_time, rng, ns, &relay, server_pk,
+                                             client->public_key, client->secret_key, nullptr);
+
+            if (client->con == nullptr) {
+                fprintf(stderr, "Failed to create client %u (fd limit too low? try ulimit -n)\n", i);
+                return 1;
+            }
+
+            routing_response_handler(client->con, response_cb, client);
+            routing_status_handler(client->con, status_cb, client);
+            routing_data_handler(client->con, data_cb, client);
+        }
+
+        const uint64_t deadline = now_ns(CLOCK_MONOTONIC) + BENCH_CONNECT_TIMEOUT_NS;
+        uint32_t confirmed = 0;
+
+        while (confirmed < batch_end - batch && now_ns(CLOCK_MONOTONIC) < deadline) {
+            mono_time_update(mono_time);
+            run_server(tcp_s, mono_time, &server_cpu_ns);
+            confirmed = 0;
+
+            for (uint32_t i = batch; i < batch_end; ++i) {
+                do_tcp_connection(logger, mono_time, clients[i].con, nullptr);
+                confirmed += tcp_con_status(clients[i].con) == TCP_CLIENT_CONFIRMED ? 1 : 0;
+            }
+
+            c_sleep(1);
+        }
+
+        connected += confirmed;
+    }
+
+    const uint64_t connect_ns = now_ns(CLOCK_MONOTONIC) - connect_start;
+
+    // Phase 2: pair clients up through routing requests.
+    for (uint32_t i = 0; i < num_clients; ++i) {
+        if (tcp_con_status(clients[i].con) == TCP_CLIENT_CONFIRMED) {
+            send_routing_request(logger, clients[i].con, clients[i].peer->public_key);
+        }
+    }
+
+    const uint64_t route_deadline = now_ns(CLOCK_MONOTONIC) + BENCH_CONNECT_TIMEOUT_NS;
+    uint32_t online = 0;
+
+    while (online < connected && now_ns(CLOCK_MONOTONIC) < route_deadline) {
+        mono_time_update(mono_time);
+        run_server(tcp_s, mono_time, &server_cpu_ns);
+        online = 0;
+
+        for (uint32_t i = 0; i < num_clients; ++i) {
+            do_tcp_connection(logger, mono_time, clients[i].con, nullptr);
+            online += clients[i].online ? 1 : 0;
+        }
+
+        c_sleep(1);
+    }
+
+    printf("clients:        %u requested, %u connected, %u routed (%.2f s to connect)\n",
+           num_clients, connected, online, (double)connect_ns / 1e9);
+
+    // Phase 3: pump traffic.
+    uint8_t payload[BENCH_MAX_PAYLOAD] = {0};
+    server_cpu_ns = 0;
+    const uint64_t run_start = now_ns(CLOCK_MONOTONIC);
+    const uint64_t run_end = run_start + (uint64_t)seconds * 1000 * 1000 * 1000;
+    const uint64_t process_cpu_start = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    while (now_ns(CLOCK_MONOTONIC) < run_end) {
+        mono_time_update(mono_time);
+
+        for (uint32_t i = 0; i < num_clients; ++i) {
+            pump_client(&bench, &clients[i], payload);
+        }
+
+        run_server(tcp_s, mono_time, &server_cpu_ns);
+
+        for (uint32_t i = 0; i < num_clients; ++i) {
+            do_tcp_connection(logger, mono_time, clients[i].con, nullptr);
+        }
+    }
+
+    const double wall_s = (double)(now_ns(CLOCK_MONOTONIC) - run_start) / 1e9;
+    const double process_cpu_s = (double)(now_ns(CLOCK_PROCESS_CPUTIME_ID) - process_cpu_start) / 1e9;
+    const double server_cpu_s = (double)server_cpu_ns / 1e9;
+
+    qsort(bench.samples, bench.samples_count, sizeof(uint32_t), cmp_u32);
+
+    printf("payload:        %u bytes, window %u packets per client\n", payload_size, window);
+    printf("relayed:        %llu packets, %.0f packets/s, %.2f MiB/s\n",
+           (unsigned long long)bench.packets_received, (double)bench.packets_received / wall_s,
+           (double)bench.bytes_received / wall_s / (1024.0 * 1024.0));
+    printf("latency:        p50 %u us, p99 %u us, max %u us (%u sampled)\n",
+           percentile(bench.samples, bench.samples_count, 50),
+           percentile(bench.samples, bench.samples_count, 99),
+           bench.max_latency, bench.samples_count);
+    printf("server cpu:     %.2f s of %.2f s wall (%.1f%%), process cpu %.2f s\n",
+           server_cpu_s, wall_s, server_cpu_s / wall_s * 100.0, process_cpu_s);
+
+    for (uint32_t i = 0; i < num_clients; ++i) {
+        kill_tcp_connection(clients[i].con);
+    }
+
+    kill_tcp_server(tcp_s);
+    free(clients);
+    free(bench.samples);
+    mono_time_free(mem, mono_time);
+    logger_kill(logger);
+
+    return 0;
+}
@@ -38,6 +38,15 @@
 /** Interval in seconds between punching attempts*/
 #define PUNCH_INTERVAL 3
 
+/** Interval in milliseconds between punching attempts while nodes report new addresses for the friend. */
+#define PUNCH_FAST_INTERVAL_MS 500
+
+/** How long in milliseconds after a node reported a new address for the friend we punch at the fast interval. */
+#define PUNCH_FAST_TIME_MS 10000
+
+/** Number of punching attempts at most made at the fast interval until punching parameters are reset. */
+#define MAX_FAST_PUNCHING_TRIES 8
+
 /** Time in seconds after which punching parameters will be reset */
 #define PUNCH_RESET_TIME 40
 
@@ -1285,6 +1294,60 @@ static bool update_client_data(const Mono_Time *mono_time, Client_data *array, s
     return true;
 }
 
+/** @brief Whether any node has recently told us an address it sees the friend at. */
+non_null()
+static bool friend_ip_reported(const DHT *dht, const DHT_Friend *dht_friend)
+{
+    for (size_t i = 0; i < MAX_FRIEND_CLIENTS; ++i) {
+        const Client_data *const client = &dht_friend->client_list[i];
+
+        if ((ip_isset(&client->assoc4.ret_ip_port.ip)
+                && !mono_time_is_timeout(dht->mono_time, client->assoc4.ret_timestamp, BAD_NODE_TIMEOUT))
+                || (ip_isset(&client->assoc6.ret_ip_port.ip)
+                    && !mono_time_is_timeout(dht->mono_time, client->assoc6.ret_timestamp, BAD_NODE_TIMEOUT))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/** @brief Note when a node tells us an address for the friend, before it is stored in the friend's client list.
+ *
+ * A new address means there are new ports to punch, see do_nat().
+ */
+non_null()
+static void note_reported_ip(const DHT *dht, DHT_Friend *dht_friend, const IP_Port *ip_port,
+                             const uint8_t *nodepublic_key)
+{
+    const uint32_t index = index_of_client_pk(dht_friend->client_list, MAX_FRIEND_CLIENTS, nodepublic_key);
+
+    if (index == UINT32_MAX) {
+        return;
+    }
+
+    const Client_data *const client = &dht_friend->client_list[index];
+    const IPPTsPng *assoc;
+
+    if (net_family_is_ipv4(ip_port->ip.family)) {
+        assoc = &client->assoc4;
+    } else if (net_family_is_ipv6(ip_port->ip.family)) {
+        assoc = &client->assoc6;
+    } else {
+        return;
+    }
+
+    const uint64_t now = mono_time_get_ms(dht->mono_time);
+
+    if (!friend_ip_reported(dht, dht_friend)) {
+        dht_friend->nat.info_since = now;
+    }
+
+    if (!ipport_equal(&assoc->ret_ip_port, ip_port)) {
+        dht_friend->nat.fresh_info_timestamp = now;
+    }
+}
+
 /**
  * If public_key is a friend or us, update ret_ip_port
  * nodepublic_key is the id of the node that sent us this info.
@@ -1301,6 +1364,7 @@ static void returnedip_ports(DHT *dht, const IP_Port *ip_port, const uint8_t *pu
 
     for (uint32_t i = 0; i < dht->num_friends; ++i) {
         if (pk_equal(public_key, dht->friends_list[i].public_key)) {
+            note_reported_ip(dht, &dht->friends_list[i], &ipp_copy, nodepublic_key);
             Client_data *const client_list = dht->friends_list[i].client_list;
 
             if (update_client_data(dht->mono_time, client_list, MAX_FRIEND_CLIENTS, &ipp_copy, nodepublic_key, false)) {
@@ -1697,6 +1761,17 @@ int dht_delfriend(DHT *dht, const uint8_t *public_key, uint32_t lock_token)
     return 0;
 }
 
+uint64_t dht_friend_info_since(const DHT *dht, const uint8_t *public_key)
+{
+    const uint32_t friend_index = index_of_friend_pk(dht->friends_list, dht->num_friends, public_key);
+
+    if (friend_index == UINT32_MAX || !friend_ip_reported(dht, &dht->friends_list[friend_index])) {
+        return 0;
+    }
+
+    return dht->friends_list[friend_index].nat.info_since;
+}
+
 /* TODO(irungentoo): Optimize this. */
 int dht_getfriendip(const DHT *dht, const uint8_t *public_key, IP_Port *ip_port)
 {
@@ -2218,7 +2293,7 @@ static int handle_nat_ping(void *object, const IP_Port *source, const uint8_t *s
     if (packet[0] == NAT_PING_REQUEST) {
         /* 1 is reply */
         send_nat_ping(dht, source_pubkey, ping_id, NAT_PING_RESPONSE);
-        dht_friend->nat.recv_nat_ping_timestamp = mono_time_get(dht->mono_time);
+        dht_friend->nat.recv_nat_ping_timestamp = mono_time_get_ms(dht->mono_time);
         return 0;
     }
 
@@ -2348,10 +2423,26 @@ static void punch_holes(DHT *dht, const IP *ip, const uint16_t *port_list, uint1
     ++dht->friends_list[friend_num].nat.tries;
 }
 
+/** @brief Interval in milliseconds between NAT pings and punching attempts for a friend.
+ *
+ * Right after a node reported a new address for the friend we try more often,
+ * because that is when a punch is most likely to hit the ports the friend's
+ * NAT is currently using.
+ */
+non_null()
+static uint64_t nat_punch_interval(const NAT *nat, uint64_t temp_time)
+{
+    if (nat->tries < MAX_FAST_PUNCHING_TRIES && nat->fresh_info_timestamp + PUNCH_FAST_TIME_MS > temp_time) {
+        return PUNCH_FAST_INTERVAL_MS;
+    }
+
+    return PUNCH_INTERVAL * 1000;
+}
+
 non_null()
 static void do_nat(DHT *dht)
 {
-    const uint64_t temp_time = mono_time_get(dht->mono_time);
+    const uint64_t temp_time = mono_time_get_ms(dht->mono_time);
 
     for (uint32_t i = 0; i < dht->num_friends; ++i) {
         IP_Port ip_list[MAX_FRIEND_CLIENTS];
@@ -2362,14 +2453,17 @@ static void do_nat(DHT *dht)
             continue;
         }
 
-        if (dht->friends_list[i].nat.nat_ping_timestamp + PUNCH_INTERVAL < temp_time) {
-            send_nat_ping(dht, dht->friends_list[i].public_key, dht->friends_list[i].nat.nat_ping_id, NAT_PING_REQUEST);
-            dht->friends_list[i].nat.nat_ping_timestamp = temp_time;
+        NAT *const nat = &dht->friends_list[i].nat;
+        const uint64_t interval = nat_punch_interval(nat, temp_time);
+
+        if (nat->nat_ping_timestamp + interval < temp_time) {
+            send_nat_ping(dht, dht->friends_list[i].public_key, nat->nat_ping_id, NAT_PING_REQUEST);
+            nat->nat_ping_timestamp = temp_time;
         }
 
-        if (dht->friends_list[i].nat.hole_punching &&
-                dht->friends_list[i].nat.punching_timestamp + PUNCH_INTERVAL < temp_time &&
-                dht->friends_list[i].nat.recv_nat_ping_timestamp + PUNCH_INTERVAL * 2 >= temp_time) {
+        if (nat->hole_punching &&
+                nat->punching_timestamp + interval < temp_time &&
+                nat->recv_nat_ping_timestamp + PUNCH_INTERVAL * 2 * 1000 >= temp_time) {
 
             const IP ip = nat_commonip(ip_list, num, MAX_FRIEND_CLIENTS / 2);
 
@@ -2377,18 +2471,18 @@ static void do_nat(DHT *dht)
                 continue;
             }
 
-            if (dht->friends_list[i].nat.punching_timestamp + PUNCH_RESET_TIME < temp_time) {
-                dht->friends_list[i].nat.tries = 0;
-                dht->friends_list[i].nat.punching_index = 0;
-                dht->friends_list[i].nat.punching_index2 = 0;
+            if (nat->punching_timestamp + PUNCH_RESET_TIME * 1000 < temp_time) {
+                nat->tries = 0;
+                nat->punching_index = 0;
+                nat->punching_index2 = 0;
             }
 
             uint16_t port_list[MAX_FRIEND_CLIENTS];
             const uint16_t numports = nat_getports(port_list, ip_list, num, &ip);
             punch_holes(dht, &ip, port_list, numports, i);
 
-            dht->friends_list[i].nat.punching_timestamp = temp_time;
-            dht->friends_list[i].nat.hole_punching = false;
+            nat->punching_timestamp = temp_time;
+            nat->hole_punching = false;
         }
     }
 }
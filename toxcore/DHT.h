@@ -167,10 +167,16 @@ typedef struct NAT {
     uint32_t    tries;
     uint32_t    punching_index2;
 
+    /* Timestamps are in milliseconds. */
     uint64_t    punching_timestamp;
     uint64_t    recv_nat_ping_timestamp;
     uint64_t    nat_ping_id;
     uint64_t    nat_ping_timestamp;
+
+    /* When nodes started reporting addresses for the friend, and when one of
+     * them last reported an address it hadn't reported before. */
+    uint64_t    info_since;
+    uint64_t    fresh_info_timestamp;
 } NAT;
 
 typedef struct Node_format {
@@ -316,6 +322,16 @@ int dht_delfriend(DHT *dht, const uint8_t *public_key, uint32_t lock_token);
 non_null()
 int dht_getfriendip(const DHT *dht, const uint8_t *public_key, IP_Port *ip_port);
 
+/** @brief When DHT nodes started reporting the address they see the friend at.
+ *
+ * @param public_key The friend's DHT public key.
+ *
+ * @return time in milliseconds since which nodes have kept reporting an
+ *   address, or 0 if the key isn't a friend or no node reports one.
+ */
+non_null()
+uint64_t dht_friend_info_since(const DHT *dht, const uint8_t *public_key);
+
 /** @brief Compares pk1 and pk2 with pk.
  *
  * @retval 0 if both are same distance.
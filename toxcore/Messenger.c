@@ -38,6 +38,7 @@
 #include "onion.h"
 #include "onion_announce.h"
 #include "onion_client.h"
+#include "pk_index.h"
 #include "state.h"
 #include "util.h"
 
@@ -56,6 +57,24 @@ bool friend_is_valid(const Messenger *m, int32_t friendnumber)
     return (uint32_t)friendnumber < m->numfriends && m->friendlist[friendnumber].status != 0;
 }
 
+/** @brief Note that the friend was added or removed, or their name, status message, user status, typing or
+ * connection status changed.
+ */
+non_null()
+static void friend_info_changed(Messenger *m, int32_t friendnumber)
+{
+    Friend *const f = &m->friendlist[friendnumber];
+
+    if (f->info_changed) {
+        return;
+    }
+
+    // reserve_friendlist made room for every friend.
+    m->changed_friends[m->num_changed_friends] = friendnumber;
+    ++m->num_changed_friends;
+    f->info_changed = true;
+}
+
 /** @brief Set the size of the friend list to numfriends.
  *
  * @retval -1 if mem_vrealloc fails.
@@ -66,6 +85,7 @@ static int realloc_friendlist(Messenger *m, uint32_t num)
     if (num == 0) {
         mem_delete(m->mem, m->friendlist);
         m->friendlist = nullptr;
+        m->friends_capacity = 0;
         return 0;
     }
 
@@ -76,21 +96,204 @@ static int realloc_friendlist(Messenger *m, uint32_t num)
     }
 
     m->friendlist = newfriendlist;
+    m->friends_capacity = num;
     return 0;
 }
 
-/** @return the friend number associated to that public key.
- * @retval -1 if no such friend.
+/** @brief Make sure the friend list, the worklist of do_friends and the changed friends have room for num friends.
+ *
+ * @retval false if mem_vrealloc fails.
  */
-int32_t getfriend_id(const Messenger *m, const uint8_t *real_pk)
+non_null()
+static bool reserve_friendlist(Messenger *m, uint32_t num)
 {
-    for (uint32_t i = 0; i < m->numfriends; ++i) {
-        if (m->friendlist[i].status > 0 && pk_equal(real_pk, m->friendlist[i].real_pk)) {
-            return i;
+    if (num <= m->friends_capacity) {
+        return true;
+    }
+
+    Friend *newfriendlist = (Friend *)mem_vrealloc(m->mem, m->friendlist, num, sizeof(Friend));
+
+    if (newfriendlist == nullptr) {
+        return false;
+    }
+
+    m->friendlist = newfriendlist;
+
+    uint32_t *active_friends = (uint32_t *)mem_vrealloc(m->mem, m->active_friends, num, sizeof(uint32_t));
+
+    if (active_friends == nullptr) {
+        return false;
+    }
+
+    m->active_friends = active_friends;
+
+    uint32_t *changed_friends = (uint32_t *)mem_vrealloc(m->mem, m->changed_friends, num, sizeof(uint32_t));
+
+    if (changed_friends == nullptr) {
+        return false;
+    }
+
+    m->changed_friends = changed_friends;
+    m->friends_capacity = num;
+    return true;
+}
+
+/** @brief Whether do_friends has anything to do for this friend. */
+non_null()
+static bool friend_needs_work(const Friend *f)
+{
+    return f->status == FRIEND_ADDED || f->status == FRIEND_REQUESTED || f->status == FRIEND_ONLINE
+           || f->file_transfers != nullptr;
+}
+
+/** @brief Put the friend on the worklist of do_friends if it has work to do there. */
+non_null()
+static void friend_worklist_update(Messenger *m, int32_t friendnumber)
+{
+    Friend *const f = &m->friendlist[friendnumber];
+
+    if (f->active_index != 0 || !friend_needs_work(f)) {
+        return;
+    }
+
+    // init_new_friend made room in the worklist for every friend.
+    m->active_friends[m->num_active_friends] = friendnumber;
+    ++m->num_active_friends;
+    f->active_index = m->num_active_friends;
+}
+
+/** @brief Take the friend off the worklist of do_friends. */
+non_null()
+static void friend_worklist_remove(Messenger *m, int32_t friendnumber)
+{
+    Friend *const f = &m->friendlist[friendnumber];
+
+    if (f->active_index == 0) {
+        return;
+    }
+
+    const uint32_t last = m->active_friends[m->num_active_friends - 1];
+    m->active_friends[f->active_index - 1] = last;
+    m->friendlist[last].active_index = f->active_index;
+    f->active_index = 0;
+    --m->num_active_friends;
+}
+
+/** Number of released file transfer tables kept around for later transfers. */
+#define FILE_TABLE_POOL_SIZE 8
+
+/** @brief Get the file transfer slots of a friend, allocating them if needed.
+ *
+ * @return nullptr on allocation failure.
+ */
+non_null()
+static File_Transfer_Table *file_table_acquire(Messenger *m, int32_t friendnumber)
+{
+    Friend *const f = &m->friendlist[friendnumber];
+
+    if (f->file_transfers != nullptr) {
+        return f->file_transfers;
+    }
+
+    File_Transfer_Table *table = m->file_table_pool;
+
+    if (table != nullptr) {
+        m->file_table_pool = table->next;
+        --m->file_table_pool_size;
+        memset(table, 0, sizeof(File_Transfer_Table));
+    } else {
+        table = (File_Transfer_Table *)mem_alloc(m->mem, sizeof(File_Transfer_Table));
+
+        if (table == nullptr) {
+            return nullptr;
         }
     }
 
-    return -1;
+    f->file_transfers = table;
+    friend_worklist_update(m, friendnumber);
+    return table;
+}
+
+/** @brief Free the buffers of a receiving slot, see file_set_recv_buffer. */
+non_null()
+static void file_recv_buffer_free(const Memory *mem, Friend *f, struct File_Transfers *ft)
+{
+    if (ft->recv_buffer == nullptr) {
+        return;
+    }
+
+    mem_delete(mem, ft->recv_buffer);
+    ft->recv_buffer = nullptr;
+    ft->recv_buffer_capacity = 0;
+    ft->recv_buffer_length = 0;
+    --f->num_recv_buffers;
+}
+
+non_null()
+static void file_table_free_recv_buffers(const Memory *mem, Friend *f)
+{
+    for (uint32_t i = 0; i < MAX_CONCURRENT_FILE_PIPES && f->num_recv_buffers > 0; ++i) {
+        file_recv_buffer_free(mem, f, &f->file_transfers->receiving[i]);
+    }
+}
+
+/** @brief Give the file transfer slots of a friend back to the pool. */
+non_null()
+static void file_table_release(Messenger *m, Friend *f)
+{
+    File_Transfer_Table *const table = f->file_transfers;
+
+    if (table == nullptr) {
+        return;
+    }
+
+    file_table_free_recv_buffers(m->mem, f);
+    f->file_transfers = nullptr;
+    f->num_file_transfers = 0;
+    f->num_sending_files = 0;
+
+    if (m->file_table_pool_size < FILE_TABLE_POOL_SIZE) {
+        table->next = m->file_table_pool;
+        m->file_table_pool = table;
+        ++m->file_table_pool_size;
+    } else {
+        mem_delete(m->mem, table);
+    }
+}
+
+/** @return the file transfer slot, or nullptr if the friend has no file transfers. */
+non_null()
+static struct File_Transfers *file_transfer_slot(const Friend *f, bool inbound, uint8_t filenumber)
+{
+    if (f->file_transfers == nullptr) {
+        return nullptr;
+    }
+
+    return inbound ? &f->file_transfers->receiving[filenumber] : &f->file_transfers->sending[filenumber];
+}
+
+/** @brief Mark a file transfer slot as free.
+ *
+ * The table itself is released in do_friends, so that slot pointers held
+ * while calling into the client stay valid.
+ */
+non_null()
+static void file_transfer_end(Friend *f, struct File_Transfers *ft)
+{
+    if (ft->status == FILESTATUS_NONE) {
+        return;
+    }
+
+    ft->status = FILESTATUS_NONE;
+    --f->num_file_transfers;
+}
+
+/** @return the friend number associated to that public key.
+ * @retval -1 if no such friend.
+ */
+int32_t getfriend_id(const Messenger *m, const uint8_t *real_pk)
+{
+    return pk_index_find(m->friend_index, real_pk);
 }
 
 /** @brief Copies the public key associated to that friend id into real_pk buffer.
@@ -169,45 +372,60 @@ static int32_t init_new_friend(Messenger *m, const uint8_t *real_pk, uint8_t sta
         return FAERR_NOMEM;
     }
 
-    /* Resize the friend list if necessary. */
-    if (realloc_friendlist(m, m->numfriends + 1) != 0) {
+    /* Resize the friend list if necessary, making sure the new friend also
+     * fits on the worklist of do_friends. */
+    if (!reserve_friendlist(m, m->numfriends + 1)) {
         return FAERR_NOMEM;
     }
 
     m->friendlist[m->numfriends] = empty_friend;
 
+    // Reuse the number of a deleted friend if there is one. Every friend is in
+    // the index, so without gaps in the list the new friend goes at the end.
+    uint32_t i = m->numfriends;
+
+    if (pk_index_size(m->friend_index) < m->numfriends) {
+        for (i = 0; i < m->numfriends; ++i) {
+            if (m->friendlist[i].status == NOFRIEND) {
+                break;
+            }
+        }
+    }
+
     const int friendcon_id = new_friend_connection(m->fr_c, real_pk);
 
     if (friendcon_id == -1) {
         return FAERR_NOMEM;
     }
 
-    for (uint32_t i = 0; i <= m->numfriends; ++i) {
-        if (m->friendlist[i].status == NOFRIEND) {
-            m->friendlist[i].status = status;
-            m->friendlist[i].friendcon_id = friendcon_id;
-            m->friendlist[i].friendrequest_lastsent = 0;
-            pk_copy(m->friendlist[i].real_pk, real_pk);
-            m->friendlist[i].statusmessage_length = 0;
-            m->friendlist[i].userstatus = USERSTATUS_NONE;
-            m->friendlist[i].is_typing = false;
-            m->friendlist[i].message_id = 0;
-            friend_connection_callbacks(m->fr_c, friendcon_id, MESSENGER_CALLBACK_INDEX, &m_handle_status, &m_handle_packet,
-                                        &m_handle_lossy_packet, m, i);
-
-            if (m->numfriends == i) {
-                ++m->numfriends;
-            }
+    if (!pk_index_add(m->friend_index, real_pk, i)) {
+        kill_friend_connection(m->fr_c, friendcon_id);
+        return FAERR_NOMEM;
+    }
 
-            if (friend_con_connected(m->fr_c, friendcon_id) == FRIENDCONN_STATUS_CONNECTED) {
-                send_online_packet(m, friendcon_id);
-            }
+    m->friendlist[i].status = status;
+    m->friendlist[i].friendcon_id = friendcon_id;
+    m->friendlist[i].friendrequest_lastsent = 0;
+    pk_copy(m->friendlist[i].real_pk, real_pk);
+    m->friendlist[i].statusmessage_length = 0;
+    m->friendlist[i].userstatus = USERSTATUS_NONE;
+    m->friendlist[i].is_typing = false;
+    m->friendlist[i].message_id = 0;
+    friend_info_changed(m, i);
+    friend_connection_callbacks(m->fr_c, friendcon_id, MESSENGER_CALLBACK_INDEX, &m_handle_status, &m_handle_packet,
+                                &m_handle_lossy_packet, m, i);
 
-            return i;
-        }
+    if (m->numfriends == i) {
+        ++m->numfriends;
+    }
+
+    friend_worklist_update(m, i);
+
+    if (friend_con_connected(m->fr_c, friendcon_id) == FRIENDCONN_STATUS_CONNECTED) {
+        send_online_packet(m, friendcon_id);
     }
 
-    return FAERR_NOMEM;
+    return i;
 }
 
 non_null()
@@ -319,6 +537,17 @@ int32_t m_addfriend_norequest(Messenger *m, const uint8_t *real_pk)
     return m_add_friend_contact_norequest(m, real_pk);
 }
 
+bool m_reserve_friends(Messenger *m, uint32_t count)
+{
+    if (count > UINT32_MAX - m->numfriends) {
+        return false;
+    }
+
+    return reserve_friendlist(m, m->numfriends + count)
+           && pk_index_reserve(m->friend_index, count)
+           && friend_connections_reserve(m->fr_c, count);
+}
+
 non_null()
 static int clear_receipts(Messenger *m, int32_t friendnumber)
 {
@@ -340,7 +569,7 @@ static int clear_receipts(Messenger *m, int32_t friendnumber)
 }
 
 non_null()
-static int add_receipt(Messenger *m, int32_t friendnumber, uint32_t packet_num, uint32_t msg_id)
+static int add_receipt(const Messenger *m, int32_t friendnumber, uint32_t packet_num, uint32_t msg_id)
 {
     if (!m_friend_exists(m, friendnumber)) {
         return -1;
@@ -365,6 +594,120 @@ static int add_receipt(Messenger *m, int32_t friendnumber, uint32_t packet_num,
     new_receipts->next = nullptr;
     return 0;
 }
+
+/** Bit in the PACKET_ID_CAPABILITIES payload saying that we take PACKET_ID_COALESCED packets. */
+#define MESSENGER_CAPABILITY_COALESCED (1 << 0)
+
+/**
+ * A PACKET_ID_COALESCED packet being filled. After the packet id, each
+ * packet in it is prefixed with its length as a big endian uint16.
+ */
+struct Coalesce_Buffer {
+    uint8_t data[MAX_CRYPTO_DATA_SIZE];
+    uint16_t length;
+    uint16_t num_packets;
+
+    /* Messages in the buffer, which have consecutive message ids. Their
+     * receipts are added once the buffer is sent and has a packet number. */
+    uint32_t first_msg_id;
+    uint32_t num_msgs;
+};
+
+non_null()
+static void coalesce_buffer_free(const Memory *mem, Friend *f)
+{
+    mem_delete(mem, f->coalesce);
+    f->coalesce = nullptr;
+}
+
+/** @brief Send the packets waiting in the coalescing buffer of a friend.
+ *
+ * @retval true if the buffer is empty now.
+ */
+non_null()
+static bool coalesce_flush(const Messenger *m, int32_t friendnumber)
+{
+    Coalesce_Buffer *const buf = m->friendlist[friendnumber].coalesce;
+
+    if (buf == nullptr || buf->num_packets == 0) {
+        return true;
+    }
+
+    const int crypt_connection_id = friend_connection_crypt_connection_id(m->fr_c,
+                                    m->friendlist[friendnumber].friendcon_id);
+    int64_t packet_num;
+
+    if (buf->num_packets == 1) {
+        // A single packet goes out as it is, so it costs nothing extra.
+        const uint16_t offset = 1 + sizeof(uint16_t);
+        packet_num = write_cryptpacket(m->net_crypto, crypt_connection_id, buf->data + offset, buf->length - offset,
+                                       false);
+    } else {
+        packet_num = write_cryptpacket(m->net_crypto, crypt_connection_id, buf->data, buf->length, false);
+    }
+
+    if (packet_num == -1) {
+        return false;
+    }
+
+    if (buf->num_packets > 1) {
+        ++m->friendlist[friendnumber].coalesced_sent;
+    }
+
+    for (uint32_t i = 0; i < buf->num_msgs; ++i) {
+        add_receipt(m, friendnumber, packet_num, buf->first_msg_id + i);
+    }
+
+    buf->length = 1;
+    buf->num_packets = 0;
+    buf->num_msgs = 0;
+    return true;
+}
+
+/** @brief Add a lossless packet to the coalescing buffer of a friend.
+ *
+ * The buffer is sent first if the packet doesn't fit into it anymore.
+ *
+ * @retval 1 if the packet was added.
+ * @retval 0 if the friend doesn't take coalesced packets, so the packet has to
+ *   be sent on its own.
+ * @retval -1 if the full buffer could not be sent.
+ */
+non_null()
+static int coalesce_packet(const Messenger *m, int32_t friendnumber, const uint8_t *packet, uint16_t length)
+{
+    Coalesce_Buffer *const buf = m->friendlist[friendnumber].coalesce;
+
+    if (buf == nullptr || 1 + sizeof(uint16_t) + length > MAX_CRYPTO_DATA_SIZE) {
+        return 0;
+    }
+
+    if (buf->length + sizeof(uint16_t) + length > MAX_CRYPTO_DATA_SIZE && !coalesce_flush(m, friendnumber)) {
+        return -1;
+    }
+
+    buf->length += net_pack_u16(buf->data + buf->length, length);
+    memcpy(buf->data + buf->length, packet, length);
+    buf->length += length;
+    ++buf->num_packets;
+    return 1;
+}
+
+/** @brief Send a lossless packet to a friend after the packets waiting in its coalescing buffer.
+ *
+ * @return packet number on success, -1 on failure.
+ */
+non_null()
+static int64_t m_write_cryptpacket(const Messenger *m, int32_t friendnumber, const uint8_t *data, uint16_t length,
+                                   bool congestion_control)
+{
+    if (!coalesce_flush(m, friendnumber)) {
+        return -1;
+    }
+
+    return write_cryptpacket(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
+                             m->friendlist[friendnumber].friendcon_id), data, length, congestion_control);
+}
 /**
  * return -1 on failure.
  * return 0 if packet was received.
@@ -482,7 +825,15 @@ int m_delfriend(Messenger *m, int32_t friendnumber)
     }
 
     kill_friend_connection(m->fr_c, m->friendlist[friendnumber].friendcon_id);
+    pk_index_remove(m->friend_index, m->friendlist[friendnumber].real_pk, friendnumber);
+    file_table_release(m, &m->friendlist[friendnumber]);
+    coalesce_buffer_free(m->mem, &m->friendlist[friendnumber]);
+    friend_worklist_remove(m, friendnumber);
+
+    const bool info_changed = m->friendlist[friendnumber].info_changed;
     m->friendlist[friendnumber] = empty_friend;
+    m->friendlist[friendnumber].info_changed = info_changed;
+    friend_info_changed(m, friendnumber);
 
     uint32_t i;
 
@@ -492,6 +843,20 @@ int m_delfriend(Messenger *m, int32_t friendnumber)
         }
     }
 
+    if (i < m->numfriends) {
+        // Friends cut off the end of the list are gone, not changed.
+        uint32_t num_changed = 0;
+
+        for (uint32_t j = 0; j < m->num_changed_friends; ++j) {
+            if (m->changed_friends[j] < i) {
+                m->changed_friends[num_changed] = m->changed_friends[j];
+                ++num_changed;
+            }
+        }
+
+        m->num_changed_friends = num_changed;
+    }
+
     m->numfriends = i;
 
     if (realloc_friendlist(m, m->numfriends) != 0) {
@@ -560,6 +925,19 @@ bool m_friend_exists(const Messenger *m, int32_t friendnumber)
  */
 int m_send_message_generic(Messenger *m, int32_t friendnumber, uint8_t type, const uint8_t *message, uint32_t length,
                            uint32_t *message_id)
+{
+    const uint32_t msg_id = m_friend_exists(m, friendnumber) ? m->friendlist[friendnumber].message_id + 1 : 0;
+    const int ret = m_send_message_with_id(m, friendnumber, type, message, length, msg_id);
+
+    if (ret == 0 && message_id != nullptr) {
+        *message_id = msg_id;
+    }
+
+    return ret;
+}
+
+int m_send_message_with_id(Messenger *m, int32_t friendnumber, uint8_t type, const uint8_t *message, uint32_t length,
+                           uint32_t message_id)
 {
     if (type > MESSAGE_ACTION) {
         LOGGER_WARNING(m->log, "message type %d is invalid", type);
@@ -587,24 +965,58 @@ int m_send_message_generic(Messenger *m, int32_t friendnumber, uint8_t type, con
     assert(message != nullptr);
     memcpy(packet + 1, message, length);
 
-    const int64_t packet_num = write_cryptpacket(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
-                               m->friendlist[friendnumber].friendcon_id), packet, length + 1, false);
+    Coalesce_Buffer *const buf = m->friendlist[friendnumber].coalesce;
 
-    if (packet_num == -1) {
+    // The messages in the buffer must have consecutive ids.
+    if (buf != nullptr && buf->num_msgs != 0 && buf->first_msg_id + buf->num_msgs != message_id
+            && !coalesce_flush(m, friendnumber)) {
         return -4;
     }
 
-    const uint32_t msg_id = ++m->friendlist[friendnumber].message_id;
+    const int queued = coalesce_packet(m, friendnumber, packet, length + 1);
 
-    add_receipt(m, friendnumber, packet_num, msg_id);
+    if (queued == -1) {
+        return -4;
+    }
 
-    if (message_id != nullptr) {
-        *message_id = msg_id;
+    if (queued == 1) {
+        m->friendlist[friendnumber].message_id = message_id;
+
+        if (buf->num_msgs == 0) {
+            buf->first_msg_id = message_id;
+        }
+
+        ++buf->num_msgs;
+        return 0;
     }
 
+    const int64_t packet_num = m_write_cryptpacket(m, friendnumber, packet, length + 1, false);
+
+    if (packet_num == -1) {
+        return -4;
+    }
+
+    m->friendlist[friendnumber].message_id = message_id;
+
+    add_receipt(m, friendnumber, packet_num, message_id);
     return 0;
 }
 
+/** @brief Whether packets with this id may wait in the coalescing buffer instead of being sent right away. */
+static bool coalesced_packet_id(uint8_t packet_id)
+{
+    switch (packet_id) {
+        case PACKET_ID_NICKNAME:
+        case PACKET_ID_STATUSMESSAGE:
+        case PACKET_ID_USERSTATUS:
+        case PACKET_ID_TYPING:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
 non_null()
 static bool write_cryptpacket_id(const Messenger *m, int32_t friendnumber, uint8_t packet_id, const uint8_t *data,
                                  uint32_t length, bool congestion_control)
@@ -623,8 +1035,15 @@ static bool write_cryptpacket_id(const Messenger *m, int32_t friendnumber, uint8
     assert(data != nullptr);
     memcpy(packet + 1, data, length);
 
-    return write_cryptpacket(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
-                             m->friendlist[friendnumber].friendcon_id), packet, length + 1, congestion_control) != -1;
+    if (coalesced_packet_id(packet_id)) {
+        const int queued = coalesce_packet(m, friendnumber, packet, length + 1);
+
+        if (queued != 0) {
+            return queued == 1;
+        }
+    }
+
+    return m_write_cryptpacket(m, friendnumber, packet, length + 1, congestion_control) != -1;
 }
 
 /** @brief Send a name packet to friendnumber.
@@ -661,6 +1080,7 @@ int setfriendname(Messenger *m, int32_t friendnumber, const uint8_t *name, uint1
 
     m->friendlist[friendnumber].name_length = length;
     memcpy(m->friendlist[friendnumber].name, name, length);
+    friend_info_changed(m, friendnumber);
     return 0;
 }
 
@@ -926,6 +1346,17 @@ int m_get_istyping(const Messenger *m, int32_t friendnumber)
     return m->friendlist[friendnumber].is_typing ? 1 : 0;
 }
 
+bool m_get_coalesced_packets(const Messenger *m, int32_t friendnumber, uint32_t *sent, uint32_t *received)
+{
+    if (!m_friend_exists(m, friendnumber)) {
+        return false;
+    }
+
+    *sent = m->friendlist[friendnumber].coalesced_sent;
+    *received = m->friendlist[friendnumber].coalesced_received;
+    return true;
+}
+
 non_null()
 static bool send_statusmessage(const Messenger *m, int32_t friendnumber, const uint8_t *status, uint16_t length)
 {
@@ -946,7 +1377,7 @@ static bool send_user_istyping(const Messenger *m, int32_t friendnumber, bool is
 }
 
 non_null()
-static int set_friend_statusmessage(const Messenger *m, int32_t friendnumber, const uint8_t *status, uint16_t length)
+static int set_friend_statusmessage(Messenger *m, int32_t friendnumber, const uint8_t *status, uint16_t length)
 {
     if (!m_friend_exists(m, friendnumber)) {
         return -1;
@@ -961,19 +1392,22 @@ static int set_friend_statusmessage(const Messenger *m, int32_t friendnumber, co
     }
 
     m->friendlist[friendnumber].statusmessage_length = length;
+    friend_info_changed(m, friendnumber);
     return 0;
 }
 
 non_null()
-static void set_friend_userstatus(const Messenger *m, int32_t friendnumber, uint8_t status)
+static void set_friend_userstatus(Messenger *m, int32_t friendnumber, uint8_t status)
 {
     userstatus_from_int(status, &m->friendlist[friendnumber].userstatus);
+    friend_info_changed(m, friendnumber);
 }
 
 non_null()
-static void set_friend_typing(const Messenger *m, int32_t friendnumber, bool is_typing)
+static void set_friend_typing(Messenger *m, int32_t friendnumber, bool is_typing)
 {
     m->friendlist[friendnumber].is_typing = is_typing;
+    friend_info_changed(m, friendnumber);
 }
 
 /** Set the function that will be executed when a friend request is received. */
@@ -1018,11 +1452,46 @@ void m_callback_connectionstatus(Messenger *m, m_friend_connection_status_cb *fu
     m->friend_connectionstatuschange = function;
 }
 
+void m_callback_connection_timing(Messenger *m, m_friend_connection_timing_cb *function)
+{
+    m->friend_connection_timing = function;
+}
+
 void m_callback_core_connection(Messenger *m, m_self_connection_status_cb *function)
 {
     m->core_connection_change = function;
 }
 
+/** @brief Milliseconds from `since` to `at`, or UINT32_MAX if `at` didn't happen. */
+static uint32_t timing_offset(uint64_t since, uint64_t at)
+{
+    if (at == 0) {
+        return UINT32_MAX;
+    }
+
+    if (at < since) {
+        return 0;
+    }
+
+    return (uint32_t)min_u64(at - since, UINT32_MAX - 1);
+}
+
+non_null(1) nullable(3)
+static void report_connection_timing(Messenger *m, int32_t friendnumber, void *userdata)
+{
+    Friend_Conn_Timing timing;
+
+    if (m->friend_connection_timing == nullptr
+            || !friend_connection_timing(m->fr_c, m->friendlist[friendnumber].friendcon_id, &timing)) {
+        return;
+    }
+
+    const uint64_t since = timing.connecting_since;
+    m->friend_connection_timing(m, friendnumber, timing_offset(since, timing.dht_pk_found),
+                                timing_offset(since, timing.dht_info_found), timing_offset(since, timing.udp_found),
+                                timing_offset(since, mono_time_get_ms(m->mono_time)), userdata);
+}
+
 non_null(1) nullable(3)
 static void check_friend_tcp_udp(Messenger *m, int32_t friendnumber, void *userdata)
 {
@@ -1034,17 +1503,27 @@ static void check_friend_tcp_udp(Messenger *m, int32_t friendnumber, void *userd
         return;
     }
 
+    m->friendlist[friendnumber].last_connection_udp_tcp = (Connection_Status)ret;
+
     if (last_connection_udp_tcp != ret) {
+        // Before the callback, so that it sees the new status from any thread.
+        friend_info_changed(m, friendnumber);
+
         if (m->friend_connectionstatuschange != nullptr) {
             m->friend_connectionstatuschange(m, friendnumber, ret, userdata);
         }
     }
 
-    m->friendlist[friendnumber].last_connection_udp_tcp = (Connection_Status)ret;
+    if (ret == CONNECTION_NONE) {
+        m->friendlist[friendnumber].connection_timing_reported = false;
+    } else if (ret == CONNECTION_UDP && !m->friendlist[friendnumber].connection_timing_reported) {
+        m->friendlist[friendnumber].connection_timing_reported = true;
+        report_connection_timing(m, friendnumber, userdata);
+    }
 }
 
-non_null()
-static void break_files(const Messenger *m, int32_t friendnumber);
+non_null(1) nullable(3)
+static bool break_files(Messenger *m, int32_t friendnumber, void *userdata);
 
 non_null(1) nullable(4)
 static void check_friend_connectionstatus(Messenger *m, int32_t friendnumber, uint8_t status, void *userdata)
@@ -1058,8 +1537,12 @@ static void check_friend_connectionstatus(Messenger *m, int32_t friendnumber, ui
 
     if (is_online != was_online) {
         if (was_online) {
-            break_files(m, friendnumber);
+            if (!break_files(m, friendnumber, userdata)) {
+                return;
+            }
+
             clear_receipts(m, friendnumber);
+            coalesce_buffer_free(m->mem, &m->friendlist[friendnumber]);
         } else {
             m->friendlist[friendnumber].name_sent = false;
             m->friendlist[friendnumber].userstatus_sent = false;
@@ -1076,8 +1559,15 @@ static void check_friend_connectionstatus(Messenger *m, int32_t friendnumber, ui
 non_null(1) nullable(4)
 static void set_friend_status(Messenger *m, int32_t friendnumber, uint8_t status, void *userdata)
 {
+    const uint8_t old_status = m->friendlist[friendnumber].status;
     check_friend_connectionstatus(m, friendnumber, status, userdata);
     m->friendlist[friendnumber].status = status;
+
+    if (status != old_status) {
+        friend_info_changed(m, friendnumber);
+    }
+
+    friend_worklist_update(m, friendnumber);
 }
 
 /*** CONFERENCES */
@@ -1139,6 +1629,11 @@ void callback_file_reqchunk(Messenger *m, m_file_chunk_request_cb *function)
     m->file_reqchunk = function;
 }
 
+void callback_file_read(Messenger *m, m_file_read_cb *function)
+{
+    m->file_read = function;
+}
+
 #define MAX_FILENAME_LENGTH 255
 
 /** @brief Copy the file transfer file id to file_id
@@ -1175,11 +1670,9 @@ int file_get_id(const Messenger *m, int32_t friendnumber, uint32_t filenumber, u
 
     file_number = temp_filenum;
 
-    const struct File_Transfers *const ft = inbound
-                                                ? &m->friendlist[friendnumber].file_receiving[file_number]
-                                                : &m->friendlist[friendnumber].file_sending[file_number];
+    const struct File_Transfers *const ft = file_transfer_slot(&m->friendlist[friendnumber], inbound, file_number);
 
-    if (ft->status == FILESTATUS_NONE) {
+    if (ft == nullptr || ft->status == FILESTATUS_NONE) {
         return -2;
     }
 
@@ -1229,7 +1722,7 @@ static bool file_sendrequest(const Messenger *m, int32_t friendnumber, uint8_t f
  * @retval -3 if no more file sending slots left.
  * @retval -4 if could not send packet (friend offline).
  */
-long int new_filesender(const Messenger *m, int32_t friendnumber, uint32_t file_type, uint64_t filesize,
+long int new_filesender(Messenger *m, int32_t friendnumber, uint32_t file_type, uint64_t filesize,
                         const uint8_t *file_id, const uint8_t *filename, uint16_t filename_length)
 {
     if (!m_friend_exists(m, friendnumber)) {
@@ -1240,10 +1733,17 @@ long int new_filesender(const Messenger *m, int32_t friendnumber, uint32_t file_
         return -2;
     }
 
+    Friend *const f = &m->friendlist[friendnumber];
+    File_Transfer_Table *const table = file_table_acquire(m, friendnumber);
+
+    if (table == nullptr) {
+        return -3;
+    }
+
     uint32_t i;
 
     for (i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
-        if (m->friendlist[friendnumber].file_sending[i].status == FILESTATUS_NONE) {
+        if (table->sending[i].status == FILESTATUS_NONE) {
             break;
         }
     }
@@ -1256,9 +1756,10 @@ long int new_filesender(const Messenger *m, int32_t friendnumber, uint32_t file_
         return -4;
     }
 
-    struct File_Transfers *ft = &m->friendlist[friendnumber].file_sending[i];
+    struct File_Transfers *ft = &table->sending[i];
 
     ft->status = FILESTATUS_NOT_ACCEPTED;
+    ++f->num_file_transfers;
 
     ft->size = filesize;
 
@@ -1268,6 +1769,8 @@ long int new_filesender(const Messenger *m, int32_t friendnumber, uint32_t file_
 
     ft->paused = FILE_PAUSE_NOT;
 
+    ft->pull = false;
+
     memcpy(ft->id, file_id, FILE_ID_LENGTH);
 
     return i;
@@ -1337,15 +1840,9 @@ int file_control(const Messenger *m, int32_t friendnumber, uint32_t filenumber,
 
     file_number = temp_filenum;
 
-    struct File_Transfers *ft;
+    struct File_Transfers *ft = file_transfer_slot(&m->friendlist[friendnumber], inbound, file_number);
 
-    if (inbound) {
-        ft = &m->friendlist[friendnumber].file_receiving[file_number];
-    } else {
-        ft = &m->friendlist[friendnumber].file_sending[file_number];
-    }
-
-    if (ft->status == FILESTATUS_NONE) {
+    if (ft == nullptr || ft->status == FILESTATUS_NONE) {
         return -3;
     }
 
@@ -1385,7 +1882,7 @@ int file_control(const Messenger *m, int32_t friendnumber, uint32_t filenumber,
                     --m->friendlist[friendnumber].num_sending_files;
                 }
 
-                ft->status = FILESTATUS_NONE;
+                file_transfer_end(&m->friendlist[friendnumber], ft);
                 break;
             }
             case FILECONTROL_PAUSE: {
@@ -1444,9 +1941,9 @@ int file_seek(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uin
     const uint8_t file_number = temp_filenum;
 
     // We're always receiving at this point.
-    struct File_Transfers *ft = &m->friendlist[friendnumber].file_receiving[file_number];
+    struct File_Transfers *ft = file_transfer_slot(&m->friendlist[friendnumber], true, file_number);
 
-    if (ft->status == FILESTATUS_NONE) {
+    if (ft == nullptr || ft->status == FILESTATUS_NONE) {
         return -3;
     }
 
@@ -1493,8 +1990,7 @@ static int64_t send_file_data_packet(const Messenger *m, int32_t friendnumber, u
         memcpy(packet + 2, data, length);
     }
 
-    return write_cryptpacket(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
-                             m->friendlist[friendnumber].friendcon_id), packet, packet_size, true);
+    return m_write_cryptpacket(m, friendnumber, packet, packet_size, true);
 }
 
 #define MAX_FILE_DATA_SIZE (MAX_CRYPTO_DATA_SIZE - 2)
@@ -1527,9 +2023,9 @@ int send_file_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber
         return -3;
     }
 
-    struct File_Transfers *ft = &m->friendlist[friendnumber].file_sending[filenumber];
+    struct File_Transfers *ft = file_transfer_slot(&m->friendlist[friendnumber], false, filenumber);
 
-    if (ft->status != FILESTATUS_TRANSFERRING) {
+    if (ft == nullptr || ft->status != FILESTATUS_TRANSFERRING) {
         return -4;
     }
 
@@ -1573,6 +2069,180 @@ int send_file_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber
     return -6;
 }
 
+int file_set_pull(const Messenger *m, int32_t friendnumber, uint32_t filenumber, bool pull)
+{
+    if (!m_friend_exists(m, friendnumber)) {
+        return -1;
+    }
+
+    if (filenumber >= MAX_CONCURRENT_FILE_PIPES) {
+        return -2;
+    }
+
+    struct File_Transfers *ft = file_transfer_slot(&m->friendlist[friendnumber], false, filenumber);
+
+    if (ft == nullptr || ft->status == FILESTATUS_NONE) {
+        return -2;
+    }
+
+    ft->pull = pull;
+    ft->requested = ft->transferred;
+    return 0;
+}
+
+int file_set_recv_buffer(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uint32_t size)
+{
+    if (!m_friend_exists(m, friendnumber)) {
+        return -1;
+    }
+
+    if (filenumber < (1 << 16)) {
+        // Not receiving.
+        return -2;
+    }
+
+    const uint32_t temp_filenum = (filenumber >> 16) - 1;
+
+    if (temp_filenum >= MAX_CONCURRENT_FILE_PIPES) {
+        return -2;
+    }
+
+    struct File_Transfers *ft = file_transfer_slot(&m->friendlist[friendnumber], true, temp_filenum);
+
+    if (ft == nullptr || ft->status == FILESTATUS_NONE) {
+        return -2;
+    }
+
+    if (size > MAX_FILE_RECV_BUFFER_SIZE) {
+        return -3;
+    }
+
+    ft->recv_buffer_size = size;
+    return 0;
+}
+
+typedef struct File_Data_Pull {
+    Messenger *m;
+    uint32_t friendnumber;
+    uint8_t filenumber;
+    struct File_Transfers *ft; // nullptr if the transfer ended while the file was read.
+    void *userdata;
+
+    uint16_t length; // bytes of file data read.
+    bool failed;
+} File_Data_Pull;
+
+/** @return the slot of a sending transfer in pull mode, or nullptr if it isn't transferring anymore. */
+non_null()
+static struct File_Transfers *pulled_file_transfer(const Messenger *m, uint32_t friendnumber, uint8_t filenumber)
+{
+    if (!m_friend_exists(m, friendnumber)) {
+        return nullptr;
+    }
+
+    struct File_Transfers *const ft = file_transfer_slot(&m->friendlist[friendnumber], false, filenumber);
+
+    if (ft == nullptr || ft->status != FILESTATUS_TRANSFERRING || !ft->pull) {
+        return nullptr;
+    }
+
+    return ft;
+}
+
+non_null()
+static int32_t fill_file_data_packet(void *object, uint8_t *data, uint16_t max_length)
+{
+    File_Data_Pull *pull = (File_Data_Pull *)object;
+    const uint64_t size = pull->ft->size;
+    const uint64_t position = pull->ft->transferred;
+    const uint16_t length = min_u64(size - position, min_u16(max_length - 2, MAX_FILE_DATA_SIZE));
+
+    data[0] = PACKET_ID_FILE_DATA;
+    data[1] = pull->filenumber;
+
+    const int64_t read = pull->m->file_read(pull->m, pull->friendnumber, pull->filenumber, position, data + 2, length,
+                                            pull->userdata);
+
+    // The read callback runs without the Tox lock, so the client may have
+    // cancelled the transfer or deleted the friend in the meantime, which can
+    // also free the slot. Nothing is sent then.
+    pull->ft = pulled_file_transfer(pull->m, pull->friendnumber, pull->filenumber);
+
+    if (pull->ft == nullptr) {
+        return -1;
+    }
+
+    // Only files of unknown size may end early.
+    if (read < 0 || read > length || (read < length && size != UINT64_MAX)) {
+        pull->failed = true;
+        return -1;
+    }
+
+    pull->length = read;
+    return 2 + read;
+}
+
+/** @brief Send the next chunk of a transfer in pull mode, reading it with the file read callback.
+ *
+ * If the callback fails, the transfer is cancelled and the client is told so
+ * through the file control callback.
+ *
+ * @retval 1 if a chunk was sent.
+ * @retval 0 if the send queue is full.
+ * @retval -1 if the transfer ended, because the read failed or because the
+ *   client ended it during the read. The slot may have been freed then.
+ */
+non_null(1) nullable(4)
+static int send_pulled_file_data(Messenger *m, int32_t friendnumber, uint8_t filenumber, void *userdata)
+{
+    struct File_Transfers *ft = file_transfer_slot(&m->friendlist[friendnumber], false, filenumber);
+
+    if (ft == nullptr) {
+        return -1;
+    }
+
+    if (!coalesce_flush(m, friendnumber)) {
+        return 0;
+    }
+
+    File_Data_Pull pull = {m, (uint32_t)friendnumber, filenumber, ft, userdata};
+    const int64_t ret = write_cryptpacket_fill(m->net_crypto, friend_connection_crypt_connection_id(
+                            m->fr_c, m->friendlist[friendnumber].friendcon_id), fill_file_data_packet, &pull, true);
+
+    if (pull.ft == nullptr) {
+        return -1;
+    }
+
+    ft = pull.ft;
+
+    if (pull.failed) {
+        LOGGER_DEBUG(m->log, "file read (friend %d, file %d) failed; cancelling the transfer", friendnumber, filenumber);
+        send_file_control_packet(m, friendnumber, false, filenumber, FILECONTROL_KILL, nullptr, 0);
+        file_transfer_end(&m->friendlist[friendnumber], ft);
+        --m->friendlist[friendnumber].num_sending_files;
+
+        if (m->file_filecontrol != nullptr) {
+            m->file_filecontrol(m, friendnumber, filenumber, FILECONTROL_KILL, userdata);
+        }
+
+        return -1;
+    }
+
+    if (ret == -1) {
+        return 0;
+    }
+
+    ft->transferred += pull.length;
+    ft->requested = ft->transferred;
+
+    if (pull.length != MAX_FILE_DATA_SIZE || ft->size == ft->transferred) {
+        ft->status = FILESTATUS_FINISHED;
+        ft->last_packet_number = ret;
+    }
+
+    return 1;
+}
+
 /**
  * Iterate over all file transfers and request chunks (from the client) for each
  * of them.
@@ -1604,7 +2274,11 @@ static bool do_all_filetransfers(Messenger *m, int32_t friendnumber, void *userd
             return false;
         }
 
-        struct File_Transfers *const ft = &friendcon->file_sending[i];
+        struct File_Transfers *const ft = file_transfer_slot(friendcon, false, i);
+
+        if (ft == nullptr) {
+            return false;
+        }
 
         if (ft->status == FILESTATUS_NONE || ft->status == FILESTATUS_NOT_ACCEPTED) {
             // Filetransfers not actively sending, nothing to do
@@ -1625,7 +2299,7 @@ static bool do_all_filetransfers(Messenger *m, int32_t friendnumber, void *userd
             }
 
             // Now it's inactive, we're no longer sending this.
-            ft->status = FILESTATUS_NONE;
+            file_transfer_end(friendcon, ft);
             --friendcon->num_sending_files;
         } else if (ft->status == FILESTATUS_TRANSFERRING && ft->paused == FILE_PAUSE_NOT) {
             if (ft->size == 0) {
@@ -1634,6 +2308,24 @@ static bool do_all_filetransfers(Messenger *m, int32_t friendnumber, void *userd
                 continue;
             }
 
+            if (ft->pull && m->file_read != nullptr) {
+                const int sent = send_pulled_file_data(m, friendnumber, i, userdata);
+
+                if (sent == -1) {
+                    // The transfer ended, and the friend and its file table
+                    // may be gone with it. Start over on the next call.
+                    return false;
+                }
+
+                if (sent == 0) {
+                    // send queue full
+                    return false;
+                }
+
+                --*free_slots;
+                continue;
+            }
+
             if (ft->size == ft->requested) {
                 // This file transfer is done.
                 continue;
@@ -1694,41 +2386,166 @@ static void do_reqchunk_filecb(Messenger *m, int32_t friendnumber, void *userdat
             break;
         }
     }
-}
+}
+
+non_null()
+static struct File_Transfers *get_file_transfer(bool outbound, uint8_t filenumber,
+        uint32_t *real_filenumber, Friend *sender)
+{
+    if (outbound) {
+        *real_filenumber = filenumber;
+    } else {
+        *real_filenumber = (filenumber + 1) << 16;
+    }
+
+    struct File_Transfers *ft = file_transfer_slot(sender, !outbound, filenumber);
+
+    if (ft == nullptr || ft->status == FILESTATUS_NONE) {
+        return nullptr;
+    }
+
+    return ft;
+}
+
+/** @brief Pass the data collected in the buffer of an incoming transfer on to the client. */
+non_null(1, 4) nullable(5)
+static void file_recv_buffer_flush(Messenger *m, int32_t friendnumber, uint8_t filenumber, struct File_Transfers *ft,
+                                   void *userdata)
+{
+    const uint32_t length = ft->recv_buffer_length;
+
+    if (length == 0) {
+        return;
+    }
+
+    ft->recv_buffer_length = 0;
+
+    if (m->file_filedata != nullptr) {
+        const uint32_t real_filenumber = (filenumber + 1) << 16;
+        m->file_filedata(m, friendnumber, real_filenumber, ft->transferred - length, ft->recv_buffer, length, userdata);
+    }
+}
+
+/** @brief Run this when the friend disconnects.
+ * Kill all current file transfers, after passing on the data collected for the incoming ones.
+ *
+ * @retval false if the client deleted the friend from the file data callback.
+ */
+non_null(1) nullable(3)
+static bool break_files(Messenger *m, int32_t friendnumber, void *userdata)
+{
+    if (m->friendlist[friendnumber].file_transfers == nullptr) {
+        return true;
+    }
+
+    for (uint32_t i = 0; i < MAX_CONCURRENT_FILE_PIPES && m->friendlist[friendnumber].num_recv_buffers > 0; ++i) {
+        struct File_Transfers *const ft = &m->friendlist[friendnumber].file_transfers->receiving[i];
+
+        if (ft->status == FILESTATUS_TRANSFERRING) {
+            file_recv_buffer_flush(m, friendnumber, i, ft, userdata);
+
+            // The client may have deleted the friend.
+            if (!m_friend_exists(m, friendnumber)) {
+                return false;
+            }
+
+            if (m->friendlist[friendnumber].file_transfers == nullptr) {
+                return true;
+            }
+        }
+    }
 
-/** @brief Run this when the friend disconnects.
- * Kill all current file transfers.
- */
-static void break_files(const Messenger *m, int32_t friendnumber)
-{
     Friend *const f = &m->friendlist[friendnumber];
 
     // TODO(irungentoo): Inform the client which file transfers get killed with a callback?
     for (uint32_t i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
-        f->file_sending[i].status = FILESTATUS_NONE;
-        f->file_receiving[i].status = FILESTATUS_NONE;
+        f->file_transfers->sending[i].status = FILESTATUS_NONE;
+        f->file_transfers->receiving[i].status = FILESTATUS_NONE;
     }
+
+    f->num_file_transfers = 0;
+    f->num_sending_files = 0;
+    return true;
 }
 
-non_null()
-static struct File_Transfers *get_file_transfer(bool outbound, uint8_t filenumber,
-        uint32_t *real_filenumber, Friend *sender)
+/** @brief Collect received file data in the buffer of the transfer.
+ *
+ * Data collected before is passed on first if the new data doesn't fit, or if
+ * the new data is empty because the transfer ends.
+ *
+ * @retval true if the data was collected.
+ * @retval false if the data must be passed on right away.
+ */
+non_null(1, 4) nullable(5, 7)
+static bool file_recv_buffer_add(Messenger *m, int32_t friendnumber, uint8_t filenumber, struct File_Transfers *ft,
+                                 const uint8_t *data, uint16_t length, void *userdata)
 {
-    struct File_Transfers *ft;
+    if (length == 0 || length > ft->recv_buffer_capacity - ft->recv_buffer_length) {
+        file_recv_buffer_flush(m, friendnumber, filenumber, ft, userdata);
+    }
 
-    if (outbound) {
-        *real_filenumber = filenumber;
-        ft = &sender->file_sending[filenumber];
-    } else {
-        *real_filenumber = (filenumber + 1) << 16;
-        ft = &sender->file_receiving[filenumber];
+    if (length == 0) {
+        return false;
     }
 
-    if (ft->status == FILESTATUS_NONE) {
-        return nullptr;
+    Friend *const f = &m->friendlist[friendnumber];
+
+    if (ft->recv_buffer_length == 0 && ft->recv_buffer_capacity != ft->recv_buffer_size) {
+        file_recv_buffer_free(m->mem, f, ft);
+
+        if (ft->recv_buffer_size != 0) {
+            ft->recv_buffer = (uint8_t *)mem_balloc(m->mem, ft->recv_buffer_size);
+
+            if (ft->recv_buffer == nullptr) {
+                LOGGER_WARNING(m->log, "could not allocate file receive buffer of size %u", ft->recv_buffer_size);
+                ft->recv_buffer_size = 0;
+                return false;
+            }
+
+            ft->recv_buffer_capacity = ft->recv_buffer_size;
+            ++f->num_recv_buffers;
+        }
     }
 
-    return ft;
+    if (length > ft->recv_buffer_capacity - ft->recv_buffer_length) {
+        return false;
+    }
+
+    memcpy(ft->recv_buffer + ft->recv_buffer_length, data, length);
+    ft->recv_buffer_length += length;
+    return true;
+}
+
+/** @brief Pass on the data collected for all incoming transfers, and free unused buffers. */
+non_null(1) nullable(3)
+static void do_file_recv_buffers(Messenger *m, int32_t friendnumber, void *userdata)
+{
+    for (uint32_t i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
+        Friend *const f = &m->friendlist[friendnumber];
+
+        if (f->num_recv_buffers == 0) {
+            return;
+        }
+
+        struct File_Transfers *const ft = &f->file_transfers->receiving[i];
+
+        if (ft->recv_buffer == nullptr) {
+            continue;
+        }
+
+        if (ft->status == FILESTATUS_TRANSFERRING) {
+            file_recv_buffer_flush(m, friendnumber, i, ft, userdata);
+
+            // The client may have deleted the friend.
+            if (!m_friend_exists(m, friendnumber) || m->friendlist[friendnumber].file_transfers == nullptr) {
+                return;
+            }
+        }
+
+        if (ft->status != FILESTATUS_TRANSFERRING || ft->recv_buffer_size == 0) {
+            file_recv_buffer_free(m->mem, &m->friendlist[friendnumber], ft);
+        }
+    }
 }
 
 /** @retval -1 on failure
@@ -1787,6 +2604,11 @@ static int handle_filecontrol(Messenger *m, int32_t friendnumber, bool outbound,
         }
 
         case FILECONTROL_KILL: {
+            if (!outbound) {
+                // Pass on what was received before the transfer ends.
+                file_recv_buffer_flush(m, friendnumber, filenumber, ft, userdata);
+            }
+
             if (m->file_filecontrol != nullptr) {
                 m->file_filecontrol(m, friendnumber, real_filenumber, control_type, userdata);
             }
@@ -1795,7 +2617,7 @@ static int handle_filecontrol(Messenger *m, int32_t friendnumber, bool outbound,
                 --m->friendlist[friendnumber].num_sending_files;
             }
 
-            ft->status = FILESTATUS_NONE;
+            file_transfer_end(&m->friendlist[friendnumber], ft);
 
             return 0;
         }
@@ -1934,8 +2756,7 @@ int send_custom_lossless_packet(const Messenger *m, int32_t friendnumber, const
         return -4;
     }
 
-    if (write_cryptpacket(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
-                          m->friendlist[friendnumber].friendcon_id), data, length, true) == -1) {
+    if (m_write_cryptpacket(m, friendnumber, data, length, true) == -1) {
         return -5;
     }
 
@@ -2001,6 +2822,85 @@ static int m_handle_packet_offline(Messenger *m, const int friendcon_id, const u
     return 0;
 }
 
+/** @brief Tell a friend that just came online which protocol extensions we support. */
+non_null()
+static bool send_capabilities(const Messenger *m, int32_t friendnumber)
+{
+    if (!m->options.coalesce_messages_enabled) {
+        // Nothing to announce, so old clients never see this packet.
+        return true;
+    }
+
+    uint8_t data[sizeof(uint32_t)];
+    net_pack_u32(data, MESSENGER_CAPABILITY_COALESCED);
+    return write_cryptpacket_id(m, friendnumber, PACKET_ID_CAPABILITIES, data, sizeof(data), false);
+}
+
+non_null(1, 3) nullable(5)
+static int m_handle_packet_capabilities(Messenger *m, const int friendcon_id, const uint8_t *data, const uint16_t data_length, void *userdata)
+{
+    // Later versions may append more bytes.
+    if (data_length < sizeof(uint32_t)) {
+        return 0;
+    }
+
+    uint32_t capabilities;
+    net_unpack_u32(data, &capabilities);
+
+    Friend *const f = &m->friendlist[friendcon_id];
+    const bool coalesce = m->options.coalesce_messages_enabled && (capabilities & MESSENGER_CAPABILITY_COALESCED) != 0;
+
+    if (coalesce && f->coalesce == nullptr) {
+        Coalesce_Buffer *const buf = (Coalesce_Buffer *)mem_alloc(m->mem, sizeof(Coalesce_Buffer));
+
+        if (buf == nullptr) {
+            // Packets keep going out on their own.
+            return -1;
+        }
+
+        buf->data[0] = PACKET_ID_COALESCED;
+        buf->length = 1;
+        f->coalesce = buf;
+    } else if (!coalesce && f->coalesce != nullptr) {
+        coalesce_flush(m, friendcon_id);
+        coalesce_buffer_free(m->mem, f);
+    }
+
+    return 0;
+}
+
+non_null(1, 3) nullable(5)
+static int m_handle_packet_coalesced(Messenger *m, const int friendcon_id, const uint8_t *data, const uint16_t data_length, void *userdata)
+{
+    ++m->friendlist[friendcon_id].coalesced_received;
+
+    uint16_t pos = 0;
+
+    while (pos < data_length) {
+        if (pos + sizeof(uint16_t) > data_length) {
+            return -1;
+        }
+
+        uint16_t length;
+        pos += net_unpack_u16(data + pos, &length);
+
+        if (length == 0 || length > data_length - pos || data[pos] == PACKET_ID_COALESCED) {
+            return -1;
+        }
+
+        m_handle_packet(m, friendcon_id, data + pos, length, userdata);
+        pos += length;
+
+        // A callback may have deleted the friend, along with the connection
+        // this packet came in on.
+        if (!m_friend_exists(m, friendcon_id) || m->friendlist[friendcon_id].status != FRIEND_ONLINE) {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
 non_null(1, 3) nullable(5)
 static int m_handle_packet_nickname(Messenger *m, const int friendcon_id, const uint8_t *data, const uint16_t data_length, void *userdata)
 {
@@ -2020,6 +2920,7 @@ static int m_handle_packet_nickname(Messenger *m, const int friendcon_id, const
 
     memcpy(m->friendlist[friendcon_id].name, data_terminated, data_length);
     m->friendlist[friendcon_id].name_length = data_length;
+    friend_info_changed(m, friendcon_id);
 
     return 0;
 }
@@ -2151,16 +3052,26 @@ static int m_handle_packet_file_sendrequest(Messenger *m, const int friendcon_id
     file_type = net_ntohl(file_type);
 
     net_unpack_u64(data + 1 + sizeof(uint32_t), &filesize);
-    struct File_Transfers *ft = &m->friendlist[friendcon_id].file_receiving[filenumber];
+    Friend *const f = &m->friendlist[friendcon_id];
+    File_Transfer_Table *const table = file_table_acquire(m, friendcon_id);
+
+    if (table == nullptr) {
+        return 0;
+    }
+
+    struct File_Transfers *ft = &table->receiving[filenumber];
 
     if (ft->status != FILESTATUS_NONE) {
         return 0;
     }
 
     ft->status = FILESTATUS_NOT_ACCEPTED;
+    ++f->num_file_transfers;
     ft->size = filesize;
     ft->transferred = 0;
     ft->paused = FILE_PAUSE_NOT;
+    file_recv_buffer_free(m->mem, f, ft);
+    ft->recv_buffer_size = 0;
     memcpy(ft->id, data + 1 + sizeof(uint32_t) + sizeof(uint64_t), FILE_ID_LENGTH);
 
     VLA(uint8_t, filename_terminated, filename_length + 1);
@@ -2233,9 +3144,9 @@ static int m_handle_packet_file_data(Messenger *m, const int friendcon_id, const
 
 #endif /* UINT8_MAX >= MAX_CONCURRENT_FILE_PIPES */
 
-    struct File_Transfers *ft = &m->friendlist[friendcon_id].file_receiving[filenumber];
+    struct File_Transfers *ft = file_transfer_slot(&m->friendlist[friendcon_id], true, filenumber);
 
-    if (ft->status != FILESTATUS_TRANSFERRING) {
+    if (ft == nullptr || ft->status != FILESTATUS_TRANSFERRING) {
         return 0;
     }
 
@@ -2257,13 +3168,16 @@ static int m_handle_packet_file_data(Messenger *m, const int friendcon_id, const
         file_data_length = ft->size - ft->transferred;
     }
 
-    if (m->file_filedata != nullptr) {
+    if (!file_recv_buffer_add(m, friendcon_id, filenumber, ft, file_data, file_data_length, userdata)
+            && m->file_filedata != nullptr) {
         m->file_filedata(m, friendcon_id, real_filenumber, position, file_data, file_data_length, userdata);
     }
 
     ft->transferred += file_data_length;
 
     if (file_data_length > 0 && (ft->transferred >= ft->size || file_data_length != MAX_FILE_DATA_SIZE)) {
+        file_recv_buffer_flush(m, friendcon_id, filenumber, ft, userdata);
+
         file_data_length = 0;
         file_data = nullptr;
         position = ft->transferred;
@@ -2276,7 +3190,7 @@ static int m_handle_packet_file_data(Messenger *m, const int friendcon_id, const
 
     /* Data is zero, filetransfer is over. */
     if (file_data_length == 0) {
-        ft->status = FILESTATUS_NONE;
+        file_transfer_end(&m->friendlist[friendcon_id], ft);
     }
 
     return 0;
@@ -2325,6 +3239,7 @@ static int m_handle_packet(void *object, int friendcon_id, const uint8_t *data,
         if (packet_id == PACKET_ID_ONLINE && length == 1) {
             set_friend_status(m, friendcon_id, FRIEND_ONLINE, userdata);
             send_online_packet(m, m->friendlist[friendcon_id].friendcon_id);
+            send_capabilities(m, friendcon_id);
         } else {
             return -1;
         }
@@ -2334,6 +3249,10 @@ static int m_handle_packet(void *object, int friendcon_id, const uint8_t *data,
         // TODO(Green-Sky): now all return 0 on error AND success, make errors errors?
         case PACKET_ID_OFFLINE:
             return m_handle_packet_offline(m, friendcon_id, payload, payload_length, userdata);
+        case PACKET_ID_CAPABILITIES:
+            return m_handle_packet_capabilities(m, friendcon_id, payload, payload_length, userdata);
+        case PACKET_ID_COALESCED:
+            return m_handle_packet_coalesced(m, friendcon_id, payload, payload_length, userdata);
         case PACKET_ID_NICKNAME:
             return m_handle_packet_nickname(m, friendcon_id, payload, payload_length, userdata);
         case PACKET_ID_STATUSMESSAGE:
@@ -2363,62 +3282,97 @@ static int m_handle_packet(void *object, int friendcon_id, const uint8_t *data,
     return handle_custom_lossless_packet(object, friendcon_id, data, length, userdata);
 }
 
-non_null(1) nullable(2)
-static void do_friends(Messenger *m, void *userdata)
+non_null(1) nullable(4)
+static void do_friend(Messenger *m, uint32_t i, uint64_t temp_time, void *userdata)
 {
-    const uint64_t temp_time = mono_time_get(m->mono_time);
+    if (m->friendlist[i].status == FRIEND_ADDED) {
+        const int fr = send_friend_request_packet(m->fr_c, m->friendlist[i].friendcon_id, m->friendlist[i].friendrequest_nospam,
+                       m->friendlist[i].info,
+                       m->friendlist[i].info_size);
 
-    for (uint32_t i = 0; i < m->numfriends; ++i) {
-        if (m->friendlist[i].status == FRIEND_ADDED) {
-            const int fr = send_friend_request_packet(m->fr_c, m->friendlist[i].friendcon_id, m->friendlist[i].friendrequest_nospam,
-                           m->friendlist[i].info,
-                           m->friendlist[i].info_size);
-
-            if (fr >= 0) {
-                set_friend_status(m, i, FRIEND_REQUESTED, userdata);
-                m->friendlist[i].friendrequest_lastsent = temp_time;
-            }
+        if (fr >= 0) {
+            set_friend_status(m, i, FRIEND_REQUESTED, userdata);
+            m->friendlist[i].friendrequest_lastsent = temp_time;
         }
+    }
 
-        if (m->friendlist[i].status == FRIEND_REQUESTED) {
-            /* If we didn't connect to friend after successfully sending him a friend
-             * request the request is deemed unsuccessful so we set the status back to
-             * FRIEND_ADDED and try again.
-             */
-            check_friend_request_timed_out(m, i, temp_time, userdata);
-        }
+    if (m->friendlist[i].status == FRIEND_REQUESTED) {
+        /* If we didn't connect to friend after successfully sending him a friend
+         * request the request is deemed unsuccessful so we set the status back to
+         * FRIEND_ADDED and try again.
+         */
+        check_friend_request_timed_out(m, i, temp_time, userdata);
+    }
 
-        if (m->friendlist[i].status == FRIEND_ONLINE) { /* friend is online. */
-            if (!m->friendlist[i].name_sent) {
-                if (m_sendname(m, i, m->name, m->name_length)) {
-                    m->friendlist[i].name_sent = true;
-                }
+    if (m->friendlist[i].status == FRIEND_ONLINE) { /* friend is online. */
+        if (!m->friendlist[i].name_sent) {
+            if (m_sendname(m, i, m->name, m->name_length)) {
+                m->friendlist[i].name_sent = true;
             }
+        }
 
-            if (!m->friendlist[i].statusmessage_sent) {
-                if (send_statusmessage(m, i, m->statusmessage, m->statusmessage_length)) {
-                    m->friendlist[i].statusmessage_sent = true;
-                }
+        if (!m->friendlist[i].statusmessage_sent) {
+            if (send_statusmessage(m, i, m->statusmessage, m->statusmessage_length)) {
+                m->friendlist[i].statusmessage_sent = true;
             }
+        }
 
-            if (!m->friendlist[i].userstatus_sent) {
-                if (send_userstatus(m, i, m->userstatus)) {
-                    m->friendlist[i].userstatus_sent = true;
-                }
+        if (!m->friendlist[i].userstatus_sent) {
+            if (send_userstatus(m, i, m->userstatus)) {
+                m->friendlist[i].userstatus_sent = true;
             }
+        }
 
-            if (!m->friendlist[i].user_istyping_sent) {
-                if (send_user_istyping(m, i, m->friendlist[i].user_istyping)) {
-                    m->friendlist[i].user_istyping_sent = true;
-                }
+        if (!m->friendlist[i].user_istyping_sent) {
+            if (send_user_istyping(m, i, m->friendlist[i].user_istyping)) {
+                m->friendlist[i].user_istyping_sent = true;
             }
+        }
+
+        // Whatever was coalesced since the last iteration goes out now. If the
+        // send queue is full, it stays in the buffer until the next one.
+        coalesce_flush(m, i);
+
+        check_friend_tcp_udp(m, i, userdata);
+        do_receipts(m, i, userdata);
+        do_reqchunk_filecb(m, i, userdata);
+
+        m->friendlist[i].last_seen_time = (uint64_t) time(nullptr);
+    }
 
-            check_friend_tcp_udp(m, i, userdata);
-            do_receipts(m, i, userdata);
-            do_reqchunk_filecb(m, i, userdata);
+    if (m->friendlist[i].num_recv_buffers > 0) {
+        do_file_recv_buffers(m, i, userdata);
+    }
+
+    if (m->friendlist[i].file_transfers != nullptr && m->friendlist[i].num_file_transfers == 0) {
+        file_table_release(m, &m->friendlist[i]);
+    }
+}
+
+non_null(1) nullable(2)
+static void do_friends(Messenger *m, void *userdata)
+{
+    const uint64_t temp_time = mono_time_get(m->mono_time);
+
+    // Only friends with something to do are on the worklist. A friend leaves
+    // it here once it is idle, and joins it again when its status changes or
+    // a file transfer starts.
+    uint32_t i = 0;
+
+    while (i < m->num_active_friends) {
+        const uint32_t friendnumber = m->active_friends[i];
+
+        do_friend(m, friendnumber, temp_time, userdata);
 
-            m->friendlist[i].last_seen_time = (uint64_t) time(nullptr);
+        // Callbacks may have deleted friends and reordered the worklist. In
+        // that case a friend may be skipped until the next iteration.
+        if (i < m->num_active_friends && m->active_friends[i] == friendnumber
+                && !friend_needs_work(&m->friendlist[friendnumber])) {
+            friend_worklist_remove(m, friendnumber);
+            continue;
         }
+
+        ++i;
     }
 }
 
@@ -3045,6 +3999,9 @@ static State_Load_Status friends_list_load(Messenger *m, const uint8_t *data, ui
     const uint32_t num = length / l_friend_size;
     const uint8_t *cur_data = data;
 
+    // Failing only means the friend list grows as friends are added.
+    m_reserve_friends(m, num);
+
     for (uint32_t i = 0; i < num; ++i) {
         struct Saved_Friend temp = { 0 };
         const uint8_t *next_data = friend_load(&temp, cur_data);
@@ -3354,6 +4311,200 @@ static State_Load_Status load_path_nodes(Messenger *m, const uint8_t *data, uint
     return STATE_LOAD_STATUS_CONTINUE;
 }
 
+// warm start state plugin
+//
+// Path nodes with their health, followed by friends whose DHT instance we were
+// talking to, so that a restarted instance can build onion paths and reach
+// friends that are still online without searching for them first. Layout:
+//
+//   [uint8_t number of path nodes]
+//   per path node: [uint32_t successes][uint32_t failures][uint32_t rtt][packed node]
+//   [uint32_t number of friends]
+//   per friend: [real public key][packed node of the friend's DHT key and IP/port]
+#define WARM_START_NODE_STATS_SIZE (3 * sizeof(uint32_t))
+
+non_null()
+static uint32_t warm_start_size(const Messenger *m)
+{
+    const uint32_t node_size = packed_node_size(net_family_ipv6());
+
+    return sizeof(uint8_t) + MAX_PATH_NODES * (WARM_START_NODE_STATS_SIZE + node_size)
+           + sizeof(uint32_t) + m->numfriends * (CRYPTO_PUBLIC_KEY_SIZE + node_size);
+}
+
+/** @brief Put the DHT key and IP/port of the friend's DHT instance in node.
+ *
+ * @retval false if either is unknown.
+ */
+non_null()
+static bool warm_start_friend_node(const Messenger *m, int32_t friendnumber, Node_format *node)
+{
+    if (m->friendlist[friendnumber].status != FRIEND_ONLINE && m->friendlist[friendnumber].status != FRIEND_CONFIRMED) {
+        return false;
+    }
+
+    const int friendcon_id = m->friendlist[friendnumber].friendcon_id;
+    const Friend_Conn *friend_con = get_conn(m->fr_c, friendcon_id);
+
+    if (friend_con == nullptr) {
+        return false;
+    }
+
+    const uint8_t zero_pk[CRYPTO_PUBLIC_KEY_SIZE] = {0};
+
+    if (get_friendcon_public_keys(nullptr, node->public_key, m->fr_c, friendcon_id) == -1
+            || pk_equal(node->public_key, zero_pk)) {
+        return false;
+    }
+
+    node->ip_port = *friend_conn_get_dht_ip_port(friend_con);
+    return net_family_is_ipv4(node->ip_port.ip.family) || net_family_is_ipv6(node->ip_port.ip.family);
+}
+
+non_null()
+static uint8_t *save_warm_start(const Messenger *m, uint8_t *data)
+{
+    const uint16_t node_size = packed_node_size(net_family_ipv6());
+    uint8_t *const section = state_write_section_header(data, STATE_COOKIE_TYPE, 0, STATE_TYPE_WARM_START);
+    uint32_t len = sizeof(uint8_t);
+    uint8_t num_nodes = 0;
+
+    for (uint16_t i = 0; i < onion_get_path_node_count(m->onion_c); ++i) {
+        Node_format node;
+        Onion_Path_Node_Stats stats;
+
+        if (!onion_get_path_node_stats(m->onion_c, i, &node, &stats)) {
+            continue;
+        }
+
+        const int l = pack_nodes(m->log, section + len + WARM_START_NODE_STATS_SIZE, node_size, &node, 1);
+
+        if (l <= 0) {
+            continue;
+        }
+
+        host_to_lendian_bytes32(section + len, stats.successes);
+        host_to_lendian_bytes32(section + len + sizeof(uint32_t), stats.failures);
+        host_to_lendian_bytes32(section + len + 2 * sizeof(uint32_t), stats.rtt);
+        len += WARM_START_NODE_STATS_SIZE + l;
+        ++num_nodes;
+    }
+
+    section[0] = num_nodes;
+
+    const uint32_t num_friends_offset = len;
+    uint32_t num_friends = 0;
+    len += sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < m->numfriends; ++i) {
+        Node_format node;
+
+        if (!warm_start_friend_node(m, i, &node)) {
+            continue;
+        }
+
+        const int l = pack_nodes(m->log, section + len + CRYPTO_PUBLIC_KEY_SIZE, node_size, &node, 1);
+
+        if (l <= 0) {
+            continue;
+        }
+
+        memcpy(section + len, m->friendlist[i].real_pk, CRYPTO_PUBLIC_KEY_SIZE);
+        len += CRYPTO_PUBLIC_KEY_SIZE + l;
+        ++num_friends;
+    }
+
+    host_to_lendian_bytes32(section + num_friends_offset, num_friends);
+
+    state_write_section_header(data, STATE_COOKIE_TYPE, len, STATE_TYPE_WARM_START);
+    return section + len;
+}
+
+/** @brief Unpack one node at data + *offset and advance the offset past it.
+ *
+ * @retval false if there is no well-formed node there.
+ */
+non_null()
+static bool warm_start_unpack_node(Node_format *node, const uint8_t *data, uint32_t length, uint32_t *offset)
+{
+    uint16_t processed = 0;
+
+    if (unpack_nodes(node, 1, &processed, data + *offset, min_u32(length - *offset, UINT16_MAX), false) != 1) {
+        return false;
+    }
+
+    *offset += processed;
+    return true;
+}
+
+non_null()
+static State_Load_Status load_warm_start(Messenger *m, const uint8_t *data, uint32_t length)
+{
+    // A damaged or truncated section only costs the warm start, so loading
+    // stops quietly at the first malformed entry.
+    if (length < sizeof(uint8_t)) {
+        return STATE_LOAD_STATUS_CONTINUE;
+    }
+
+    const uint8_t num_nodes = data[0];
+    uint32_t offset = sizeof(uint8_t);
+
+    for (uint8_t i = 0; i < num_nodes; ++i) {
+        if (length - offset < WARM_START_NODE_STATS_SIZE) {
+            return STATE_LOAD_STATUS_CONTINUE;
+        }
+
+        Onion_Path_Node_Stats stats;
+        lendian_bytes_to_host32(&stats.successes, data + offset);
+        lendian_bytes_to_host32(&stats.failures, data + offset + sizeof(uint32_t));
+        lendian_bytes_to_host32(&stats.rtt, data + offset + 2 * sizeof(uint32_t));
+        offset += WARM_START_NODE_STATS_SIZE;
+
+        Node_format node;
+
+        if (!warm_start_unpack_node(&node, data, length, &offset)) {
+            return STATE_LOAD_STATUS_CONTINUE;
+        }
+
+        onion_add_saved_path_node(m->onion_c, &node.ip_port, node.public_key, &stats);
+    }
+
+    if (length - offset < sizeof(uint32_t)) {
+        return STATE_LOAD_STATUS_CONTINUE;
+    }
+
+    uint32_t num_friends;
+    lendian_bytes_to_host32(&num_friends, data + offset);
+    offset += sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < num_friends; ++i) {
+        if (length - offset < CRYPTO_PUBLIC_KEY_SIZE) {
+            return STATE_LOAD_STATUS_CONTINUE;
+        }
+
+        const uint8_t *real_pk = data + offset;
+        offset += CRYPTO_PUBLIC_KEY_SIZE;
+
+        Node_format node;
+
+        if (!warm_start_unpack_node(&node, data, length, &offset)) {
+            return STATE_LOAD_STATUS_CONTINUE;
+        }
+
+        const int32_t friendnumber = getfriend_id(m, real_pk);
+
+        if (friendnumber == -1) {
+            continue;
+        }
+
+        const int friendcon_id = m->friendlist[friendnumber].friendcon_id;
+        set_dht_temp_pk(m->fr_c, friendcon_id, node.public_key, nullptr);
+        set_dht_ip_port(m->fr_c, friendcon_id, &node.ip_port);
+    }
+
+    return STATE_LOAD_STATUS_CONTINUE;
+}
+
 non_null()
 static void m_register_default_plugins(Messenger *m)
 {
@@ -3369,6 +4520,9 @@ static void m_register_default_plugins(Messenger *m)
     }
     m_register_state_plugin(m, STATE_TYPE_TCP_RELAY, tcp_relay_size, load_tcp_relays, save_tcp_relays);
     m_register_state_plugin(m, STATE_TYPE_PATH_NODE, path_node_size, load_path_nodes, save_path_nodes);
+    if (m->options.warm_start_enabled) {
+        m_register_state_plugin(m, STATE_TYPE_WARM_START, warm_start_size, load_warm_start, save_warm_start);
+    }
 }
 
 bool messenger_load_state_section(Messenger *m, const uint8_t *data, uint32_t length, uint16_t type,
@@ -3482,10 +4636,19 @@ Messenger *new_messenger(Mono_Time *mono_time, const Memory *mem, const Random *
         return nullptr;
     }
 
+    m->friend_index = pk_index_new(mem, rng);
+
+    if (m->friend_index == nullptr) {
+        friendreq_kill(m->fr);
+        mem_delete(mem, m);
+        return nullptr;
+    }
+
     m->log = logger_new(mem);
 
     if (m->log == nullptr) {
         friendreq_kill(m->fr);
+        pk_index_free(m->friend_index);
         mem_delete(mem, m);
         return nullptr;
     }
@@ -3510,6 +4673,7 @@ Messenger *new_messenger(Mono_Time *mono_time, const Memory *mem, const Random *
 
     if (m->net == nullptr) {
         friendreq_kill(m->fr);
+        pk_index_free(m->friend_index);
 
         if (error != nullptr && net_err == 1) {
             LOGGER_WARNING(m->log, "network initialisation failed (no ports available)");
@@ -3526,6 +4690,7 @@ Messenger *new_messenger(Mono_Time *mono_time, const Memory *mem, const Random *
     if (m->dht == nullptr) {
         kill_networking(m->net);
         friendreq_kill(m->fr);
+        pk_index_free(m->friend_index);
         logger_kill(m->log);
         mem_delete(mem, m);
         return nullptr;
@@ -3539,6 +4704,7 @@ Messenger *new_messenger(Mono_Time *mono_time, const Memory *mem, const Random *
         kill_dht(m->dht);
         kill_networking(m->net);
         friendreq_kill(m->fr);
+        pk_index_free(m->friend_index);
         logger_kill(m->log);
         mem_delete(mem, m);
         return nullptr;
@@ -3553,6 +4719,7 @@ Messenger *new_messenger(Mono_Time *mono_time, const Memory *mem, const Random *
         kill_dht(m->dht);
         kill_networking(m->net);
         friendreq_kill(m->fr);
+        pk_index_free(m->friend_index);
         logger_kill(m->log);
         mem_delete(mem, m);
         return nullptr;
@@ -3574,7 +4741,8 @@ Messenger *new_messenger(Mono_Time *mono_time, const Memory *mem, const Random *
     m->onion_a = new_onion_announce(m->log, m->mem, m->rng, m->mono_time, m->dht);
     m->onion_c = new_onion_client(m->log, m->mem, m->rng, m->mono_time, m->net_crypto);
     if (m->onion_c != nullptr) {
-        m->fr_c = new_friend_connections(m->log, m->mono_time, m->ns, m->onion_c, options->local_discovery_enabled);
+        m->fr_c = new_friend_connections(m->log, m->mem, m->rng, m->mono_time, m->ns, m->onion_c,
+                                         options->local_discovery_enabled);
     }
 
     if ((options->dht_announcements_enabled && (m->forwarding == nullptr || m->announce == nullptr)) ||
@@ -3592,6 +4760,7 @@ Messenger *new_messenger(Mono_Time *mono_time, const Memory *mem, const Random *
         kill_dht(m->dht);
         kill_networking(m->net);
         friendreq_kill(m->fr);
+        pk_index_free(m->friend_index);
         logger_kill(m->log);
         mem_delete(mem, m);
         return nullptr;
@@ -3615,6 +4784,7 @@ Messenger *new_messenger(Mono_Time *mono_time, const Memory *mem, const Random *
         kill_dht(m->dht);
         kill_networking(m->net);
         friendreq_kill(m->fr);
+        pk_index_free(m->friend_index);
         logger_kill(m->log);
         mem_delete(mem, m);
         return nullptr;
@@ -3640,6 +4810,7 @@ Messenger *new_messenger(Mono_Time *mono_time, const Memory *mem, const Random *
             kill_dht(m->dht);
             kill_networking(m->net);
             friendreq_kill(m->fr);
+            pk_index_free(m->friend_index);
             logger_kill(m->log);
             mem_delete(mem, m);
 
@@ -3697,10 +4868,25 @@ void kill_messenger(Messenger *m)
 
     for (uint32_t i = 0; i < m->numfriends; ++i) {
         clear_receipts(m, i);
+        coalesce_buffer_free(m->mem, &m->friendlist[i]);
+
+        if (m->friendlist[i].file_transfers != nullptr) {
+            file_table_free_recv_buffers(m->mem, &m->friendlist[i]);
+            mem_delete(m->mem, m->friendlist[i].file_transfers);
+        }
+    }
+
+    while (m->file_table_pool != nullptr) {
+        File_Transfer_Table *const next = m->file_table_pool->next;
+        mem_delete(m->mem, m->file_table_pool);
+        m->file_table_pool = next;
     }
 
     mem_delete(m->mem, m->friendlist);
+    mem_delete(m->mem, m->active_friends);
+    mem_delete(m->mem, m->changed_friends);
     friendreq_kill(m->fr);
+    pk_index_free(m->friend_index);
 
     mem_delete(m->mem, m->options.state_plugins);
     logger_kill(m->log);
@@ -3717,11 +4903,15 @@ bool m_is_receiving_file(Messenger *m)
         return true;
     }
 
-    // TODO(iphydf): This is a very expensive loop. Consider keeping track of
-    // the number of live file transfers.
     for (size_t friend_number = 0; friend_number < m->numfriends; ++friend_number) {
+        const File_Transfer_Table *const table = m->friendlist[friend_number].file_transfers;
+
+        if (table == nullptr) {
+            continue;
+        }
+
         for (size_t i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
-            if (m->friendlist[friend_number].file_receiving[i].status == FILESTATUS_TRANSFERRING) {
+            if (table->receiving[i].status == FILESTATUS_TRANSFERRING) {
                 m->is_receiving_file = skip_count;
                 return true;
             }
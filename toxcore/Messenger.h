@@ -29,6 +29,7 @@
 #include "onion.h"
 #include "onion_announce.h"
 #include "onion_client.h"
+#include "pk_index.h"
 #include "state.h"
 
 #define MAX_NAME_LENGTH 128
@@ -79,6 +80,8 @@ typedef struct Messenger_Options {
     bool local_discovery_enabled;
     bool dht_announcements_enabled;
     bool groups_persistence_enabled;
+    bool warm_start_enabled;
+    bool coalesce_messages_enabled;
 
     logger_cb *log_callback;
     void *log_context;
@@ -140,6 +143,9 @@ typedef enum Userstatus {
 
 #define FILE_ID_LENGTH 32
 
+/** Largest buffer for batching received file data, see file_set_recv_buffer. */
+#define MAX_FILE_RECV_BUFFER_SIZE (1024 * 1024)
+
 struct File_Transfers {
     uint64_t size;
     uint64_t transferred;
@@ -148,7 +154,24 @@ struct File_Transfers {
     uint32_t last_packet_number; /* number of the last packet sent. */
     uint64_t requested; /* total data requested by the request chunk callback */
     uint8_t id[FILE_ID_LENGTH];
+    bool pull; /* true if the data is read with the file read callback instead of requested chunk by chunk. */
+    uint8_t *recv_buffer; /* received data not passed to the client yet, see file_set_recv_buffer. */
+    uint32_t recv_buffer_capacity;
+    uint32_t recv_buffer_length;
+    uint32_t recv_buffer_size; /* requested capacity, 0 to pass on every chunk as it arrives. */
 };
+
+/**
+ * The file transfer slots of a friend. Most friends never transfer files, so
+ * these are only allocated while a friend has a transfer slot in use, and
+ * kept in a small pool in between.
+ */
+typedef struct File_Transfer_Table {
+    struct File_Transfers sending[MAX_CONCURRENT_FILE_PIPES];
+    struct File_Transfers receiving[MAX_CONCURRENT_FILE_PIPES];
+
+    struct File_Transfer_Table *next; // next free table in the pool.
+} File_Transfer_Table;
 typedef enum Filestatus {
     FILESTATUS_NONE,
     FILESTATUS_NOT_ACCEPTED,
@@ -180,6 +203,13 @@ typedef void m_self_connection_status_cb(Messenger *m, Onion_Connection_Status c
 typedef void m_friend_status_cb(Messenger *m, uint32_t friend_number, unsigned int status, void *user_data);
 typedef void m_friend_connection_status_cb(Messenger *m, uint32_t friend_number, unsigned int connection_status,
         void *user_data);
+/** @brief Reports the steps of connecting to a friend over UDP.
+ *
+ * Each step is given in milliseconds since the friend was added or last went
+ * offline, or UINT32_MAX if it didn't happen during this connection attempt.
+ */
+typedef void m_friend_connection_timing_cb(Messenger *m, uint32_t friend_number, uint32_t dht_pk_ms,
+        uint32_t dht_info_ms, uint32_t udp_ms, uint32_t connected_ms, void *user_data);
 typedef void m_friend_message_cb(Messenger *m, uint32_t friend_number, unsigned int message_type,
                                  const uint8_t *message, size_t length, void *user_data);
 typedef void m_file_recv_control_cb(Messenger *m, uint32_t friend_number, uint32_t file_number, unsigned int control,
@@ -196,6 +226,14 @@ typedef void m_file_recv_cb(Messenger *m, uint32_t friend_number, uint32_t file_
                             uint64_t file_size, const uint8_t *filename, size_t filename_length, void *user_data);
 typedef void m_file_chunk_request_cb(Messenger *m, uint32_t friend_number, uint32_t file_number, uint64_t position,
                                      size_t length, void *user_data);
+/** @brief Read data of an outgoing file transfer straight into the packet that carries it.
+ *
+ * @return number of bytes read. Fewer than `length` only at the end of a file
+ *   of unknown size.
+ * @retval -1 on error, which cancels the transfer.
+ */
+typedef int64_t m_file_read_cb(Messenger *m, uint32_t friend_number, uint32_t file_number, uint64_t position,
+                               uint8_t *data, size_t length, void *user_data);
 typedef void m_file_recv_chunk_cb(Messenger *m, uint32_t friend_number, uint32_t file_number, uint64_t position,
                                   const uint8_t *data, size_t length, void *user_data);
 typedef void m_friend_lossy_packet_cb(Messenger *m, uint32_t friend_number, uint8_t packet_id, const uint8_t *data,
@@ -207,6 +245,9 @@ typedef void m_conference_invite_cb(Messenger *m, uint32_t friend_number, const
 typedef void m_group_invite_cb(const Messenger *m, uint32_t friend_number, const uint8_t *invite_data, size_t length,
                                const uint8_t *group_name, size_t group_name_length, void *user_data);
 
+/** @brief Small packets waiting to be sent to a friend together, see `coalesce_messages_enabled`. */
+typedef struct Coalesce_Buffer Coalesce_Buffer;
+
 typedef struct Friend {
     uint8_t real_pk[CRYPTO_PUBLIC_KEY_SIZE];
     int friendcon_id;
@@ -231,9 +272,16 @@ typedef struct Friend {
     uint32_t friendrequest_nospam; // The nospam number used in the friend request.
     uint64_t last_seen_time;
     Connection_Status last_connection_udp_tcp;
-    struct File_Transfers file_sending[MAX_CONCURRENT_FILE_PIPES];
+    bool connection_timing_reported; // whether the timing of the current UDP connection was reported.
+    bool info_changed; // whether the friend is in changed_friends of the Messenger.
+    File_Transfer_Table *file_transfers; // nullptr if the friend has no file transfers.
+    uint32_t num_file_transfers; // number of slots in use in file_transfers, in both directions.
     uint32_t num_sending_files;
-    struct File_Transfers file_receiving[MAX_CONCURRENT_FILE_PIPES];
+    uint32_t num_recv_buffers; // number of receiving slots in file_transfers with a recv_buffer.
+    uint32_t active_index; // position in active_friends of the Messenger plus 1, or 0 if not in it.
+    Coalesce_Buffer *coalesce; // nullptr unless both we and the online friend coalesce packets.
+    uint32_t coalesced_sent; // PACKET_ID_COALESCED packets sent to the friend.
+    uint32_t coalesced_received; // PACKET_ID_COALESCED packets received from the friend.
 
     struct Receipts *receipts_start;
     struct Receipts *receipts_end;
@@ -271,6 +319,15 @@ struct Messenger {
 
     Friend *friendlist;
     uint32_t numfriends;
+    uint32_t friends_capacity; // allocated length of friendlist, active_friends and changed_friends.
+    Pk_Index *friend_index;  // real public key -> friend number
+    uint32_t *active_friends; // friends that do_friends has work to do for, in no particular order.
+    uint32_t num_active_friends;
+    uint32_t *changed_friends; // friends added, removed or with new info since tox_threads_publish last took them.
+    uint32_t num_changed_friends;
+
+    File_Transfer_Table *file_table_pool; // released file transfer tables kept for reuse.
+    uint32_t file_table_pool_size;
 
     uint64_t lastdump;
     uint8_t is_receiving_file;
@@ -291,6 +348,7 @@ struct Messenger {
     m_friend_typing_cb *friend_typingchange;
     m_friend_read_receipt_cb *read_receipt;
     m_friend_connection_status_cb *friend_connectionstatuschange;
+    m_friend_connection_timing_cb *friend_connection_timing;
 
     struct Group_Chats *conferences_object;
     m_conference_invite_cb *conference_invite;
@@ -301,6 +359,7 @@ struct Messenger {
     m_file_recv_control_cb *file_filecontrol;
     m_file_recv_chunk_cb *file_filedata;
     m_file_chunk_request_cb *file_reqchunk;
+    m_file_read_cb *file_read;
 
     m_friend_lossy_packet_cb *lossy_packethandler;
     m_friend_lossless_packet_cb *lossless_packethandler;
@@ -361,6 +420,18 @@ int32_t m_addfriend(Messenger *m, const uint8_t *address, const uint8_t *data, u
 non_null()
 int32_t m_addfriend_norequest(Messenger *m, const uint8_t *real_pk);
 
+/** @brief Make room for adding `count` more friends.
+ *
+ * Reserves space in the friend list, the public key indexes, friend
+ * connections and the onion client at once, so that adding the friends
+ * afterwards doesn't reallocate any of them.
+ *
+ * @retval true on success.
+ * @retval false if allocation failed or there would be too many friends.
+ */
+non_null()
+bool m_reserve_friends(Messenger *m, uint32_t count);
+
 /** @brief Initializes the friend connection and onion connection for a groupchat.
  *
  * @retval true on success.
@@ -440,6 +511,17 @@ non_null(1, 4) nullable(6)
 int m_send_message_generic(Messenger *m, int32_t friendnumber, uint8_t type, const uint8_t *message, uint32_t length,
                            uint32_t *message_id);
 
+/** @brief Send a message like m_send_message_generic, with a message id chosen by the caller.
+ *
+ * For callers that hand out message ids before the message is actually sent.
+ * The friend's following messages get ids counting up from this one.
+ *
+ * @return the same values as m_send_message_generic.
+ */
+non_null()
+int m_send_message_with_id(Messenger *m, int32_t friendnumber, uint8_t type, const uint8_t *message, uint32_t length,
+                           uint32_t message_id);
+
 /** @brief Set the name and name_length of a friend.
  *
  * name must be a string of maximum MAX_NAME_LENGTH length.
@@ -553,6 +635,13 @@ int m_set_usertyping(Messenger *m, int32_t friendnumber, bool is_typing);
 non_null()
 int m_get_istyping(const Messenger *m, int32_t friendnumber);
 
+/** @brief Get the number of PACKET_ID_COALESCED packets sent to and received from a friend.
+ *
+ * @retval false if the friend doesn't exist.
+ */
+non_null()
+bool m_get_coalesced_packets(const Messenger *m, int32_t friendnumber, uint32_t *sent, uint32_t *received);
+
 /** Set the function that will be executed when a friend request is received. */
 non_null(1) nullable(2)
 void m_callback_friendrequest(Messenger *m, m_friend_request_cb *function);
@@ -599,6 +688,13 @@ non_null() void m_callback_read_receipt(Messenger *m, m_friend_read_receipt_cb *
  */
 non_null() void m_callback_connectionstatus(Messenger *m, m_friend_connection_status_cb *function);
 
+/** @brief Set the callback for the timing of connections to friends.
+ *
+ * Called once each time a friend becomes reachable over UDP after having been
+ * offline.
+ */
+non_null(1) nullable(2) void m_callback_connection_timing(Messenger *m, m_friend_connection_timing_cb *function);
+
 /** @brief Set the callback for typing changes. */
 non_null() void m_callback_core_connection(Messenger *m, m_self_connection_status_cb *function);
 
@@ -645,6 +741,9 @@ non_null() void callback_file_data(Messenger *m, m_file_recv_chunk_cb *function)
 /** @brief Set the callback for file request chunk. */
 non_null() void callback_file_reqchunk(Messenger *m, m_file_chunk_request_cb *function);
 
+/** @brief Set the callback that reads the data of transfers in pull mode. */
+non_null(1) nullable(2) void callback_file_read(Messenger *m, m_file_read_cb *function);
+
 /** @brief Copy the file transfer file id to file_id
  *
  * @retval 0 on success.
@@ -665,7 +764,7 @@ int file_get_id(const Messenger *m, int32_t friendnumber, uint32_t filenumber, u
  * @retval -4 if could not send packet (friend offline).
  */
 non_null()
-long int new_filesender(const Messenger *m, int32_t friendnumber, uint32_t file_type, uint64_t filesize,
+long int new_filesender(Messenger *m, int32_t friendnumber, uint32_t file_type, uint64_t filesize,
                         const uint8_t *file_id, const uint8_t *filename, uint16_t filename_length);
 
 /** @brief Send a file control request.
@@ -697,6 +796,37 @@ int file_control(const Messenger *m, int32_t friendnumber, uint32_t filenumber,
 non_null()
 int file_seek(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uint64_t position);
 
+/** @brief Switch an outgoing file transfer between pull mode and chunk requests.
+ *
+ * In pull mode, the file read callback reads each chunk straight into its
+ * packet in the send queue, and no chunk requests are made. Chunks that were
+ * requested but not sent yet are read again. The end of the transfer is still
+ * signalled with a chunk request of length 0.
+ *
+ * @retval 0 on success
+ * @retval -1 if friend not valid.
+ * @retval -2 if there is no outgoing transfer with this file number.
+ */
+non_null()
+int file_set_pull(const Messenger *m, int32_t friendnumber, uint32_t filenumber, bool pull);
+
+/** @brief Batch the data of an incoming file transfer before passing it on.
+ *
+ * Contiguous chunks are collected in a buffer of the given size and passed to
+ * the file data callback together: when the buffer is full, at the end of each
+ * do_messenger iteration, and before the transfer ends, also when the friend
+ * goes offline. A size of 0 passes on each chunk as it arrives, which is the
+ * default. The new size applies once the data already collected has been
+ * passed on.
+ *
+ * @retval 0 on success
+ * @retval -1 if friend not valid.
+ * @retval -2 if there is no incoming transfer with this file number.
+ * @retval -3 if the size is larger than MAX_FILE_RECV_BUFFER_SIZE.
+ */
+non_null()
+int file_set_recv_buffer(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uint32_t size);
+
 /** @brief Send file data.
  *
  * @retval 0 on success
@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "Messenger.h"
+#include "mem.h"
+
+namespace {
+
+/** @brief A friend as it was before file transfer slots were allocated on demand. */
+struct Inline_Transfers_Friend {
+    Friend f;
+    File_Transfers file_sending[MAX_CONCURRENT_FILE_PIPES];
+    File_Transfers file_receiving[MAX_CONCURRENT_FILE_PIPES];
+};
+
+/**
+ * @brief Grows a friend list one friend at a time, the way m_addfriend() does.
+ *
+ * @return false on allocation failure.
+ */
+template <typename T>
+bool grow_friendlist(const Memory *mem, uint32_t num_friends)
+{
+    T *list = nullptr;
+
+    for (uint32_t i = 0; i < num_friends; ++i) {
+        T *new_list = static_cast<T *>(mem_vrealloc(mem, list, i + 1, sizeof(T)));
+
+        if (new_list == nullptr) {
+            mem_delete(mem, list);
+            return false;
+        }
+
+        list = new_list;
+        list[i] = T{};
+    }
+
+    benchmark::DoNotOptimize(list);
+    mem_delete(mem, list);
+    return true;
+}
+
+/** @brief Adding state.range(0) friends with the transfer slots inside each friend. */
+void BM_friendlist_inline_transfers(benchmark::State &state)
+{
+    const Memory *mem = os_memory();
+    const uint32_t num_friends = state.range(0);
+
+    for (auto _ : state) {
+        if (!grow_friendlist<Inline_Transfers_Friend>(mem, num_friends)) {
+            state.SkipWithError("allocation failed");
+            break;
+        }
+    }
+
+    state.counters["bytes_per_friend"] = sizeof(Inline_Transfers_Friend);
+}
+BENCHMARK(BM_friendlist_inline_transfers)->Arg(1000)->Arg(10000);
+
+/**
+ * @brief Adding state.range(0) friends, state.range(1) of which start a file
+ * transfer and get a table of transfer slots.
+ */
+void BM_friendlist_lazy_transfers(benchmark::State &state)
+{
+    const Memory *mem = os_memory();
+    const uint32_t num_friends = state.range(0);
+    const uint32_t num_transferring = state.range(1);
+    std::vector<File_Transfer_Table *> tables(num_transferring);
+
+    for (auto _ : state) {
+        if (!grow_friendlist<Friend>(mem, num_friends)) {
+            state.SkipWithError("allocation failed");
+            break;
+        }
+
+        for (File_Transfer_Table *&table : tables) {
+            table = static_cast<File_Transfer_Table *>(mem_alloc(mem, sizeof(File_Transfer_Table)));
+        }
+
+        for (File_Transfer_Table *table : tables) {
+            mem_delete(mem, table);
+        }
+    }
+
+    const double table_bytes = static_cast<double>(num_transferring) * sizeof(File_Transfer_Table);
+    state.counters["bytes_per_friend"] = sizeof(Friend) + table_bytes / num_friends;
+}
+BENCHMARK(BM_friendlist_lazy_transfers)
+    ->Args({1000, 0})
+    ->Args({10000, 0})
+    ->Args({10000, 100})
+    ->Args({10000, 1000});
+
+}  // namespace
+
+BENCHMARK_MAIN();
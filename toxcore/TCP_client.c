@@ -50,6 +50,11 @@ struct TCP_Client_Connection {
     uint64_t ping_response_id;
     uint64_t ping_request_id;
 
+    /* Round trip time measurement, in milliseconds. */
+    uint64_t handshake_sent_ms;
+    uint64_t ping_sent_ms;
+    uint32_t rtt;
+
     TCP_Client_Conn connections[NUM_CLIENT_CONNECTIONS];
     tcp_routing_response_cb *response_callback;
     void *response_callback_object;
@@ -85,6 +90,10 @@ TCP_Client_Status tcp_con_status(const TCP_Client_Connection *con)
 {
     return con->status;
 }
+uint32_t tcp_con_rtt(const TCP_Client_Connection *con)
+{
+    return con->rtt;
+}
 void *tcp_con_custom_object(const TCP_Client_Connection *con)
 {
     return con->custom_object;
@@ -771,8 +780,27 @@ static int handle_tcp_client_ping(const Logger *logger, TCP_Client_Connection *c
     return 0;
 }
 
+/** @brief Add a round trip time sample to the smoothed RTT of the connection.
+ *
+ * Uses the same 1/8 gain as TCP's SRTT estimator. Samples are clamped to at
+ * least 1ms so that 0 can mean "not measured yet".
+ */
+non_null()
+static void tcp_client_add_rtt_sample(TCP_Client_Connection *conn, uint64_t sent_ms, uint64_t now_ms)
+{
+    const uint32_t sample = (uint32_t)max_u64(1, min_u64(now_ms - min_u64(sent_ms, now_ms), UINT32_MAX));
+
+    if (conn->rtt == 0) {
+        conn->rtt = sample;
+        return;
+    }
+
+    conn->rtt = (uint32_t)max_u64(1, ((uint64_t)conn->rtt * 7 + sample) / 8);
+}
+
 non_null()
-static int handle_tcp_client_pong(TCP_Client_Connection *conn, const uint8_t *data, uint16_t length)
+static int handle_tcp_client_pong(TCP_Client_Connection *conn, const Mono_Time *mono_time, const uint8_t *data,
+                                  uint16_t length)
 {
     if (length != 1 + sizeof(uint64_t)) {
         return -1;
@@ -784,6 +812,7 @@ static int handle_tcp_client_pong(TCP_Client_Connection *conn, const uint8_t *da
     if (ping_id != 0) {
         if (ping_id == conn->ping_id) {
             conn->ping_id = 0;
+            tcp_client_add_rtt_sample(conn, conn->ping_sent_ms, mono_time_get_ms(mono_time));
         }
 
         return 0;
@@ -811,9 +840,9 @@ static int handle_tcp_client_oob_recv(TCP_Client_Connection *conn, const uint8_t
  * @retval 0 on success
  * @retval -1 on failure
  */
-non_null(1, 2, 3) nullable(5)
-static int handle_tcp_client_packet(const Logger *logger, TCP_Client_Connection *conn, const uint8_t *data,
-                                    uint16_t length, void *userdata)
+non_null(1, 2, 3, 4) nullable(6)
+static int handle_tcp_client_packet(const Logger *logger, TCP_Client_Connection *conn, const Mono_Time *mono_time,
+                                    const uint8_t *data, uint16_t length, void *userdata)
 {
     if (length <= 1) {
         return -1;
@@ -833,7 +862,7 @@ static int handle_tcp_client_packet(const Logger *logger, TCP_Client_Connection
             return handle_tcp_client_ping(logger, conn, data, length);
 
         case TCP_PACKET_PONG:
-            return handle_tcp_client_pong(conn, data, length);
+            return handle_tcp_client_pong(conn, mono_time, data, length);
 
         case TCP_PACKET_OOB_RECV:
             return handle_tcp_client_oob_recv(conn, data, length, userdata);
@@ -869,10 +898,11 @@ static int handle_tcp_client_packet(const Logger *logger, TCP_Client_Connection
     return 0;
 }
 
-non_null(1, 2) nullable(3)
-static bool tcp_process_packet(const Logger *logger, TCP_Client_Connection *conn, void *userdata)
+non_null(1, 2, 3) nullable(4)
+static bool tcp_process_packet(const Logger *logger, TCP_Client_Connection *conn, const Mono_Time *mono_time,
+                               void *userdata)
 {
-    uint8_t packet[MAX_PACKET_SIZE];
+    uint8_t packet[MAX_PACKET_SIZE + CRYPTO_MAC_SIZE];
     const int len = read_packet_tcp_secure_connection(logger, conn->con.mem, conn->con.ns, conn->con.sock, &conn->next_packet_length, conn->con.shared_key, conn->recv_nonce, packet, sizeof(packet),
                     &conn->ip_port);
 
@@ -885,7 +915,7 @@ static bool tcp_process_packet(const Logger *logger, TCP_Client_Connection *conn
         return false;
     }
 
-    if (handle_tcp_client_packet(logger, conn, packet, len, userdata) == -1) {
+    if (handle_tcp_client_packet(logger, conn, mono_time, packet, len, userdata) == -1) {
         conn->status = TCP_CLIENT_DISCONNECTED;
         return false;
     }
@@ -910,6 +940,7 @@ static int do_confirmed_tcp(const Logger *logger, TCP_Client_Connection *conn, c
 
         conn->ping_request_id = ping_id;
         conn->ping_id = ping_id;
+        conn->ping_sent_ms = mono_time_get_ms(mono_time);
         tcp_send_ping_request(logger, conn);
         conn->last_pinged = mono_time_get(mono_time);
     }
@@ -919,7 +950,7 @@ static int do_confirmed_tcp(const Logger *logger, TCP_Client_Connection *conn, c
         return 0;
     }
 
-    while (tcp_process_packet(logger, conn, userdata)) {
+    while (tcp_process_packet(logger, conn, mono_time, userdata)) {
         /* Keep reading until error or out of data. */
     }
 
@@ -985,6 +1016,7 @@ void do_tcp_connection(const Logger *logger, const Mono_Time *mono_time,
     if (tcp_connection->status == TCP_CLIENT_CONNECTING) {
         if (send_pending_data(logger, &tcp_connection->con) == 0) {
             tcp_connection->status = TCP_CLIENT_UNCONFIRMED;
+            tcp_connection->handshake_sent_ms = mono_time_get_ms(mono_time);
         }
     }
 
@@ -997,6 +1029,7 @@ void do_tcp_connection(const Logger *logger, const Mono_Time *mono_time,
             if (handle_handshake(tcp_connection, data) == 0) {
                 tcp_connection->kill_at = UINT64_MAX;
                 tcp_connection->status = TCP_CLIENT_CONFIRMED;
+                tcp_client_add_rtt_sample(tcp_connection, tcp_connection->handshake_sent_ms, mono_time_get_ms(mono_time));
             } else {
                 tcp_connection->kill_at = 0;
                 tcp_connection->status = TCP_CLIENT_DISCONNECTED;
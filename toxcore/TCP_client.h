@@ -50,6 +50,16 @@ IP_Port tcp_con_ip_port(const TCP_Client_Connection *con);
 non_null()
 TCP_Client_Status tcp_con_status(const TCP_Client_Connection *con);
 
+/** @brief Smoothed round trip time to the relay in milliseconds.
+ *
+ * Sampled from the handshake and from every ping/pong exchange. Resolution is
+ * limited by how often the mono_time is updated.
+ *
+ * @retval 0 if no sample has been taken yet.
+ */
+non_null()
+uint32_t tcp_con_rtt(const TCP_Client_Connection *con);
+
 non_null()
 void *tcp_con_custom_object(const TCP_Client_Connection *con);
 non_null()
@@ -286,13 +286,14 @@ int read_packet_tcp_secure_connection(
         *next_packet_length = len;
     }
 
-    if (max_len + CRYPTO_MAC_SIZE < *next_packet_length) {
+    if (max_len < *next_packet_length) {
         LOGGER_DEBUG(logger, "packet too large");
         return -1;
     }
 
-    VLA(uint8_t, data_encrypted, (int) *next_packet_length);
-    const int len_packet = read_tcp_packet(logger, mem, ns, sock, data_encrypted, *next_packet_length, ip_port);
+    // Read the encrypted frame straight into the caller's buffer and decrypt
+    // it in place, so the plaintext never goes through an intermediate copy.
+    const int len_packet = read_tcp_packet(logger, mem, ns, sock, data, *next_packet_length, ip_port);
 
     if (len_packet == -1) {
         return 0;
@@ -305,7 +306,7 @@ int read_packet_tcp_secure_connection(
 
     *next_packet_length = 0;
 
-    const int len = decrypt_data_symmetric(mem, shared_key, recv_nonce, data_encrypted, len_packet, data);
+    const int len = decrypt_data_symmetric(mem, shared_key, recv_nonce, data, len_packet, data);
 
     if (len + CRYPTO_MAC_SIZE != len_packet) {
         LOGGER_ERROR(logger, "decrypted length %d does not match expected length %d", len + CRYPTO_MAC_SIZE, len_packet);
@@ -102,6 +102,12 @@ int read_tcp_packet(
     const Logger *logger, const Memory *mem, const Network *ns, Socket sock, uint8_t *data, uint16_t length, const IP_Port *ip_port);
 
 /**
+ * @brief Read and decrypt one packet in place.
+ *
+ * The encrypted frame is read into `data`, which must be `max_len` bytes big,
+ * and decrypted there. The plaintext is therefore at most
+ * `max_len - CRYPTO_MAC_SIZE` bytes long.
+ *
  * @return length of received packet on success.
  * @retval 0 if could not read any packet.
  * @retval -1 on failure (connection must be killed).
@@ -56,6 +56,35 @@ struct TCP_Connections {
 
     bool onion_status;
     uint16_t onion_num_conns;
+
+    TCP_Onion_Share *onion_share;
+    uint32_t onion_share_index; /* Index in onion_share->members. */
+    uint64_t onion_share_seen; /* Last sequence number of onion_share->queue we looked at. */
+};
+
+/** Number of foreign onion responses kept for other share members to pick up. */
+#define TCP_ONION_SHARE_QUEUE_SIZE 64
+
+/** Connection numbers of relays lent by another share member have this bit set. */
+#define TCP_ONION_SHARE_FLAG (1 << 30)
+#define TCP_ONION_SHARE_MAX_MEMBERS (1 << 14)
+#define TCP_ONION_SHARE_MAX_RELAYS (1 << 16)
+
+typedef struct TCP_Onion_Share_Packet {
+    uint64_t seq; /* 0 if the slot is empty or the packet was handled. */
+    uint32_t origin; /* Share index of the member that received the packet and already tried it. */
+    uint16_t length;
+    uint8_t data[MAX_PACKET_SIZE];
+} TCP_Onion_Share_Packet;
+
+struct TCP_Onion_Share {
+    const Memory *mem;
+
+    TCP_Connections **members;
+    uint32_t members_length;
+
+    TCP_Onion_Share_Packet queue[TCP_ONION_SHARE_QUEUE_SIZE];
+    uint64_t next_seq;
 };
 
 static const TCP_Connection_to empty_tcp_connection_to = {0};
@@ -284,6 +313,29 @@ static TCP_con *get_tcp_connection(const TCP_Connections *tcp_c, int tcp_connect
     return &tcp_c->tcp_connections[tcp_connections_number];
 }
 
+/** @brief Rank a relay for selection: lower is better.
+ *
+ * The score is the smoothed round trip time to the relay plus a fixed penalty
+ * for every connection currently routed through it, so a slightly slower but
+ * idle relay beats a busy one. Relays without an RTT sample are ranked as if
+ * they had TCP_RELAY_UNKNOWN_RTT.
+ */
+non_null()
+static uint64_t tcp_relay_score(const TCP_con *tcp_con)
+{
+    uint64_t rtt = TCP_RELAY_UNKNOWN_RTT;
+
+    if (tcp_con->status == TCP_CONN_CONNECTED) {
+        const uint32_t measured = tcp_con_rtt(tcp_con->connection);
+
+        if (measured != 0) {
+            rtt = measured;
+        }
+    }
+
+    return rtt + (uint64_t)tcp_con->lock_count * TCP_RELAY_LOAD_PENALTY;
+}
+
 uint32_t tcp_connected_relays_count(const TCP_Connections *tcp_c)
 {
     uint32_t count = 0;
@@ -324,28 +376,50 @@ int send_packet_tcp_connection(const TCP_Connections *tcp_c, int connections_num
 
     bool limit_reached = false;
 
+    /* Try the online relays best-ranked first. */
+    const TCP_con *online[MAX_FRIEND_TCP_CONNECTIONS];
+    uint8_t online_ids[MAX_FRIEND_TCP_CONNECTIONS];
+    uint64_t online_scores[MAX_FRIEND_TCP_CONNECTIONS];
+    uint32_t num_online = 0;
+
     for (uint32_t i = 0; i < MAX_FRIEND_TCP_CONNECTIONS; ++i) {
-        uint32_t tcp_con_num = con_to->connections[i].tcp_connection;
+        const uint32_t tcp_con_num = con_to->connections[i].tcp_connection;
         const uint8_t status = con_to->connections[i].status;
-        const uint8_t connection_id = con_to->connections[i].connection_id;
 
-        if (tcp_con_num > 0 && status == TCP_CONNECTIONS_STATUS_ONLINE) {
-            tcp_con_num -= 1;
-            TCP_con *tcp_con = get_tcp_connection(tcp_c, tcp_con_num);
+        if (tcp_con_num == 0 || status != TCP_CONNECTIONS_STATUS_ONLINE) {
+            continue;
+        }
 
-            if (tcp_con == nullptr) {
-                continue;
-            }
+        const TCP_con *tcp_con = get_tcp_connection(tcp_c, tcp_con_num - 1);
 
-            ret = send_data(tcp_c->logger, tcp_con->connection, connection_id, packet, length);
+        if (tcp_con == nullptr) {
+            continue;
+        }
 
-            if (ret == 0) {
-                limit_reached = true;
-            }
+        const uint64_t score = tcp_relay_score(tcp_con);
+        uint32_t j = num_online;
 
-            if (ret == 1) {
-                break;
-            }
+        for (; j > 0 && online_scores[j - 1] > score; --j) {
+            online[j] = online[j - 1];
+            online_ids[j] = online_ids[j - 1];
+            online_scores[j] = online_scores[j - 1];
+        }
+
+        online[j] = tcp_con;
+        online_ids[j] = con_to->connections[i].connection_id;
+        online_scores[j] = score;
+        ++num_online;
+    }
+
+    for (uint32_t i = 0; i < num_online; ++i) {
+        ret = send_data(tcp_c->logger, online[i]->connection, online_ids[i], packet, length);
+
+        if (ret == 0) {
+            limit_reached = true;
+        }
+
+        if (ret == 1) {
+            break;
         }
     }
 
@@ -389,7 +463,8 @@ int send_packet_tcp_connection(const TCP_Connections *tcp_c, int connections_num
  * return TCP connection number on success.
  * return -1 on failure.
  */
-int get_random_tcp_onion_conn_number(const TCP_Connections *tcp_c)
+non_null()
+static int get_random_own_onion_conn_number(const TCP_Connections *tcp_c)
 {
     const uint32_t r = random_u32(tcp_c->rng);
 
@@ -404,6 +479,51 @@ int get_random_tcp_onion_conn_number(const TCP_Connections *tcp_c)
     return -1;
 }
 
+/** @brief Pick a random onion relay lent by another member of our share.
+ *
+ * @return an encoded connection number (see TCP_ONION_SHARE_FLAG).
+ * @retval -1 if no other member has an onion relay.
+ */
+non_null()
+static int get_random_shared_onion_conn_number(const TCP_Connections *tcp_c)
+{
+    const TCP_Onion_Share *share = tcp_c->onion_share;
+
+    if (share == nullptr || share->members_length == 0) {
+        return -1;
+    }
+
+    const uint32_t r = random_u32(tcp_c->rng);
+
+    for (uint32_t i = 0; i < share->members_length; ++i) {
+        const uint32_t index = (i + r) % share->members_length;
+        const TCP_Connections *member = share->members[index];
+
+        if (member == nullptr || member == tcp_c) {
+            continue;
+        }
+
+        const int number = get_random_own_onion_conn_number(member);
+
+        if (number != -1 && number < TCP_ONION_SHARE_MAX_RELAYS) {
+            return TCP_ONION_SHARE_FLAG | (int)(index << 16) | number;
+        }
+    }
+
+    return -1;
+}
+
+int get_random_tcp_onion_conn_number(const TCP_Connections *tcp_c)
+{
+    const int number = get_random_own_onion_conn_number(tcp_c);
+
+    if (number != -1) {
+        return number;
+    }
+
+    return get_random_shared_onion_conn_number(tcp_c);
+}
+
 /** @brief Return TCP connection number of active TCP connection with ip_port.
  *
  * return TCP connection number on success.
@@ -431,7 +551,8 @@ static int get_conn_number_by_ip_port(const TCP_Connections *tcp_c, const IP_Por
  */
 bool tcp_get_random_conn_ip_port(const TCP_Connections *tcp_c, IP_Port *ip_port)
 {
-    const int index = get_random_tcp_onion_conn_number(tcp_c);
+    // Forwarded responses are not shared, so only our own relays qualify here.
+    const int index = get_random_own_onion_conn_number(tcp_c);
 
     if (index == -1) {
         return false;
@@ -449,6 +570,19 @@ bool tcp_get_random_conn_ip_port(const TCP_Connections *tcp_c, IP_Port *ip_port)
 int tcp_send_onion_request(TCP_Connections *tcp_c, uint32_t tcp_connections_number, const uint8_t *data,
                            uint16_t length)
 {
+    if ((tcp_connections_number & TCP_ONION_SHARE_FLAG) != 0) {
+        const TCP_Onion_Share *share = tcp_c->onion_share;
+        const uint32_t index = (tcp_connections_number & ~TCP_ONION_SHARE_FLAG) >> 16;
+
+        if (share == nullptr || index >= share->members_length || share->members[index] == nullptr
+                || share->members[index] == tcp_c) {
+            return -1;
+        }
+
+        tcp_c = share->members[index];
+        tcp_connections_number &= TCP_ONION_SHARE_MAX_RELAYS - 1;
+    }
+
     if (tcp_connections_number >= tcp_c->tcp_connections_length) {
         return -1;
     }
@@ -1199,18 +1333,66 @@ static int tcp_conn_oob_callback(void *object, const uint8_t *public_key, const
     return 0;
 }
 
+non_null()
+static void tcp_onion_share_push(TCP_Onion_Share *share, uint32_t origin, const uint8_t *data, uint16_t length)
+{
+    if (length > MAX_PACKET_SIZE) {
+        return;
+    }
+
+    TCP_Onion_Share_Packet *slot = &share->queue[share->next_seq % TCP_ONION_SHARE_QUEUE_SIZE];
+    slot->seq = share->next_seq;
+    slot->origin = origin;
+    slot->length = length;
+    memcpy(slot->data, data, length);
+    ++share->next_seq;
+}
+
 non_null()
 static int tcp_onion_callback(void *object, const uint8_t *data, uint16_t length, void *userdata)
 {
     TCP_Connections *tcp_c = (TCP_Connections *)object;
 
-    if (tcp_c->tcp_onion_callback != nullptr) {
-        tcp_c->tcp_onion_callback(tcp_c->tcp_onion_callback_object, data, length, userdata);
+    if (tcp_c->tcp_onion_callback != nullptr
+            && tcp_c->tcp_onion_callback(tcp_c->tcp_onion_callback_object, data, length, userdata) == 0) {
+        return 0;
+    }
+
+    /* Not ours: it may be a response to a request another share member sent through our relay. The
+     * other members pick it up in their own iteration, so their callbacks get their own userdata. */
+    if (tcp_c->onion_share != nullptr) {
+        tcp_onion_share_push(tcp_c->onion_share, tcp_c->onion_share_index, data, length);
     }
 
     return 0;
 }
 
+/** Try the onion responses other share members could not handle. */
+non_null(1) nullable(2)
+static void tcp_onion_share_poll(TCP_Connections *tcp_c, void *userdata)
+{
+    TCP_Onion_Share *share = tcp_c->onion_share;
+
+    if (share == nullptr) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < TCP_ONION_SHARE_QUEUE_SIZE; ++i) {
+        TCP_Onion_Share_Packet *slot = &share->queue[i];
+
+        if (slot->seq == 0 || slot->seq <= tcp_c->onion_share_seen || slot->origin == tcp_c->onion_share_index) {
+            continue;
+        }
+
+        if (tcp_c->tcp_onion_callback != nullptr
+                && tcp_c->tcp_onion_callback(tcp_c->tcp_onion_callback_object, slot->data, slot->length, userdata) == 0) {
+            slot->seq = 0;
+        }
+    }
+
+    tcp_c->onion_share_seen = share->next_seq - 1;
+}
+
 non_null()
 static void tcp_forwarding_callback(void *object, const uint8_t *data, uint16_t length, void *userdata)
 {
@@ -1249,6 +1431,31 @@ static int tcp_relay_set_callbacks(TCP_Connections *tcp_c, int tcp_connections_n
     return 0;
 }
 
+/** @brief Whether we should allocate more of our own relays for onion use.
+ *
+ * Onion relays lent by other members of our share count towards
+ * NUM_ONION_TCP_CONNECTIONS, so only one member of a share has to keep onion
+ * relays open.
+ */
+non_null()
+static bool tcp_onion_conns_needed(const TCP_Connections *tcp_c)
+{
+    uint32_t available = tcp_c->onion_num_conns;
+    const TCP_Onion_Share *share = tcp_c->onion_share;
+
+    if (share != nullptr) {
+        for (uint32_t i = 0; i < share->members_length && available < NUM_ONION_TCP_CONNECTIONS; ++i) {
+            const TCP_Connections *member = share->members[i];
+
+            if (member != nullptr && member != tcp_c) {
+                available += member->onion_num_conns;
+            }
+        }
+    }
+
+    return available < NUM_ONION_TCP_CONNECTIONS;
+}
+
 non_null()
 static int tcp_relay_on_online(TCP_Connections *tcp_c, int tcp_connections_number)
 {
@@ -1282,7 +1489,7 @@ static int tcp_relay_on_online(TCP_Connections *tcp_c, int tcp_connections_numbe
         tcp_con->connected_time = 0;
     }
 
-    if (tcp_c->onion_status && tcp_c->onion_num_conns < NUM_ONION_TCP_CONNECTIONS) {
+    if (tcp_c->onion_status && tcp_onion_conns_needed(tcp_c)) {
         tcp_con->onion = true;
         ++tcp_c->onion_num_conns;
     }
@@ -1474,6 +1681,9 @@ static bool copy_tcp_relay_conn(const TCP_Connections *tcp_c, Node_format *tcp_r
 }
 
 /** @brief Copy a maximum of max_num TCP relays we are connected to to tcp_relays.
+ *
+ * Relays are copied best-ranked first (see `tcp_relay_score`), ties are
+ * broken by a random starting index.
  *
  * NOTE that the family of the copied ip ports will be set to TCP_INET or TCP_INET6.
  *
@@ -1482,15 +1692,51 @@ static bool copy_tcp_relay_conn(const TCP_Connections *tcp_c, Node_format *tcp_r
  */
 uint32_t tcp_copy_connected_relays(const TCP_Connections *tcp_c, Node_format *tcp_relays, uint16_t max_num)
 {
+    if (tcp_c->tcp_connections_length == 0) {
+        return 0;
+    }
+
     const uint32_t r = random_u32(tcp_c->rng);
     uint32_t copied = 0;
 
-    for (uint32_t i = 0; (i < tcp_c->tcp_connections_length) && (copied < max_num); ++i) {
-        const uint16_t idx = (i + r) % tcp_c->tcp_connections_length;
+    /* Selection by repeated minimum: max_num is small (a handful of relays). */
+    uint64_t prev_score = 0;
+    uint32_t prev_rank = 0;
 
-        if (copy_tcp_relay_conn(tcp_c, &tcp_relays[copied], idx)) {
-            ++copied;
+    while (copied < max_num) {
+        int best = -1;
+        uint64_t best_score = UINT64_MAX;
+        uint32_t best_rank = 0;
+
+        for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
+            const uint32_t idx = (i + r) % tcp_c->tcp_connections_length;
+            const TCP_con *tcp_con = get_tcp_connection(tcp_c, idx);
+
+            if (tcp_con == nullptr || tcp_con->status != TCP_CONN_CONNECTED) {
+                continue;
+            }
+
+            const uint64_t score = tcp_relay_score(tcp_con);
+
+            /* Skip relays already copied: everything ordered before (prev_score, prev_rank). */
+            if (copied > 0 && (score < prev_score || (score == prev_score && i <= prev_rank))) {
+                continue;
+            }
+
+            if (score < best_score) {
+                best = idx;
+                best_score = score;
+                best_rank = i;
+            }
         }
+
+        if (best == -1 || !copy_tcp_relay_conn(tcp_c, &tcp_relays[copied], best)) {
+            break;
+        }
+
+        prev_score = best_score;
+        prev_rank = best_rank;
+        ++copied;
     }
 
     return copied;
@@ -1531,22 +1777,35 @@ int set_tcp_onion_status(TCP_Connections *tcp_c, bool status)
     }
 
     if (status) {
-        for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
-            TCP_con *tcp_con = get_tcp_connection(tcp_c, i);
+        /* Hand the best-ranked connected relays to the onion first. */
+        while (tcp_onion_conns_needed(tcp_c)) {
+            TCP_con *best = nullptr;
+            uint64_t best_score = UINT64_MAX;
 
-            if (tcp_con != nullptr) {
-                if (tcp_con->status == TCP_CONN_CONNECTED && !tcp_con->onion) {
-                    ++tcp_c->onion_num_conns;
-                    tcp_con->onion = true;
+            for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
+                TCP_con *tcp_con = get_tcp_connection(tcp_c, i);
+
+                if (tcp_con == nullptr || tcp_con->status != TCP_CONN_CONNECTED || tcp_con->onion) {
+                    continue;
+                }
+
+                const uint64_t score = tcp_relay_score(tcp_con);
+
+                if (score < best_score) {
+                    best = tcp_con;
+                    best_score = score;
                 }
             }
 
-            if (tcp_c->onion_num_conns >= NUM_ONION_TCP_CONNECTIONS) {
+            if (best == nullptr) {
                 break;
             }
+
+            ++tcp_c->onion_num_conns;
+            best->onion = true;
         }
 
-        if (tcp_c->onion_num_conns < NUM_ONION_TCP_CONNECTIONS) {
+        if (tcp_onion_conns_needed(tcp_c)) {
             const unsigned int wakeup = NUM_ONION_TCP_CONNECTIONS - tcp_c->onion_num_conns;
 
             for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
@@ -1683,40 +1942,161 @@ static void kill_nonused_tcp(TCP_Connections *tcp_c)
     }
 
     const uint32_t max_kill_count = num_online - RECOMMENDED_FRIEND_TCP_CONNECTIONS;
-    uint32_t kill_count = 0;
 
-    for (uint32_t i = 0; i < tcp_c->tcp_connections_length && kill_count < max_kill_count; ++i) {
-        const TCP_con *tcp_con = get_tcp_connection(tcp_c, i);
+    /* Drop the worst-ranked unused relays first, so the fast ones stay connected. */
+    for (uint32_t kill_count = 0; kill_count < max_kill_count; ++kill_count) {
+        int worst = -1;
+        uint64_t worst_score = 0;
 
-        if (tcp_con == nullptr) {
-            continue;
-        }
+        for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
+            const TCP_con *tcp_con = get_tcp_connection(tcp_c, i);
+
+            if (tcp_con == nullptr || tcp_con->status != TCP_CONN_CONNECTED) {
+                continue;
+            }
 
-        if (tcp_con->status == TCP_CONN_CONNECTED) {
             if (tcp_con->onion || tcp_con->lock_count > 0) {  // connection is in use so we skip it
                 continue;
             }
 
-            if (mono_time_is_timeout(tcp_c->mono_time, tcp_con->connected_time, TCP_CONNECTION_ANNOUNCE_TIMEOUT)) {
-                kill_tcp_relay_connection(tcp_c, i);
-                ++kill_count;
+            if (!mono_time_is_timeout(tcp_c->mono_time, tcp_con->connected_time, TCP_CONNECTION_ANNOUNCE_TIMEOUT)) {
+                continue;
+            }
+
+            const uint64_t score = tcp_relay_score(tcp_con);
+
+            if (worst == -1 || score > worst_score) {
+                worst = i;
+                worst_score = score;
             }
         }
+
+        if (worst == -1) {
+            break;
+        }
+
+        kill_tcp_relay_connection(tcp_c, worst);
     }
 }
 
+/** @brief Take over onion duty if the share member that lent us relays dropped them. */
+non_null()
+static void tcp_onion_share_rebalance(TCP_Connections *tcp_c)
+{
+    if (tcp_c->onion_share == nullptr || !tcp_c->onion_status || !tcp_onion_conns_needed(tcp_c)) {
+        return;
+    }
+
+    tcp_c->onion_status = false;
+    set_tcp_onion_status(tcp_c, true);
+}
+
 void do_tcp_connections(const Logger *logger, TCP_Connections *tcp_c, void *userdata)
 {
     do_tcp_conns(logger, tcp_c, userdata);
+    tcp_onion_share_poll(tcp_c, userdata);
+    tcp_onion_share_rebalance(tcp_c);
     kill_nonused_tcp(tcp_c);
 }
 
+TCP_Onion_Share *new_tcp_onion_share(const Memory *mem)
+{
+    TCP_Onion_Share *share = (TCP_Onion_Share *)mem_alloc(mem, sizeof(TCP_Onion_Share));
+
+    if (share == nullptr) {
+        return nullptr;
+    }
+
+    share->mem = mem;
+    share->next_seq = 1;
+
+    return share;
+}
+
+void kill_tcp_onion_share(TCP_Onion_Share *share)
+{
+    if (share == nullptr) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < share->members_length; ++i) {
+        if (share->members[i] != nullptr) {
+            share->members[i]->onion_share = nullptr;
+        }
+    }
+
+    mem_delete(share->mem, share->members);
+    mem_delete(share->mem, share);
+}
+
+bool tcp_onion_share_join(TCP_Connections *tcp_c, TCP_Onion_Share *share)
+{
+    if (tcp_c->onion_share != nullptr) {
+        return false;
+    }
+
+    uint32_t index = share->members_length;
+
+    for (uint32_t i = 0; i < share->members_length; ++i) {
+        if (share->members[i] == nullptr) {
+            index = i;
+            break;
+        }
+    }
+
+    if (index == share->members_length) {
+        if (index >= TCP_ONION_SHARE_MAX_MEMBERS) {
+            return false;
+        }
+
+        TCP_Connections **members = (TCP_Connections **)mem_vrealloc(
+                                        share->mem, share->members, index + 1, sizeof(TCP_Connections *));
+
+        if (members == nullptr) {
+            return false;
+        }
+
+        share->members = members;
+        ++share->members_length;
+    }
+
+    share->members[index] = tcp_c;
+    tcp_c->onion_share = share;
+    tcp_c->onion_share_index = index;
+    tcp_c->onion_share_seen = share->next_seq - 1;
+
+    return true;
+}
+
+void tcp_onion_share_leave(TCP_Connections *tcp_c)
+{
+    TCP_Onion_Share *share = tcp_c->onion_share;
+
+    if (share == nullptr) {
+        return;
+    }
+
+    share->members[tcp_c->onion_share_index] = nullptr;
+    tcp_c->onion_share = nullptr;
+
+    while (share->members_length > 0 && share->members[share->members_length - 1] == nullptr) {
+        --share->members_length;
+    }
+
+    if (share->members_length == 0) {
+        mem_delete(share->mem, share->members);
+        share->members = nullptr;
+    }
+}
+
 void kill_tcp_connections(TCP_Connections *tcp_c)
 {
     if (tcp_c == nullptr) {
         return;
     }
 
+    tcp_onion_share_leave(tcp_c);
+
     for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
         kill_tcp_connection(tcp_c->tcp_connections[i].connection);
     }
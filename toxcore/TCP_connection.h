@@ -49,6 +49,16 @@
 /** Number of TCP connections used for onion purposes. */
 #define NUM_ONION_TCP_CONNECTIONS RECOMMENDED_FRIEND_TCP_CONNECTIONS
 
+/** RTT in milliseconds assumed for relays that have not been measured yet. */
+#define TCP_RELAY_UNKNOWN_RTT 1000
+
+/** @brief Milliseconds added to a relay's rank for each connection routed through it.
+ *
+ * Used when picking relays, to spread load instead of piling every friend onto
+ * the single fastest relay.
+ */
+#define TCP_RELAY_LOAD_PENALTY 50
+
 typedef struct TCP_Conn_to {
     uint32_t tcp_connection;
     uint8_t status;
@@ -80,6 +90,20 @@ typedef struct TCP_con {
 
 typedef struct TCP_Connections TCP_Connections;
 
+/** @brief A group of TCP_Connections that lend each other their onion relays.
+ *
+ * Onion requests and responses are not tied to the identity a relay connection
+ * was authenticated with, so the onion relays of one member can carry the
+ * onion traffic of all members. Only one member of a share needs to keep
+ * NUM_ONION_TCP_CONNECTIONS relays open for the onion; the others can let
+ * their relays sleep when no friend uses them. Friend (routed) traffic cannot
+ * be shared: the relay pairs routes by the public key each connection
+ * authenticated with.
+ *
+ * All members of a share must be driven from the same thread.
+ */
+typedef struct TCP_Onion_Share TCP_Onion_Share;
+
 non_null()
 const uint8_t *tcp_connections_public_key(const TCP_Connections *tcp_c);
 
@@ -317,4 +341,29 @@ void do_tcp_connections(const Logger *logger, TCP_Connections *tcp_c, void *user
 nullable(1)
 void kill_tcp_connections(TCP_Connections *tcp_c);
 
+/** @brief Create an empty onion relay share.
+ *
+ * Returns NULL on allocation failure.
+ */
+non_null()
+TCP_Onion_Share *new_tcp_onion_share(const Memory *mem);
+
+/** @brief Destroy a share, detaching any members still in it. */
+nullable(1)
+void kill_tcp_onion_share(TCP_Onion_Share *share);
+
+/** @brief Add tcp_c to the share.
+ *
+ * Returns false if tcp_c is already in a share or on allocation failure.
+ */
+non_null()
+bool tcp_onion_share_join(TCP_Connections *tcp_c, TCP_Onion_Share *share);
+
+/** @brief Remove tcp_c from its share, if any.
+ *
+ * Called automatically by `kill_tcp_connections`.
+ */
+non_null()
+void tcp_onion_share_leave(TCP_Connections *tcp_c);
+
 #endif /* C_TOXCORE_TOXCORE_TCP_CONNECTION_H */
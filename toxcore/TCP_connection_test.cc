@@ -2,9 +2,65 @@
 
 #include <gtest/gtest.h>
 
+#include <array>
+
+#include "crypto_core.h"
+#include "crypto_core_test_util.hh"
+#include "logger.h"
+#include "mem_test_util.hh"
+#include "mono_time.h"
+#include "network_test_util.hh"
+
 namespace {
 
 // TODO(Jfreegman) make this useful or remove it after NGC is merged
 TEST(TCP_connection, NullTest) { (void)tcp_send_oob_packet_using_relay; }
 
+TEST(TCP_connection, OnionShareJoinAndLeave)
+{
+    Test_Random rng;
+    Test_Memory mem;
+    Test_Network ns;
+
+    Logger *log = logger_new(mem);
+    ASSERT_NE(log, nullptr);
+    Mono_Time *mono_time = mono_time_new(mem, nullptr, nullptr);
+    ASSERT_NE(mono_time, nullptr);
+
+    const TCP_Proxy_Info proxy_info{};
+    std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE> pk;
+    std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> sk;
+
+    crypto_new_keypair(rng, pk.data(), sk.data());
+    TCP_Connections *tc_1 = new_tcp_connections(log, mem, rng, ns, mono_time, sk.data(), &proxy_info);
+    ASSERT_NE(tc_1, nullptr);
+    crypto_new_keypair(rng, pk.data(), sk.data());
+    TCP_Connections *tc_2 = new_tcp_connections(log, mem, rng, ns, mono_time, sk.data(), &proxy_info);
+    ASSERT_NE(tc_2, nullptr);
+
+    TCP_Onion_Share *share = new_tcp_onion_share(mem);
+    ASSERT_NE(share, nullptr);
+
+    EXPECT_TRUE(tcp_onion_share_join(tc_1, share));
+    EXPECT_FALSE(tcp_onion_share_join(tc_1, share));
+    EXPECT_TRUE(tcp_onion_share_join(tc_2, share));
+
+    // Nobody has connected relays yet, so there is nothing to lend.
+    EXPECT_EQ(get_random_tcp_onion_conn_number(tc_1), -1);
+    EXPECT_EQ(get_random_tcp_onion_conn_number(tc_2), -1);
+
+    // A member can leave and join again.
+    tcp_onion_share_leave(tc_1);
+    EXPECT_TRUE(tcp_onion_share_join(tc_1, share));
+
+    // Killing a member removes it from the share, killing the share detaches
+    // the remaining members.
+    kill_tcp_connections(tc_2);
+    kill_tcp_onion_share(share);
+    kill_tcp_connections(tc_1);
+
+    mono_time_free(mem, mono_time);
+    logger_kill(log);
+}
+
 }  // namespace
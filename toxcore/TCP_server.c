@@ -90,6 +90,9 @@ struct TCP_Server {
 
     uint64_t counter;
 
+    /* Whether a connection still had unsent output after the last `do_tcp_server`. */
+    bool pending_output;
+
     BS_List accepted_key_list;
 };
 
@@ -106,6 +109,25 @@ size_t tcp_server_listen_count(const TCP_Server *tcp_server)
     return tcp_server->num_listening_socks;
 }
 
+uint32_t tcp_server_num_connections(const TCP_Server *tcp_server)
+{
+    return tcp_server->num_accepted_connections;
+}
+
+bool tcp_server_has_pending_output(const TCP_Server *tcp_server)
+{
+    return tcp_server->pending_output;
+}
+
+int tcp_server_event_fd(const TCP_Server *tcp_server)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+    return tcp_server->efd;
+#else
+    return -1;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
 /** This is needed to compile on Android below API 21 */
 #ifdef TCP_SERVER_USE_EPOLL
 #ifndef EPOLLRDHUP
@@ -1111,7 +1133,7 @@ static int do_unconfirmed(TCP_Server *tcp_server, const Mono_Time *mono_time, ui
 
     LOGGER_TRACE(tcp_server->logger, "handling unconfirmed TCP connection %d", i);
 
-    uint8_t packet[MAX_PACKET_SIZE];
+    uint8_t packet[MAX_PACKET_SIZE + CRYPTO_MAC_SIZE];
     const int len = read_packet_tcp_secure_connection(tcp_server->logger, conn->con.mem, conn->con.ns, conn->con.sock, &conn->next_packet_length, conn->con.shared_key, conn->recv_nonce, packet,
                     sizeof(packet), &conn->con.ip_port);
 
@@ -1132,7 +1154,7 @@ static bool tcp_process_secure_packet(TCP_Server *tcp_server, uint32_t i)
 {
     TCP_Secure_Connection *const conn = &tcp_server->accepted_connection_array[i];
 
-    uint8_t packet[MAX_PACKET_SIZE];
+    uint8_t packet[MAX_PACKET_SIZE + CRYPTO_MAC_SIZE];
     const int len = read_packet_tcp_secure_connection(tcp_server->logger, conn->con.mem, conn->con.ns, conn->con.sock, &conn->next_packet_length, conn->con.shared_key, conn->recv_nonce, packet,
                     sizeof(packet), &conn->con.ip_port);
     LOGGER_TRACE(tcp_server->logger, "processing packet for %d: %d", i, len);
@@ -1375,6 +1397,29 @@ static void do_tcp_epoll(TCP_Server *tcp_server, const Mono_Time *mono_time)
 }
 #endif /* TCP_SERVER_USE_EPOLL */
 
+/** @brief Retries sending the output that connections couldn't send right away.
+ *
+ * With epoll, `do_tcp_confirmed` only runs once per second, so without this a
+ * connection that hit backpressure would wait that long for its next write.
+ */
+non_null()
+static void do_tcp_pending(TCP_Server *tcp_server)
+{
+    tcp_server->pending_output = false;
+
+    for (uint32_t i = 0; i < tcp_server->size_accepted_connections; ++i) {
+        TCP_Secure_Connection *conn = &tcp_server->accepted_connection_array[i];
+
+        if (conn->status != TCP_STATUS_CONFIRMED) {
+            continue;
+        }
+
+        if (send_pending_data(tcp_server->logger, &conn->con) == -1) {
+            tcp_server->pending_output = true;
+        }
+    }
+}
+
 void do_tcp_server(TCP_Server *tcp_server, const Mono_Time *mono_time)
 {
 #ifdef TCP_SERVER_USE_EPOLL
@@ -1387,6 +1432,7 @@ void do_tcp_server(TCP_Server *tcp_server, const Mono_Time *mono_time)
 #endif /* TCP_SERVER_USE_EPOLL */
 
     do_tcp_confirmed(tcp_server, mono_time);
+    do_tcp_pending(tcp_server);
 }
 
 void kill_tcp_server(TCP_Server *tcp_server)
@@ -37,6 +37,28 @@ non_null()
 const uint8_t *tcp_server_public_key(const TCP_Server *tcp_server);
 non_null()
 size_t tcp_server_listen_count(const TCP_Server *tcp_server);
+/** @brief Number of clients that completed the handshake and are connected. */
+non_null()
+uint32_t tcp_server_num_connections(const TCP_Server *tcp_server);
+
+/** @brief Whether some connection couldn't send all of its output in the last `do_tcp_server`.
+ *
+ * The rest goes out in the next `do_tcp_server`, but nothing wakes a caller
+ * waiting on `tcp_server_event_fd` when the socket becomes writable again, so
+ * such a caller should not wait long while this is true.
+ */
+non_null()
+bool tcp_server_has_pending_output(const TCP_Server *tcp_server);
+
+/** @brief Descriptor that becomes readable when `do_tcp_server` has socket events to handle.
+ *
+ * This is the server's epoll descriptor, so it can be added to the caller's
+ * own epoll set or poll()ed.
+ *
+ * @retval -1 if the server was built without epoll and has to be polled.
+ */
+non_null()
+int tcp_server_event_fd(const TCP_Server *tcp_server);
 
 /** Create new TCP server instance. */
 non_null(1, 2, 3, 4, 7, 8) nullable(9, 10)
@@ -49,11 +49,42 @@ uint8_t announce_response_of_request_type(uint8_t request_type)
     }
 }
 
+/* Announcement data is kept in slabs of ANNOUNCE_SLAB_CHUNKS chunks of one
+ * size class each, from ANNOUNCE_MIN_CHUNK_SIZE up to MAX_ANNOUNCEMENT_SIZE.
+ */
+#define ANNOUNCE_SLAB_CHUNKS 8
+#define ANNOUNCE_SIZE_CLASSES 4
+#define ANNOUNCE_MIN_CHUNK_SIZE 64
+#define ANNOUNCE_SLAB_FULL ((uint8_t)((1U << ANNOUNCE_SLAB_CHUNKS) - 1))
+
+#define NO_ENTRY UINT16_MAX
+
+static_assert(ANNOUNCE_MIN_CHUNK_SIZE << (ANNOUNCE_SIZE_CLASSES - 1) == MAX_ANNOUNCEMENT_SIZE,
+              "the largest size class must hold a maximum size announcement");
+static_assert(ANNOUNCE_MIN_MEMORY_BUDGET == MAX_ANNOUNCEMENT_SIZE * ANNOUNCE_SLAB_CHUNKS,
+              "the minimum budget must fit one slab of the largest size class");
+
+typedef struct Announce_Slab Announce_Slab;
+
+struct Announce_Slab {
+    Announce_Slab *prev;
+    Announce_Slab *next;
+    uint8_t *chunks;
+    uint8_t size_class;
+    /* Bit i is set if chunk i is in use. */
+    uint8_t used;
+};
+
 typedef struct Announce_Entry {
     uint64_t store_until;
     uint8_t data_public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint8_t *data;
     uint32_t length;
+
+    /* Slab holding data, and the neighbours in the least recently stored list. */
+    Announce_Slab *slab;
+    uint16_t lru_prev;
+    uint16_t lru_next;
 } Announce_Entry;
 
 struct Announcements {
@@ -75,6 +106,19 @@ struct Announcements {
     uint64_t start_time;
 
     Announce_Entry entries[ANNOUNCE_BUCKETS * ANNOUNCE_BUCKET_SIZE];
+
+    /* Slabs with a free chunk and full slabs, per size class. */
+    Announce_Slab *partial_slabs[ANNOUNCE_SIZE_CLASSES];
+    Announce_Slab *full_slabs[ANNOUNCE_SIZE_CLASSES];
+    uint32_t memory_bytes;
+    uint32_t memory_budget;
+
+    /* Entries holding data, from least to most recently stored. */
+    uint16_t lru_oldest;
+    uint16_t lru_newest;
+
+    uint64_t evictions;
+    uint64_t rejected;
 };
 
 void announce_set_synch_offset(Announcements *announce, int32_t synch_offset)
@@ -92,12 +136,364 @@ static bool entry_is_empty(const Announcements *announce, const Announce_Entry *
     return mono_time_get(announce->mono_time) >= entry->store_until;
 }
 
+static uint32_t slab_bytes(uint8_t size_class)
+{
+    return (ANNOUNCE_MIN_CHUNK_SIZE << size_class) * ANNOUNCE_SLAB_CHUNKS;
+}
+
+non_null()
+static void slab_list_push(Announce_Slab **head, Announce_Slab *slab)
+{
+    slab->prev = nullptr;
+    slab->next = *head;
+
+    if (*head != nullptr) {
+        (*head)->prev = slab;
+    }
+
+    *head = slab;
+}
+
 non_null()
-static void delete_entry(Announce_Entry *entry)
+static void slab_list_unlink(Announce_Slab **head, Announce_Slab *slab)
 {
+    if (slab->prev != nullptr) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+
+    if (slab->next != nullptr) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/** @brief Take a chunk of the size class from a slab that has one free. */
+non_null()
+static uint8_t *chunk_alloc(Announcements *announce, uint8_t size_class, Announce_Slab **slab_out)
+{
+    Announce_Slab *slab = announce->partial_slabs[size_class];
+
+    if (slab == nullptr) {
+        return nullptr;
+    }
+
+    uint8_t i = 0;
+
+    while ((slab->used & (1U << i)) != 0) {
+        ++i;
+    }
+
+    slab->used |= (uint8_t)(1U << i);
+
+    if (slab->used == ANNOUNCE_SLAB_FULL) {
+        slab_list_unlink(&announce->partial_slabs[size_class], slab);
+        slab_list_push(&announce->full_slabs[size_class], slab);
+    }
+
+    *slab_out = slab;
+    return &slab->chunks[i * (ANNOUNCE_MIN_CHUNK_SIZE << size_class)];
+}
+
+/** @brief Return a chunk to its slab, and the slab to the system once it is empty. */
+non_null()
+static void chunk_free(Announcements *announce, Announce_Slab *slab, const uint8_t *chunk)
+{
+    const uint8_t size_class = slab->size_class;
+    const uint8_t i = (chunk - slab->chunks) / (ANNOUNCE_MIN_CHUNK_SIZE << size_class);
+
+    if (slab->used == ANNOUNCE_SLAB_FULL) {
+        slab_list_unlink(&announce->full_slabs[size_class], slab);
+        slab_list_push(&announce->partial_slabs[size_class], slab);
+    }
+
+    slab->used &= (uint8_t)~(1U << i);
+
+    if (slab->used == 0) {
+        slab_list_unlink(&announce->partial_slabs[size_class], slab);
+        announce->memory_bytes -= slab_bytes(size_class);
+        mem_delete(announce->mem, slab->chunks);
+        mem_delete(announce->mem, slab);
+    }
+}
+
+non_null()
+static bool slab_new(Announcements *announce, uint8_t size_class)
+{
+    Announce_Slab *slab = (Announce_Slab *)mem_alloc(announce->mem, sizeof(Announce_Slab));
+
+    if (slab == nullptr) {
+        return false;
+    }
+
+    slab->chunks = (uint8_t *)mem_balloc(announce->mem, slab_bytes(size_class));
+
+    if (slab->chunks == nullptr) {
+        mem_delete(announce->mem, slab);
+        return false;
+    }
+
+    slab->size_class = size_class;
+    slab->used = 0;
+    slab_list_push(&announce->partial_slabs[size_class], slab);
+    announce->memory_bytes += slab_bytes(size_class);
+
+    return true;
+}
+
+non_null()
+static uint16_t entry_index(const Announcements *announce, const Announce_Entry *entry)
+{
+    return (uint16_t)(entry - announce->entries);
+}
+
+non_null()
+static void lru_unlink(Announcements *announce, Announce_Entry *entry)
+{
+    if (entry->lru_prev != NO_ENTRY) {
+        announce->entries[entry->lru_prev].lru_next = entry->lru_next;
+    } else {
+        announce->lru_oldest = entry->lru_next;
+    }
+
+    if (entry->lru_next != NO_ENTRY) {
+        announce->entries[entry->lru_next].lru_prev = entry->lru_prev;
+    } else {
+        announce->lru_newest = entry->lru_prev;
+    }
+}
+
+non_null()
+static void lru_push(Announcements *announce, Announce_Entry *entry)
+{
+    const uint16_t index = entry_index(announce, entry);
+
+    entry->lru_prev = announce->lru_newest;
+    entry->lru_next = NO_ENTRY;
+
+    if (announce->lru_newest != NO_ENTRY) {
+        announce->entries[announce->lru_newest].lru_next = index;
+    } else {
+        announce->lru_oldest = index;
+    }
+
+    announce->lru_newest = index;
+}
+
+/** @brief Mark an entry's data as the most recently stored. */
+non_null()
+static void lru_touch(Announcements *announce, Announce_Entry *entry)
+{
+    if (entry->data != nullptr) {
+        lru_unlink(announce, entry);
+        lru_push(announce, entry);
+    }
+}
+
+non_null()
+static void release_data(Announcements *announce, Announce_Entry *entry)
+{
+    if (entry->data == nullptr) {
+        return;
+    }
+
+    lru_unlink(announce, entry);
+    chunk_free(announce, entry->slab, entry->data);
+    entry->data = nullptr;
+    entry->slab = nullptr;
+}
+
+non_null()
+static void delete_entry(Announcements *announce, Announce_Entry *entry)
+{
+    release_data(announce, entry);
     entry->store_until = 0;
 }
 
+/** @brief Whether an entry may make room for data stored under a key that
+ * differs from ours at bit `distance`: it has timed out or is farther from us.
+ */
+non_null()
+static bool entry_is_evictable(const Announcements *announce, const Announce_Entry *entry, unsigned int distance)
+{
+    return entry_is_empty(announce, entry) || bit_by_bit_cmp(announce->public_key, entry->data_public_key) < distance;
+}
+
+non_null()
+static bool entry_is_alone_in_slab(const Announce_Entry *entry)
+{
+    return (entry->slab->used & (entry->slab->used - 1)) == 0;
+}
+
+non_null()
+static void evict(Announcements *announce, Announce_Entry *entry)
+{
+    if (entry_is_empty(announce, entry)) {
+        release_data(announce, entry);
+    } else {
+        delete_entry(announce, entry);
+        ++announce->evictions;
+    }
+}
+
+/** @brief Pick the least recently stored entry that has timed out, or failing
+ * that the least recently stored evictable one. If `size_class` is
+ * ANNOUNCE_SIZE_CLASSES, only entries whose eviction empties their slab are
+ * considered, otherwise only entries of that size class.
+ *
+ * @return nullptr if there is no such entry.
+ */
+non_null()
+static Announce_Entry *pick_victim(Announcements *announce, uint8_t size_class, unsigned int distance)
+{
+    Announce_Entry *victim = nullptr;
+
+    for (uint16_t i = announce->lru_oldest; i != NO_ENTRY; i = announce->entries[i].lru_next) {
+        Announce_Entry *const entry = &announce->entries[i];
+
+        if (size_class == ANNOUNCE_SIZE_CLASSES
+                ? !entry_is_alone_in_slab(entry)
+                : entry->slab->size_class != size_class) {
+            continue;
+        }
+
+        if (entry_is_empty(announce, entry)) {
+            return entry;
+        }
+
+        if (victim == nullptr && entry_is_evictable(announce, entry, distance)) {
+            victim = entry;
+        }
+    }
+
+    return victim;
+}
+
+/** @brief Evict entries that are alone in their slab until `needed` bytes are
+ * freed. Evicts nothing if that isn't possible.
+ *
+ * @return true if enough was freed.
+ */
+non_null()
+static bool evict_slabs(Announcements *announce, uint32_t needed, unsigned int distance)
+{
+    uint32_t freeable = 0;
+
+    for (uint16_t i = announce->lru_oldest; i != NO_ENTRY; i = announce->entries[i].lru_next) {
+        const Announce_Entry *const entry = &announce->entries[i];
+
+        if (entry_is_alone_in_slab(entry) && entry_is_evictable(announce, entry, distance)) {
+            freeable += slab_bytes(entry->slab->size_class);
+        }
+    }
+
+    if (freeable < needed) {
+        return false;
+    }
+
+    uint32_t freed = 0;
+
+    while (freed < needed) {
+        Announce_Entry *const victim = pick_victim(announce, ANNOUNCE_SIZE_CLASSES, distance);
+        assert(victim != nullptr);
+
+        freed += slab_bytes(victim->slab->size_class);
+        evict(announce, victim);
+    }
+
+    return true;
+}
+
+/** @brief Allocate room for length bytes of data, evicting entries to stay
+ * within the memory budget if needed.
+ *
+ * Room is made by evicting one entry of the same size class, which frees a
+ * chunk. Only if there is none, entries of other size classes are evicted, and
+ * only ones that empty their slab, so that each eviction frees memory.
+ */
+non_null()
+static uint8_t *data_alloc(Announcements *announce, uint32_t length, const uint8_t *data_public_key,
+                           Announce_Slab **slab_out)
+{
+    const unsigned int distance = bit_by_bit_cmp(announce->public_key, data_public_key);
+    uint8_t size_class = 0;
+
+    while ((uint32_t)(ANNOUNCE_MIN_CHUNK_SIZE << size_class) < length) {
+        ++size_class;
+    }
+
+    uint8_t *chunk = chunk_alloc(announce, size_class, slab_out);
+
+    if (chunk != nullptr) {
+        return chunk;
+    }
+
+    const uint32_t needed = announce->memory_bytes + slab_bytes(size_class);
+
+    if (needed > announce->memory_budget) {
+        Announce_Entry *const victim = pick_victim(announce, size_class, distance);
+
+        if (victim != nullptr) {
+            /* All slabs of the size class are full, so this frees a chunk. */
+            evict(announce, victim);
+            return chunk_alloc(announce, size_class, slab_out);
+        }
+
+        if (!evict_slabs(announce, needed - announce->memory_budget, distance)) {
+            ++announce->rejected;
+            return nullptr;
+        }
+    }
+
+    if (!slab_new(announce, size_class)) {
+        return nullptr;
+    }
+
+    return chunk_alloc(announce, size_class, slab_out);
+}
+
+void announce_set_memory_budget(Announcements *announce, uint32_t memory_budget)
+{
+    announce->memory_budget = max_u32(memory_budget, ANNOUNCE_MIN_MEMORY_BUDGET);
+
+    /* Only evictions that empty a slab lower memory_bytes, so stop once there
+     * are none left rather than deleting entries for nothing.
+     */
+    while (announce->memory_bytes > announce->memory_budget) {
+        /* Farther than any key, so every entry is evictable. */
+        Announce_Entry *const victim = pick_victim(announce, ANNOUNCE_SIZE_CLASSES, CRYPTO_PUBLIC_KEY_SIZE * 8 + 1);
+
+        if (victim == nullptr) {
+            break;
+        }
+
+        evict(announce, victim);
+    }
+}
+
+void announce_get_stats(const Announcements *announce, Announce_Stats *stats)
+{
+    stats->entries = 0;
+    stats->data_bytes = 0;
+
+    for (uint32_t i = 0; i < ANNOUNCE_BUCKETS * ANNOUNCE_BUCKET_SIZE; ++i) {
+        const Announce_Entry *const entry = &announce->entries[i];
+
+        if (!entry_is_empty(announce, entry)) {
+            ++stats->entries;
+
+            if (entry->data != nullptr) {
+                stats->data_bytes += entry->length;
+            }
+        }
+    }
+
+    stats->memory_bytes = announce->memory_bytes;
+    stats->memory_budget = announce->memory_budget;
+    stats->evictions = announce->evictions;
+    stats->rejected = announce->rejected;
+}
+
 /** Return bits (at most 8) from pk starting at index as uint8_t */
 non_null()
 static uint8_t truncate_pk_at_index(const uint8_t *pk, uint16_t index, uint16_t bits)
@@ -239,17 +635,22 @@ bool announce_store_data(Announcements *announce, const uint8_t *data_public_key
     if (length > 0) {
         assert(data != nullptr);
 
-        free(entry->data);
+        release_data(announce, entry);
 
-        uint8_t *entry_data = (uint8_t *)malloc(length);
+        Announce_Slab *slab;
+        uint8_t *entry_data = data_alloc(announce, length, data_public_key, &slab);
 
         if (entry_data == nullptr) {
-            entry->data = nullptr;  // TODO(iphydf): Is this necessary?
+            delete_entry(announce, entry);
             return false;
         }
 
         memcpy(entry_data, data, length);
         entry->data = entry_data;
+        entry->slab = slab;
+        lru_push(announce, entry);
+    } else {
+        lru_touch(announce, entry);
     }
 
     entry->length = length;
@@ -490,10 +891,11 @@ static int create_reply_plain_store_announce_request(Announcements *announce,
         crypto_sha256(stored_hash, stored->data, stored->length);
 
         if (!crypto_sha256_eq(announcement, stored_hash)) {
-            delete_entry(stored);
+            delete_entry(announce, stored);
             return -1;
         } else {
             stored->store_until = mono_time_get(announce->mono_time) + timeout;
+            lru_touch(announce, stored);
         }
     } else {
         if (!announce_store_data(announce, data_public_key, announcement, announcement_len, timeout)) {
@@ -674,6 +1076,9 @@ Announcements *new_announcements(const Logger *log, const Memory *mem, const Ran
     }
 
     announce->start_time = mono_time_get(announce->mono_time);
+    announce->memory_budget = ANNOUNCE_DEFAULT_MEMORY_BUDGET;
+    announce->lru_oldest = NO_ENTRY;
+    announce->lru_newest = NO_ENTRY;
 
     set_callback_forwarded_request(forwarding, forwarded_request_callback, announce);
 
@@ -700,7 +1105,7 @@ void kill_announcements(Announcements *announce)
     shared_key_cache_free(announce->shared_keys);
 
     for (uint32_t i = 0; i < ANNOUNCE_BUCKETS * ANNOUNCE_BUCKET_SIZE; ++i) {
-        free(announce->entries[i].data);
+        release_data(announce, &announce->entries[i]);
     }
 
     free(announce);
@@ -38,6 +38,42 @@ bool announce_on_stored(const Announcements *announce, const uint8_t *data_publi
 non_null()
 void announce_set_synch_offset(Announcements *announce, int32_t synch_offset);
 
+#define ANNOUNCE_DEFAULT_MEMORY_BUDGET (128 * 1024)
+#define ANNOUNCE_MIN_MEMORY_BUDGET (4 * 1024)
+
+/**
+ * @brief Set how many bytes of memory the stored announcement data may take up.
+ *
+ * Data is kept in slabs of fixed size chunks, and the budget counts the whole
+ * slabs. When a store would exceed it, an entry of the same chunk size is
+ * evicted: one that timed out if possible, else the least recently stored one
+ * that is farther from our DHT key than the key being stored. If there is none,
+ * entries of other chunk sizes are evicted the same way, but only ones alone
+ * in their slab, and only if that frees enough. Otherwise the store is refused.
+ * Lowering the budget evicts entries that are alone in their slab right away
+ * until it is met or there are none left. Values below
+ * ANNOUNCE_MIN_MEMORY_BUDGET are raised to it.
+ */
+non_null()
+void announce_set_memory_budget(Announcements *announce, uint32_t memory_budget);
+
+typedef struct Announce_Stats {
+    /** Stored announcements that have not timed out. */
+    uint32_t entries;
+    /** Bytes of announcement data in those entries. */
+    uint32_t data_bytes;
+    /** Bytes of slab memory allocated for announcement data. */
+    uint32_t memory_bytes;
+    uint32_t memory_budget;
+    /** Live entries evicted to stay within the memory budget. */
+    uint64_t evictions;
+    /** Stores refused because nothing could be evicted. */
+    uint64_t rejected;
+} Announce_Stats;
+
+non_null()
+void announce_get_stats(const Announcements *announce, Announce_Stats *stats);
+
 nullable(1)
 void kill_announcements(Announcements *announce);
 
@@ -430,6 +430,9 @@ int32_t encrypt_precompute(const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE],
  * using a shared key @ref CRYPTO_SHARED_KEY_SIZE big and a @ref CRYPTO_NONCE_SIZE
  * byte nonce.
  *
+ * `plain` and `encrypted` may overlap. Placing the plaintext at
+ * `encrypted + CRYPTO_MAC_SIZE` encrypts it in place.
+ *
  * @retval -1 if there was a problem.
  * @return length of encrypted data if everything was fine.
  */
@@ -446,6 +449,9 @@ int32_t encrypt_data_symmetric(const Memory *mem,
  * `length - CRYPTO_MAC_SIZE` using a shared key @ref CRYPTO_SHARED_KEY_SIZE
  * big and a @ref CRYPTO_NONCE_SIZE byte nonce.
  *
+ * `plain` and `encrypted` may overlap, so a packet can be decrypted in place
+ * by passing the same buffer for both.
+ *
  * @retval -1 if there was a problem (decryption failed).
  * @return length of plain data if everything was fine.
  */
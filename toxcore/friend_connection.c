@@ -18,12 +18,14 @@
 #include "ccompat.h"
 #include "crypto_core.h"
 #include "logger.h"
+#include "mem.h"
 #include "mono_time.h"
 #include "net_crypto.h"
 #include "network.h"
 #include "onion.h"
 #include "onion_announce.h"
 #include "onion_client.h"
+#include "pk_index.h"
 #include "util.h"
 
 #define PORTS_PER_DISCOVERY 10
@@ -63,6 +65,8 @@ struct Friend_Conn {
     uint32_t tcp_relay_share_index;
 
     bool hosting_tcp_relay;
+
+    Friend_Conn_Timing timing;
 };
 
 static const Friend_Conn empty_friend_conn = {0};
@@ -77,6 +81,8 @@ struct Friend_Connections {
 
     Friend_Conn *conns;
     uint32_t num_cons;
+    uint32_t conns_capacity;  // allocated length of conns
+    Pk_Index *conn_index;  // real public key -> friendcon_id
 
     fr_request_cb *fr_request_callback;
     void *fr_request_object;
@@ -128,6 +134,7 @@ static bool realloc_friendconns(Friend_Connections *fr_c, uint32_t num)
     if (num == 0) {
         free(fr_c->conns);
         fr_c->conns = nullptr;
+        fr_c->conns_capacity = 0;
         return true;
     }
 
@@ -138,6 +145,7 @@ static bool realloc_friendconns(Friend_Connections *fr_c, uint32_t num)
     }
 
     fr_c->conns = newgroup_cons;
+    fr_c->conns_capacity = num;
     return true;
 }
 
@@ -149,13 +157,17 @@ static bool realloc_friendconns(Friend_Connections *fr_c, uint32_t num)
 non_null()
 static int create_friend_conn(Friend_Connections *fr_c)
 {
-    for (uint32_t i = 0; i < fr_c->num_cons; ++i) {
-        if (fr_c->conns[i].status == FRIENDCONN_STATUS_NONE) {
-            return i;
+    // Every connection is in the index, so only look for a free slot if
+    // there is one.
+    if (pk_index_size(fr_c->conn_index) < fr_c->num_cons) {
+        for (uint32_t i = 0; i < fr_c->num_cons; ++i) {
+            if (fr_c->conns[i].status == FRIENDCONN_STATUS_NONE) {
+                return i;
+            }
         }
     }
 
-    if (!realloc_friendconns(fr_c, fr_c->num_cons + 1)) {
+    if (fr_c->num_cons == fr_c->conns_capacity && !realloc_friendconns(fr_c, fr_c->num_cons + 1)) {
         return -1;
     }
 
@@ -178,6 +190,7 @@ static int wipe_friend_conn(Friend_Connections *fr_c, int friendcon_id)
         return -1;
     }
 
+    pk_index_remove(fr_c->conn_index, fr_c->conns[friendcon_id].real_public_key, friendcon_id);
     fr_c->conns[friendcon_id] = empty_friend_conn;
 
     uint32_t i;
@@ -211,17 +224,7 @@ Friend_Conn *get_conn(const Friend_Connections *fr_c, int friendcon_id)
  */
 int getfriend_conn_id_pk(const Friend_Connections *fr_c, const uint8_t *real_pk)
 {
-    for (uint32_t i = 0; i < fr_c->num_cons; ++i) {
-        const Friend_Conn *friend_con = get_conn(fr_c, i);
-
-        if (friend_con != nullptr) {
-            if (pk_equal(friend_con->real_public_key, real_pk)) {
-                return i;
-            }
-        }
-    }
-
-    return -1;
+    return pk_index_find(fr_c->conn_index, real_pk);
 }
 
 /** @brief Add a TCP relay associated to the friend.
@@ -349,11 +352,10 @@ static int tcp_relay_node_callback(void *object, uint32_t number, const IP_Port
 non_null()
 static int friend_new_connection(Friend_Connections *fr_c, int friendcon_id);
 
-/** Callback for DHT ip_port changes. */
+/** Try to connect directly to the friend at the ip_port their DHT instance is at. */
 non_null()
-static void dht_ip_callback(void *object, int32_t number, const IP_Port *ip_port)
+static void friend_set_ip_port(Friend_Connections *fr_c, int32_t number, const IP_Port *ip_port)
 {
-    Friend_Connections *const fr_c = (Friend_Connections *)object;
     Friend_Conn *const friend_con = get_conn(fr_c, number);
 
     if (friend_con == nullptr) {
@@ -374,6 +376,21 @@ static void dht_ip_callback(void *object, int32_t number, const IP_Port *ip_port
     }
 }
 
+/** Callback for DHT ip_port changes, called when the friend's DHT instance reached us directly. */
+non_null()
+static void dht_ip_callback(void *object, int32_t number, const IP_Port *ip_port)
+{
+    Friend_Connections *const fr_c = (Friend_Connections *)object;
+
+    friend_set_ip_port(fr_c, number, ip_port);
+
+    Friend_Conn *const friend_con = get_conn(fr_c, number);
+
+    if (friend_con != nullptr && friend_con->timing.udp_found == 0) {
+        friend_con->timing.udp_found = mono_time_get_ms(fr_c->mono_time);
+    }
+}
+
 non_null()
 static void change_dht_pk(Friend_Connections *fr_c, int friendcon_id, const uint8_t *dht_public_key)
 {
@@ -397,6 +414,17 @@ static void change_dht_pk(Friend_Connections *fr_c, int friendcon_id, const uint
     memcpy(friend_con->dht_temp_pk, dht_public_key, CRYPTO_PUBLIC_KEY_SIZE);
 }
 
+/** @brief Start timing a new connection attempt. A DHT key we still have counts as found right away. */
+non_null()
+static void timing_restart(const Friend_Connections *fr_c, Friend_Conn *friend_con)
+{
+    const uint64_t now = mono_time_get_ms(fr_c->mono_time);
+
+    friend_con->timing.connecting_since = now;
+    friend_con->timing.dht_pk_found = friend_con->dht_lock_token > 0 ? now : 0;
+    friend_con->timing.udp_found = 0;
+}
+
 non_null()
 static int handle_status(void *object, int id, bool status, void *userdata)
 {
@@ -420,6 +448,7 @@ static int handle_status(void *object, int id, bool status, void *userdata)
             status_changed = true;
             friend_con->dht_pk_lastrecv = mono_time_get(fr_c->mono_time);
             onion_set_friend_online(fr_c->onion_c, friend_con->onion_friendnum, status);
+            timing_restart(fr_c, friend_con);
         }
 
         friend_con->status = FRIENDCONN_STATUS_CONNECTING;
@@ -470,6 +499,10 @@ static void dht_pk_callback(void *object, int32_t number, const uint8_t *dht_pub
 
     friend_new_connection(fr_c, number);
     onion_set_friend_dht_pubkey(fr_c->onion_c, friend_con->onion_friendnum, dht_public_key);
+
+    if (friend_con->timing.dht_pk_found == 0) {
+        friend_con->timing.dht_pk_found = mono_time_get_ms(fr_c->mono_time);
+    }
 }
 
 non_null()
@@ -690,6 +723,29 @@ unsigned int friend_con_connected(const Friend_Connections *fr_c, int friendcon_
     return friend_con->status;
 }
 
+bool friend_connection_timing(const Friend_Connections *fr_c, int friendcon_id, Friend_Conn_Timing *timing)
+{
+    const Friend_Conn *const friend_con = get_conn(fr_c, friendcon_id);
+
+    if (friend_con == nullptr) {
+        return false;
+    }
+
+    *timing = friend_con->timing;
+
+    // The DHT only knows since when nodes have been reporting an address. If
+    // that was before this attempt started, it was known from the start.
+    if (friend_con->dht_lock_token > 0) {
+        const uint64_t info_since = dht_friend_info_since(fr_c->dht, friend_con->dht_temp_pk);
+
+        if (info_since != 0) {
+            timing->dht_info_found = max_u64(info_since, timing->connecting_since);
+        }
+    }
+
+    return true;
+}
+
 /** @brief Copy public keys associated to friendcon_id.
  *
  * @retval 0 on success.
@@ -720,6 +776,11 @@ void set_dht_temp_pk(Friend_Connections *fr_c, int friendcon_id, const uint8_t *
     dht_pk_callback(fr_c, friendcon_id, dht_temp_pk, userdata);
 }
 
+void set_dht_ip_port(Friend_Connections *fr_c, int friendcon_id, const IP_Port *ip_port)
+{
+    friend_set_ip_port(fr_c, friendcon_id, ip_port);
+}
+
 /** @brief Set the callbacks for the friend connection.
  * @param index is the index (0 to (MAX_FRIEND_CONNECTION_CALLBACKS - 1)) we
  *   want the callback to set in the array.
@@ -813,12 +874,18 @@ int new_friend_connection(Friend_Connections *fr_c, const uint8_t *real_public_k
         return -1;
     }
 
+    if (!pk_index_add(fr_c->conn_index, real_public_key, friendcon_id)) {
+        onion_delfriend(fr_c->onion_c, onion_friendnum);
+        return -1;
+    }
+
     Friend_Conn *const friend_con = &fr_c->conns[friendcon_id];
 
     friend_con->crypt_connection_id = -1;
     friend_con->status = FRIENDCONN_STATUS_CONNECTING;
     memcpy(friend_con->real_public_key, real_public_key, CRYPTO_PUBLIC_KEY_SIZE);
     friend_con->onion_friendnum = onion_friendnum;
+    friend_con->timing.connecting_since = mono_time_get_ms(fr_c->mono_time);
 
     recv_tcp_relay_handler(fr_c->onion_c, onion_friendnum, &tcp_relay_node_callback, fr_c, friendcon_id);
     onion_dht_pk_callback(fr_c->onion_c, onion_friendnum, &dht_pk_callback, fr_c, friendcon_id);
@@ -826,6 +893,22 @@ int new_friend_connection(Friend_Connections *fr_c, const uint8_t *real_public_k
     return friendcon_id;
 }
 
+bool friend_connections_reserve(Friend_Connections *fr_c, uint32_t count)
+{
+    if (count > UINT32_MAX / sizeof(Friend_Conn) - fr_c->num_cons) {
+        return false;
+    }
+
+    const uint32_t num = fr_c->num_cons + count;
+
+    if (num > fr_c->conns_capacity && !realloc_friendconns(fr_c, num)) {
+        return false;
+    }
+
+    return pk_index_reserve(fr_c->conn_index, count)
+           && onion_reserve_friends(fr_c->onion_c, count);
+}
+
 /** @brief Kill a friend connection.
  *
  * @retval -1 on failure.
@@ -912,7 +995,7 @@ int send_friend_request_packet(Friend_Connections *fr_c, int friendcon_id, uint3
 
 /** Create new friend_connections instance. */
 Friend_Connections *new_friend_connections(
-    const Logger *logger, const Mono_Time *mono_time, const Network *ns,
+    const Logger *logger, const Memory *mem, const Random *rng, const Mono_Time *mono_time, const Network *ns,
     Onion_Client *onion_c, bool local_discovery_enabled)
 {
     if (onion_c == nullptr) {
@@ -925,6 +1008,13 @@ Friend_Connections *new_friend_connections(
         return nullptr;
     }
 
+    temp->conn_index = pk_index_new(mem, rng);
+
+    if (temp->conn_index == nullptr) {
+        free(temp);
+        return nullptr;
+    }
+
     temp->local_discovery_enabled = local_discovery_enabled;
 
     if (temp->local_discovery_enabled) {
@@ -1042,5 +1132,6 @@ void kill_friend_connections(Friend_Connections *fr_c)
     }
 
     lan_discovery_kill(fr_c->broadcast);
+    pk_index_free(fr_c->conn_index);
     free(fr_c);
 }
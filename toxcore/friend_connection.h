@@ -14,7 +14,9 @@
 #include "DHT.h"
 #include "LAN_discovery.h"
 #include "attributes.h"
+#include "crypto_core.h"
 #include "logger.h"
+#include "mem.h"
 #include "mono_time.h"
 #include "net_crypto.h"
 #include "network.h"
@@ -53,6 +55,21 @@ typedef enum Friendconn_Status {
 
 typedef struct Friend_Connections Friend_Connections;
 
+/**
+ * When the steps of establishing a friend connection happened, in
+ * milliseconds of mono time. A step that hasn't happened yet is 0.
+ */
+typedef struct Friend_Conn_Timing {
+    /** When the friend was added or the connection last went offline. */
+    uint64_t connecting_since;
+    /** When we learned the friend's DHT public key, usually through the onion. */
+    uint64_t dht_pk_found;
+    /** When DHT nodes started telling us the address they see the friend at. */
+    uint64_t dht_info_found;
+    /** When the friend's DHT first reached us directly over UDP. */
+    uint64_t udp_found;
+} Friend_Conn_Timing;
+
 non_null() Net_Crypto *friendconn_net_crypto(const Friend_Connections *fr_c);
 
 /** @return friendcon_id corresponding to the real public key on success.
@@ -77,6 +94,14 @@ int friend_connection_lock(const Friend_Connections *fr_c, int friendcon_id);
 non_null()
 unsigned int friend_con_connected(const Friend_Connections *fr_c, int friendcon_id);
 
+/** @brief Get the timing of the current connection attempt, or of the one that led to the current connection.
+ *
+ * @retval true on success.
+ * @retval false if friendcon_id is not valid.
+ */
+non_null()
+bool friend_connection_timing(const Friend_Connections *fr_c, int friendcon_id, Friend_Conn_Timing *timing);
+
 /** @brief Copy public keys associated to friendcon_id.
  *
  * @retval 0 on success.
@@ -89,6 +114,10 @@ int get_friendcon_public_keys(uint8_t *real_pk, uint8_t *dht_temp_pk, const Frie
 non_null()
 void set_dht_temp_pk(Friend_Connections *fr_c, int friendcon_id, const uint8_t *dht_temp_pk, void *userdata);
 
+/** Set the ip_port the friend's DHT instance was last seen at, and try to connect to it directly. */
+non_null()
+void set_dht_ip_port(Friend_Connections *fr_c, int friendcon_id, const IP_Port *ip_port);
+
 typedef int global_status_cb(void *object, int friendcon_id, bool status, void *userdata);
 
 typedef int fc_status_cb(void *object, int friendcon_id, bool status, void *userdata);
@@ -130,6 +159,16 @@ int friend_connection_crypt_connection_id(const Friend_Connections *fr_c, int fr
 non_null()
 int new_friend_connection(Friend_Connections *fr_c, const uint8_t *real_public_key);
 
+/** @brief Make room for `count` more friend connections without reallocating.
+ *
+ * Also reserves room for them in the onion client.
+ *
+ * @retval true on success.
+ * @retval false if allocation failed or there would be too many friends.
+ */
+non_null()
+bool friend_connections_reserve(Friend_Connections *fr_c, uint32_t count);
+
 /** @brief Kill a friend connection.
  *
  * @retval -1 on failure.
@@ -161,7 +200,7 @@ void set_friend_request_callback(Friend_Connections *fr_c, fr_request_cb *fr_req
 /** Create new friend_connections instance. */
 non_null()
 Friend_Connections *new_friend_connections(
-    const Logger *logger, const Mono_Time *mono_time, const Network *ns,
+    const Logger *logger, const Memory *mem, const Random *rng, const Mono_Time *mono_time, const Network *ns,
     Onion_Client *onion_c, bool local_discovery_enabled);
 
 /** main friend_connections loop. */
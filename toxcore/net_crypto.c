@@ -797,13 +797,13 @@ static int get_data_pointer(const Packets_Array *array, Packet_Data **data, uint
     return 1;
 }
 
-/** @brief Add data to end of array.
+/** @brief Add data to end of array. The array takes ownership of the data.
  *
- * @retval -1 on failure.
+ * @retval -1 on failure, in which case the caller still owns the data.
  * @return packet number on success.
  */
 non_null()
-static int64_t add_data_end_of_buffer(const Logger *logger, const Memory *mem, Packets_Array *array, const Packet_Data *data)
+static int64_t add_data_end_of_buffer(const Logger *logger, Packets_Array *array, Packet_Data *data)
 {
     const uint32_t num_spots = num_packets_array(array);
 
@@ -812,16 +812,8 @@ static int64_t add_data_end_of_buffer(const Logger *logger, const Memory *mem, P
         return -1;
     }
 
-    Packet_Data *new_d = (Packet_Data *)mem_alloc(mem, sizeof(Packet_Data));
-
-    if (new_d == nullptr) {
-        LOGGER_ERROR(logger, "packet data allocation failed");
-        return -1;
-    }
-
-    *new_d = *data;
     const uint32_t id = array->buffer_end;
-    array->buffer[id % CRYPTO_PACKET_BUFFER_SIZE] = new_d;
+    array->buffer[id % CRYPTO_PACKET_BUFFER_SIZE] = data;
     ++array->buffer_end;
     return id;
 }
@@ -1155,19 +1147,18 @@ static int reset_max_speed_reached(Net_Crypto *c, int crypt_connection_id)
 }
 
 /**
+ * @brief Put a lossless packet into the send queue and try to send it.
+ *
+ * The packet is written by the fill callback straight into its slot in the
+ * queue, after the connection was found to have room for it.
+ *
  * @retval -1 if data could not be put in packet queue.
  * @return positive packet number if data was put into the queue.
  */
-non_null()
-static int64_t send_lossless_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t length,
+non_null(1, 3) nullable(4)
+static int64_t send_lossless_packet(Net_Crypto *c, int crypt_connection_id, crypto_fill_packet_cb *fill, void *object,
                                     bool congestion_control)
 {
-    if (length == 0 || length > MAX_CRYPTO_DATA_SIZE) {
-        LOGGER_ERROR(c->log, "rejecting too large (or empty) packet of size %d on crypt connection %d", length,
-                     crypt_connection_id);
-        return -1;
-    }
-
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
     if (conn == nullptr) {
@@ -1183,13 +1174,47 @@ static int64_t send_lossless_packet(Net_Crypto *c, int crypt_connection_id, cons
         return -1;
     }
 
-    Packet_Data dt;
-    dt.sent_time = 0;
-    dt.length = length;
-    memcpy(dt.data, data, length);
-    const int64_t packet_num = add_data_end_of_buffer(c->log, c->mem, &conn->send_array, &dt);
+    if (num_packets_array(&conn->send_array) >= CRYPTO_PACKET_BUFFER_SIZE) {
+        LOGGER_WARNING(c->log, "crypto packet buffer size exceeded on crypt connection %d", crypt_connection_id);
+        return -1;
+    }
+
+    Packet_Data *dt = (Packet_Data *)mem_alloc(c->mem, sizeof(Packet_Data));
+
+    if (dt == nullptr) {
+        LOGGER_ERROR(c->log, "packet data allocation failed");
+        return -1;
+    }
+
+    const int32_t length = fill(object, dt->data, MAX_CRYPTO_DATA_SIZE);
+
+    if (length == -1) {
+        mem_delete(c->mem, dt);
+        return -1;
+    }
+
+    if (length <= 0 || length > MAX_CRYPTO_DATA_SIZE) {
+        LOGGER_ERROR(c->log, "rejecting too large (or empty) packet of size %d on crypt connection %d", length,
+                     crypt_connection_id);
+        mem_delete(c->mem, dt);
+        return -1;
+    }
+
+    dt->length = length;
+
+    // The fill callback may have let other threads in, so the connection
+    // array may have moved.
+    conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == nullptr) {
+        mem_delete(c->mem, dt);
+        return -1;
+    }
+
+    const int64_t packet_num = add_data_end_of_buffer(c->log, &conn->send_array, dt);
 
     if (packet_num == -1) {
+        mem_delete(c->mem, dt);
         return -1;
     }
 
@@ -1197,7 +1222,7 @@ static int64_t send_lossless_packet(Net_Crypto *c, int crypt_connection_id, cons
         return packet_num;
     }
 
-    if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, packet_num, data, length) == 0) {
+    if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, packet_num, dt->data, dt->length) == 0) {
         Packet_Data *dt1 = nullptr;
 
         if (get_data_pointer(&conn->send_array, &dt1, packet_num) == 1) {
@@ -2783,6 +2808,51 @@ uint32_t crypto_num_free_sendqueue_slots(const Net_Crypto *c, int crypt_connecti
     return max_packets;
 }
 
+/** @brief A finished packet that write_cryptpacket() copies into the send buffer. */
+typedef struct Lossless_Packet_Copy {
+    const uint8_t *data;
+    uint16_t length;
+} Lossless_Packet_Copy;
+
+non_null()
+static int32_t copy_lossless_packet(void *object, uint8_t *data, uint16_t max_length)
+{
+    const Lossless_Packet_Copy *copy = (const Lossless_Packet_Copy *)object;
+
+    if (copy->length > max_length) {
+        // Let send_lossless_packet reject it.
+        return copy->length;
+    }
+
+    memcpy(data, copy->data, copy->length);
+    return copy->length;
+}
+
+/** @brief A fill callback from write_cryptpacket_fill(), checked before it is queued. */
+typedef struct Lossless_Packet_Fill {
+    const Logger *log;
+    crypto_fill_packet_cb *fill;
+    void *object;
+} Lossless_Packet_Fill;
+
+non_null()
+static int32_t fill_lossless_packet(void *object, uint8_t *data, uint16_t max_length)
+{
+    const Lossless_Packet_Fill *fill = (const Lossless_Packet_Fill *)object;
+    const int32_t length = fill->fill(fill->object, data, max_length);
+
+    if (length > 0 && (data[0] < PACKET_ID_RANGE_LOSSLESS_START || data[0] > PACKET_ID_RANGE_LOSSLESS_END)) {
+        LOGGER_ERROR(fill->log, "rejecting lossless packet with out-of-range id %d", data[0]);
+        return -1;
+    }
+
+    return length;
+}
+
+non_null(1, 3) nullable(4)
+static int64_t write_lossless_packet(Net_Crypto *c, int crypt_connection_id, crypto_fill_packet_cb *fill, void *object,
+                                     bool congestion_control);
+
 /** @brief Sends a lossless cryptopacket.
  *
  * return -1 if data could not be put in packet queue.
@@ -2806,6 +2876,25 @@ int64_t write_cryptpacket(Net_Crypto *c, int crypt_connection_id, const uint8_t
         return -1;
     }
 
+    Lossless_Packet_Copy copy = {data, length};
+    return write_lossless_packet(c, crypt_connection_id, copy_lossless_packet, &copy, congestion_control);
+}
+
+/** @brief Sends a lossless cryptopacket that fill writes straight into the send buffer.
+ *
+ * Returns like write_cryptpacket(). Packets whose first byte is not in the
+ * PACKET_ID_RANGE_LOSSLESS are rejected after fill wrote them.
+ */
+int64_t write_cryptpacket_fill(Net_Crypto *c, int crypt_connection_id, crypto_fill_packet_cb *fill, void *object,
+                               bool congestion_control)
+{
+    Lossless_Packet_Fill checked_fill = {c->log, fill, object};
+    return write_lossless_packet(c, crypt_connection_id, fill_lossless_packet, &checked_fill, congestion_control);
+}
+
+static int64_t write_lossless_packet(Net_Crypto *c, int crypt_connection_id, crypto_fill_packet_cb *fill, void *object,
+                                     bool congestion_control)
+{
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
     if (conn == nullptr) {
@@ -2819,17 +2908,23 @@ int64_t write_cryptpacket(Net_Crypto *c, int crypt_connection_id, const uint8_t
     }
 
     if (congestion_control && conn->packets_left == 0) {
-        LOGGER_ERROR(c->log, "congestion control: rejecting packet of length %d on crypt connection %d", length,
-                     crypt_connection_id);
+        LOGGER_ERROR(c->log, "congestion control: rejecting packet on crypt connection %d", crypt_connection_id);
         return -1;
     }
 
-    const int64_t ret = send_lossless_packet(c, crypt_connection_id, data, length, congestion_control);
+    const int64_t ret = send_lossless_packet(c, crypt_connection_id, fill, object, congestion_control);
 
     if (ret == -1) {
         return -1;
     }
 
+    // The fill callback may have let other threads in.
+    conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == nullptr) {
+        return ret;
+    }
+
     if (congestion_control) {
         --conn->packets_left;
         --conn->packets_left_requested;
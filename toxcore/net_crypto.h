@@ -54,6 +54,8 @@ typedef enum Packet_Id {
 
     PACKET_ID_ONLINE             = 24,
     PACKET_ID_OFFLINE            = 25,
+    PACKET_ID_CAPABILITIES       = 26,
+    PACKET_ID_COALESCED          = 27,
     PACKET_ID_NICKNAME           = 48,
     PACKET_ID_STATUSMESSAGE      = 49,
     PACKET_ID_USERSTATUS         = 50,
@@ -257,6 +259,31 @@ non_null()
 int64_t write_cryptpacket(Net_Crypto *c, int crypt_connection_id,
                           const uint8_t *data, uint16_t length, bool congestion_control);
 
+/** @brief Writes a lossless packet into the buffer of its send queue slot.
+ *
+ * The first byte written must be in the PACKET_ID_RANGE_LOSSLESS.
+ *
+ * @param max_length Size of the buffer.
+ *
+ * @return length of the packet.
+ * @retval -1 to not send a packet after all.
+ */
+typedef int32_t crypto_fill_packet_cb(void *object, uint8_t *data, uint16_t max_length);
+
+/** @brief Sends a lossless cryptopacket that the callback writes straight into the send queue.
+ *
+ * Saves copying the packet when its data comes from elsewhere, e.g. a file.
+ * The callback is only called once the packet is known to fit into the queue.
+ *
+ * return -1 if data could not be put in packet queue.
+ * return positive packet number if data was put into the queue.
+ *
+ * congestion_control: should congestion control apply to this packet?
+ */
+non_null(1, 3) nullable(4)
+int64_t write_cryptpacket_fill(Net_Crypto *c, int crypt_connection_id, crypto_fill_packet_cb *fill, void *object,
+                               bool congestion_control);
+
 /** @brief Check if packet_number was received by the other side.
  *
  * packet_number must be a valid packet number of a packet sent on this connection.
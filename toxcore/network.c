@@ -86,6 +86,8 @@
 #include "ccompat.h"
 #include "logger.h"
 #include "mem.h"
+#include "mono_time.h"
+#include "rate_limit.h"
 #include "util.h"
 
 // Disable MSG_NOSIGNAL on systems not supporting it, e.g. Windows, FreeBSD
@@ -1013,6 +1015,11 @@ struct Networking_Core {
     uint16_t port;
     /* Our UDP socket. */
     Socket sock;
+
+    /* Separately allocated so that const send/receive paths can count. */
+    Net_Stats *stats;
+    /* nullptr until the first limit is set. */
+    Rate_Limiter *limiter;
 };
 
 Family net_family(const Networking_Core *net)
@@ -1025,6 +1032,16 @@ uint16_t net_port(const Networking_Core *net)
     return net->port;
 }
 
+Socket net_udp_socket(const Networking_Core *net)
+{
+    return net->sock;
+}
+
+const Net_Stats *net_get_stats(const Networking_Core *net)
+{
+    return net->stats;
+}
+
 /* Basic network functions:
  */
 
@@ -1097,6 +1114,11 @@ int send_packet(const Networking_Core *net, const IP_Port *ip_port, Packet packe
     const long res = net_sendto(net->ns, net->sock, packet.data, packet.length, &addr, &ipp_copy);
     loglogdata(net->log, "O=>", packet.data, packet.length, ip_port, res);
 
+    if (res > 0) {
+        ++net->stats->packets_sent;
+        net->stats->bytes_sent += (uint64_t)res;
+    }
+
     assert(res <= INT_MAX);
     return (int)res;
 }
@@ -1186,6 +1208,50 @@ void networking_registerhandler(Networking_Core *net, uint8_t byte, packet_handl
     net->packethandlers[byte].object = object;
 }
 
+packet_handler_cb *networking_get_handler(const Networking_Core *net, uint8_t byte, void **object)
+{
+    *object = net->packethandlers[byte].object;
+    return net->packethandlers[byte].function;
+}
+
+bool net_set_rate_limit(Networking_Core *net, const Random *rng, const Mono_Time *mono_time,
+                        uint8_t packet_id, uint32_t per_second)
+{
+    if (net->limiter == nullptr) {
+        if (per_second == 0) {
+            return true;
+        }
+
+        net->limiter = rate_limiter_new(net->mem, rng, mono_time);
+
+        if (net->limiter == nullptr) {
+            return false;
+        }
+    }
+
+    rate_limiter_set(net->limiter, packet_id, per_second);
+    return true;
+}
+
+/** @brief Check a received packet against the per-source limit for its type.
+ *
+ * IPv4 sources are keyed by address, IPv6 sources by /64 prefix since hosts
+ * are usually given a whole /64 to pick addresses from.
+ */
+non_null()
+static bool net_packet_allowed(Rate_Limiter *limiter, const IP *source, uint8_t packet_id)
+{
+    if (net_family_is_ipv4(source->family)) {
+        return rate_limiter_allow(limiter, source->ip.v4.uint8, sizeof(source->ip.v4.uint8), packet_id);
+    }
+
+    if (ipv6_ipv4_in_v6(&source->ip.v6)) {
+        return rate_limiter_allow(limiter, &source->ip.v6.uint8[12], 4, packet_id);
+    }
+
+    return rate_limiter_allow(limiter, source->ip.v6.uint8, 8, packet_id);
+}
+
 void networking_poll(const Networking_Core *net, void *userdata)
 {
     if (net_family_is_unspec(net->family)) {
@@ -1202,12 +1268,21 @@ void networking_poll(const Networking_Core *net, void *userdata)
             continue;
         }
 
+        ++net->stats->packets_recv[data[0]];
+        net->stats->bytes_recv += length;
+
         const Packet_Handler *const handler = &net->packethandlers[data[0]];
 
         if (handler->function == nullptr) {
             // TODO(https://github.com/TokTok/c-toxcore/issues/1115): Make this
             // a warning or error again.
             LOGGER_DEBUG(net->log, "[%02u] -- Packet has no handler", data[0]);
+            ++net->stats->packets_unhandled;
+            continue;
+        }
+
+        if (net->limiter != nullptr && !net_packet_allowed(net->limiter, &ip_port.ip, data[0])) {
+            ++net->stats->packets_rate_limited[data[0]];
             continue;
         }
 
@@ -1262,6 +1337,13 @@ Networking_Core *new_networking_ex(
         return nullptr;
     }
 
+    temp->stats = (Net_Stats *)mem_alloc(mem, sizeof(Net_Stats));
+
+    if (temp->stats == nullptr) {
+        mem_delete(mem, temp);
+        return nullptr;
+    }
+
     temp->ns = ns;
     temp->log = log;
     temp->mem = mem;
@@ -1278,6 +1360,7 @@ Networking_Core *new_networking_ex(
         char *strerror = net_new_strerror(neterror);
         LOGGER_ERROR(log, "failed to get a socket?! %d, %s", neterror, strerror);
         net_kill_strerror(strerror);
+        mem_delete(mem, temp->stats);
         mem_delete(mem, temp);
 
         if (error != nullptr) {
@@ -1354,6 +1437,7 @@ Networking_Core *new_networking_ex(
 
         portptr = &addr6->sin6_port;
     } else {
+        mem_delete(mem, temp->stats);
         mem_delete(mem, temp);
         return nullptr;
     }
@@ -1466,6 +1550,13 @@ Networking_Core *new_networking_no_udp(const Logger *log, const Memory *mem, con
         return nullptr;
     }
 
+    net->stats = (Net_Stats *)mem_alloc(mem, sizeof(Net_Stats));
+
+    if (net->stats == nullptr) {
+        mem_delete(mem, net);
+        return nullptr;
+    }
+
     net->ns = ns;
     net->log = log;
     net->mem = mem;
@@ -1485,6 +1576,8 @@ void kill_networking(Networking_Core *net)
         kill_sock(net->ns, net->sock);
     }
 
+    rate_limiter_free(net->limiter);
+    mem_delete(net->mem, net->stats);
     mem_delete(net->mem, net);
 }
 
@@ -15,8 +15,10 @@
 
 #include "attributes.h"
 #include "bin_pack.h"
+#include "crypto_core.h"
 #include "logger.h"
 #include "mem.h"
+#include "mono_time.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -428,6 +430,38 @@ non_null()
 Family net_family(const Networking_Core *net);
 non_null()
 uint16_t net_port(const Networking_Core *net);
+/** @brief The UDP socket, e.g. for waiting until it becomes readable. */
+non_null()
+Socket net_udp_socket(const Networking_Core *net);
+
+/** @brief UDP traffic counters of a Networking_Core. */
+typedef struct Net_Stats {
+    /** Received packets, indexed by packet id (the first byte). */
+    uint64_t packets_recv[256];
+    uint64_t bytes_recv;
+    /** Received packets for which no handler was registered. */
+    uint64_t packets_unhandled;
+    /** Received packets dropped by the rate limiter, indexed by packet id. */
+    uint64_t packets_rate_limited[256];
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+} Net_Stats;
+
+non_null()
+const Net_Stats *net_get_stats(const Networking_Core *net);
+
+/** @brief Limit how many packets of a type each source address may send per second.
+ *
+ * Packets over the limit are dropped before their handler is called, and
+ * counted in `packets_rate_limited`. IPv6 sources are grouped by /64 prefix.
+ * A limit of 0 removes it. The limiter is created on first use.
+ *
+ * @retval true on success.
+ * @retval false if the rate limiter couldn't be allocated.
+ */
+non_null()
+bool net_set_rate_limit(Networking_Core *net, const Random *rng, const Mono_Time *mono_time,
+                        uint8_t packet_id, uint32_t per_second);
 
 /** Close the socket. */
 non_null()
@@ -495,6 +529,15 @@ int sendpacket(const Networking_Core *net, const IP_Port *ip_port, const uint8_t
 non_null(1) nullable(3, 4)
 void networking_registerhandler(Networking_Core *net, uint8_t byte, packet_handler_cb *cb, void *object);
 
+/** @brief Get the function called when a packet beginning with byte is received.
+ *
+ * @param object Set to the object the function is called with.
+ *
+ * @return the function set with networking_registerhandler, or nullptr if there is none.
+ */
+non_null()
+packet_handler_cb *networking_get_handler(const Networking_Core *net, uint8_t byte, void **object);
+
 /** Call this several times a second. */
 non_null(1) nullable(2)
 void networking_poll(const Networking_Core *net, void *userdata);
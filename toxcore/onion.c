@@ -9,6 +9,7 @@
 #include "onion.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <string.h>
 
 #include "DHT.h"
@@ -33,20 +34,58 @@
 
 #define KEY_REFRESH_INTERVAL (2 * 60 * 60)
 
+#define ONION_RELAY_BATCH_SIZE 128
+
 // Settings for the shared key cache
 #define MAX_KEYS_PER_SLOT 4
 #define KEYS_TIMEOUT 600
 
+/** @brief Set the key for the current refresh interval from the key seed.
+ *
+ * The interval start becomes the timestamp, so the next change happens at
+ * the same moment in every instance sharing the seed.
+ */
+non_null()
+static void derive_symmetric_key(Onion *onion)
+{
+    const uint64_t interval = mono_time_get(onion->mono_time) / KEY_REFRESH_INTERVAL;
+
+    uint8_t data[CRYPTO_SYMMETRIC_KEY_SIZE + sizeof(uint64_t)];
+    memcpy(data, onion->key_seed, CRYPTO_SYMMETRIC_KEY_SIZE);
+    net_pack_u64(data + CRYPTO_SYMMETRIC_KEY_SIZE, interval);
+
+    uint8_t hash[CRYPTO_SHA256_SIZE];
+    crypto_sha256(hash, data, sizeof(data));
+    memcpy(onion->secret_symmetric_key, hash, CRYPTO_SYMMETRIC_KEY_SIZE);
+
+    crypto_memzero(data, sizeof(data));
+    crypto_memzero(hash, sizeof(hash));
+
+    onion->timestamp = interval * KEY_REFRESH_INTERVAL;
+}
+
 /** Change symmetric keys every 2 hours to make paths expire eventually. */
 non_null()
 static void change_symmetric_key(Onion *onion)
 {
     if (mono_time_is_timeout(onion->mono_time, onion->timestamp, KEY_REFRESH_INTERVAL)) {
+        if (onion->has_key_seed) {
+            derive_symmetric_key(onion);
+            return;
+        }
+
         new_symmetric_key(onion->rng, onion->secret_symmetric_key);
         onion->timestamp = mono_time_get(onion->mono_time);
     }
 }
 
+void onion_set_key_seed(Onion *onion, const uint8_t *seed)
+{
+    memcpy(onion->key_seed, seed, CRYPTO_SYMMETRIC_KEY_SIZE);
+    onion->has_key_seed = true;
+    derive_symmetric_key(onion);
+}
+
 /** packing and unpacking functions */
 non_null()
 static void ip_pack_to_bytes(uint8_t *data, const IP *source)
@@ -147,6 +186,11 @@ int create_onion_path(const Random *rng, const DHT *dht, Onion_Path *new_path, c
     memcpy(new_path->node_public_key2, nodes[1].public_key, CRYPTO_PUBLIC_KEY_SIZE);
     memcpy(new_path->node_public_key3, nodes[2].public_key, CRYPTO_PUBLIC_KEY_SIZE);
 
+    ipport_pack(new_path->layer_header2, &new_path->ip_port2);
+    memcpy(new_path->layer_header2 + SIZE_IPPORT, new_path->public_key2, CRYPTO_PUBLIC_KEY_SIZE);
+    ipport_pack(new_path->layer_header3, &new_path->ip_port3);
+    memcpy(new_path->layer_header3 + SIZE_IPPORT, new_path->public_key3, CRYPTO_PUBLIC_KEY_SIZE);
+
     return 0;
 }
 
@@ -171,6 +215,47 @@ int onion_path_to_nodes(Node_format *nodes, unsigned int num_nodes, const Onion_
     return 0;
 }
 
+/** @brief Build the second and third layer of an onion packet in place.
+ *
+ * Writes the layer for the second node (MAC, then the encrypted third layer
+ * header and layer) to `layer2`, which must have room for
+ * `SIZE_IPPORT + SEND_BASE + length + CRYPTO_MAC_SIZE` bytes. Each layer's
+ * plaintext is laid out where its ciphertext goes, so encryption works in
+ * place and the only copy of `data` is the one into the packet.
+ *
+ * return -1 on failure.
+ * return length of the second layer on success.
+ */
+non_null()
+static int create_onion_inner_layers(const Memory *mem, const Onion_Path *path, const uint8_t *nonce, uint8_t *layer2,
+                                     const IP_Port *dest, const uint8_t *data, uint16_t length)
+{
+    uint8_t *const plain2 = layer2 + CRYPTO_MAC_SIZE;
+    uint8_t *const layer3 = plain2 + sizeof(path->layer_header3);
+    uint8_t *const plain3 = layer3 + CRYPTO_MAC_SIZE;
+
+    const uint16_t plain3_size = SIZE_IPPORT + length;
+    ipport_pack(plain3, dest);
+    memcpy(plain3 + SIZE_IPPORT, data, length);
+
+    int len = encrypt_data_symmetric(mem, path->shared_key3, nonce, plain3, plain3_size, layer3);
+
+    if (len != plain3_size + CRYPTO_MAC_SIZE) {
+        return -1;
+    }
+
+    const uint16_t plain2_size = SIZE_IPPORT + SEND_BASE + length;
+    memcpy(plain2, path->layer_header3, sizeof(path->layer_header3));
+
+    len = encrypt_data_symmetric(mem, path->shared_key2, nonce, plain2, plain2_size, layer2);
+
+    if (len != plain2_size + CRYPTO_MAC_SIZE) {
+        return -1;
+    }
+
+    return len;
+}
+
 /** @brief Create a onion packet.
  *
  * Use Onion_Path path to create packet for data of length to dest.
@@ -188,35 +273,22 @@ int create_onion_packet(const Memory *mem, const Random *rng, uint8_t *packet, u
         return -1;
     }
 
-    const uint16_t step1_size = SIZE_IPPORT + length;
-    VLA(uint8_t, step1, step1_size);
-
-    ipport_pack(step1, dest);
-    memcpy(step1 + SIZE_IPPORT, data, length);
-
     uint8_t nonce[CRYPTO_NONCE_SIZE];
     random_nonce(rng, nonce);
 
-    const uint16_t step2_size = SIZE_IPPORT + SEND_BASE + length;
-    VLA(uint8_t, step2, step2_size);
-    ipport_pack(step2, &path->ip_port3);
-    memcpy(step2 + SIZE_IPPORT, path->public_key3, CRYPTO_PUBLIC_KEY_SIZE);
+    uint8_t *const layer1 = packet + 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE;
+    uint8_t *const plain1 = layer1 + CRYPTO_MAC_SIZE;
 
-    int len = encrypt_data_symmetric(mem, path->shared_key3, nonce, step1, step1_size,
-                                     step2 + SIZE_IPPORT + CRYPTO_PUBLIC_KEY_SIZE);
-
-    if (len != SIZE_IPPORT + length + CRYPTO_MAC_SIZE) {
+    if (create_onion_inner_layers(mem, path, nonce, plain1 + sizeof(path->layer_header2), dest, data, length) == -1) {
         return -1;
     }
 
-    const uint16_t step3_size = SIZE_IPPORT + SEND_BASE * 2 + length;
-    VLA(uint8_t, step3, step3_size);
-    ipport_pack(step3, &path->ip_port2);
-    memcpy(step3 + SIZE_IPPORT, path->public_key2, CRYPTO_PUBLIC_KEY_SIZE);
-    len = encrypt_data_symmetric(mem, path->shared_key2, nonce, step2, step2_size,
-                                 step3 + SIZE_IPPORT + CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(plain1, path->layer_header2, sizeof(path->layer_header2));
+
+    const uint16_t plain1_size = SIZE_IPPORT + SEND_BASE * 2 + length;
+    const int len = encrypt_data_symmetric(mem, path->shared_key1, nonce, plain1, plain1_size, layer1);
 
-    if (len != SIZE_IPPORT + SEND_BASE + length + CRYPTO_MAC_SIZE) {
+    if (len != plain1_size + CRYPTO_MAC_SIZE) {
         return -1;
     }
 
@@ -224,13 +296,6 @@ int create_onion_packet(const Memory *mem, const Random *rng, uint8_t *packet, u
     memcpy(packet + 1, nonce, CRYPTO_NONCE_SIZE);
     memcpy(packet + 1 + CRYPTO_NONCE_SIZE, path->public_key1, CRYPTO_PUBLIC_KEY_SIZE);
 
-    len = encrypt_data_symmetric(mem, path->shared_key1, nonce, step3, step3_size,
-                                 packet + 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE);
-
-    if (len != SIZE_IPPORT + SEND_BASE * 2 + length + CRYPTO_MAC_SIZE) {
-        return -1;
-    }
-
     return 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + len;
 }
 
@@ -251,39 +316,20 @@ int create_onion_packet_tcp(const Memory *mem, const Random *rng, uint8_t *packe
         return -1;
     }
 
-    const uint16_t step1_size = SIZE_IPPORT + length;
-    VLA(uint8_t, step1, step1_size);
-
-    ipport_pack(step1, dest);
-    memcpy(step1 + SIZE_IPPORT, data, length);
-
     uint8_t nonce[CRYPTO_NONCE_SIZE];
     random_nonce(rng, nonce);
 
-    const uint16_t step2_size = SIZE_IPPORT + SEND_BASE + length;
-    VLA(uint8_t, step2, step2_size);
-    ipport_pack(step2, &path->ip_port3);
-    memcpy(step2 + SIZE_IPPORT, path->public_key3, CRYPTO_PUBLIC_KEY_SIZE);
-
-    int len = encrypt_data_symmetric(mem, path->shared_key3, nonce, step1, step1_size,
-                                     step2 + SIZE_IPPORT + CRYPTO_PUBLIC_KEY_SIZE);
+    const int len = create_onion_inner_layers(mem, path, nonce, packet + CRYPTO_NONCE_SIZE + sizeof(path->layer_header2),
+                    dest, data, length);
 
-    if (len != SIZE_IPPORT + length + CRYPTO_MAC_SIZE) {
-        return -1;
-    }
-
-    ipport_pack(packet + CRYPTO_NONCE_SIZE, &path->ip_port2);
-    memcpy(packet + CRYPTO_NONCE_SIZE + SIZE_IPPORT, path->public_key2, CRYPTO_PUBLIC_KEY_SIZE);
-    len = encrypt_data_symmetric(mem, path->shared_key2, nonce, step2, step2_size,
-                                 packet + CRYPTO_NONCE_SIZE + SIZE_IPPORT + CRYPTO_PUBLIC_KEY_SIZE);
-
-    if (len != SIZE_IPPORT + SEND_BASE + length + CRYPTO_MAC_SIZE) {
+    if (len == -1) {
         return -1;
     }
 
     memcpy(packet, nonce, CRYPTO_NONCE_SIZE);
+    memcpy(packet + CRYPTO_NONCE_SIZE, path->layer_header2, sizeof(path->layer_header2));
 
-    return CRYPTO_NONCE_SIZE + SIZE_IPPORT + CRYPTO_PUBLIC_KEY_SIZE + len;
+    return CRYPTO_NONCE_SIZE + sizeof(path->layer_header2) + len;
 }
 
 /** @brief Create and send a onion response sent initially to dest with.
@@ -316,92 +362,109 @@ int send_onion_response(const Logger *log, const Networking_Core *net,
     return 0;
 }
 
-non_null()
-static int handle_send_initial(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length,
-                               void *userdata)
-{
-    Onion *onion = (Onion *)object;
+/** @brief One onion packet passing through this relay.
+ *
+ * relay_prepare() does everything that needs the shared key caches or the
+ * random number generator. relay_peel() only reads the job and the symmetric
+ * key, so a batch of jobs can be peeled on several threads at once.
+ * relay_send() then sends the result.
+ */
+typedef struct Onion_Relay_Job {
+    IP_Port source;
+    const uint8_t *packet;
+    uint16_t length;
 
-    if (length > ONION_MAX_PACKET_SIZE) {
-        LOGGER_TRACE(onion->log, "invalid initial onion packet length: %u (max: %u)",
-                     length, ONION_MAX_PACKET_SIZE);
-        return 1;
-    }
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    uint8_t ret_nonce[CRYPTO_NONCE_SIZE];
 
-    if (length <= 1 + SEND_1) {
-        LOGGER_TRACE(onion->log, "initial onion packet cannot contain SEND_1 packet: %u <= %u",
-                     length, 1 + SEND_1);
-        return 1;
+    IP_Port send_to;
+    const uint8_t *out;
+    uint16_t out_length;
+    uint8_t data[ONION_MAX_PACKET_SIZE];
+} Onion_Relay_Job;
+
+/** @brief Build the packet for the next hop from a peeled layer.
+ *
+ * plain holds the address of the next hop followed by the next layer. The
+ * address of source and the return path so far (ret_length bytes of ret) are
+ * sealed under our symmetric key and appended, so responses can find their
+ * way back. If packet_id is not 0, it is put in front together with nonce.
+ *
+ * @return length of the packet written to data, 0 on failure.
+ */
+non_null(1, 3, 4, 6, 9, 10, 11) nullable(7)
+static uint16_t wrap_layer(const Onion *onion, uint8_t packet_id, const uint8_t *nonce,
+                           const uint8_t *plain, uint16_t len, const IP_Port *source,
+                           const uint8_t *ret, uint16_t ret_length, const uint8_t *ret_nonce,
+                           uint8_t *data, IP_Port *send_to)
+{
+    assert(ret_length <= RETURN_2);
+
+    if (ipport_unpack(send_to, plain, len, false) == -1) {
+        return 0;
     }
 
-    change_symmetric_key(onion);
+    uint16_t data_len = 0;
 
-    const int nonce_start = 1;
-    const int public_key_start = nonce_start + CRYPTO_NONCE_SIZE;
-    const int ciphertext_start = public_key_start + CRYPTO_PUBLIC_KEY_SIZE;
+    if (packet_id != 0) {
+        data[0] = packet_id;
+        memcpy(data + 1, nonce, CRYPTO_NONCE_SIZE);
+        data_len = 1 + CRYPTO_NONCE_SIZE;
+    }
 
-    const int ciphertext_length = length - ciphertext_start;
-    const int plaintext_length = ciphertext_length - CRYPTO_MAC_SIZE;
+    memcpy(data + data_len, plain + SIZE_IPPORT, len - SIZE_IPPORT);
+    data_len += len - SIZE_IPPORT;
 
-    uint8_t plain[ONION_MAX_PACKET_SIZE];
-    const uint8_t *public_key = &packet[public_key_start];
-    const uint8_t *shared_key = shared_key_cache_lookup(onion->shared_keys_1, public_key);
+    uint8_t ret_data[SIZE_IPPORT + RETURN_2];
+    ipport_pack(ret_data, source);
 
-    if (shared_key == nullptr) {
-        /* Error looking up/deriving the shared key */
-        LOGGER_TRACE(onion->log, "shared onion key lookup failed for pk %02x%02x...",
-                     public_key[0], public_key[1]);
-        return 1;
+    if (ret_length > 0) {
+        memcpy(ret_data + SIZE_IPPORT, ret, ret_length);
     }
 
-    const int len = decrypt_data_symmetric(
-                        onion->mem, shared_key, &packet[nonce_start], &packet[ciphertext_start], ciphertext_length, plain);
+    uint8_t *ret_part = data + data_len;
+    memcpy(ret_part, ret_nonce, CRYPTO_NONCE_SIZE);
+    const int ret_len = encrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, ret_part, ret_data,
+                        SIZE_IPPORT + ret_length, ret_part + CRYPTO_NONCE_SIZE);
 
-    if (len != plaintext_length) {
-        LOGGER_TRACE(onion->log, "decrypt failed: %d != %d", len, plaintext_length);
-        return 1;
+    if (ret_len != SIZE_IPPORT + ret_length + CRYPTO_MAC_SIZE) {
+        return 0;
     }
 
-    return onion_send_1(onion, plain, len, source, packet + 1);
+    return data_len + CRYPTO_NONCE_SIZE + ret_len;
 }
 
-int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, const IP_Port *source, const uint8_t *nonce)
+non_null()
+static bool onion_send_1_length_ok(const Onion *onion, uint16_t len)
 {
     const uint16_t max_len = ONION_MAX_PACKET_SIZE + SIZE_IPPORT - (1 + CRYPTO_NONCE_SIZE + ONION_RETURN_1);
+
     if (len > max_len) {
         LOGGER_TRACE(onion->log, "invalid SEND_1 length: %d > %d", len, max_len);
-        return 1;
+        return false;
     }
 
-    if (len <= SIZE_IPPORT + SEND_BASE * 2) {
-        return 1;
-    }
-
-    IP_Port send_to;
+    return len > SIZE_IPPORT + SEND_BASE * 2;
+}
 
-    if (ipport_unpack(&send_to, plain, len, false) == -1) {
+int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, const IP_Port *source, const uint8_t *nonce)
+{
+    if (!onion_send_1_length_ok(onion, len)) {
         return 1;
     }
 
-    uint8_t ip_port[SIZE_IPPORT];
-    ipport_pack(ip_port, source);
+    uint8_t ret_nonce[CRYPTO_NONCE_SIZE];
+    random_nonce(onion->rng, ret_nonce);
 
-    uint8_t data[ONION_MAX_PACKET_SIZE] = {0};
-    data[0] = NET_PACKET_ONION_SEND_1;
-    memcpy(data + 1, nonce, CRYPTO_NONCE_SIZE);
-    memcpy(data + 1 + CRYPTO_NONCE_SIZE, plain + SIZE_IPPORT, len - SIZE_IPPORT);
-    uint16_t data_len = 1 + CRYPTO_NONCE_SIZE + (len - SIZE_IPPORT);
-    uint8_t *ret_part = data + data_len;
-    random_nonce(onion->rng, ret_part);
-    len = encrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, ret_part, ip_port, SIZE_IPPORT,
-                                 ret_part + CRYPTO_NONCE_SIZE);
+    uint8_t data[ONION_MAX_PACKET_SIZE];
+    IP_Port send_to;
+    const uint16_t data_len = wrap_layer(onion, NET_PACKET_ONION_SEND_1, nonce, plain, len, source, nullptr, 0,
+                                         ret_nonce, data, &send_to);
 
-    if (len != SIZE_IPPORT + CRYPTO_MAC_SIZE) {
+    if (data_len == 0) {
         return 1;
     }
 
-    data_len += CRYPTO_NONCE_SIZE + len;
-
     if ((uint32_t)sendpacket(onion->net, &send_to, data, data_len) != data_len) {
         return 1;
     }
@@ -412,300 +475,471 @@ int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, const I
     return 0;
 }
 
+static bool is_announce_response(uint8_t packet_id)
+{
+    return packet_id == NET_PACKET_ANNOUNCE_RESPONSE || packet_id == NET_PACKET_ANNOUNCE_RESPONSE_OLD
+           || packet_id == NET_PACKET_ONION_DATA_RESPONSE;
+}
+
+/** @brief Check the packet and gather what relay_peel() needs for it.
+ *
+ * @retval false if the packet should be dropped.
+ */
 non_null()
-static int handle_send_1(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length, void *userdata)
+static bool relay_prepare(Onion *onion, Onion_Relay_Job *job)
 {
-    Onion *onion = (Onion *)object;
+    const uint8_t *packet = job->packet;
+    const uint16_t length = job->length;
 
     if (length > ONION_MAX_PACKET_SIZE) {
-        return 1;
+        LOGGER_TRACE(onion->log, "invalid onion packet length: %u (max: %u)", length, ONION_MAX_PACKET_SIZE);
+        return false;
     }
 
-    if (length <= 1 + SEND_2) {
-        return 1;
-    }
+    Shared_Key_Cache *shared_keys;
 
-    change_symmetric_key(onion);
+    switch (packet[0]) {
+        case NET_PACKET_ONION_SEND_INITIAL: {
+            if (length <= 1 + SEND_1) {
+                LOGGER_TRACE(onion->log, "initial onion packet cannot contain SEND_1 packet: %u <= %u",
+                             length, 1 + SEND_1);
+                return false;
+            }
+
+            shared_keys = onion->shared_keys_1;
+            break;
+        }
+
+        case NET_PACKET_ONION_SEND_1: {
+            if (length <= 1 + SEND_2) {
+                return false;
+            }
+
+            shared_keys = onion->shared_keys_2;
+            break;
+        }
+
+        case NET_PACKET_ONION_SEND_2: {
+            if (length <= 1 + SEND_3) {
+                return false;
+            }
+
+            shared_keys = onion->shared_keys_3;
+            break;
+        }
+
+        case NET_PACKET_ONION_RECV_3:
+            return length > 1 + RETURN_3 && is_announce_response(packet[1 + RETURN_3]);
+
+        case NET_PACKET_ONION_RECV_2:
+            return length > 1 + RETURN_2 && is_announce_response(packet[1 + RETURN_2]);
+
+        case NET_PACKET_ONION_RECV_1:
+            return length > 1 + RETURN_1 && is_announce_response(packet[1 + RETURN_1]);
+
+        default:
+            return false;
+    }
 
-    uint8_t plain[ONION_MAX_PACKET_SIZE];
     const uint8_t *public_key = packet + 1 + CRYPTO_NONCE_SIZE;
-    const uint8_t *shared_key = shared_key_cache_lookup(onion->shared_keys_2, public_key);
+    const uint8_t *shared_key = shared_key_cache_lookup(shared_keys, public_key);
 
     if (shared_key == nullptr) {
         /* Error looking up/deriving the shared key */
-        return 1;
+        LOGGER_TRACE(onion->log, "shared onion key lookup failed for pk %02x%02x...",
+                     public_key[0], public_key[1]);
+        return false;
     }
 
-    int len = decrypt_data_symmetric(onion->mem, shared_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE,
-                                     length - (1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + RETURN_1), plain);
+    memcpy(job->shared_key, shared_key, CRYPTO_SHARED_KEY_SIZE);
+    random_nonce(onion->rng, job->ret_nonce);
+    return true;
+}
 
-    if (len != length - (1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + RETURN_1 + CRYPTO_MAC_SIZE)) {
-        return 1;
+/** @brief Decrypt the layer of a SEND packet that is meant for us.
+ *
+ * @return length of the layer in plain, -1 on failure.
+ */
+non_null()
+static int peel_send_layer(const Onion *onion, const Onion_Relay_Job *job, uint16_t ret_length, uint8_t *plain)
+{
+    const uint16_t header_length = 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE;
+    const int len = decrypt_data_symmetric(onion->mem, job->shared_key, job->packet + 1, job->packet + header_length,
+                                           job->length - (header_length + ret_length), plain);
+
+    if (len != job->length - (header_length + ret_length + CRYPTO_MAC_SIZE)) {
+        return -1;
     }
 
-    IP_Port send_to;
+    return len;
+}
 
-    if (ipport_unpack(&send_to, plain, len, false) == -1) {
-        return 1;
-    }
+/** @brief Open our part of the return path of a RECV packet and put the rest
+ * in front of the response for the previous hop.
+ */
+non_null()
+static void peel_recv_layer(const Onion *onion, Onion_Relay_Job *job, uint8_t packet_id,
+                            uint16_t ret_in_length, uint16_t ret_out_length)
+{
+    const uint8_t *packet = job->packet;
+    uint8_t plain[SIZE_IPPORT + RETURN_2];
+    const int len = decrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, packet + 1,
+                                           packet + 1 + CRYPTO_NONCE_SIZE,
+                                           SIZE_IPPORT + ret_out_length + CRYPTO_MAC_SIZE, plain);
 
-    uint8_t data[ONION_MAX_PACKET_SIZE] = {0};
-    data[0] = NET_PACKET_ONION_SEND_2;
-    memcpy(data + 1, packet + 1, CRYPTO_NONCE_SIZE);
-    memcpy(data + 1 + CRYPTO_NONCE_SIZE, plain + SIZE_IPPORT, len - SIZE_IPPORT);
-    uint16_t data_len = 1 + CRYPTO_NONCE_SIZE + (len - SIZE_IPPORT);
-    uint8_t *ret_part = data + data_len;
-    random_nonce(onion->rng, ret_part);
-    uint8_t ret_data[RETURN_1 + SIZE_IPPORT];
-    ipport_pack(ret_data, source);
-    memcpy(ret_data + SIZE_IPPORT, packet + (length - RETURN_1), RETURN_1);
-    len = encrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, ret_part, ret_data, sizeof(ret_data),
-                                 ret_part + CRYPTO_NONCE_SIZE);
+    if (len != SIZE_IPPORT + ret_out_length) {
+        return;
+    }
 
-    if (len != RETURN_2 - CRYPTO_NONCE_SIZE) {
-        return 1;
+    // The last hop may return to a TCP client, whose address is not an IP.
+    if (ipport_unpack(&job->send_to, plain, len, ret_out_length == 0) == -1) {
+        return;
     }
 
-    data_len += CRYPTO_NONCE_SIZE + len;
+    const uint16_t response_length = job->length - (1 + ret_in_length);
 
-    if ((uint32_t)sendpacket(onion->net, &send_to, data, data_len) != data_len) {
-        return 1;
+    if (ret_out_length == 0) {
+        job->out = packet + 1 + ret_in_length;
+        job->out_length = response_length;
+        return;
     }
 
-    Ip_Ntoa ip_str;
-    LOGGER_TRACE(onion->log, "forwarded onion packet to %s:%d, level 2 (%02x in %02x, %d bytes)",
-                 net_ip_ntoa(&send_to.ip, &ip_str), net_ntohs(send_to.port), packet[0], data[0], data_len);
-    return 0;
+    job->data[0] = packet_id;
+    memcpy(job->data + 1, plain + SIZE_IPPORT, ret_out_length);
+    memcpy(job->data + 1 + ret_out_length, packet + 1 + ret_in_length, response_length);
+    job->out = job->data;
+    job->out_length = 1 + ret_out_length + response_length;
 }
 
+/** @brief Peel our layer off a prepared packet. Sets out_length to 0 if the
+ * packet should be dropped. Safe to call from any thread.
+ */
 non_null()
-static int handle_send_2(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length, void *userdata)
+static void relay_peel(const Onion *onion, Onion_Relay_Job *job)
 {
-    Onion *onion = (Onion *)object;
+    const uint8_t *packet = job->packet;
+    uint8_t plain[ONION_MAX_PACKET_SIZE];
+    int len;
 
-    if (length > ONION_MAX_PACKET_SIZE) {
-        return 1;
-    }
+    job->out = job->data;
+    job->out_length = 0;
 
-    if (length <= 1 + SEND_3) {
-        return 1;
-    }
+    switch (packet[0]) {
+        case NET_PACKET_ONION_SEND_INITIAL: {
+            len = peel_send_layer(onion, job, 0, plain);
 
-    change_symmetric_key(onion);
+            if (len == -1 || !onion_send_1_length_ok(onion, len)) {
+                return;
+            }
 
-    uint8_t plain[ONION_MAX_PACKET_SIZE];
-    const uint8_t *public_key = packet + 1 + CRYPTO_NONCE_SIZE;
-    const uint8_t *shared_key = shared_key_cache_lookup(onion->shared_keys_3, public_key);
+            job->out_length = wrap_layer(onion, NET_PACKET_ONION_SEND_1, packet + 1, plain, len, &job->source,
+                                         nullptr, 0, job->ret_nonce, job->data, &job->send_to);
+            return;
+        }
 
-    if (shared_key == nullptr) {
-        /* Error looking up/deriving the shared key */
-        return 1;
-    }
+        case NET_PACKET_ONION_SEND_1: {
+            len = peel_send_layer(onion, job, RETURN_1, plain);
 
-    int len = decrypt_data_symmetric(onion->mem, shared_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE,
-                                     length - (1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + RETURN_2), plain);
+            if (len == -1) {
+                return;
+            }
 
-    if (len != length - (1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + RETURN_2 + CRYPTO_MAC_SIZE)) {
-        return 1;
-    }
+            job->out_length = wrap_layer(onion, NET_PACKET_ONION_SEND_2, packet + 1, plain, len, &job->source,
+                                         packet + (job->length - RETURN_1), RETURN_1, job->ret_nonce, job->data,
+                                         &job->send_to);
+            return;
+        }
 
-    assert(len > SIZE_IPPORT);
+        case NET_PACKET_ONION_SEND_2: {
+            len = peel_send_layer(onion, job, RETURN_2, plain);
 
-    const uint8_t packet_id = plain[SIZE_IPPORT];
+            if (len <= SIZE_IPPORT) {
+                return;
+            }
 
-    if (packet_id != NET_PACKET_ANNOUNCE_REQUEST && packet_id != NET_PACKET_ANNOUNCE_REQUEST_OLD &&
-            packet_id != NET_PACKET_ONION_DATA_REQUEST) {
-        return 1;
-    }
+            const uint8_t packet_id = plain[SIZE_IPPORT];
 
-    IP_Port send_to;
+            if (packet_id != NET_PACKET_ANNOUNCE_REQUEST && packet_id != NET_PACKET_ANNOUNCE_REQUEST_OLD &&
+                    packet_id != NET_PACKET_ONION_DATA_REQUEST) {
+                return;
+            }
 
-    if (ipport_unpack(&send_to, plain, len, false) == -1) {
-        return 1;
-    }
+            job->out_length = wrap_layer(onion, 0, packet + 1, plain, len, &job->source,
+                                         packet + (job->length - RETURN_2), RETURN_2, job->ret_nonce, job->data,
+                                         &job->send_to);
+            return;
+        }
 
-    uint8_t data[ONION_MAX_PACKET_SIZE] = {0};
-    memcpy(data, plain + SIZE_IPPORT, len - SIZE_IPPORT);
-    uint16_t data_len = len - SIZE_IPPORT;
-    uint8_t *ret_part = data + (len - SIZE_IPPORT);
-    random_nonce(onion->rng, ret_part);
-    uint8_t ret_data[RETURN_2 + SIZE_IPPORT];
-    ipport_pack(ret_data, source);
-    memcpy(ret_data + SIZE_IPPORT, packet + (length - RETURN_2), RETURN_2);
-    len = encrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, ret_part, ret_data, sizeof(ret_data),
-                                 ret_part + CRYPTO_NONCE_SIZE);
+        case NET_PACKET_ONION_RECV_3: {
+            peel_recv_layer(onion, job, NET_PACKET_ONION_RECV_2, RETURN_3, RETURN_2);
+            return;
+        }
+
+        case NET_PACKET_ONION_RECV_2: {
+            peel_recv_layer(onion, job, NET_PACKET_ONION_RECV_1, RETURN_2, RETURN_1);
+            return;
+        }
+
+        case NET_PACKET_ONION_RECV_1: {
+            peel_recv_layer(onion, job, 0, RETURN_1, 0);
+            return;
+        }
+    }
+}
 
-    if (len != RETURN_3 - CRYPTO_NONCE_SIZE) {
+non_null()
+static int relay_send(const Onion *onion, const Onion_Relay_Job *job)
+{
+    if (job->out_length == 0) {
         return 1;
     }
 
-    data_len += RETURN_3;
+    if (job->packet[0] == NET_PACKET_ONION_RECV_1 && onion->recv_1_function != nullptr &&
+            !net_family_is_ipv4(job->send_to.ip.family) &&
+            !net_family_is_ipv6(job->send_to.ip.family)) {
+        return onion->recv_1_function(onion->callback_object, &job->send_to, job->out, job->out_length);
+    }
 
-    if ((uint32_t)sendpacket(onion->net, &send_to, data, data_len) != data_len) {
+    if ((uint32_t)sendpacket(onion->net, &job->send_to, job->out, job->out_length) != job->out_length) {
         return 1;
     }
 
     Ip_Ntoa ip_str;
-    LOGGER_TRACE(onion->log, "forwarded onion packet to %s:%d, level 3 (%02x in %02x, %d bytes)",
-                 net_ip_ntoa(&send_to.ip, &ip_str), net_ntohs(send_to.port), packet[0], data[0], data_len);
+    LOGGER_TRACE(onion->log, "forwarded onion packet to %s:%d (%02x in %02x, %d bytes)",
+                 net_ip_ntoa(&job->send_to.ip, &ip_str), net_ntohs(job->send_to.port), job->packet[0], job->out[0],
+                 job->out_length);
     return 0;
 }
 
+typedef struct Onion_Relay_Worker {
+    Onion_Relay_Pool *pool;
+    uint8_t index;
+} Onion_Relay_Worker;
+
+struct Onion_Relay_Pool {
+    Onion *onion;
+
+    Onion_Relay_Job jobs[ONION_RELAY_BATCH_SIZE];
+    uint8_t packets[ONION_RELAY_BATCH_SIZE][ONION_MAX_PACKET_SIZE];
+    uint16_t count;
+
+    /* Including the thread that calls onion_relay_batch(). */
+    uint8_t num_threads;
+    pthread_t threads[ONION_RELAY_MAX_THREADS];
+    Onion_Relay_Worker workers[ONION_RELAY_MAX_THREADS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    /* Incremented for every batch handed to the workers. */
+    uint32_t generation;
+    /* Workers still peeling the current batch. */
+    uint8_t running;
+    bool stop;
+};
+
+/** @brief Peel every num_threads'th job of the batch, starting at index. */
 non_null()
-static int handle_recv_3(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length, void *userdata)
+static void relay_peel_share(Onion_Relay_Pool *pool, uint8_t index)
 {
-    Onion *onion = (Onion *)object;
-
-    if (length > ONION_MAX_PACKET_SIZE) {
-        return 1;
+    for (uint16_t i = index; i < pool->count; i += pool->num_threads) {
+        relay_peel(pool->onion, &pool->jobs[i]);
     }
+}
 
-    if (length <= 1 + RETURN_3) {
-        return 1;
-    }
+non_null()
+static void *relay_worker_thread(void *arg)
+{
+    const Onion_Relay_Worker *worker = (const Onion_Relay_Worker *)arg;
+    Onion_Relay_Pool *pool = worker->pool;
+    uint32_t seen = 0;
 
-    const uint8_t packet_id = packet[1 + RETURN_3];
+    pthread_mutex_lock(&pool->lock);
 
-    if (packet_id != NET_PACKET_ANNOUNCE_RESPONSE && packet_id != NET_PACKET_ANNOUNCE_RESPONSE_OLD &&
-            packet_id != NET_PACKET_ONION_DATA_RESPONSE) {
-        return 1;
-    }
+    while (true) {
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
 
-    change_symmetric_key(onion);
+        if (pool->stop) {
+            break;
+        }
 
-    uint8_t plain[SIZE_IPPORT + RETURN_2];
-    const int len = decrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
-                                           SIZE_IPPORT + RETURN_2 + CRYPTO_MAC_SIZE, plain);
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
 
-    if ((uint32_t)len != sizeof(plain)) {
-        return 1;
-    }
+        relay_peel_share(pool, worker->index);
 
-    IP_Port send_to;
+        pthread_mutex_lock(&pool->lock);
 
-    if (ipport_unpack(&send_to, plain, len, false) == -1) {
-        LOGGER_DEBUG(onion->log, "failed to unpack IP/Port");
-        return 1;
-    }
+        --pool->running;
 
-    uint8_t data[ONION_MAX_PACKET_SIZE] = {0};
-    data[0] = NET_PACKET_ONION_RECV_2;
-    memcpy(data + 1, plain + SIZE_IPPORT, RETURN_2);
-    memcpy(data + 1 + RETURN_2, packet + 1 + RETURN_3, length - (1 + RETURN_3));
-    const uint16_t data_len = 1 + RETURN_2 + (length - (1 + RETURN_3));
-
-    if ((uint32_t)sendpacket(onion->net, &send_to, data, data_len) != data_len) {
-        return 1;
+        if (pool->running == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
     }
 
-    Ip_Ntoa ip_str;
-    LOGGER_TRACE(onion->log, "forwarded onion RECV_2 to %s:%d (%02x in %02x, %d bytes)",
-                 net_ip_ntoa(&send_to.ip, &ip_str), net_ntohs(send_to.port), packet[0], data[0], data_len);
-    return 0;
+    pthread_mutex_unlock(&pool->lock);
+    return nullptr;
 }
 
-non_null()
-static int handle_recv_2(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length, void *userdata)
+void onion_relay_batch(Onion *onion)
 {
-    Onion *onion = (Onion *)object;
+    Onion_Relay_Pool *pool = onion->relay_pool;
 
-    if (length > ONION_MAX_PACKET_SIZE) {
-        return 1;
+    if (pool == nullptr || pool->count == 0) {
+        return;
     }
 
-    if (length <= 1 + RETURN_2) {
-        return 1;
+    pthread_mutex_lock(&pool->lock);
+    ++pool->generation;
+    pool->running = pool->num_threads - 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    relay_peel_share(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
     }
 
-    const uint8_t packet_id = packet[1 + RETURN_2];
+    pthread_mutex_unlock(&pool->lock);
 
-    if (packet_id != NET_PACKET_ANNOUNCE_RESPONSE && packet_id != NET_PACKET_ANNOUNCE_RESPONSE_OLD &&
-            packet_id != NET_PACKET_ONION_DATA_RESPONSE) {
-        return 1;
+    for (uint16_t i = 0; i < pool->count; ++i) {
+        relay_send(onion, &pool->jobs[i]);
     }
 
-    change_symmetric_key(onion);
+    pool->count = 0;
+}
 
-    uint8_t plain[SIZE_IPPORT + RETURN_1];
-    const int len = decrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
-                                           SIZE_IPPORT + RETURN_1 + CRYPTO_MAC_SIZE, plain);
+/** @brief Queue a packet for the next batch, relaying the current one first if it is full. */
+non_null()
+static int relay_pool_add(Onion *onion, const IP_Port *source, const uint8_t *packet, uint16_t length)
+{
+    Onion_Relay_Pool *pool = onion->relay_pool;
 
-    if ((uint32_t)len != sizeof(plain)) {
+    if (length > ONION_MAX_PACKET_SIZE) {
         return 1;
     }
 
-    IP_Port send_to;
-
-    if (ipport_unpack(&send_to, plain, len, false) == -1) {
-        return 1;
+    if (pool->count == ONION_RELAY_BATCH_SIZE) {
+        onion_relay_batch(onion);
     }
 
-    uint8_t data[ONION_MAX_PACKET_SIZE] = {0};
-    data[0] = NET_PACKET_ONION_RECV_1;
-    memcpy(data + 1, plain + SIZE_IPPORT, RETURN_1);
-    memcpy(data + 1 + RETURN_1, packet + 1 + RETURN_2, length - (1 + RETURN_2));
-    const uint16_t data_len = 1 + RETURN_1 + (length - (1 + RETURN_2));
+    Onion_Relay_Job *job = &pool->jobs[pool->count];
+    memcpy(pool->packets[pool->count], packet, length);
+    job->source = *source;
+    job->packet = pool->packets[pool->count];
+    job->length = length;
 
-    if ((uint32_t)sendpacket(onion->net, &send_to, data, data_len) != data_len) {
+    if (!relay_prepare(onion, job)) {
         return 1;
     }
 
-    Ip_Ntoa ip_str;
-    LOGGER_TRACE(onion->log, "forwarded onion RECV_1 to %s:%d (%02x in %02x, %d bytes)",
-                 net_ip_ntoa(&send_to.ip, &ip_str), net_ntohs(send_to.port), packet[0], data[0], data_len);
+    ++pool->count;
     return 0;
 }
 
+/** @brief Stop the worker threads and free the pool. Queued packets are dropped. */
 non_null()
-static int handle_recv_1(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length, void *userdata)
+static void relay_pool_free(const Memory *mem, Onion_Relay_Pool *pool, uint8_t started)
 {
-    Onion *onion = (Onion *)object;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
 
-    if (length > ONION_MAX_PACKET_SIZE) {
-        return 1;
+    for (uint8_t i = 1; i < started; ++i) {
+        pthread_join(pool->threads[i], nullptr);
     }
 
-    if (length <= 1 + RETURN_1) {
-        return 1;
+    pthread_cond_destroy(&pool->work_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->lock);
+    mem_delete(mem, pool);
+}
+
+bool onion_set_relay_threads(Onion *onion, uint8_t threads)
+{
+    if (onion->relay_pool != nullptr) {
+        onion_relay_batch(onion);
+        relay_pool_free(onion->mem, onion->relay_pool, onion->relay_pool->num_threads);
+        onion->relay_pool = nullptr;
     }
 
-    const uint8_t packet_id = packet[1 + RETURN_1];
+    if (threads <= 1) {
+        return true;
+    }
 
-    if (packet_id != NET_PACKET_ANNOUNCE_RESPONSE && packet_id != NET_PACKET_ANNOUNCE_RESPONSE_OLD &&
-            packet_id != NET_PACKET_ONION_DATA_RESPONSE) {
-        return 1;
+    Onion_Relay_Pool *pool = (Onion_Relay_Pool *)mem_alloc(onion->mem, sizeof(Onion_Relay_Pool));
+
+    if (pool == nullptr) {
+        return false;
     }
 
-    change_symmetric_key(onion);
+    if (pthread_mutex_init(&pool->lock, nullptr) != 0) {
+        mem_delete(onion->mem, pool);
+        return false;
+    }
 
-    uint8_t plain[SIZE_IPPORT];
-    const int len = decrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
-                                           SIZE_IPPORT + CRYPTO_MAC_SIZE, plain);
+    if (pthread_cond_init(&pool->work_ready, nullptr) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        mem_delete(onion->mem, pool);
+        return false;
+    }
 
-    if ((uint32_t)len != SIZE_IPPORT) {
-        return 1;
+    if (pthread_cond_init(&pool->work_done, nullptr) != 0) {
+        pthread_cond_destroy(&pool->work_ready);
+        pthread_mutex_destroy(&pool->lock);
+        mem_delete(onion->mem, pool);
+        return false;
     }
 
-    IP_Port send_to;
+    pool->onion = onion;
+    pool->num_threads = (uint8_t)min_u32(threads, ONION_RELAY_MAX_THREADS);
 
-    if (ipport_unpack(&send_to, plain, len, true) == -1) {
-        LOGGER_DEBUG(onion->log, "failed to unpack IP/Port");
-        return 1;
+    for (uint8_t i = 1; i < pool->num_threads; ++i) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+
+        if (pthread_create(&pool->threads[i], nullptr, relay_worker_thread, &pool->workers[i]) != 0) {
+            relay_pool_free(onion->mem, pool, i);
+            return false;
+        }
     }
 
-    const uint16_t data_len = length - (1 + RETURN_1);
+    onion->relay_pool = pool;
+    return true;
+}
 
-    if (onion->recv_1_function != nullptr &&
-            !net_family_is_ipv4(send_to.ip.family) &&
-            !net_family_is_ipv6(send_to.ip.family)) {
-        return onion->recv_1_function(onion->callback_object, &send_to, packet + (1 + RETURN_1), data_len);
+non_null(1, 2, 3) nullable(5)
+static int handle_onion_relay(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length,
+                              void *userdata)
+{
+    Onion *onion = (Onion *)object;
+
+    /* Peeling reads the key, so it only changes here on the main thread,
+     * never while a batch is being peeled.
+     */
+    change_symmetric_key(onion);
+
+    if (onion->relay_pool != nullptr) {
+        return relay_pool_add(onion, source, packet, length);
     }
 
-    if ((uint32_t)sendpacket(onion->net, &send_to, packet + (1 + RETURN_1), data_len) != data_len) {
+    Onion_Relay_Job job;
+    job.source = *source;
+    job.packet = packet;
+    job.length = length;
+
+    if (!relay_prepare(onion, &job)) {
         return 1;
     }
 
-    return 0;
+    relay_peel(onion, &job);
+    return relay_send(onion, &job);
 }
 
 void set_callback_handle_recv_1(Onion *onion, onion_recv_1_cb *function, void *object)
@@ -748,13 +982,13 @@ Onion *new_onion(const Logger *log, const Memory *mem, const Mono_Time *mono_tim
         return nullptr;
     }
 
-    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_INITIAL, &handle_send_initial, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_1, &handle_send_1, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_2, &handle_send_2, onion);
+    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_INITIAL, &handle_onion_relay, onion);
+    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_1, &handle_onion_relay, onion);
+    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_2, &handle_onion_relay, onion);
 
-    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_3, &handle_recv_3, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_2, &handle_recv_2, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_1, &handle_recv_1, onion);
+    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_3, &handle_onion_relay, onion);
+    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_2, &handle_onion_relay, onion);
+    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_1, &handle_onion_relay, onion);
 
     return onion;
 }
@@ -773,7 +1007,12 @@ void kill_onion(Onion *onion)
     networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_2, nullptr, nullptr);
     networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_1, nullptr, nullptr);
 
+    if (onion->relay_pool != nullptr) {
+        relay_pool_free(onion->mem, onion->relay_pool, onion->relay_pool->num_threads);
+    }
+
     crypto_memzero(onion->secret_symmetric_key, sizeof(onion->secret_symmetric_key));
+    crypto_memzero(onion->key_seed, sizeof(onion->key_seed));
 
     shared_key_cache_free(onion->shared_keys_1);
     shared_key_cache_free(onion->shared_keys_2);
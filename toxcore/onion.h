@@ -20,6 +20,10 @@
 
 typedef int onion_recv_1_cb(void *object, const IP_Port *dest, const uint8_t *data, uint16_t length);
 
+#define ONION_RELAY_MAX_THREADS 16
+
+typedef struct Onion_Relay_Pool Onion_Relay_Pool;
+
 typedef struct Onion {
     const Logger *log;
     const Mono_Time *mono_time;
@@ -30,12 +34,19 @@ typedef struct Onion {
     uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
     uint64_t timestamp;
 
+    /* Set by onion_set_key_seed(): return path keys are derived from it. */
+    bool has_key_seed;
+    uint8_t key_seed[CRYPTO_SYMMETRIC_KEY_SIZE];
+
     Shared_Key_Cache *shared_keys_1;
     Shared_Key_Cache *shared_keys_2;
     Shared_Key_Cache *shared_keys_3;
 
     onion_recv_1_cb *recv_1_function;
     void *callback_object;
+
+    /* Set by onion_set_relay_threads(). */
+    Onion_Relay_Pool *relay_pool;
 } Onion;
 
 #define ONION_MAX_PACKET_SIZE 1400
@@ -72,6 +83,11 @@ typedef struct Onion_Path {
     IP_Port     ip_port3;
     uint8_t     node_public_key3[CRYPTO_PUBLIC_KEY_SIZE];
 
+    /* Plaintext headers of the second and third layer (packed ip_port and
+     * public key), serialised once by create_onion_path(). */
+    uint8_t layer_header2[SIZE_IPPORT + CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t layer_header3[SIZE_IPPORT + CRYPTO_PUBLIC_KEY_SIZE];
+
     uint32_t path_num;
 } Onion_Path;
 
@@ -151,6 +167,37 @@ int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, const I
 non_null(1) nullable(2, 3)
 void set_callback_handle_recv_1(Onion *onion, onion_recv_1_cb *function, void *object);
 
+/** @brief Derive the return path keys from a seed instead of generating them randomly.
+ *
+ * The key that protects onion return paths is still replaced every two hours,
+ * but each one is derived from the seed and the current interval. Processes
+ * serving one node that share the seed and the clock (e.g. forked workers) can
+ * then decrypt each other's return paths.
+ */
+non_null()
+void onion_set_key_seed(Onion *onion, const uint8_t *seed);
+
+/** @brief Relay onion packets in batches on several threads.
+ *
+ * Onion packets received by networking_poll() are then queued instead of
+ * relayed right away. onion_relay_batch() peels the queued layers on
+ * `threads` threads, the calling one included, and sends the results in the
+ * order the packets arrived. Shared key lookups and sending stay on the
+ * calling thread. A value of 1 or less relays every packet as it arrives.
+ *
+ * @return true on success. On failure packets are relayed as they arrive.
+ */
+non_null()
+bool onion_set_relay_threads(Onion *onion, uint8_t threads);
+
+/** @brief Relay the onion packets queued since the last call.
+ *
+ * Call this after each networking_poll() when relay threads are set. Does
+ * nothing otherwise.
+ */
+non_null()
+void onion_relay_batch(Onion *onion);
+
 non_null()
 Onion *new_onion(const Logger *log, const Memory *mem, const Mono_Time *mono_time, const Random *rng, DHT *dht);
 
@@ -22,8 +22,8 @@
 #include "network.h"
 #include "onion.h"
 #include "shared_key_cache.h"
-#include "sort.h"
 #include "timed_auth.h"
+#include "util.h"
 
 #define PING_ID_TIMEOUT ONION_ANNOUNCE_TIMEOUT
 
@@ -45,12 +45,30 @@
 static_assert(ONION_PING_ID_SIZE == CRYPTO_PUBLIC_KEY_SIZE,
               "announce response packets assume that ONION_PING_ID_SIZE is equal to CRYPTO_PUBLIC_KEY_SIZE");
 
+/* Settings for the announce store */
+#define ANNOUNCE_BUCKETS 256
+#define EXPIRY_WHEEL_SIZE 512
+#define NO_ENTRY UINT16_MAX
+
+static_assert(ANNOUNCE_BUCKETS >= ONION_ANNOUNCE_MAX_ENTRIES && (ANNOUNCE_BUCKETS & (ANNOUNCE_BUCKETS - 1)) == 0,
+              "ANNOUNCE_BUCKETS must be a power of 2 no smaller than ONION_ANNOUNCE_MAX_ENTRIES");
+static_assert(EXPIRY_WHEEL_SIZE > ONION_ANNOUNCE_TIMEOUT + 1,
+              "an entry must time out before the expiry wheel comes around to its slot again");
+
 typedef struct Onion_Announce_Entry {
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
     IP_Port ret_ip_port;
     uint8_t ret[ONION_RETURN_3];
     uint8_t data_public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint64_t announce_time;
+
+    /* Next entry in the same hash bucket, or in the free list. */
+    uint16_t bucket_next;
+    /* Neighbours in the expiry wheel slot. */
+    uint16_t wheel_prev;
+    uint16_t wheel_next;
+    /* Position in the eviction heap. */
+    uint16_t heap_index;
 } Onion_Announce_Entry;
 
 struct Onion_Announce {
@@ -60,7 +78,19 @@ struct Onion_Announce {
     const Memory *mem;
     DHT     *dht;
     Networking_Core *net;
+    /* Entries are found through the buckets by public key. The eviction heap
+     * keeps the entry farthest from our DHT key on top, and every entry is
+     * linked into the expiry wheel slot of the second it times out in.
+     */
     Onion_Announce_Entry entries[ONION_ANNOUNCE_MAX_ENTRIES];
+    uint16_t buckets[ANNOUNCE_BUCKETS];
+    uint32_t bucket_salt;
+    uint16_t free_entries;
+    uint16_t eviction_heap[ONION_ANNOUNCE_MAX_ENTRIES];
+    uint16_t num_entries;
+    uint16_t expiry_wheel[EXPIRY_WHEEL_SIZE];
+    uint64_t expired_until;
+
     uint8_t hmac_key[CRYPTO_HMAC_KEY_SIZE];
 
     Shared_Key_Cache *shared_keys_recv;
@@ -78,14 +108,27 @@ void onion_announce_extra_data_callback(Onion_Announce *onion_a, uint16_t extra_
     onion_a->extra_data_object = extra_data_object;
 }
 
-uint8_t *onion_announce_entry_public_key(Onion_Announce *onion_a, uint32_t entry)
+non_null()
+static uint16_t entry_bucket(const Onion_Announce *onion_a, const uint8_t *public_key)
 {
-    return onion_a->entries[entry].public_key;
+    uint32_t word;
+    memcpy(&word, public_key, sizeof(word));
+    return ((word ^ onion_a->bucket_salt) * 2654435761U) >> 24 & (ANNOUNCE_BUCKETS - 1);
 }
 
-void onion_announce_entry_set_time(Onion_Announce *onion_a, uint32_t entry, uint64_t announce_time)
+uint32_t onion_announce_num_entries(const Onion_Announce *onion_a)
 {
-    onion_a->entries[entry].announce_time = announce_time;
+    uint32_t count = 0;
+
+    for (uint16_t i = 0; i < onion_a->num_entries; ++i) {
+        const Onion_Announce_Entry *entry = &onion_a->entries[onion_a->eviction_heap[i]];
+
+        if (!mono_time_is_timeout(onion_a->mono_time, entry->announce_time, ONION_ANNOUNCE_TIMEOUT)) {
+            ++count;
+        }
+    }
+
+    return count;
 }
 
 /** @brief Create an onion announce request packet in packet of max_packet_length.
@@ -263,6 +306,27 @@ int send_data_request(
     return 0;
 }
 
+/** @brief Find the entry stored for a public key.
+ *
+ * return -1 if there is none
+ * return its position in entries if there is
+ */
+non_null()
+static int find_entry(const Onion_Announce *onion_a, const uint8_t *public_key)
+{
+    uint16_t index = onion_a->buckets[entry_bucket(onion_a, public_key)];
+
+    while (index != NO_ENTRY) {
+        if (pk_equal(onion_a->entries[index].public_key, public_key)) {
+            return index;
+        }
+
+        index = onion_a->entries[index].bucket_next;
+    }
+
+    return -1;
+}
+
 /** @brief check if public key is in entries list
  *
  * return -1 if no
@@ -271,128 +335,175 @@ int send_data_request(
 non_null()
 static int in_entries(const Onion_Announce *onion_a, const uint8_t *public_key)
 {
-    for (unsigned int i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-        if (!mono_time_is_timeout(onion_a->mono_time, onion_a->entries[i].announce_time, ONION_ANNOUNCE_TIMEOUT)
-                && pk_equal(onion_a->entries[i].public_key, public_key)) {
-            return i;
-        }
+    const int index = find_entry(onion_a, public_key);
+
+    if (index == -1
+            || mono_time_is_timeout(onion_a->mono_time, onion_a->entries[index].announce_time, ONION_ANNOUNCE_TIMEOUT)) {
+        return -1;
     }
 
-    return -1;
+    return index;
 }
 
-typedef struct Onion_Announce_Entry_Cmp {
-    const Memory *mem;
-    const Mono_Time *mono_time;
-    const uint8_t *comp_public_key;
-} Onion_Announce_Entry_Cmp;
+/** @brief Whether entry a is farther away from our DHT key than entry b. */
+non_null()
+static bool entry_farther(const Onion_Announce *onion_a, uint16_t a, uint16_t b)
+{
+    return id_closest(dht_get_self_public_key(onion_a->dht),
+                      onion_a->entries[a].public_key, onion_a->entries[b].public_key) == 2;
+}
 
 non_null()
-static int onion_announce_entry_cmp(const Onion_Announce_Entry_Cmp *cmp, const Onion_Announce_Entry *entry1, const Onion_Announce_Entry *entry2)
+static void eviction_heap_swap(Onion_Announce *onion_a, uint16_t i, uint16_t j)
 {
-    const bool t1 = mono_time_is_timeout(cmp->mono_time, entry1->announce_time, ONION_ANNOUNCE_TIMEOUT);
-    const bool t2 = mono_time_is_timeout(cmp->mono_time, entry2->announce_time, ONION_ANNOUNCE_TIMEOUT);
+    const uint16_t entry = onion_a->eviction_heap[i];
+    onion_a->eviction_heap[i] = onion_a->eviction_heap[j];
+    onion_a->eviction_heap[j] = entry;
+    onion_a->entries[onion_a->eviction_heap[i]].heap_index = i;
+    onion_a->entries[onion_a->eviction_heap[j]].heap_index = j;
+}
 
-    if (t1 && t2) {
-        return 0;
-    }
+/** @brief Restore the heap order around position i, after the entry there was added or replaced. */
+non_null()
+static void eviction_heap_fix(Onion_Announce *onion_a, uint16_t i)
+{
+    uint16_t *const heap = onion_a->eviction_heap;
 
-    if (t1) {
-        return -1;
+    while (i > 0 && entry_farther(onion_a, heap[i], heap[(i - 1) / 2])) {
+        eviction_heap_swap(onion_a, i, (i - 1) / 2);
+        i = (i - 1) / 2;
     }
 
-    if (t2) {
-        return 1;
-    }
+    while (true) {
+        const uint16_t left = 2 * i + 1;
+        const uint16_t right = left + 1;
+        uint16_t farthest = i;
 
-    const int closest = id_closest(cmp->comp_public_key, entry1->public_key, entry2->public_key);
+        if (left < onion_a->num_entries && entry_farther(onion_a, heap[left], heap[farthest])) {
+            farthest = left;
+        }
 
-    if (closest == 1) {
-        return 1;
-    }
+        if (right < onion_a->num_entries && entry_farther(onion_a, heap[right], heap[farthest])) {
+            farthest = right;
+        }
 
-    if (closest == 2) {
-        return -1;
-    }
+        if (farthest == i) {
+            return;
+        }
 
-    return 0;
+        eviction_heap_swap(onion_a, i, farthest);
+        i = farthest;
+    }
 }
 
+/** @brief Link an entry into the wheel slot of the second it times out in. */
 non_null()
-static bool onion_announce_entry_less_handler(const void *object, const void *a, const void *b)
+static void expiry_wheel_link(Onion_Announce *onion_a, uint16_t index)
 {
-    const Onion_Announce_Entry_Cmp *cmp = (const Onion_Announce_Entry_Cmp *)object;
-    const Onion_Announce_Entry *entry1 = (const Onion_Announce_Entry *)a;
-    const Onion_Announce_Entry *entry2 = (const Onion_Announce_Entry *)b;
+    Onion_Announce_Entry *const entry = &onion_a->entries[index];
+    uint16_t *const slot = &onion_a->expiry_wheel[(entry->announce_time + ONION_ANNOUNCE_TIMEOUT + 1) % EXPIRY_WHEEL_SIZE];
 
-    return onion_announce_entry_cmp(cmp, entry1, entry2) < 0;
-}
+    entry->wheel_prev = NO_ENTRY;
+    entry->wheel_next = *slot;
 
-non_null()
-static const void *onion_announce_entry_get_handler(const void *arr, uint32_t index)
-{
-    const Onion_Announce_Entry *entries = (const Onion_Announce_Entry *)arr;
-    return &entries[index];
+    if (*slot != NO_ENTRY) {
+        onion_a->entries[*slot].wheel_prev = index;
+    }
+
+    *slot = index;
 }
 
 non_null()
-static void onion_announce_entry_set_handler(void *arr, uint32_t index, const void *val)
+static void expiry_wheel_unlink(Onion_Announce *onion_a, uint16_t index)
 {
-    Onion_Announce_Entry *entries = (Onion_Announce_Entry *)arr;
-    const Onion_Announce_Entry *entry = (const Onion_Announce_Entry *)val;
-    entries[index] = *entry;
+    const Onion_Announce_Entry *const entry = &onion_a->entries[index];
+
+    if (entry->wheel_prev != NO_ENTRY) {
+        onion_a->entries[entry->wheel_prev].wheel_next = entry->wheel_next;
+    } else {
+        onion_a->expiry_wheel[(entry->announce_time + ONION_ANNOUNCE_TIMEOUT + 1) % EXPIRY_WHEEL_SIZE] = entry->wheel_next;
+    }
+
+    if (entry->wheel_next != NO_ENTRY) {
+        onion_a->entries[entry->wheel_next].wheel_prev = entry->wheel_prev;
+    }
 }
 
+/** @brief Take a free entry, link it into the index and the eviction heap and return its position. */
 non_null()
-static void *onion_announce_entry_subarr_handler(void *arr, uint32_t index, uint32_t size)
+static uint16_t insert_entry(Onion_Announce *onion_a, const uint8_t *public_key)
 {
-    Onion_Announce_Entry *entries = (Onion_Announce_Entry *)arr;
-    return &entries[index];
+    assert(onion_a->free_entries != NO_ENTRY);
+
+    const uint16_t index = onion_a->free_entries;
+    Onion_Announce_Entry *const entry = &onion_a->entries[index];
+    onion_a->free_entries = entry->bucket_next;
+
+    memcpy(entry->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+
+    uint16_t *const bucket = &onion_a->buckets[entry_bucket(onion_a, public_key)];
+    entry->bucket_next = *bucket;
+    *bucket = index;
+
+    entry->heap_index = onion_a->num_entries;
+    onion_a->eviction_heap[onion_a->num_entries] = index;
+    ++onion_a->num_entries;
+    eviction_heap_fix(onion_a, entry->heap_index);
+
+    return index;
 }
 
+/** @brief Unlink an entry from the index, the eviction heap and the expiry wheel and free it. */
 non_null()
-static void *onion_announce_entry_alloc_handler(const void *object, uint32_t size)
+static void remove_entry(Onion_Announce *onion_a, uint16_t index)
 {
-    const Onion_Announce_Entry_Cmp *cmp = (const Onion_Announce_Entry_Cmp *)object;
-    Onion_Announce_Entry *tmp = (Onion_Announce_Entry *)mem_valloc(cmp->mem, size, sizeof(Onion_Announce_Entry));
+    Onion_Announce_Entry *const entry = &onion_a->entries[index];
 
-    if (tmp == nullptr) {
-        return nullptr;
+    uint16_t *link = &onion_a->buckets[entry_bucket(onion_a, entry->public_key)];
+
+    while (*link != index) {
+        link = &onion_a->entries[*link].bucket_next;
+    }
+
+    *link = entry->bucket_next;
+
+    expiry_wheel_unlink(onion_a, index);
+
+    const uint16_t heap_index = entry->heap_index;
+    --onion_a->num_entries;
+
+    if (heap_index != onion_a->num_entries) {
+        eviction_heap_swap(onion_a, heap_index, onion_a->num_entries);
+        eviction_heap_fix(onion_a, heap_index);
     }
 
-    return tmp;
+    crypto_memzero(entry, sizeof(Onion_Announce_Entry));
+    entry->bucket_next = onion_a->free_entries;
+    onion_a->free_entries = index;
 }
 
+/** @brief Remove the entries that timed out since the last call.
+ *
+ * Every entry sits in the wheel slot of the second it times out in, and no
+ * entry lives longer than the wheel is wide, so each slot visited holds only
+ * entries that are due.
+ */
 non_null()
-static void onion_announce_entry_delete_handler(const void *object, void *arr, uint32_t size)
+static void expire_entries(Onion_Announce *onion_a)
 {
-    const Onion_Announce_Entry_Cmp *cmp = (const Onion_Announce_Entry_Cmp *)object;
-    mem_delete(cmp->mem, arr);
-}
+    const uint64_t now = mono_time_get(onion_a->mono_time);
+    const uint64_t elapsed = now - onion_a->expired_until;
+    const uint64_t slots = min_u64(elapsed, EXPIRY_WHEEL_SIZE);
 
-static const Sort_Funcs onion_announce_entry_cmp_funcs = {
-    onion_announce_entry_less_handler,
-    onion_announce_entry_get_handler,
-    onion_announce_entry_set_handler,
-    onion_announce_entry_subarr_handler,
-    onion_announce_entry_alloc_handler,
-    onion_announce_entry_delete_handler,
-};
+    for (uint64_t t = now - slots + 1; t <= now; ++t) {
+        uint16_t *const slot = &onion_a->expiry_wheel[t % EXPIRY_WHEEL_SIZE];
 
-non_null()
-static void sort_onion_announce_list(const Memory *mem, const Mono_Time *mono_time,
-                                     Onion_Announce_Entry *list, unsigned int length,
-                                     const uint8_t *comp_public_key)
-{
-    // Pass comp_public_key to sort with each Onion_Announce_Entry entry, so the
-    // comparison function can use it as the base of comparison.
-    const Onion_Announce_Entry_Cmp cmp = {
-        mem,
-        mono_time,
-        comp_public_key,
-    };
-
-    merge_sort(list, length, &cmp, &onion_announce_entry_cmp_funcs);
+        while (*slot != NO_ENTRY) {
+            remove_entry(onion_a, *slot);
+        }
+    }
+
+    onion_a->expired_until = now;
 }
 
 /** @brief add entry to entries list
@@ -404,36 +515,47 @@ non_null()
 static int add_to_entries(Onion_Announce *onion_a, const IP_Port *ret_ip_port, const uint8_t *public_key,
                           const uint8_t *data_public_key, const uint8_t *ret)
 {
-    int pos = in_entries(onion_a, public_key);
+    expire_entries(onion_a);
+
+    int pos = find_entry(onion_a, public_key);
+
+    if (pos != -1) {
+        expiry_wheel_unlink(onion_a, pos);
+    } else {
+        if (onion_a->num_entries == ONION_ANNOUNCE_MAX_ENTRIES) {
+            const uint16_t farthest = onion_a->eviction_heap[0];
 
-    if (pos == -1) {
-        for (unsigned i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-            if (mono_time_is_timeout(onion_a->mono_time, onion_a->entries[i].announce_time, ONION_ANNOUNCE_TIMEOUT)) {
-                pos = i;
+            if (id_closest(dht_get_self_public_key(onion_a->dht), public_key, onion_a->entries[farthest].public_key) != 1) {
+                return -1;
             }
-        }
-    }
 
-    if (pos == -1) {
-        if (id_closest(dht_get_self_public_key(onion_a->dht), public_key, onion_a->entries[0].public_key) == 1) {
-            pos = 0;
+            remove_entry(onion_a, farthest);
         }
-    }
 
-    if (pos == -1) {
-        return -1;
+        pos = insert_entry(onion_a, public_key);
     }
 
-    memcpy(onion_a->entries[pos].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    onion_a->entries[pos].ret_ip_port = *ret_ip_port;
-    memcpy(onion_a->entries[pos].ret, ret, ONION_RETURN_3);
-    memcpy(onion_a->entries[pos].data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    onion_a->entries[pos].announce_time = mono_time_get(onion_a->mono_time);
+    Onion_Announce_Entry *const entry = &onion_a->entries[pos];
+    entry->ret_ip_port = *ret_ip_port;
+    memcpy(entry->ret, ret, ONION_RETURN_3);
+    memcpy(entry->data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    entry->announce_time = mono_time_get(onion_a->mono_time);
+    expiry_wheel_link(onion_a, pos);
+
+    return pos;
+}
+
+bool onion_announce_entry_add(Onion_Announce *onion_a, const uint8_t *public_key)
+{
+    const IP_Port ret_ip_port = {{{0}}};
+    const uint8_t data_public_key[CRYPTO_PUBLIC_KEY_SIZE] = {0};
+    const uint8_t ret[ONION_RETURN_3] = {0};
+    return add_to_entries(onion_a, &ret_ip_port, public_key, data_public_key, ret) != -1;
+}
 
-    sort_onion_announce_list(onion_a->mem, onion_a->mono_time,
-                             onion_a->entries, ONION_ANNOUNCE_MAX_ENTRIES,
-                             dht_get_self_public_key(onion_a->dht));
-    return in_entries(onion_a, public_key);
+bool onion_announce_entry_exists(const Onion_Announce *onion_a, const uint8_t *public_key)
+{
+    return in_entries(onion_a, public_key) != -1;
 }
 
 non_null()
@@ -717,6 +839,22 @@ Onion_Announce *new_onion_announce(const Logger *log, const Memory *mem, const R
     onion_a->extra_data_object = nullptr;
     new_hmac_key(rng, onion_a->hmac_key);
 
+    onion_a->bucket_salt = random_u32(rng);
+    onion_a->free_entries = 0;
+    onion_a->expired_until = mono_time_get(mono_time);
+
+    for (uint16_t i = 0; i < ANNOUNCE_BUCKETS; ++i) {
+        onion_a->buckets[i] = NO_ENTRY;
+    }
+
+    for (uint16_t i = 0; i < EXPIRY_WHEEL_SIZE; ++i) {
+        onion_a->expiry_wheel[i] = NO_ENTRY;
+    }
+
+    for (uint16_t i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
+        onion_a->entries[i].bucket_next = i + 1 < ONION_ANNOUNCE_MAX_ENTRIES ? i + 1 : NO_ENTRY;
+    }
+
     onion_a->shared_keys_recv = shared_key_cache_new(log, mono_time, mem, dht_get_self_secret_key(dht), KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
     if (onion_a->shared_keys_recv == nullptr) {
         // cppcheck-suppress mismatchAllocDealloc
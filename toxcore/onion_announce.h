@@ -45,9 +45,13 @@ typedef struct Onion_Announce Onion_Announce;
 
 /** These two are not public; they are for tests only! */
 non_null()
-uint8_t *onion_announce_entry_public_key(Onion_Announce *onion_a, uint32_t entry);
+bool onion_announce_entry_add(Onion_Announce *onion_a, const uint8_t *public_key);
 non_null()
-void onion_announce_entry_set_time(Onion_Announce *onion_a, uint32_t entry, uint64_t announce_time);
+bool onion_announce_entry_exists(const Onion_Announce *onion_a, const uint8_t *public_key);
+
+/** @brief Number of announce entries that have not timed out yet. */
+non_null()
+uint32_t onion_announce_num_entries(const Onion_Announce *onion_a);
 
 /** @brief Create an onion announce request packet in packet of max_packet_length.
  *
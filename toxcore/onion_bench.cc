@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "DHT.h"
+#include "crypto_core.h"
+#include "logger.h"
+#include "mem.h"
+#include "mono_time.h"
+#include "network.h"
+#include "onion.h"
+
+namespace {
+
+/** @brief A DHT without a UDP socket, just enough to create onion paths from. */
+class Onion_Path_Fixture {
+public:
+    Onion_Path_Fixture()
+        : mem_(os_memory())
+        , rng_(os_random())
+        , log_(logger_new(mem_))
+        , mono_time_(mono_time_new(mem_, nullptr, nullptr))
+        , net_(new_networking_no_udp(log_, mem_, os_network()))
+        , dht_(new_dht(log_, mem_, rng_, os_network(), mono_time_, net_, false, false))
+    {
+        std::array<Node_format, ONION_PATH_LENGTH> nodes{};
+
+        for (uint32_t i = 0; i < nodes.size(); ++i) {
+            uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+            crypto_new_keypair(rng_, nodes[i].public_key, secret_key);
+            nodes[i].ip_port.ip.family = net_family_ipv4();
+            nodes[i].ip_port.ip.ip.v4 = get_ip4_loopback();
+            nodes[i].ip_port.port = net_htons(33445 + i);
+        }
+
+        create_onion_path(rng_, dht_, &path_, nodes.data());
+
+        dest_.ip.family = net_family_ipv4();
+        dest_.ip.ip.v4 = get_ip4_loopback();
+        dest_.port = net_htons(33448);
+    }
+
+    ~Onion_Path_Fixture()
+    {
+        kill_dht(dht_);
+        kill_networking(net_);
+        mono_time_free(mem_, mono_time_);
+        logger_kill(log_);
+    }
+
+    const Memory *mem() const { return mem_; }
+    const Random *rng() const { return rng_; }
+    const Onion_Path *path() const { return &path_; }
+    const IP_Port *dest() const { return &dest_; }
+
+private:
+    const Memory *mem_;
+    const Random *rng_;
+    Logger *log_;
+    Mono_Time *mono_time_;
+    Networking_Core *net_;
+    DHT *dht_;
+    Onion_Path path_{};
+    IP_Port dest_{};
+};
+
+void BM_create_onion_packet(benchmark::State &state)
+{
+    const Onion_Path_Fixture fixture;
+    const std::vector<uint8_t> data(state.range(0), 0x42);
+    std::array<uint8_t, ONION_MAX_PACKET_SIZE> packet;
+
+    for (auto _ : state) {
+        const int len = create_onion_packet(fixture.mem(), fixture.rng(), packet.data(), packet.size(),
+                                            fixture.path(), fixture.dest(), data.data(), data.size());
+        benchmark::DoNotOptimize(len);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_create_onion_packet)->Arg(64)->Arg(256)->Arg(ONION_MAX_DATA_SIZE);
+
+void BM_create_onion_packet_tcp(benchmark::State &state)
+{
+    const Onion_Path_Fixture fixture;
+    const std::vector<uint8_t> data(state.range(0), 0x42);
+    std::array<uint8_t, ONION_MAX_PACKET_SIZE> packet;
+
+    for (auto _ : state) {
+        const int len = create_onion_packet_tcp(fixture.mem(), fixture.rng(), packet.data(), packet.size(),
+                                                fixture.path(), fixture.dest(), data.data(), data.size());
+        benchmark::DoNotOptimize(len);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_create_onion_packet_tcp)->Arg(64)->Arg(256)->Arg(ONION_MAX_DATA_SIZE);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -28,6 +28,7 @@
 #include "onion.h"
 #include "onion_announce.h"
 #include "ping_array.h"
+#include "pk_index.h"
 #include "sort.h"
 #include "timed_auth.h"
 #include "util.h"
@@ -61,6 +62,11 @@ typedef struct Onion_Client_Paths {
     uint64_t path_creation_time[NUMBER_ONION_PATHS];
     /* number of times used without success. */
     unsigned int last_path_used_times[NUMBER_ONION_PATHS];
+    /* announce requests sent and responses received since the path was created. */
+    uint32_t path_requests[NUMBER_ONION_PATHS];
+    uint32_t path_responses[NUMBER_ONION_PATHS];
+    /* smoothed announce round trip time in milliseconds, 0 until the first response. */
+    uint32_t path_rtt[NUMBER_ONION_PATHS];
 } Onion_Client_Paths;
 
 typedef struct Last_Pinged {
@@ -77,6 +83,7 @@ struct Onion_Friend {
     uint8_t real_public_key[CRYPTO_PUBLIC_KEY_SIZE];
 
     Onion_Node clients_list[MAX_ONION_CLIENTS];
+    bool has_temp_key;  // the temp key pair is made on the first announce request
     uint8_t temp_public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint8_t temp_secret_key[CRYPTO_SECRET_KEY_SIZE];
 
@@ -91,6 +98,10 @@ struct Onion_Friend {
     uint32_t run_count;
     uint32_t pings;  // how many sucessful pings we've made for this friend
 
+    uint64_t next_run;  // when do_friend() next has something to do for this friend
+    uint8_t retry_exponent;  // do_friend() retries what failed after 2^retry_exponent seconds
+    uint16_t queue_index;  // position in Onion_Client::friend_queue
+
     Last_Pinged last_pinged[MAX_STORED_PINGED_NODES];
     uint8_t last_pinged_index;
 
@@ -110,6 +121,8 @@ struct Onion_Friend {
 
 static const Onion_Friend empty_onion_friend = {false};
 
+static const Onion_Path_Node_Stats empty_path_node_stats = {0};
+
 typedef struct Onion_Data_Handler {
     oniondata_handler_cb *function;
     void *object;
@@ -126,6 +139,13 @@ struct Onion_Client {
     Networking_Core *net;
     Onion_Friend    *friends_list;
     uint16_t       num_friends;
+    uint16_t       friends_capacity;  // allocated length of friends_list and friend_queue
+    Pk_Index       *friend_index;  // real public key -> friend number
+
+    /* Valid friends as a binary min-heap on Onion_Friend::next_run, so that
+     * do_onion_client() only visits the friends that are due. */
+    uint16_t *friend_queue;
+    uint16_t friend_queue_length;
 
     Onion_Node clients_announce_list[MAX_ONION_CLIENTS_ANNOUNCE];
     uint64_t last_announce;
@@ -144,6 +164,7 @@ struct Onion_Client {
     Last_Pinged last_pinged[MAX_STORED_PINGED_NODES];
 
     Node_format path_nodes[MAX_PATH_NODES];
+    Onion_Path_Node_Stats path_node_stats[MAX_PATH_NODES];
     uint16_t path_nodes_index;
 
     Node_format path_nodes_bs[MAX_PATH_NODES];
@@ -273,6 +294,7 @@ static int onion_add_path_node(Onion_Client *onion_c, const IP_Port *ip_port, co
     onion_c->path_nodes[onion_c->path_nodes_index % MAX_PATH_NODES].ip_port = *ip_port;
     memcpy(onion_c->path_nodes[onion_c->path_nodes_index % MAX_PATH_NODES].public_key, public_key,
            CRYPTO_PUBLIC_KEY_SIZE);
+    onion_c->path_node_stats[onion_c->path_nodes_index % MAX_PATH_NODES] = empty_path_node_stats;
 
     const uint16_t last = onion_c->path_nodes_index;
     ++onion_c->path_nodes_index;
@@ -284,6 +306,19 @@ static int onion_add_path_node(Onion_Client *onion_c, const IP_Port *ip_port, co
     return 0;
 }
 
+bool onion_add_saved_path_node(Onion_Client *onion_c, const IP_Port *ip_port, const uint8_t *public_key,
+                               const Onion_Path_Node_Stats *stats)
+{
+    const uint16_t slot = onion_c->path_nodes_index % MAX_PATH_NODES;
+
+    if (onion_add_path_node(onion_c, ip_port, public_key) == -1) {
+        return false;
+    }
+
+    onion_c->path_node_stats[slot] = *stats;
+    return true;
+}
+
 /** @brief Put up to max_num nodes in nodes.
  *
  * return the number of nodes.
@@ -321,6 +356,82 @@ uint16_t onion_backup_nodes(const Onion_Client *onion_c, Node_format *nodes, uin
     return i;
 }
 
+/** @brief Whether path node a has been more reliable, or as reliable and faster, than path node b.
+ *
+ * Success rates are estimated as if every node had one extra success and one
+ * extra failure, so that nodes we know nothing about rank between good and bad
+ * ones.
+ */
+non_null()
+static bool path_node_better(const Onion_Path_Node_Stats *a, const Onion_Path_Node_Stats *b)
+{
+    const uint64_t rate_a = (uint64_t)(a->successes + 1) * (b->successes + b->failures + 2);
+    const uint64_t rate_b = (uint64_t)(b->successes + 1) * (a->successes + a->failures + 2);
+
+    if (rate_a != rate_b) {
+        return rate_a > rate_b;
+    }
+
+    if (a->rtt == 0 || b->rtt == 0) {
+        return b->rtt == 0;
+    }
+
+    return a->rtt <= b->rtt;
+}
+
+/** @brief Pick one of the first num_nodes path nodes at random, favouring healthy ones.
+ *
+ * Two nodes are drawn and the better one is kept. This steers most paths away
+ * from nodes that lose or delay requests while every node can still be picked.
+ */
+non_null()
+static const Node_format *random_path_node(const Onion_Client *onion_c, uint16_t num_nodes)
+{
+    const uint32_t a = random_range_u32(onion_c->rng, num_nodes);
+    const uint32_t b = random_range_u32(onion_c->rng, num_nodes);
+
+    if (path_node_better(&onion_c->path_node_stats[a], &onion_c->path_node_stats[b])) {
+        return &onion_c->path_nodes[a];
+    }
+
+    return &onion_c->path_nodes[b];
+}
+
+bool onion_get_path_stats(const Onion_Client *onion_c, bool friends, uint32_t path_index, Onion_Path_Stats *stats)
+{
+    const Onion_Client_Paths *onion_paths = friends ? &onion_c->onion_paths_friends : &onion_c->onion_paths_self;
+
+    if (path_index >= NUMBER_ONION_PATHS || onion_paths->path_creation_time[path_index] == 0) {
+        return false;
+    }
+
+    stats->requests = onion_paths->path_requests[path_index];
+    stats->responses = onion_paths->path_responses[path_index];
+    stats->rtt = onion_paths->path_rtt[path_index];
+    stats->age = mono_time_get(onion_c->mono_time) - onion_paths->path_creation_time[path_index];
+    return true;
+}
+
+uint16_t onion_get_path_node_count(const Onion_Client *onion_c)
+{
+    return min_u16(onion_c->path_nodes_index, MAX_PATH_NODES);
+}
+
+bool onion_get_path_node_stats(const Onion_Client *onion_c, uint16_t index, Node_format *node,
+                               Onion_Path_Node_Stats *stats)
+{
+    const uint16_t num_nodes = onion_get_path_node_count(onion_c);
+
+    if (index >= num_nodes) {
+        return false;
+    }
+
+    const uint16_t slot = (onion_c->path_nodes_index + index) % num_nodes;
+    *node = onion_c->path_nodes[slot];
+    *stats = onion_c->path_node_stats[slot];
+    return true;
+}
+
 /** @brief Put up to max_num random nodes in nodes.
  *
  * return the number of nodes.
@@ -341,8 +452,7 @@ static uint16_t random_nodes_path_onion(const Onion_Client *onion_c, Node_format
         }
 
         for (unsigned int i = 0; i < max_num; ++i) {
-            const uint32_t rand_idx = random_range_u32(onion_c->rng, num_nodes);
-            nodes[i] = onion_c->path_nodes[rand_idx];
+            nodes[i] = *random_path_node(onion_c, num_nodes);
         }
     } else {
         const int random_tcp = get_random_tcp_con_number(onion_c->c);
@@ -356,8 +466,7 @@ static uint16_t random_nodes_path_onion(const Onion_Client *onion_c, Node_format
             nodes[0].ip_port = tcp_connections_number_to_ip_port(random_tcp);
 
             for (unsigned int i = 1; i < max_num; ++i) {
-                const uint32_t rand_idx = random_range_u32(onion_c->rng, num_nodes);
-                nodes[i] = onion_c->path_nodes[rand_idx];
+                nodes[i] = *random_path_node(onion_c, num_nodes);
             }
         } else {
             const uint16_t num_nodes_bs = min_u16(onion_c->path_nodes_index_bs, MAX_PATH_NODES);
@@ -427,6 +536,57 @@ static bool onion_node_timed_out(const Onion_Node *node, const Mono_Time *mono_t
                && mono_time_is_timeout(mono_time, node->last_pinged, ONION_NODE_TIMEOUT));
 }
 
+/** @brief Fold a round trip time sample in milliseconds into a smoothed one. */
+static uint32_t smooth_rtt(uint32_t rtt, uint64_t sample)
+{
+    const uint64_t clamped = max_u64(1, min_u64(sample, UINT32_MAX));
+
+    if (rtt == 0) {
+        return (uint32_t)clamped;
+    }
+
+    return (uint32_t)(((uint64_t)rtt * 7 + clamped) / 8);
+}
+
+/** @brief Credit or debit the path nodes that make up path.
+ *
+ * Counts are halved once they grow large so that recent behaviour dominates.
+ */
+non_null()
+static void path_nodes_record(Onion_Client *onion_c, const Onion_Path *path, bool success, uint64_t rtt)
+{
+    const uint16_t num_nodes = min_u16(onion_c->path_nodes_index, MAX_PATH_NODES);
+    Node_format nodes[ONION_PATH_LENGTH];
+
+    if (onion_path_to_nodes(nodes, ONION_PATH_LENGTH, path) != 0) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < ONION_PATH_LENGTH; ++i) {
+        for (uint16_t j = 0; j < num_nodes; ++j) {
+            if (!pk_equal(nodes[i].public_key, onion_c->path_nodes[j].public_key)) {
+                continue;
+            }
+
+            Onion_Path_Node_Stats *stats = &onion_c->path_node_stats[j];
+
+            if (success) {
+                ++stats->successes;
+                stats->rtt = smooth_rtt(stats->rtt, rtt);
+            } else {
+                ++stats->failures;
+            }
+
+            if (stats->successes + stats->failures >= PATH_NODE_STATS_MAX_COUNT) {
+                stats->successes /= 2;
+                stats->failures /= 2;
+            }
+
+            break;
+        }
+    }
+}
+
 /** @brief Create a new path or use an old suitable one (if pathnum is valid)
  * or a random one from onion_paths.
  *
@@ -437,7 +597,7 @@ static bool onion_node_timed_out(const Onion_Node *node, const Mono_Time *mono_t
  * vulnerable to some attacks that could deanonimize us.
  */
 non_null()
-static int random_path(const Onion_Client *onion_c, Onion_Client_Paths *onion_paths, uint32_t pathnum, Onion_Path *path)
+static int random_path(Onion_Client *onion_c, Onion_Client_Paths *onion_paths, uint32_t pathnum, Onion_Path *path)
 {
     if (pathnum == UINT32_MAX) {
         pathnum = random_range_u32(onion_c->rng, NUMBER_ONION_PATHS);
@@ -455,13 +615,26 @@ static int random_path(const Onion_Client *onion_c, Onion_Client_Paths *onion_pa
         const int n = is_path_used(onion_c->mono_time, onion_paths, nodes);
 
         if (n == -1) {
+            // A path that stopped answering, rather than one that got too
+            // old, counts against the nodes it went through.
+            const bool failed = onion_paths->path_creation_time[pathnum] != 0
+                                && onion_paths->last_path_used_times[pathnum] >= ONION_PATH_MAX_NO_RESPONSE_USES;
+            const Onion_Path old_path = onion_paths->paths[pathnum];
+
             if (create_onion_path(onion_c->rng, onion_c->dht, &onion_paths->paths[pathnum], nodes) == -1) {
                 return -1;
             }
 
+            if (failed) {
+                path_nodes_record(onion_c, &old_path, false, 0);
+            }
+
             onion_paths->path_creation_time[pathnum] = mono_time_get(onion_c->mono_time);
             onion_paths->last_path_success[pathnum] = onion_paths->path_creation_time[pathnum];
             onion_paths->last_path_used_times[pathnum] = ONION_PATH_MAX_NO_RESPONSE_USES / 2;
+            onion_paths->path_requests[pathnum] = 0;
+            onion_paths->path_responses[pathnum] = 0;
+            onion_paths->path_rtt[pathnum] = 0;
 
             uint32_t path_num = random_u32(onion_c->rng);
             path_num /= NUMBER_ONION_PATHS;
@@ -483,9 +656,9 @@ static int random_path(const Onion_Client *onion_c, Onion_Client_Paths *onion_pa
     return 0;
 }
 
-/** Set path timeouts, return the path number. */
+/** @brief Set path timeouts and record a response that took rtt milliseconds, return the path number. */
 non_null()
-static uint32_t set_path_timeouts(Onion_Client *onion_c, uint32_t num, uint32_t path_num)
+static uint32_t set_path_timeouts(Onion_Client *onion_c, uint32_t num, uint32_t path_num, uint64_t rtt)
 {
     if (num > onion_c->num_friends) {
         return -1;
@@ -511,6 +684,11 @@ static uint32_t set_path_timeouts(Onion_Client *onion_c, uint32_t num, uint32_t
             }
         }
 
+        ++onion_paths->path_responses[path_num % NUMBER_ONION_PATHS];
+        onion_paths->path_rtt[path_num % NUMBER_ONION_PATHS] =
+            smooth_rtt(onion_paths->path_rtt[path_num % NUMBER_ONION_PATHS], rtt);
+        path_nodes_record(onion_c, &onion_paths->paths[path_num % NUMBER_ONION_PATHS], true, rtt);
+
         return path_num;
     }
 
@@ -576,11 +754,14 @@ non_null()
 static int new_sendback(Onion_Client *onion_c, uint32_t num, const uint8_t *public_key, const IP_Port *ip_port,
                         uint32_t path_num, uint64_t *sendback)
 {
-    uint8_t data[sizeof(uint32_t) + CRYPTO_PUBLIC_KEY_SIZE + sizeof(IP_Port) + sizeof(uint32_t)];
+    const uint64_t sent_time = mono_time_get_ms(onion_c->mono_time);
+    uint8_t data[sizeof(uint32_t) + CRYPTO_PUBLIC_KEY_SIZE + sizeof(IP_Port) + sizeof(uint32_t) + sizeof(uint64_t)];
     memcpy(data, &num, sizeof(uint32_t));
     memcpy(data + sizeof(uint32_t), public_key, CRYPTO_PUBLIC_KEY_SIZE);
     memcpy(data + sizeof(uint32_t) + CRYPTO_PUBLIC_KEY_SIZE, ip_port, sizeof(IP_Port));
     memcpy(data + sizeof(uint32_t) + CRYPTO_PUBLIC_KEY_SIZE + sizeof(IP_Port), &path_num, sizeof(uint32_t));
+    memcpy(data + sizeof(uint32_t) + CRYPTO_PUBLIC_KEY_SIZE + sizeof(IP_Port) + sizeof(uint32_t), &sent_time,
+           sizeof(uint64_t));
     *sendback = ping_array_add(onion_c->announce_ping_array, onion_c->mono_time, onion_c->rng, data, sizeof(data));
 
     if (*sendback == 0) {
@@ -597,17 +778,18 @@ static int new_sendback(Onion_Client *onion_c, uint32_t num, const uint8_t *publ
  * sendback is the sendback ONION_ANNOUNCE_SENDBACK_DATA_LENGTH big
  * ret_pubkey must be at least CRYPTO_PUBLIC_KEY_SIZE big
  * ret_ip_port must be at least 1 big
+ * rtt is set to the milliseconds that passed since the request was sent
  *
  * return -1 on failure
  * return num (see new_sendback(...)) on success
  */
 non_null()
 static uint32_t check_sendback(Onion_Client *onion_c, const uint8_t *sendback, uint8_t *ret_pubkey,
-                               IP_Port *ret_ip_port, uint32_t *path_num)
+                               IP_Port *ret_ip_port, uint32_t *path_num, uint64_t *rtt)
 {
     uint64_t sback;
     memcpy(&sback, sendback, sizeof(uint64_t));
-    uint8_t data[sizeof(uint32_t) + CRYPTO_PUBLIC_KEY_SIZE + sizeof(IP_Port) + sizeof(uint32_t)];
+    uint8_t data[sizeof(uint32_t) + CRYPTO_PUBLIC_KEY_SIZE + sizeof(IP_Port) + sizeof(uint32_t) + sizeof(uint64_t)];
 
     if (ping_array_check(onion_c->announce_ping_array, onion_c->mono_time, data, sizeof(data), sback) != sizeof(data)) {
         return -1;
@@ -617,6 +799,12 @@ static uint32_t check_sendback(Onion_Client *onion_c, const uint8_t *sendback, u
     memcpy(ret_ip_port, data + sizeof(uint32_t) + CRYPTO_PUBLIC_KEY_SIZE, sizeof(IP_Port));
     memcpy(path_num, data + sizeof(uint32_t) + CRYPTO_PUBLIC_KEY_SIZE + sizeof(IP_Port), sizeof(uint32_t));
 
+    uint64_t sent_time;
+    memcpy(&sent_time, data + sizeof(uint32_t) + CRYPTO_PUBLIC_KEY_SIZE + sizeof(IP_Port) + sizeof(uint32_t),
+           sizeof(uint64_t));
+    const uint64_t now = mono_time_get_ms(onion_c->mono_time);
+    *rtt = now > sent_time ? now - sent_time : 0;
+
     uint32_t num;
     memcpy(&num, data, sizeof(uint32_t));
     return num;
@@ -633,23 +821,19 @@ static int client_send_announce_request(Onion_Client *onion_c, uint32_t num, con
 
     uint64_t sendback;
     Onion_Path path;
+    Onion_Client_Paths *onion_paths = num == 0 ? &onion_c->onion_paths_self : &onion_c->onion_paths_friends;
 
-    if (num == 0) {
-        if (random_path(onion_c, &onion_c->onion_paths_self, pathnum, &path) == -1) {
-            LOGGER_TRACE(onion_c->logger, "cannot find path to self");
-            return -1;
-        }
-    } else {
-        if (random_path(onion_c, &onion_c->onion_paths_friends, pathnum, &path) == -1) {
-            LOGGER_TRACE(onion_c->logger, "cannot find path to friend");
-            return -1;
-        }
+    if (random_path(onion_c, onion_paths, pathnum, &path) == -1) {
+        LOGGER_TRACE(onion_c->logger, "cannot find path to %s", num == 0 ? "self" : "friend");
+        return -1;
     }
 
     if (new_sendback(onion_c, num, dest_pubkey, dest, path.path_num, &sendback) == -1) {
         return -1;
     }
 
+    ++onion_paths->path_requests[path.path_num % NUMBER_ONION_PATHS];
+
     uint8_t zero_ping_id[ONION_PING_ID_SIZE] = {0};
 
     if (ping_id == nullptr) {
@@ -667,6 +851,11 @@ static int client_send_announce_request(Onion_Client *onion_c, uint32_t num, con
     } else {
         Onion_Friend *onion_friend = &onion_c->friends_list[num - 1];
 
+        if (!onion_friend->has_temp_key) {
+            crypto_new_keypair(onion_c->rng, onion_friend->temp_public_key, onion_friend->temp_secret_key);
+            onion_friend->has_temp_key = true;
+        }
+
         if (onion_friend->gc_data_length == 0) { // contact is a friend
             len = create_announce_request(
                       onion_c->mem, onion_c->rng, request, sizeof(request), dest_pubkey, onion_friend->temp_public_key,
@@ -807,6 +996,100 @@ static void sort_onion_node_list(const Memory *mem, const Mono_Time *mono_time,
     merge_sort(list, length, &cmp, &onion_node_cmp_funcs);
 }
 
+non_null()
+static bool friend_queue_before(const Onion_Client *onion_c, uint32_t a, uint32_t b)
+{
+    return onion_c->friends_list[onion_c->friend_queue[a]].next_run
+           < onion_c->friends_list[onion_c->friend_queue[b]].next_run;
+}
+
+non_null()
+static void friend_queue_swap(Onion_Client *onion_c, uint32_t a, uint32_t b)
+{
+    const uint16_t friend_a = onion_c->friend_queue[a];
+    const uint16_t friend_b = onion_c->friend_queue[b];
+
+    onion_c->friend_queue[a] = friend_b;
+    onion_c->friend_queue[b] = friend_a;
+    onion_c->friends_list[friend_b].queue_index = a;
+    onion_c->friends_list[friend_a].queue_index = b;
+}
+
+/** @brief Restore the heap order after the key at `index` changed. */
+non_null()
+static void friend_queue_fix(Onion_Client *onion_c, uint32_t index)
+{
+    while (index > 0 && friend_queue_before(onion_c, index, (index - 1) / 2)) {
+        friend_queue_swap(onion_c, index, (index - 1) / 2);
+        index = (index - 1) / 2;
+    }
+
+    while (true) {
+        const uint32_t left = 2 * index + 1;
+        const uint32_t right = left + 1;
+        uint32_t smallest = index;
+
+        if (left < onion_c->friend_queue_length && friend_queue_before(onion_c, left, smallest)) {
+            smallest = left;
+        }
+
+        if (right < onion_c->friend_queue_length && friend_queue_before(onion_c, right, smallest)) {
+            smallest = right;
+        }
+
+        if (smallest == index) {
+            return;
+        }
+
+        friend_queue_swap(onion_c, index, smallest);
+        index = smallest;
+    }
+}
+
+/** @brief Add a newly valid friend to the queue, due immediately. */
+non_null()
+static void friend_queue_push(Onion_Client *onion_c, uint16_t friendnum)
+{
+    const uint16_t index = onion_c->friend_queue_length;
+    ++onion_c->friend_queue_length;
+
+    onion_c->friend_queue[index] = friendnum;
+    onion_c->friends_list[friendnum].queue_index = index;
+    onion_c->friends_list[friendnum].next_run = 0;
+    friend_queue_fix(onion_c, index);
+}
+
+non_null()
+static void friend_queue_remove(Onion_Client *onion_c, uint16_t friendnum)
+{
+    const uint16_t index = onion_c->friends_list[friendnum].queue_index;
+    const uint16_t last = onion_c->friend_queue_length - 1;
+
+    friend_queue_swap(onion_c, index, last);
+    --onion_c->friend_queue_length;
+
+    if (index < onion_c->friend_queue_length) {
+        friend_queue_fix(onion_c, index);
+    }
+}
+
+/** @brief Set when do_onion_client() should next call do_friend() for a valid friend. */
+non_null()
+static void schedule_friend(Onion_Client *onion_c, uint16_t friendnum, uint64_t next_run)
+{
+    onion_c->friends_list[friendnum].next_run = next_run;
+    friend_queue_fix(onion_c, onion_c->friends_list[friendnum].queue_index);
+}
+
+/** @brief Make do_onion_client() visit a friend on its next run, because something outside do_friend() changed its state. */
+non_null()
+static void wake_friend(Onion_Client *onion_c, uint32_t friendnum)
+{
+    if (friendnum < onion_c->num_friends && onion_c->friends_list[friendnum].is_valid) {
+        schedule_friend(onion_c, friendnum, 0);
+    }
+}
+
 non_null()
 static int client_add_to_list(Onion_Client *onion_c, uint32_t num, const uint8_t *public_key, const IP_Port *ip_port,
                               uint8_t is_stored, const uint8_t *pingid_or_key, uint32_t path_used)
@@ -881,6 +1164,11 @@ static int client_add_to_list(Onion_Client *onion_c, uint32_t num, const uint8_t
     }
 
     node_list[index].path_used = path_used;
+
+    if (num != 0) {
+        wake_friend(onion_c, num - 1);
+    }
+
     return 0;
 }
 
@@ -991,7 +1279,8 @@ static int handle_announce_response(void *object, const IP_Port *source, const u
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
     IP_Port ip_port;
     uint32_t path_num;
-    const uint32_t num = check_sendback(onion_c, packet + 1, public_key, &ip_port, &path_num);
+    uint64_t rtt;
+    const uint32_t num = check_sendback(onion_c, packet + 1, public_key, &ip_port, &path_num, &rtt);
 
     if (num > onion_c->num_friends) {
         return 1;
@@ -1027,7 +1316,7 @@ static int handle_announce_response(void *object, const IP_Port *source, const u
         return 1;
     }
 
-    const uint32_t path_used = set_path_timeouts(onion_c, num, path_num);
+    const uint32_t path_used = set_path_timeouts(onion_c, num, path_num, rtt);
 
     if (client_add_to_list(onion_c, num, public_key, &ip_port, plain[0], plain + 1, path_used) == -1) {
         LOGGER_WARNING(onion_c->logger, "failed to add client to list");
@@ -1095,7 +1384,8 @@ static int handle_announce_response_old(void *object, const IP_Port *source, con
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
     IP_Port ip_port;
     uint32_t path_num;
-    const uint32_t num = check_sendback(onion_c, packet + 1, public_key, &ip_port, &path_num);
+    uint64_t rtt;
+    const uint32_t num = check_sendback(onion_c, packet + 1, public_key, &ip_port, &path_num, &rtt);
 
     if (num > onion_c->num_friends) {
         return 1;
@@ -1131,7 +1421,7 @@ static int handle_announce_response_old(void *object, const IP_Port *source, con
         return 1;
     }
 
-    const uint32_t path_used = set_path_timeouts(onion_c, num, path_num);
+    const uint32_t path_used = set_path_timeouts(onion_c, num, path_num, rtt);
 
     if (client_add_to_list(onion_c, num, public_key, &ip_port, plain[0], plain + 1, path_used) == -1) {
         LOGGER_WARNING(onion_c->logger, "failed to add client to list");
@@ -1525,17 +1815,7 @@ static int send_dhtpk_announce(Onion_Client *onion_c, uint16_t friend_num, uint8
  */
 int onion_friend_num(const Onion_Client *onion_c, const uint8_t *public_key)
 {
-    for (unsigned int i = 0; i < onion_c->num_friends; ++i) {
-        if (!onion_c->friends_list[i].is_valid) {
-            continue;
-        }
-
-        if (pk_equal(public_key, onion_c->friends_list[i].real_public_key)) {
-            return i;
-        }
-    }
-
-    return -1;
+    return pk_index_find(onion_c->friend_index, public_key);
 }
 
 /** @brief Set the size of the friend list to num.
@@ -1549,19 +1829,49 @@ static int realloc_onion_friends(Onion_Client *onion_c, uint32_t num)
     if (num == 0) {
         mem_delete(onion_c->mem, onion_c->friends_list);
         onion_c->friends_list = nullptr;
+        mem_delete(onion_c->mem, onion_c->friend_queue);
+        onion_c->friend_queue = nullptr;
+        onion_c->friends_capacity = 0;
         return 0;
     }
 
+    // The queue only ever holds valid friends, so it always fits in `num`.
+    uint16_t *new_friend_queue = (uint16_t *)mem_vrealloc(onion_c->mem, onion_c->friend_queue, num, sizeof(uint16_t));
+
+    if (new_friend_queue == nullptr) {
+        return -1;
+    }
+
+    onion_c->friend_queue = new_friend_queue;
+
     Onion_Friend *newonion_friends = (Onion_Friend *)mem_vrealloc(onion_c->mem, onion_c->friends_list, num, sizeof(Onion_Friend));
 
     if (newonion_friends == nullptr) {
+        // The queue may have shrunk already.
+        onion_c->friends_capacity = (uint16_t)min_u32(onion_c->friends_capacity, num);
         return -1;
     }
 
     onion_c->friends_list = newonion_friends;
+    onion_c->friends_capacity = (uint16_t)num;
     return 0;
 }
 
+bool onion_reserve_friends(Onion_Client *onion_c, uint32_t count)
+{
+    if (count > (uint32_t)(UINT16_MAX - onion_c->num_friends)) {
+        return false;
+    }
+
+    const uint32_t num = onion_c->num_friends + count;
+
+    if (num > onion_c->friends_capacity && realloc_onion_friends(onion_c, num) == -1) {
+        return false;
+    }
+
+    return pk_index_reserve(onion_c->friend_index, count);
+}
+
 /** @brief Add a friend who we want to connect to.
  *
  * return -1 on failure.
@@ -1577,15 +1887,24 @@ int onion_addfriend(Onion_Client *onion_c, const uint8_t *public_key)
 
     unsigned int index = -1;
 
-    for (unsigned int i = 0; i < onion_c->num_friends; ++i) {
-        if (!onion_c->friends_list[i].is_valid) {
-            index = i;
-            break;
+    // Every valid friend is in the index, so only look for a free slot if
+    // there is one.
+    if (pk_index_size(onion_c->friend_index) < onion_c->num_friends) {
+        for (unsigned int i = 0; i < onion_c->num_friends; ++i) {
+            if (!onion_c->friends_list[i].is_valid) {
+                index = i;
+                break;
+            }
         }
     }
 
     if (index == (uint32_t) -1) {
-        if (realloc_onion_friends(onion_c, onion_c->num_friends + 1) == -1) {
+        if (onion_c->num_friends == UINT16_MAX) {
+            return -1;
+        }
+
+        if (onion_c->num_friends == onion_c->friends_capacity
+                && realloc_onion_friends(onion_c, onion_c->num_friends + 1) == -1) {
             return -1;
         }
 
@@ -1594,10 +1913,13 @@ int onion_addfriend(Onion_Client *onion_c, const uint8_t *public_key)
         ++onion_c->num_friends;
     }
 
+    if (!pk_index_add(onion_c->friend_index, public_key, index)) {
+        return -1;
+    }
+
     onion_c->friends_list[index].is_valid = true;
     memcpy(onion_c->friends_list[index].real_public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    crypto_new_keypair(onion_c->rng, onion_c->friends_list[index].temp_public_key,
-                       onion_c->friends_list[index].temp_secret_key);
+    friend_queue_push(onion_c, index);
     return index;
 }
 
@@ -1620,6 +1942,11 @@ int onion_delfriend(Onion_Client *onion_c, int friend_num)
 
 #endif /* 0 */
 
+    if (onion_c->friends_list[friend_num].is_valid) {
+        friend_queue_remove(onion_c, friend_num);
+        pk_index_remove(onion_c->friend_index, onion_c->friends_list[friend_num].real_public_key, friend_num);
+    }
+
     crypto_memzero(&onion_c->friends_list[friend_num], sizeof(Onion_Friend));
     unsigned int i;
 
@@ -1746,6 +2073,15 @@ int onion_getfriendip(const Onion_Client *onion_c, int friend_num, IP_Port *ip_p
     return dht_getfriendip(onion_c->dht, dht_public_key, ip_port);
 }
 
+uint64_t onion_friend_next_search(const Onion_Client *onion_c, int friend_num)
+{
+    if ((uint32_t)friend_num >= onion_c->num_friends) {
+        return UINT64_MAX;
+    }
+
+    return onion_c->friends_list[friend_num].next_run;
+}
+
 /** @brief Set if friend is online or not.
  *
  * NOTE: This function is there and should be used so that we don't send
@@ -1766,8 +2102,11 @@ int onion_set_friend_online(Onion_Client *onion_c, int friend_num, bool is_onlin
     if (!is_online) {
         onion_c->friends_list[friend_num].last_noreplay = 0;
         onion_c->friends_list[friend_num].run_count = 0;
+        onion_c->friends_list[friend_num].retry_exponent = 0;
     }
 
+    wake_friend(onion_c, friend_num);
+
     return 0;
 }
 
@@ -1798,35 +2137,98 @@ static void populate_path_nodes(Onion_Client *onion_c)
 /* Max exponent when calculating the announce request interval */
 #define MAX_RUN_COUNT_EXPONENT 12
 
+/* Max exponent of the time in seconds after which do_friend() retries sends that failed */
+#define MAX_RETRY_EXPONENT 4
+
+/** @brief How long to wait between announce requests to each node when searching for a friend. */
+non_null()
+static uint32_t friend_search_interval(const Onion_Friend *o_friend)
+{
+    if (o_friend->run_count <= ANNOUNCE_FRIEND_RUN_COUNT_BEGINNING) {
+        return ANNOUNCE_FRIEND_NEW_INTERVAL;
+    }
+
+    // how often we ping a node for a friend depends on how many times we've already tried.
+    // the interval increases exponentially, as the longer a friend has been offline, the less
+    // likely the case is that they're online and failed to find us
+    const uint32_t c = 1 << min_u32(MAX_RUN_COUNT_EXPONENT, o_friend->run_count - 2);
+    return min_u32(c, ANNOUNCE_FRIEND_MAX_INTERVAL);
+}
+
+/** @brief A deadline that already passed, because what was due then failed, is moved to the retry time. */
+non_null()
+static uint64_t retry_deadline(uint64_t deadline, uint64_t now, uint64_t retry, bool *retrying)
+{
+    if (deadline > now) {
+        return deadline;
+    }
+
+    *retrying = true;
+    return retry;
+}
+
+/** @brief The earliest time at which one of the timeouts checked by do_friend() expires.
+ *
+ * `mono_time_is_timeout(t, timeout)` holds from `t + timeout + 1` on. Timeouts
+ * that expired already are replaced by `retry`, and set `*retrying`.
+ */
+non_null()
+static uint64_t friend_next_deadline(const Onion_Client *onion_c, const Onion_Friend *o_friend, uint64_t retry,
+                                     bool *retrying)
+{
+    const uint32_t interval = friend_search_interval(o_friend);
+    const uint64_t now = mono_time_get(onion_c->mono_time);
+
+    uint64_t next_run = min_u64(
+                            retry_deadline(o_friend->last_dht_pk_onion_sent + ONION_DHTPK_SEND_INTERVAL + 1, now, retry, retrying),
+                            retry_deadline(o_friend->last_dht_pk_dht_sent + DHT_DHTPK_SEND_INTERVAL + 1, now, retry, retrying));
+
+    for (unsigned i = 0; i < MAX_ONION_CLIENTS; ++i) {
+        const Onion_Node *node = &o_friend->clients_list[i];
+
+        if (onion_node_timed_out(node, onion_c->mono_time)) {
+            continue;
+        }
+
+        if (node->pings_since_last_response >= ONION_NODE_MAX_PINGS) {
+            // Not pinged any more, but it leaves the list when it times out.
+            next_run = min_u64(next_run, retry_deadline(node->last_pinged + ONION_NODE_TIMEOUT + 1, now, retry, retrying));
+            continue;
+        }
+
+        const uint64_t spaced = o_friend->time_last_pinged + interval / (MAX_ONION_CLIENTS / 2) + 1;
+        next_run = min_u64(next_run, retry_deadline(max_u64(spaced, node->last_pinged + interval + 1), now, retry,
+                                                    retrying));
+    }
+
+    return next_run;
+}
+
+/** @brief Search for a friend if they are offline.
+ *
+ * @return the time at which this friend should next be visited, always in the
+ *   future. Anything that changes the friend's state in between must call
+ *   wake_friend().
+ */
 non_null()
-static void do_friend(Onion_Client *onion_c, uint16_t friendnum)
+static uint64_t do_friend(Onion_Client *onion_c, uint16_t friendnum)
 {
     if (friendnum >= onion_c->num_friends) {
-        return;
+        return UINT64_MAX;
     }
 
     Onion_Friend *o_friend = &onion_c->friends_list[friendnum];
 
     if (!o_friend->is_valid) {
-        return;
+        return UINT64_MAX;
     }
 
-    uint32_t interval;
+    const uint32_t interval = friend_search_interval(o_friend);
     const uint64_t tm = mono_time_get(onion_c->mono_time);
     const bool friend_is_new = o_friend->run_count <= ANNOUNCE_FRIEND_RUN_COUNT_BEGINNING;
 
-    if (!friend_is_new) {
-        // how often we ping a node for a friend depends on how many times we've already tried.
-        // the interval increases exponentially, as the longer a friend has been offline, the less
-        // likely the case is that they're online and failed to find us
-        const uint32_t c = 1 << min_u32(MAX_RUN_COUNT_EXPONENT, o_friend->run_count - 2);
-        interval = min_u32(c, ANNOUNCE_FRIEND_MAX_INTERVAL);
-    } else {
-        interval = ANNOUNCE_FRIEND_NEW_INTERVAL;
-    }
-
     if (o_friend->is_online) {
-        return;
+        return UINT64_MAX;
     }
 
     assert(interval >= ANNOUNCE_FRIEND_NEW_INTERVAL); // an int overflow would be devastating
@@ -1890,32 +2292,60 @@ static void do_friend(Onion_Client *onion_c, uint16_t friendnum)
         }
     }
 
-    if (count == MAX_ONION_CLIENTS) {
-        if (!friend_is_new) {
-            o_friend->last_populated = tm;
-        }
+    // For a friend that is offline, failing to send is the normal case: the
+    // DHT route needs their DHT key and the onion route nodes they announced
+    // themselves to. So what failed is retried with exponential backoff rather
+    // than on every run, while the rest keeps its own schedule. Anything that
+    // makes a retry more likely to succeed, like nodes being added, wakes the
+    // friend anyway.
+    const uint64_t retry = tm + (UINT64_C(1) << o_friend->retry_exponent);
+    bool retrying = false;
+    uint64_t next_run = friend_next_deadline(onion_c, o_friend, retry, &retrying);
 
-        return;
-    }
+    if (count < MAX_ONION_CLIENTS) {
+        // check if path nodes list for this friend needs to be repopulated
+        if (count <= MAX_ONION_CLIENTS / 2
+                || mono_time_is_timeout(onion_c->mono_time, o_friend->last_populated, ANNOUNCE_POPULATE_TIMEOUT)) {
+            const uint16_t num_nodes = min_u16(onion_c->path_nodes_index, MAX_PATH_NODES);
+            const uint16_t n = min_u16(num_nodes, MAX_PATH_NODES / 4);
 
-    // check if path nodes list for this friend needs to be repopulated
-    if (count <= MAX_ONION_CLIENTS / 2
-            || mono_time_is_timeout(onion_c->mono_time, o_friend->last_populated, ANNOUNCE_POPULATE_TIMEOUT)) {
-        const uint16_t num_nodes = min_u16(onion_c->path_nodes_index, MAX_PATH_NODES);
-        const uint16_t n = min_u16(num_nodes, MAX_PATH_NODES / 4);
+            if (n > 0) {
+                o_friend->last_populated = tm;
+            }
 
-        if (n == 0) {
-            return;
+            for (uint16_t i = 0; i < n; ++i) {
+                const uint32_t num = random_range_u32(onion_c->rng, num_nodes);
+                client_send_announce_request(onion_c, friendnum + 1, &onion_c->path_nodes[num].ip_port,
+                                             onion_c->path_nodes[num].public_key, nullptr, -1);
+            }
         }
 
-        o_friend->last_populated = tm;
+        if (count <= MAX_ONION_CLIENTS / 2) {
+            // Populate again until enough nodes answered.
+            retrying = true;
+        }
 
-        for (uint16_t i = 0; i < n; ++i) {
-            const uint32_t num = random_range_u32(onion_c->rng, num_nodes);
-            client_send_announce_request(onion_c, friendnum + 1, &onion_c->path_nodes[num].ip_port,
-                                         onion_c->path_nodes[num].public_key, nullptr, -1);
+        next_run = min_u64(next_run, retry_deadline(o_friend->last_populated + ANNOUNCE_POPULATE_TIMEOUT + 1, tm, retry,
+                                                    &retrying));
+    }
+
+    if (retrying) {
+        next_run = min_u64(next_run, retry);
+
+        if (o_friend->retry_exponent < MAX_RETRY_EXPONENT) {
+            ++o_friend->retry_exponent;
         }
+    } else {
+        o_friend->retry_exponent = 0;
+    }
+
+    if (count == MAX_ONION_CLIENTS && !friend_is_new) {
+        // Nodes only leave the list by timing out, which is one of the
+        // deadlines, so the list stays full at least until the next run.
+        o_friend->last_populated = next_run - 1;
     }
+
+    return next_run;
 }
 
 /** Function to call when onion data packet with contents beginning with byte is received. */
@@ -2147,6 +2577,7 @@ static void reset_friend_run_counts(Onion_Client *onion_c)
 
         if (o_friend->is_valid) {
             o_friend->run_count = 0;
+            schedule_friend(onion_c, i, 0);
         }
     }
 }
@@ -2201,8 +2632,16 @@ void do_onion_client(Onion_Client *onion_c)
     }
 
     if (onion_connection_status(onion_c) != ONION_CONNECTION_STATUS_NONE) {
-        for (unsigned i = 0; i < onion_c->num_friends; ++i) {
-            do_friend(onion_c, i);
+        const uint64_t now = mono_time_get(onion_c->mono_time);
+
+        while (onion_c->friend_queue_length != 0) {
+            const uint16_t friendnum = onion_c->friend_queue[0];
+
+            if (onion_c->friends_list[friendnum].next_run > now) {
+                break;
+            }
+
+            schedule_friend(onion_c, friendnum, do_friend(onion_c, friendnum));
         }
     }
 
@@ -2232,6 +2671,14 @@ Onion_Client *new_onion_client(const Logger *logger, const Memory *mem, const Ra
         return nullptr;
     }
 
+    onion_c->friend_index = pk_index_new(mem, rng);
+
+    if (onion_c->friend_index == nullptr) {
+        ping_array_kill(onion_c->announce_ping_array);
+        mem_delete(mem, onion_c);
+        return nullptr;
+    }
+
     onion_c->mono_time = mono_time;
     onion_c->logger = logger;
     onion_c->rng = rng;
@@ -2261,6 +2708,7 @@ void kill_onion_client(Onion_Client *onion_c)
 
     ping_array_kill(onion_c->announce_ping_array);
     realloc_onion_friends(onion_c, 0);
+    pk_index_free(onion_c->friend_index);
     networking_registerhandler(onion_c->net, NET_PACKET_ANNOUNCE_RESPONSE, nullptr, nullptr);
     networking_registerhandler(onion_c->net, NET_PACKET_ANNOUNCE_RESPONSE_OLD, nullptr, nullptr);
     networking_registerhandler(onion_c->net, NET_PACKET_ONION_DATA_RESPONSE, nullptr, nullptr);
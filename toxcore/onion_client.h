@@ -50,6 +50,9 @@
 
 #define MAX_PATH_NODES 32
 
+/** Success and failure counts of a path node are halved once they add up to this. */
+#define PATH_NODE_STATS_MAX_COUNT 64
+
 #define GCA_MAX_DATA_LENGTH GCA_PUBLIC_ANNOUNCE_MAX_SIZE
 
 /**
@@ -66,6 +69,28 @@
 
 typedef struct Onion_Client Onion_Client;
 
+/** Health of one of the onion paths announce requests are sent over. */
+typedef struct Onion_Path_Stats {
+    /** Announce requests sent over the path since it was created. */
+    uint32_t requests;
+    /** Announce responses received over the path since it was created. */
+    uint32_t responses;
+    /** Smoothed round trip time of announce requests in milliseconds, 0 if unknown. */
+    uint32_t rtt;
+    /** Seconds since the path was created. */
+    uint64_t age;
+} Onion_Path_Stats;
+
+/** Health of a node that paths are built from. */
+typedef struct Onion_Path_Node_Stats {
+    /** Announce responses received over paths through the node. */
+    uint32_t successes;
+    /** Paths through the node that were dropped for not getting responses. */
+    uint32_t failures;
+    /** Smoothed round trip time of paths through the node in milliseconds, 0 if unknown. */
+    uint32_t rtt;
+} Onion_Path_Node_Stats;
+
 non_null()
 DHT *onion_get_dht(const Onion_Client *onion_c);
 non_null()
@@ -87,6 +112,17 @@ Net_Crypto *onion_get_net_crypto(const Onion_Client *onion_c);
 non_null()
 bool onion_add_bs_path_node(Onion_Client *onion_c, const IP_Port *ip_port, const uint8_t *public_key);
 
+/** @brief Add a node remembered from an earlier session to the path_nodes array.
+ *
+ * Unlike bootstrap path nodes, these are used for paths as soon as the DHT is
+ * connected, and stats carries over how well paths through them did.
+ *
+ * @retval false if the node is not an IPv4/IPv6 node or is already known.
+ */
+non_null()
+bool onion_add_saved_path_node(Onion_Client *onion_c, const IP_Port *ip_port, const uint8_t *public_key,
+                               const Onion_Path_Node_Stats *stats);
+
 /** @brief Put up to max_num nodes in nodes.
  *
  * return the number of nodes.
@@ -94,6 +130,32 @@ bool onion_add_bs_path_node(Onion_Client *onion_c, const IP_Port *ip_port, const
 non_null()
 uint16_t onion_backup_nodes(const Onion_Client *onion_c, Node_format *nodes, uint16_t max_num);
 
+/** @brief Get the health of one of the paths used to announce ourselves or to search for friends.
+ *
+ * @param friends false for the paths used to announce ourselves, true for the
+ *   ones used to search for friends.
+ * @param path_index Index of the path, less than NUMBER_ONION_PATHS.
+ *
+ * @retval false if the index is out of range or no path was created there yet.
+ */
+non_null()
+bool onion_get_path_stats(const Onion_Client *onion_c, bool friends, uint32_t path_index, Onion_Path_Stats *stats);
+
+/** @brief Number of nodes that paths are currently built from. */
+non_null()
+uint16_t onion_get_path_node_count(const Onion_Client *onion_c);
+
+/** @brief Get a node that paths are built from and its health.
+ *
+ * @param index Index of the node, less than onion_get_path_node_count(). Nodes
+ *   are indexed from the least to the most recently added.
+ *
+ * @retval false if the index is out of range.
+ */
+non_null()
+bool onion_get_path_node_stats(const Onion_Client *onion_c, uint16_t index, Node_format *node,
+                               Onion_Path_Node_Stats *stats);
+
 /** @brief Get the friend_num of a friend.
  *
  * return -1 on failure.
@@ -110,6 +172,14 @@ int onion_friend_num(const Onion_Client *onion_c, const uint8_t *public_key);
 non_null()
 int onion_addfriend(Onion_Client *onion_c, const uint8_t *public_key);
 
+/** @brief Make room for adding `count` more friends without reallocating.
+ *
+ * @retval true on success.
+ * @retval false if the friend limit would be exceeded or allocation failed.
+ */
+non_null()
+bool onion_reserve_friends(Onion_Client *onion_c, uint32_t count);
+
 /** @brief Delete a friend.
  *
  * return -1 on failure.
@@ -138,6 +208,13 @@ int onion_set_friend_online(Onion_Client *onion_c, int friend_num, bool is_onlin
 non_null()
 int onion_getfriendip(const Onion_Client *onion_c, int friend_num, IP_Port *ip_port);
 
+/** @brief When do_onion_client() next searches for friend friend_num.
+ *
+ * @return the time in seconds, or UINT64_MAX if friend_num is not a friend.
+ */
+non_null()
+uint64_t onion_friend_next_search(const Onion_Client *onion_c, int friend_num);
+
 typedef int recv_tcp_relay_cb(void *object, uint32_t number, const IP_Port *ip_port, const uint8_t *public_key);
 
 /** @brief Set the function for this friend that will be callbacked with object and number
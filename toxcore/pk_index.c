@@ -0,0 +1,234 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+#include "pk_index.h"
+
+#include <stdint.h>
+#include <string.h>     // memcpy(...)
+
+#include "attributes.h"
+#include "ccompat.h"
+#include "crypto_core.h"
+#include "mem.h"
+
+/** Smallest table size once anything was added. Must be a power of 2. */
+#define PK_INDEX_MIN_CAPACITY 16
+
+typedef struct Pk_Index_Entry {
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    int32_t id;  // -1 if the slot is empty
+} Pk_Index_Entry;
+
+struct Pk_Index {
+    const Memory *mem;
+    uint64_t seed;
+
+    Pk_Index_Entry *entries;
+    uint32_t capacity;  // 0 or a power of 2
+    uint32_t size;
+};
+
+Pk_Index *pk_index_new(const Memory *mem, const Random *rng)
+{
+    Pk_Index *index = (Pk_Index *)mem_alloc(mem, sizeof(Pk_Index));
+
+    if (index == nullptr) {
+        return nullptr;
+    }
+
+    index->mem = mem;
+    index->seed = random_u64(rng);
+
+    return index;
+}
+
+void pk_index_free(Pk_Index *index)
+{
+    if (index == nullptr) {
+        return;
+    }
+
+    mem_delete(index->mem, index->entries);
+    mem_delete(index->mem, index);
+}
+
+uint32_t pk_index_size(const Pk_Index *index)
+{
+    return index->size;
+}
+
+non_null()
+static uint32_t pk_index_slot(const Pk_Index *index, const uint8_t *public_key)
+{
+    uint64_t h = index->seed;
+
+    for (uint32_t i = 0; i < CRYPTO_PUBLIC_KEY_SIZE; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, public_key + i, sizeof(word));
+        h = (h ^ word) * 0x9e3779b97f4a7c15;
+        h ^= h >> 29;
+    }
+
+    return (uint32_t)(h >> 32) & (index->capacity - 1);
+}
+
+/** @brief Slot holding the public key, or UINT32_MAX if it's not in the index. */
+non_null()
+static uint32_t pk_index_lookup(const Pk_Index *index, const uint8_t *public_key)
+{
+    if (index->size == 0) {
+        return UINT32_MAX;
+    }
+
+    const uint32_t mask = index->capacity - 1;
+
+    for (uint32_t i = pk_index_slot(index, public_key);; i = (i + 1) & mask) {
+        const Pk_Index_Entry *entry = &index->entries[i];
+
+        if (entry->id == -1) {
+            return UINT32_MAX;
+        }
+
+        if (pk_equal(entry->public_key, public_key)) {
+            return i;
+        }
+    }
+}
+
+non_null()
+static void pk_index_insert(Pk_Index *index, const uint8_t *public_key, int32_t id)
+{
+    const uint32_t mask = index->capacity - 1;
+    uint32_t i = pk_index_slot(index, public_key);
+
+    while (index->entries[i].id != -1) {
+        i = (i + 1) & mask;
+    }
+
+    pk_copy(index->entries[i].public_key, public_key);
+    index->entries[i].id = id;
+    ++index->size;
+}
+
+/** @brief Move all entries into a table of the given size. */
+non_null()
+static bool pk_index_resize(Pk_Index *index, uint32_t capacity)
+{
+    Pk_Index_Entry *entries = (Pk_Index_Entry *)mem_valloc(index->mem, capacity, sizeof(Pk_Index_Entry));
+
+    if (entries == nullptr) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < capacity; ++i) {
+        entries[i].id = -1;
+    }
+
+    Pk_Index_Entry *const old_entries = index->entries;
+    const uint32_t old_capacity = index->capacity;
+
+    index->entries = entries;
+    index->capacity = capacity;
+    index->size = 0;
+
+    for (uint32_t i = 0; i < old_capacity; ++i) {
+        if (old_entries[i].id != -1) {
+            pk_index_insert(index, old_entries[i].public_key, old_entries[i].id);
+        }
+    }
+
+    mem_delete(index->mem, old_entries);
+    return true;
+}
+
+int32_t pk_index_find(const Pk_Index *index, const uint8_t *public_key)
+{
+    const uint32_t slot = pk_index_lookup(index, public_key);
+
+    if (slot == UINT32_MAX) {
+        return -1;
+    }
+
+    return index->entries[slot].id;
+}
+
+bool pk_index_add(Pk_Index *index, const uint8_t *public_key, int32_t id)
+{
+    if (id < 0 || pk_index_lookup(index, public_key) != UINT32_MAX) {
+        return false;
+    }
+
+    if ((index->size + 1) * 2 > index->capacity) {
+        if (index->capacity > UINT32_MAX / 2) {
+            return false;
+        }
+
+        const uint32_t capacity = index->capacity == 0 ? PK_INDEX_MIN_CAPACITY : index->capacity * 2;
+
+        if (!pk_index_resize(index, capacity)) {
+            return false;
+        }
+    }
+
+    pk_index_insert(index, public_key, id);
+    return true;
+}
+
+bool pk_index_reserve(Pk_Index *index, uint32_t count)
+{
+    if (count > UINT32_MAX / 2 - index->size) {
+        return false;
+    }
+
+    const uint32_t needed = (index->size + count) * 2;
+
+    if (needed <= index->capacity) {
+        return true;
+    }
+
+    uint32_t capacity = index->capacity == 0 ? PK_INDEX_MIN_CAPACITY : index->capacity;
+
+    while (capacity < needed) {
+        if (capacity > UINT32_MAX / 2) {
+            return false;
+        }
+
+        capacity *= 2;
+    }
+
+    return pk_index_resize(index, capacity);
+}
+
+bool pk_index_remove(Pk_Index *index, const uint8_t *public_key, int32_t id)
+{
+    const uint32_t slot = pk_index_lookup(index, public_key);
+
+    if (slot == UINT32_MAX || index->entries[slot].id != id) {
+        return false;
+    }
+
+    // Shift the following entries of the probe sequence back into the gap, so
+    // that lookups never need tombstones.
+    const uint32_t mask = index->capacity - 1;
+    uint32_t hole = slot;
+
+    for (uint32_t i = (slot + 1) & mask; index->entries[i].id != -1; i = (i + 1) & mask) {
+        const uint32_t home = pk_index_slot(index, index->entries[i].public_key);
+
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            index->entries[hole] = index->entries[i];
+            hole = i;
+        }
+    }
+
+    index->entries[hole].id = -1;
+    --index->size;
+
+    if (index->size * 8 < index->capacity && index->capacity > PK_INDEX_MIN_CAPACITY) {
+        // Failing to shrink only costs memory.
+        pk_index_resize(index, index->capacity / 2);
+    }
+
+    return true;
+}
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+#ifndef C_TOXCORE_TOXCORE_PK_INDEX_H
+#define C_TOXCORE_TOXCORE_PK_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>     // uint*_t
+
+#include "attributes.h"
+#include "crypto_core.h"
+#include "mem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Hash index from public keys to the ids of the entries that own them, such as
+ * friend numbers.
+ *
+ * Unlike BS_List, adding and removing keys take constant time on average, so it
+ * suits lists that can grow to many thousands of entries and change often. It
+ * is an open addressing table with linear probing that stays at most half
+ * full, growing and shrinking by powers of two.
+ *
+ * The hash is seeded randomly per index, so peers can't pick public keys that
+ * all land in the same place.
+ */
+typedef struct Pk_Index Pk_Index;
+
+/**
+ * @brief Creates an empty index.
+ * @return nullptr on allocation failure.
+ */
+non_null()
+Pk_Index *pk_index_new(const Memory *mem, const Random *rng);
+
+/**
+ * @brief Deletes the index and frees all resources.
+ * @param index Index to delete or nullptr.
+ */
+nullable(1)
+void pk_index_free(Pk_Index *index);
+
+/** @brief Number of public keys in the index. */
+non_null()
+uint32_t pk_index_size(const Pk_Index *index);
+
+/**
+ * @brief Looks up the id associated with a public key.
+ *
+ * @retval >=0 id associated with the public key.
+ * @retval -1 if the public key is not in the index.
+ */
+non_null()
+int32_t pk_index_find(const Pk_Index *index, const uint8_t *public_key);
+
+/**
+ * @brief Associates an id with a public key.
+ *
+ * @param id Id to associate, must not be negative.
+ *
+ * @retval true on success.
+ * @retval false if the public key is already in the index, the id is negative
+ *   or memory allocation failed.
+ */
+non_null()
+bool pk_index_add(Pk_Index *index, const uint8_t *public_key, int32_t id);
+
+/**
+ * @brief Makes room for adding `count` more public keys without rehashing.
+ *
+ * Adding many keys in a row otherwise rehashes the table every time it doubles.
+ *
+ * @retval true on success.
+ * @retval false if memory allocation failed.
+ */
+non_null()
+bool pk_index_reserve(Pk_Index *index, uint32_t count);
+
+/**
+ * @brief Removes a public key from the index.
+ *
+ * @retval true on success.
+ * @retval false if the public key is not in the index or has a different id.
+ */
+non_null()
+bool pk_index_remove(Pk_Index *index, const uint8_t *public_key, int32_t id);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* C_TOXCORE_TOXCORE_PK_INDEX_H */
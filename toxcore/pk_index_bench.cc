@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "crypto_core.h"
+#include "mem.h"
+#include "pk_index.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+std::vector<PublicKey> random_keys(const Random *rng, std::size_t count)
+{
+    std::vector<PublicKey> keys(count);
+
+    for (PublicKey &key : keys) {
+        random_bytes(rng, key.data(), key.size());
+    }
+
+    return keys;
+}
+
+/** @brief Adding state.range(0) friends to an empty index, then deleting them all. */
+void BM_pk_index_add_delete(benchmark::State &state)
+{
+    const Memory *mem = os_memory();
+    const Random *rng = os_random();
+    const std::vector<PublicKey> keys = random_keys(rng, state.range(0));
+
+    for (auto _ : state) {
+        Pk_Index *index = pk_index_new(mem, rng);
+
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            pk_index_add(index, keys[i].data(), static_cast<int32_t>(i));
+        }
+
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            pk_index_remove(index, keys[i].data(), static_cast<int32_t>(i));
+        }
+
+        pk_index_free(index);
+    }
+
+    state.SetItemsProcessed(state.iterations() * keys.size() * 2);
+}
+BENCHMARK(BM_pk_index_add_delete)->Arg(1000)->Arg(10000)->Arg(100000);
+
+/** @brief Looking up a friend among state.range(0), half of the time one that isn't there. */
+void BM_pk_index_lookup(benchmark::State &state)
+{
+    const Memory *mem = os_memory();
+    const Random *rng = os_random();
+    const std::vector<PublicKey> keys = random_keys(rng, state.range(0));
+    const std::vector<PublicKey> strangers = random_keys(rng, 1024);
+    Pk_Index *index = pk_index_new(mem, rng);
+
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        pk_index_add(index, keys[i].data(), static_cast<int32_t>(i));
+    }
+
+    std::size_t i = 0;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(pk_index_find(index, keys[i % keys.size()].data()));
+        benchmark::DoNotOptimize(pk_index_find(index, strangers[i % strangers.size()].data()));
+        ++i;
+    }
+
+    pk_index_free(index);
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_pk_index_lookup)->Arg(1000)->Arg(10000)->Arg(100000);
+
+/** @brief The same lookups done the way getfriend_id() used to, for comparison. */
+void BM_linear_scan_lookup(benchmark::State &state)
+{
+    const Random *rng = os_random();
+    const std::vector<PublicKey> keys = random_keys(rng, state.range(0));
+    const std::vector<PublicKey> strangers = random_keys(rng, 1024);
+
+    const auto scan = [&keys](const PublicKey &key) {
+        for (std::size_t j = 0; j < keys.size(); ++j) {
+            if (pk_equal(keys[j].data(), key.data())) {
+                return static_cast<int32_t>(j);
+            }
+        }
+
+        return -1;
+    };
+
+    std::size_t i = 0;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(scan(keys[i % keys.size()]));
+        benchmark::DoNotOptimize(scan(strangers[i % strangers.size()]));
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_linear_scan_lookup)->Arg(1000)->Arg(10000)->Arg(100000);
+
+}  // namespace
+
+BENCHMARK_MAIN();
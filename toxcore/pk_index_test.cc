@@ -0,0 +1,149 @@
+#include "pk_index.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <vector>
+
+#include "crypto_core_test_util.hh"
+#include "mem_test_util.hh"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+class PkIndex : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        index_ = pk_index_new(mem_, rng_);
+        ASSERT_NE(index_, nullptr);
+    }
+
+    void TearDown() override { pk_index_free(index_); }
+
+    std::vector<PublicKey> random_keys(std::size_t count)
+    {
+        std::vector<PublicKey> keys(count);
+
+        for (PublicKey &key : keys) {
+            random_bytes(rng_, key.data(), key.size());
+        }
+
+        return keys;
+    }
+
+    Test_Memory mem_;
+    Test_Random rng_;
+    Pk_Index *index_ = nullptr;
+};
+
+TEST_F(PkIndex, EmptyIndexFindsNothing)
+{
+    const PublicKey key{1, 2, 3};
+    EXPECT_EQ(pk_index_size(index_), 0);
+    EXPECT_EQ(pk_index_find(index_, key.data()), -1);
+    EXPECT_FALSE(pk_index_remove(index_, key.data(), 0));
+}
+
+TEST_F(PkIndex, FindsAddedKeys)
+{
+    const std::vector<PublicKey> keys = random_keys(1000);
+
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        ASSERT_TRUE(pk_index_add(index_, keys[i].data(), static_cast<int32_t>(i)));
+    }
+
+    EXPECT_EQ(pk_index_size(index_), keys.size());
+
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_EQ(pk_index_find(index_, keys[i].data()), static_cast<int32_t>(i));
+    }
+}
+
+TEST_F(PkIndex, RejectsDuplicatesAndNegativeIds)
+{
+    const PublicKey key{4, 5, 6};
+    EXPECT_FALSE(pk_index_add(index_, key.data(), -1));
+    EXPECT_TRUE(pk_index_add(index_, key.data(), 7));
+    EXPECT_FALSE(pk_index_add(index_, key.data(), 8));
+    EXPECT_EQ(pk_index_find(index_, key.data()), 7);
+}
+
+TEST_F(PkIndex, RemoveNeedsMatchingId)
+{
+    const PublicKey key{7, 8, 9};
+    ASSERT_TRUE(pk_index_add(index_, key.data(), 3));
+    EXPECT_FALSE(pk_index_remove(index_, key.data(), 4));
+    EXPECT_TRUE(pk_index_remove(index_, key.data(), 3));
+    EXPECT_EQ(pk_index_find(index_, key.data()), -1);
+    EXPECT_EQ(pk_index_size(index_), 0);
+}
+
+TEST_F(PkIndex, RemovingKeepsOtherKeysFindable)
+{
+    const std::vector<PublicKey> keys = random_keys(2000);
+
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        ASSERT_TRUE(pk_index_add(index_, keys[i].data(), static_cast<int32_t>(i)));
+    }
+
+    // Remove every other key, which also shrinks the table on the way.
+    for (std::size_t i = 0; i < keys.size(); i += 2) {
+        ASSERT_TRUE(pk_index_remove(index_, keys[i].data(), static_cast<int32_t>(i)));
+    }
+
+    EXPECT_EQ(pk_index_size(index_), keys.size() / 2);
+
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_EQ(pk_index_find(index_, keys[i].data()), i % 2 == 0 ? -1 : static_cast<int32_t>(i));
+    }
+
+    for (std::size_t i = 1; i < keys.size(); i += 2) {
+        ASSERT_TRUE(pk_index_remove(index_, keys[i].data(), static_cast<int32_t>(i)));
+    }
+
+    EXPECT_EQ(pk_index_size(index_), 0);
+}
+
+TEST_F(PkIndex, KeysCanBeAddedAgainAfterRemoval)
+{
+    const std::vector<PublicKey> keys = random_keys(100);
+
+    for (int round = 0; round < 3; ++round) {
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            ASSERT_TRUE(pk_index_add(index_, keys[i].data(), static_cast<int32_t>(i + round)));
+        }
+
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            ASSERT_EQ(pk_index_find(index_, keys[i].data()), static_cast<int32_t>(i + round));
+            ASSERT_TRUE(pk_index_remove(index_, keys[i].data(), static_cast<int32_t>(i + round)));
+        }
+    }
+}
+
+TEST_F(PkIndex, ReserveKeepsExistingKeys)
+{
+    const std::vector<PublicKey> keys = random_keys(1000);
+
+    for (std::size_t i = 0; i < 10; ++i) {
+        ASSERT_TRUE(pk_index_add(index_, keys[i].data(), static_cast<int32_t>(i)));
+    }
+
+    ASSERT_TRUE(pk_index_reserve(index_, keys.size() - 10));
+    EXPECT_EQ(pk_index_size(index_), 10);
+
+    for (std::size_t i = 10; i < keys.size(); ++i) {
+        ASSERT_TRUE(pk_index_add(index_, keys[i].data(), static_cast<int32_t>(i)));
+    }
+
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_EQ(pk_index_find(index_, keys[i].data()), static_cast<int32_t>(i));
+    }
+
+    // Reserving less than what already fits is a no-op.
+    EXPECT_TRUE(pk_index_reserve(index_, 0));
+    EXPECT_FALSE(pk_index_reserve(index_, UINT32_MAX));
+}
+
+}  // namespace
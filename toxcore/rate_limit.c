@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+#include "rate_limit.h"
+
+#include <stdint.h>
+#include <string.h>     // memset(...)
+
+#include "attributes.h"
+#include "ccompat.h"
+#include "crypto_core.h"
+#include "mem.h"
+#include "mono_time.h"
+
+/** Number of independent hash rows. The estimate is the minimum over all rows. */
+#define RATE_LIMIT_DEPTH 4
+/** Counters per row. Must be a power of 2. */
+#define RATE_LIMIT_WIDTH 2048
+/** After this many seconds without decay all counters would be zero anyway. */
+#define RATE_LIMIT_MAX_DECAY 16
+
+struct Rate_Limiter {
+    const Memory *mem;
+    const Mono_Time *mono_time;
+
+    uint64_t seeds[RATE_LIMIT_DEPTH];
+    uint16_t counters[RATE_LIMIT_DEPTH][RATE_LIMIT_WIDTH];
+    uint64_t last_decay;
+
+    /* Limit per packet id, with the burst factor applied. 0 = unlimited. */
+    uint16_t thresholds[256];
+};
+
+Rate_Limiter *rate_limiter_new(const Memory *mem, const Random *rng, const Mono_Time *mono_time)
+{
+    Rate_Limiter *limiter = (Rate_Limiter *)mem_alloc(mem, sizeof(Rate_Limiter));
+
+    if (limiter == nullptr) {
+        return nullptr;
+    }
+
+    limiter->mem = mem;
+    limiter->mono_time = mono_time;
+
+    for (uint32_t i = 0; i < RATE_LIMIT_DEPTH; ++i) {
+        limiter->seeds[i] = random_u64(rng);
+    }
+
+    limiter->last_decay = mono_time_get(mono_time);
+
+    return limiter;
+}
+
+void rate_limiter_free(Rate_Limiter *limiter)
+{
+    if (limiter == nullptr) {
+        return;
+    }
+
+    mem_delete(limiter->mem, limiter);
+}
+
+void rate_limiter_set(Rate_Limiter *limiter, uint8_t packet_id, uint32_t per_second)
+{
+    if (per_second > RATE_LIMIT_MAX) {
+        per_second = RATE_LIMIT_MAX;
+    }
+
+    // Counters are halved every second, so a steady rate of r packets per
+    // second keeps them at about 2r.
+    limiter->thresholds[packet_id] = (uint16_t)(per_second * 2);
+}
+
+uint32_t rate_limiter_get(const Rate_Limiter *limiter, uint8_t packet_id)
+{
+    return limiter->thresholds[packet_id] / 2;
+}
+
+non_null()
+static void rate_limiter_decay(Rate_Limiter *limiter)
+{
+    const uint64_t now = mono_time_get(limiter->mono_time);
+
+    if (now <= limiter->last_decay) {
+        return;
+    }
+
+    const uint64_t seconds = now - limiter->last_decay;
+    limiter->last_decay = now;
+
+    if (seconds >= RATE_LIMIT_MAX_DECAY) {
+        memset(limiter->counters, 0, sizeof(limiter->counters));
+        return;
+    }
+
+    for (uint32_t row = 0; row < RATE_LIMIT_DEPTH; ++row) {
+        for (uint32_t i = 0; i < RATE_LIMIT_WIDTH; ++i) {
+            limiter->counters[row][i] >>= seconds;
+        }
+    }
+}
+
+/** @brief Seeded FNV-1a with a 64 bit finaliser so that all output bits depend on the input. */
+non_null()
+static uint32_t rate_limit_hash(uint64_t seed, const uint8_t *source, uint16_t source_length, uint8_t packet_id)
+{
+    uint64_t hash = seed ^ 0xcbf29ce484222325;
+
+    for (uint16_t i = 0; i < source_length; ++i) {
+        hash = (hash ^ source[i]) * 0x100000001b3;
+    }
+
+    hash = (hash ^ packet_id) * 0x100000001b3;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+
+    return (uint32_t)(hash & (RATE_LIMIT_WIDTH - 1));
+}
+
+bool rate_limiter_allow(Rate_Limiter *limiter, const uint8_t *source, uint16_t source_length, uint8_t packet_id)
+{
+    const uint16_t threshold = limiter->thresholds[packet_id];
+
+    if (threshold == 0) {
+        return true;
+    }
+
+    rate_limiter_decay(limiter);
+
+    uint16_t *cells[RATE_LIMIT_DEPTH];
+    uint16_t estimate = UINT16_MAX;
+
+    for (uint32_t row = 0; row < RATE_LIMIT_DEPTH; ++row) {
+        cells[row] = &limiter->counters[row][rate_limit_hash(limiter->seeds[row], source, source_length, packet_id)];
+
+        if (*cells[row] < estimate) {
+            estimate = *cells[row];
+        }
+    }
+
+    if (estimate >= threshold) {
+        return false;
+    }
+
+    // Conservative update: only raise the counters that define the estimate,
+    // which keeps collisions from inflating the other sources' counts.
+    for (uint32_t row = 0; row < RATE_LIMIT_DEPTH; ++row) {
+        if (*cells[row] == estimate) {
+            ++*cells[row];
+        }
+    }
+
+    return true;
+}
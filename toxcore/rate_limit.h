@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+#ifndef C_TOXCORE_TOXCORE_RATE_LIMIT_H
+#define C_TOXCORE_TOXCORE_RATE_LIMIT_H
+
+#include <stdbool.h>
+#include <stdint.h>     // uint*_t
+
+#include "attributes.h"
+#include "crypto_core.h"
+#include "mem.h"
+#include "mono_time.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Per-source packet rate limiter.
+ *
+ * Packet counts per (source, packet id) are kept in a count-min sketch whose
+ * counters are halved every second, so memory use is fixed no matter how many
+ * sources there are. A source that stays under its limit is never throttled;
+ * colliding sources can only make the estimate too high, never too low, so a
+ * source sharing counters with a flooder may be throttled with it.
+ *
+ * The hash seeds are random per limiter, so senders can't pick addresses that
+ * collide with a victim on purpose.
+ */
+
+/** Largest packets-per-second limit the counters can represent. */
+#define RATE_LIMIT_MAX 16383
+
+typedef struct Rate_Limiter Rate_Limiter;
+
+/**
+ * @brief Creates a rate limiter with no limits set.
+ * @return nullptr on allocation failure.
+ */
+non_null()
+Rate_Limiter *rate_limiter_new(const Memory *mem, const Random *rng, const Mono_Time *mono_time);
+
+/**
+ * @brief Deletes the rate limiter and frees all resources.
+ * @param limiter Rate limiter to delete or nullptr.
+ */
+nullable(1)
+void rate_limiter_free(Rate_Limiter *limiter);
+
+/**
+ * @brief Sets how many packets of a type each source may send per second.
+ *
+ * Sources may burst up to twice the limit after being quiet. A limit of 0
+ * removes it; limits above RATE_LIMIT_MAX are clamped.
+ */
+non_null()
+void rate_limiter_set(Rate_Limiter *limiter, uint8_t packet_id, uint32_t per_second);
+
+/** @brief Returns the limit set for a packet type, or 0 if there is none. */
+non_null()
+uint32_t rate_limiter_get(const Rate_Limiter *limiter, uint8_t packet_id);
+
+/**
+ * @brief Counts a packet and decides whether it may be handled.
+ *
+ * @param source Bytes identifying the sender, e.g. its IP address.
+ *
+ * @retval true if the packet is within the limit for its type (or the type
+ *   has no limit).
+ * @retval false if the packet should be dropped.
+ */
+non_null()
+bool rate_limiter_allow(Rate_Limiter *limiter, const uint8_t *source, uint16_t source_length, uint8_t packet_id);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* C_TOXCORE_TOXCORE_RATE_LIMIT_H */
@@ -0,0 +1,118 @@
+#include "rate_limit.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+
+#include "crypto_core_test_util.hh"
+#include "mem_test_util.hh"
+#include "mono_time.h"
+
+namespace {
+
+class RateLimit : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        mono_time_ = mono_time_new(mem_, nullptr, nullptr);
+        ASSERT_NE(mono_time_, nullptr);
+        mono_time_set_current_time_callback(
+            mono_time_, [](void *user_data) { return *static_cast<uint64_t *>(user_data); },
+            &current_time_);
+        mono_time_update(mono_time_);
+
+        limiter_ = rate_limiter_new(mem_, rng_, mono_time_);
+        ASSERT_NE(limiter_, nullptr);
+    }
+
+    void TearDown() override
+    {
+        rate_limiter_free(limiter_);
+        mono_time_free(mem_, mono_time_);
+    }
+
+    void advance_seconds(uint64_t seconds)
+    {
+        current_time_ += seconds * 1000;
+        mono_time_update(mono_time_);
+    }
+
+    uint32_t count_allowed(const std::array<uint8_t, 4> &source, uint8_t packet_id, uint32_t attempts)
+    {
+        uint32_t allowed = 0;
+
+        for (uint32_t i = 0; i < attempts; ++i) {
+            if (rate_limiter_allow(limiter_, source.data(), source.size(), packet_id)) {
+                ++allowed;
+            }
+        }
+
+        return allowed;
+    }
+
+    Test_Memory mem_;
+    Test_Random rng_;
+    uint64_t current_time_ = 1000000;
+    Mono_Time *mono_time_ = nullptr;
+    Rate_Limiter *limiter_ = nullptr;
+};
+
+const std::array<uint8_t, 4> flooder{192, 0, 2, 1};
+const std::array<uint8_t, 4> bystander{198, 51, 100, 7};
+
+TEST_F(RateLimit, UnlimitedTypesAlwaysPass)
+{
+    EXPECT_EQ(rate_limiter_get(limiter_, 2), 0);
+    EXPECT_EQ(count_allowed(flooder, 2, 10000), 10000);
+}
+
+TEST_F(RateLimit, BurstIsBoundedByTwiceTheLimit)
+{
+    rate_limiter_set(limiter_, 2, 10);
+    EXPECT_EQ(rate_limiter_get(limiter_, 2), 10);
+    EXPECT_EQ(count_allowed(flooder, 2, 1000), 20);
+}
+
+TEST_F(RateLimit, SteadyRateConvergesToTheLimit)
+{
+    rate_limiter_set(limiter_, 2, 10);
+    count_allowed(flooder, 2, 1000);
+
+    for (int i = 0; i < 10; ++i) {
+        advance_seconds(1);
+        EXPECT_EQ(count_allowed(flooder, 2, 1000), 10);
+    }
+}
+
+TEST_F(RateLimit, CountersForgetQuietSources)
+{
+    rate_limiter_set(limiter_, 2, 10);
+    count_allowed(flooder, 2, 1000);
+
+    advance_seconds(60);
+    EXPECT_EQ(count_allowed(flooder, 2, 1000), 20);
+}
+
+TEST_F(RateLimit, SourcesAndTypesAreLimitedSeparately)
+{
+    rate_limiter_set(limiter_, 2, 10);
+    rate_limiter_set(limiter_, 0, 5);
+
+    EXPECT_EQ(count_allowed(flooder, 2, 1000), 20);
+    EXPECT_EQ(count_allowed(flooder, 0, 1000), 10);
+    EXPECT_EQ(count_allowed(bystander, 2, 1000), 20);
+}
+
+TEST_F(RateLimit, LimitsAreClampedAndRemovable)
+{
+    rate_limiter_set(limiter_, 2, UINT32_MAX);
+    EXPECT_EQ(rate_limiter_get(limiter_, 2), RATE_LIMIT_MAX);
+
+    rate_limiter_set(limiter_, 2, 1);
+    EXPECT_EQ(count_allowed(flooder, 2, 100), 2);
+
+    rate_limiter_set(limiter_, 2, 0);
+    EXPECT_EQ(count_allowed(flooder, 2, 100), 100);
+}
+
+}  // namespace
@@ -34,6 +34,7 @@
 #include "state.h"
 #include "tox_private.h"
 #include "tox_struct.h"
+#include "tox_threads.h"
 #include "util.h"
 
 #include "../toxencryptsave/defines.h"
@@ -53,6 +54,8 @@ static_assert(TOX_DHT_NODE_IP_STRING_SIZE == IP_NTOA_LEN,
               "TOX_DHT_NODE_IP_STRING_SIZE is assumed to be equal to IP_NTOA_LEN");
 static_assert(TOX_GROUP_PEER_IP_STRING_MAX_LENGTH == IP_NTOA_LEN,
               "TOX_GROUP_PEER_IP_STRING_MAX_LENGTH is assumed to be equal to IP_NTOA_LEN");
+static_assert(TOX_FILE_RECV_BUFFER_MAX_SIZE == MAX_FILE_RECV_BUFFER_SIZE,
+              "TOX_FILE_RECV_BUFFER_MAX_SIZE is assumed to be equal to MAX_FILE_RECV_BUFFER_SIZE");
 static_assert(TOX_DHT_NODE_PUBLIC_KEY_SIZE == CRYPTO_PUBLIC_KEY_SIZE,
               "TOX_DHT_NODE_PUBLIC_KEY_SIZE is assumed to be equal to CRYPTO_PUBLIC_KEY_SIZE");
 static_assert(TOX_FILE_ID_LENGTH == CRYPTO_SYMMETRIC_KEY_SIZE,
@@ -159,6 +162,21 @@ static void tox_friend_connection_status_handler(Messenger *m, uint32_t friend_n
     }
 }
 
+static m_friend_connection_timing_cb tox_friend_connection_timing_handler;
+non_null(1) nullable(7)
+static void tox_friend_connection_timing_handler(Messenger *m, uint32_t friend_number, uint32_t dht_pk_ms,
+        uint32_t dht_info_ms, uint32_t udp_ms, uint32_t connected_ms, void *user_data)
+{
+    struct Tox_Userdata *tox_data = (struct Tox_Userdata *)user_data;
+
+    if (tox_data->tox->friend_connection_timing_callback != nullptr) {
+        tox_unlock(tox_data->tox);
+        tox_data->tox->friend_connection_timing_callback(tox_data->tox, friend_number, dht_pk_ms, dht_info_ms, udp_ms,
+                connected_ms, tox_data->user_data);
+        tox_lock(tox_data->tox);
+    }
+}
+
 static m_friend_typing_cb tox_friend_typing_handler;
 non_null(1) nullable(4)
 static void tox_friend_typing_handler(Messenger *m, uint32_t friend_number, bool is_typing, void *user_data)
@@ -244,6 +262,25 @@ static void tox_file_chunk_request_handler(Messenger *m, uint32_t friend_number,
     }
 }
 
+static m_file_read_cb tox_file_read_chunk_handler;
+non_null(1, 5) nullable(7)
+static int64_t tox_file_read_chunk_handler(Messenger *m, uint32_t friend_number, uint32_t file_number,
+        uint64_t position, uint8_t *data, size_t length, void *user_data)
+{
+    struct Tox_Userdata *tox_data = (struct Tox_Userdata *)user_data;
+
+    if (tox_data->tox->file_read_chunk_callback == nullptr) {
+        return -1;
+    }
+
+    tox_unlock(tox_data->tox);
+    const int64_t ret = tox_data->tox->file_read_chunk_callback(tox_data->tox, friend_number, file_number, position,
+                        data, length, tox_data->user_data);
+    tox_lock(tox_data->tox);
+
+    return ret;
+}
+
 static m_file_recv_cb tox_file_recv_handler;
 non_null(1, 6) nullable(8)
 static void tox_file_recv_handler(Messenger *m, uint32_t friend_number, uint32_t file_number, uint32_t kind,
@@ -798,6 +835,8 @@ static Tox *tox_new_system(const struct Tox_Options *options, Tox_Err_New *error
     m_options.local_discovery_enabled = tox_options_get_local_discovery_enabled(opts);
     m_options.dht_announcements_enabled = tox_options_get_dht_announcements_enabled(opts);
     m_options.groups_persistence_enabled = tox_options_get_experimental_groups_persistence(opts);
+    m_options.warm_start_enabled = tox_options_get_experimental_warm_start(opts);
+    m_options.coalesce_messages_enabled = tox_options_get_experimental_coalesce_messages(opts);
 
     if (m_options.udp_disabled) {
         m_options.local_discovery_enabled = false;
@@ -978,6 +1017,7 @@ static Tox *tox_new_system(const struct Tox_Options *options, Tox_Err_New *error
     m_callback_statusmessage(tox->m, tox_friend_status_message_handler);
     m_callback_userstatus(tox->m, tox_friend_status_handler);
     m_callback_connectionstatus(tox->m, tox_friend_connection_status_handler);
+    m_callback_connection_timing(tox->m, tox_friend_connection_timing_handler);
     m_callback_typingchange(tox->m, tox_friend_typing_handler);
     m_callback_read_receipt(tox->m, tox_friend_read_receipt_handler);
     m_callback_friendrequest(tox->m, tox_friend_request_handler);
@@ -1015,6 +1055,26 @@ static Tox *tox_new_system(const struct Tox_Options *options, Tox_Err_New *error
     gc_callback_rejected(tox->m, tox_group_join_fail_handler);
     gc_callback_voice_state(tox->m, tox_group_voice_state_handler);
 
+    if (tox->mutex != nullptr) {
+        tox->threads = tox_threads_new(tox->sys.mem);
+
+        if (tox->threads == nullptr) {
+            kill_groupchats(tox->m->conferences_object);
+            kill_messenger(tox->m);
+
+            mono_time_free(tox->sys.mem, tox->mono_time);
+            tox_unlock(tox);
+
+            pthread_mutex_destroy(tox->mutex);
+            mem_delete(sys->mem, tox->mutex);
+            mem_delete(sys->mem, tox);
+
+            SET_ERROR_PARAMETER(error, TOX_ERR_NEW_MALLOC);
+            tox_options_free(default_options);
+            return nullptr;
+        }
+    }
+
     tox_unlock(tox);
 
     SET_ERROR_PARAMETER(error, TOX_ERR_NEW_OK);
@@ -1062,6 +1122,8 @@ void tox_kill(Tox *tox)
 
     tox_lock(tox);
     LOGGER_ASSERT(tox->m->log, tox->toxav_object == nullptr, "Attempted to kill tox while toxav is still alive");
+    tox_threads_free(tox->threads);
+    tox->threads = nullptr;
     kill_groupchats(tox->m->conferences_object);
     kill_messenger(tox->m);
     mono_time_free(tox->sys.mem, tox->mono_time);
@@ -1499,6 +1561,15 @@ static void set_friend_error(const Logger *log, int32_t ret, Tox_Err_Friend_Add
     }
 }
 
+/** @brief Makes a new friend start without messages queued for an earlier friend with the same number. */
+non_null()
+static void tox_friend_added(const Tox *tox, uint32_t friend_number)
+{
+    if (tox->threads != nullptr) {
+        tox_threads_friend_reset(tox->threads, friend_number);
+    }
+}
+
 uint32_t tox_friend_add(Tox *tox, const uint8_t address[TOX_ADDRESS_SIZE], const uint8_t *message, size_t length,
                         Tox_Err_Friend_Add *error)
 {
@@ -1513,6 +1584,7 @@ uint32_t tox_friend_add(Tox *tox, const uint8_t address[TOX_ADDRESS_SIZE], const
     const int32_t ret = m_addfriend(tox->m, address, message, length);
 
     if (ret >= 0) {
+        tox_friend_added(tox, (uint32_t)ret);
         SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_ADD_OK);
         tox_unlock(tox);
         return (uint32_t)ret;
@@ -1536,6 +1608,7 @@ uint32_t tox_friend_add_norequest(Tox *tox, const uint8_t public_key[TOX_PUBLIC_
     const int32_t ret = m_addfriend_norequest(tox->m, public_key);
 
     if (ret >= 0) {
+        tox_friend_added(tox, (uint32_t)ret);
         SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_ADD_OK);
         tox_unlock(tox);
         return (uint32_t)ret;
@@ -1546,6 +1619,51 @@ uint32_t tox_friend_add_norequest(Tox *tox, const uint8_t public_key[TOX_PUBLIC_
     return UINT32_MAX;
 }
 
+uint32_t tox_friend_add_norequest_bulk(Tox *tox, const uint8_t *public_keys, uint32_t count,
+                                       Tox_Friend_Number *friend_numbers, Tox_Err_Friend_Add *statuses,
+                                       Tox_Err_Friend_Add_Bulk *error)
+{
+    assert(tox != nullptr);
+
+    if (public_keys == nullptr && count != 0) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_ADD_BULK_NULL);
+        return 0;
+    }
+
+    tox_lock(tox);
+
+    // If this fails, the friend list grows one friend at a time, and the
+    // friends that don't fit get an error status.
+    m_reserve_friends(tox->m, count);
+
+    uint32_t added = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const int32_t ret = m_addfriend_norequest(tox->m, &public_keys[i * TOX_PUBLIC_KEY_SIZE]);
+
+        if (ret >= 0) {
+            tox_friend_added(tox, (uint32_t)ret);
+            ++added;
+        }
+
+        if (friend_numbers != nullptr) {
+            friend_numbers[i] = ret >= 0 ? (uint32_t)ret : UINT32_MAX;
+        }
+
+        if (statuses != nullptr) {
+            if (ret >= 0) {
+                statuses[i] = TOX_ERR_FRIEND_ADD_OK;
+            } else {
+                set_friend_error(tox->m->log, ret, &statuses[i]);
+            }
+        }
+    }
+
+    tox_unlock(tox);
+    SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_ADD_BULK_OK);
+    return added;
+}
+
 bool tox_friend_delete(Tox *tox, uint32_t friend_number, Tox_Err_Friend_Delete *error)
 {
     assert(tox != nullptr);
@@ -1611,10 +1729,12 @@ bool tox_friend_get_public_key(const Tox *tox, uint32_t friend_number, uint8_t p
 bool tox_friend_exists(const Tox *tox, uint32_t friend_number)
 {
     assert(tox != nullptr);
-    tox_lock(tox);
-    const bool ret = m_friend_exists(tox->m, friend_number);
-    tox_unlock(tox);
-    return ret;
+
+    if (tox->threads != nullptr) {
+        return tox_threads_friend_exists(tox->threads, friend_number);
+    }
+
+    return m_friend_exists(tox->m, friend_number);
 }
 
 uint64_t tox_friend_get_last_online(const Tox *tox, uint32_t friend_number, Tox_Err_Friend_Get_Last_Online *error)
@@ -1657,9 +1777,9 @@ void tox_self_get_friend_list(const Tox *tox, uint32_t *friend_list)
 size_t tox_friend_get_name_size(const Tox *tox, uint32_t friend_number, Tox_Err_Friend_Query *error)
 {
     assert(tox != nullptr);
-    tox_lock(tox);
-    const int ret = m_get_name_size(tox->m, friend_number);
-    tox_unlock(tox);
+    const int ret = tox->threads != nullptr
+                    ? tox_threads_friend_name(tox->threads, friend_number, nullptr)
+                    : m_get_name_size(tox->m, friend_number);
 
     if (ret == -1) {
         SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_FRIEND_NOT_FOUND);
@@ -1679,9 +1799,9 @@ bool tox_friend_get_name(const Tox *tox, uint32_t friend_number, uint8_t *name,
         return false;
     }
 
-    tox_lock(tox);
-    const int ret = getname(tox->m, friend_number, name);
-    tox_unlock(tox);
+    const int ret = tox->threads != nullptr
+                    ? tox_threads_friend_name(tox->threads, friend_number, name)
+                    : getname(tox->m, friend_number, name);
 
     if (ret == -1) {
         SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_FRIEND_NOT_FOUND);
@@ -1701,9 +1821,9 @@ void tox_callback_friend_name(Tox *tox, tox_friend_name_cb *callback)
 size_t tox_friend_get_status_message_size(const Tox *tox, uint32_t friend_number, Tox_Err_Friend_Query *error)
 {
     assert(tox != nullptr);
-    tox_lock(tox);
-    const int ret = m_get_statusmessage_size(tox->m, friend_number);
-    tox_unlock(tox);
+    const int ret = tox->threads != nullptr
+                    ? tox_threads_friend_status_message(tox->threads, friend_number, nullptr)
+                    : m_get_statusmessage_size(tox->m, friend_number);
 
     if (ret == -1) {
         SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_FRIEND_NOT_FOUND);
@@ -1724,12 +1844,20 @@ bool tox_friend_get_status_message(const Tox *tox, uint32_t friend_number, uint8
         return false;
     }
 
-    tox_lock(tox);
+    if (tox->threads != nullptr) {
+        if (tox_threads_friend_status_message(tox->threads, friend_number, status_message) == -1) {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_FRIEND_NOT_FOUND);
+            return false;
+        }
+
+        SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_OK);
+        return true;
+    }
+
     const int size = m_get_statusmessage_size(tox->m, friend_number);
 
     if (size == -1) {
         SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_FRIEND_NOT_FOUND);
-        tox_unlock(tox);
         return false;
     }
 
@@ -1737,7 +1865,6 @@ bool tox_friend_get_status_message(const Tox *tox, uint32_t friend_number, uint8
     LOGGER_ASSERT(tox->m->log, ret == size, "concurrency problem: friend status message changed");
 
     SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_OK);
-    tox_unlock(tox);
     return ret == size;
 }
 
@@ -1750,9 +1877,9 @@ void tox_callback_friend_status_message(Tox *tox, tox_friend_status_message_cb *
 Tox_User_Status tox_friend_get_status(const Tox *tox, uint32_t friend_number, Tox_Err_Friend_Query *error)
 {
     assert(tox != nullptr);
-    tox_lock(tox);
-    const int ret = m_get_userstatus(tox->m, friend_number);
-    tox_unlock(tox);
+    const int ret = tox->threads != nullptr
+                    ? tox_threads_friend_user_status(tox->threads, friend_number)
+                    : m_get_userstatus(tox->m, friend_number);
 
     if (ret == USERSTATUS_INVALID) {
         SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_FRIEND_NOT_FOUND);
@@ -1772,9 +1899,9 @@ void tox_callback_friend_status(Tox *tox, tox_friend_status_cb *callback)
 Tox_Connection tox_friend_get_connection_status(const Tox *tox, uint32_t friend_number, Tox_Err_Friend_Query *error)
 {
     assert(tox != nullptr);
-    tox_lock(tox);
-    const int ret = m_get_friend_connectionstatus(tox->m, friend_number);
-    tox_unlock(tox);
+    const int ret = tox->threads != nullptr
+                    ? tox_threads_friend_connection_status(tox->threads, friend_number)
+                    : m_get_friend_connectionstatus(tox->m, friend_number);
 
     if (ret == -1) {
         SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_FRIEND_NOT_FOUND);
@@ -1791,12 +1918,18 @@ void tox_callback_friend_connection_status(Tox *tox, tox_friend_connection_statu
     tox->friend_connection_status_callback = callback;
 }
 
+void tox_callback_friend_connection_timing(Tox *tox, tox_friend_connection_timing_cb *callback)
+{
+    assert(tox != nullptr);
+    tox->friend_connection_timing_callback = callback;
+}
+
 bool tox_friend_get_typing(const Tox *tox, uint32_t friend_number, Tox_Err_Friend_Query *error)
 {
     assert(tox != nullptr);
-    tox_lock(tox);
-    const int ret = m_get_istyping(tox->m, friend_number);
-    tox_unlock(tox);
+    const int ret = tox->threads != nullptr
+                    ? tox_threads_friend_typing(tox->threads, friend_number)
+                    : m_get_istyping(tox->m, friend_number);
 
     if (ret == -1) {
         SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_FRIEND_NOT_FOUND);
@@ -1887,9 +2020,31 @@ uint32_t tox_friend_send_message(Tox *tox, uint32_t friend_number, Tox_Message_T
     }
 
     uint32_t message_id = 0;
-    tox_lock(tox);
-    set_message_error(tox->m->log, m_send_message_generic(tox->m, friend_number, type, message, length, &message_id),
-                      error);
+
+    if (tox->threads == nullptr) {
+        set_message_error(tox->m->log, m_send_message_generic(tox->m, friend_number, type, message, length, &message_id),
+                          error);
+        return message_id;
+    }
+
+    // Rather than wait for tox_iterate, queue the message for the thread that
+    // holds the lock.
+    if (pthread_mutex_trylock(tox->mutex) != 0) {
+        set_message_error(tox->m->log, tox_threads_queue_message(tox->threads, friend_number, type, message, length,
+                          &message_id), error);
+
+        // The lock may have been released before the message was queued, in
+        // which case nobody sends it until the lock is taken again. Releasing
+        // the lock sends the queue.
+        if (pthread_mutex_trylock(tox->mutex) == 0) {
+            tox_unlock(tox);
+        }
+
+        return message_id;
+    }
+
+    set_message_error(tox->m->log, tox_threads_send_message(tox->threads, tox->m, friend_number, type, message, length,
+                      &message_id), error);
     tox_unlock(tox);
     return message_id;
 }
@@ -2187,6 +2342,84 @@ void tox_callback_file_chunk_request(Tox *tox, tox_file_chunk_request_cb *callba
     tox->file_chunk_request_callback = callback;
 }
 
+bool tox_file_set_recv_buffer(Tox *tox, uint32_t friend_number, uint32_t file_number, uint32_t size,
+                              Tox_Err_File_Set_Recv_Buffer *error)
+{
+    assert(tox != nullptr);
+    tox_lock(tox);
+    const int ret = file_set_recv_buffer(tox->m, friend_number, file_number, size);
+    tox_unlock(tox);
+
+    switch (ret) {
+        case 0: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SET_RECV_BUFFER_OK);
+            return true;
+        }
+
+        case -1: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SET_RECV_BUFFER_FRIEND_NOT_FOUND);
+            return false;
+        }
+
+        case -2: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SET_RECV_BUFFER_NOT_FOUND);
+            return false;
+        }
+
+        case -3: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SET_RECV_BUFFER_TOO_LARGE);
+            return false;
+        }
+    }
+
+    /* can't happen */
+    LOGGER_FATAL(tox->m->log, "impossible return value: %d", ret);
+
+    return false;
+}
+
+void tox_callback_file_read_chunk(Tox *tox, tox_file_read_chunk_cb *callback)
+{
+    assert(tox != nullptr);
+    tox->file_read_chunk_callback = callback;
+
+    // Without a callback, transfers in pull mode fall back to chunk requests.
+    tox_lock(tox);
+    callback_file_read(tox->m, callback != nullptr ? tox_file_read_chunk_handler : nullptr);
+    tox_unlock(tox);
+}
+
+bool tox_file_set_pull(Tox *tox, uint32_t friend_number, uint32_t file_number, bool pull,
+                       Tox_Err_File_Set_Pull *error)
+{
+    assert(tox != nullptr);
+    tox_lock(tox);
+    const int ret = file_set_pull(tox->m, friend_number, file_number, pull);
+    tox_unlock(tox);
+
+    switch (ret) {
+        case 0: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SET_PULL_OK);
+            return true;
+        }
+
+        case -1: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SET_PULL_FRIEND_NOT_FOUND);
+            return false;
+        }
+
+        case -2: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SET_PULL_NOT_FOUND);
+            return false;
+        }
+    }
+
+    /* can't happen */
+    LOGGER_FATAL(tox->m->log, "impossible return value: %d", ret);
+
+    return false;
+}
+
 void tox_callback_file_recv(Tox *tox, tox_file_recv_cb *callback)
 {
     assert(tox != nullptr);
@@ -652,6 +652,19 @@ struct Tox_Options {
     /**
      * Make public API functions thread-safe using a per-instance lock.
      *
+     * The friend getters tox_friend_exists, tox_friend_get_name,
+     * tox_friend_get_status_message, tox_friend_get_status,
+     * tox_friend_get_connection_status and tox_friend_get_typing don't take
+     * the lock. They return the state as of the last time the lock was
+     * released. tox_friend_send_message doesn't wait for the lock either: while
+     * another thread holds it, the message is queued and sent when that thread
+     * releases the lock.
+     *
+     * A queued message is accepted with TOX_ERR_FRIEND_SEND_MESSAGE_OK based on
+     * the friend's state at the time of the call. If the friend goes offline or
+     * is removed before the message is sent, the message is dropped without any
+     * error being reported, and no read receipt arrives for its message id.
+     *
      * Default: false.
      */
     bool experimental_thread_safety;
@@ -686,6 +699,33 @@ struct Tox_Options {
      * Default: false. May become true in the future (0.3.0).
      */
     bool experimental_disable_dns;
+
+    /**
+     * Save a warm-start section in Tox save data (via `tox_get_savedata`):
+     * the onion path nodes and how well they answered, and the DHT public key
+     * and IP/port of every friend whose DHT instance is known. Loading it lets
+     * a restarted instance build onion paths and reach friends that are still
+     * online right away instead of searching for them first.
+     *
+     * The section holds friends' IP addresses, so only enable it if the save
+     * data is kept as private as those are.
+     *
+     * Default: false.
+     */
+    bool experimental_warm_start;
+
+    /**
+     * Send short messages, typing notifications, names and statuses to a
+     * friend together in one packet per iteration instead of one packet each,
+     * if the friend has this option enabled, too. Friends running older
+     * versions get every packet on its own as before.
+     *
+     * Message order and read receipts are not affected, but each of these
+     * packets may go out up to one `tox_iteration_interval` later.
+     *
+     * Default: false.
+     */
+    bool experimental_coalesce_messages;
 };
 
 bool tox_options_get_ipv6_enabled(const Tox_Options *options);
@@ -764,6 +804,14 @@ bool tox_options_get_experimental_disable_dns(const Tox_Options *options);
 
 void tox_options_set_experimental_disable_dns(Tox_Options *options, bool experimental_disable_dns);
 
+bool tox_options_get_experimental_warm_start(const Tox_Options *options);
+
+void tox_options_set_experimental_warm_start(Tox_Options *options, bool experimental_warm_start);
+
+bool tox_options_get_experimental_coalesce_messages(const Tox_Options *options);
+
+void tox_options_set_experimental_coalesce_messages(Tox_Options *options, bool experimental_coalesce_messages);
+
 /**
  * @brief Initialises a Tox_Options object with the default options.
  *
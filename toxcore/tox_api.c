@@ -127,6 +127,10 @@ uint32_t tox_group_peer_ip_string_max_length(void)
 {
     return TOX_GROUP_PEER_IP_STRING_MAX_LENGTH;
 }
+uint32_t tox_file_recv_buffer_max_size(void)
+{
+    return TOX_FILE_RECV_BUFFER_MAX_SIZE;
+}
 uint32_t tox_dht_node_ip_string_size(void)
 {
     return TOX_DHT_NODE_IP_STRING_SIZE;
@@ -282,6 +286,22 @@ void tox_options_set_experimental_disable_dns(Tox_Options *options, bool experim
 {
     options->experimental_disable_dns = experimental_disable_dns;
 }
+bool tox_options_get_experimental_warm_start(const Tox_Options *options)
+{
+    return options->experimental_warm_start;
+}
+void tox_options_set_experimental_warm_start(Tox_Options *options, bool experimental_warm_start)
+{
+    options->experimental_warm_start = experimental_warm_start;
+}
+bool tox_options_get_experimental_coalesce_messages(const Tox_Options *options)
+{
+    return options->experimental_coalesce_messages;
+}
+void tox_options_set_experimental_coalesce_messages(Tox_Options *options, bool experimental_coalesce_messages)
+{
+    options->experimental_coalesce_messages = experimental_coalesce_messages;
+}
 
 const uint8_t *tox_options_get_savedata_data(const Tox_Options *options)
 {
@@ -308,6 +328,8 @@ void tox_options_default(Tox_Options *options)
         tox_options_set_experimental_thread_safety(options, false);
         tox_options_set_experimental_groups_persistence(options, false);
         tox_options_set_experimental_disable_dns(options, false);
+        tox_options_set_experimental_warm_start(options, false);
+        tox_options_set_experimental_coalesce_messages(options, false);
     }
 }
 
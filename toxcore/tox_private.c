@@ -9,8 +9,10 @@
 #include "tox_private.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "DHT.h"
+#include "TCP_connection.h"
 #include "attributes.h"
 #include "ccompat.h"
 #include "crypto_core.h"
@@ -19,8 +21,10 @@
 #include "mem.h"
 #include "net_crypto.h"
 #include "network.h"
+#include "onion_client.h"
 #include "tox.h"
 #include "tox_struct.h"
+#include "tox_threads.h"
 
 #define SET_ERROR_PARAMETER(param, x) \
     do {                              \
@@ -50,6 +54,13 @@ void tox_lock(const Tox *tox)
 
 void tox_unlock(const Tox *tox)
 {
+    if (tox->threads != nullptr) {
+        // Send what other threads queued while we held the lock, and show them
+        // what changed.
+        tox_threads_send_queued(tox->threads, tox->m);
+        tox_threads_publish(tox->threads, tox->m);
+    }
+
     if (tox->mutex != nullptr) {
         pthread_mutex_unlock(tox->mutex);
     }
@@ -175,6 +186,88 @@ uint16_t tox_dht_get_num_closelist_announce_capable(const Tox *tox)
     return num_cap;
 }
 
+uint32_t tox_onion_path_count(void)
+{
+    return NUMBER_ONION_PATHS;
+}
+
+bool tox_onion_get_path_stats(const Tox *tox, bool friends, uint32_t path_index, Tox_Onion_Path_Stats *stats)
+{
+    assert(tox != nullptr);
+    assert(stats != nullptr);
+
+    Onion_Path_Stats path_stats;
+
+    tox_lock(tox);
+    const bool ok = onion_get_path_stats(tox->m->onion_c, friends, path_index, &path_stats);
+    tox_unlock(tox);
+
+    if (!ok) {
+        return false;
+    }
+
+    stats->requests = path_stats.requests;
+    stats->responses = path_stats.responses;
+    stats->rtt = path_stats.rtt;
+    stats->age = path_stats.age;
+    return true;
+}
+
+uint16_t tox_onion_get_num_path_nodes(const Tox *tox)
+{
+    assert(tox != nullptr);
+
+    tox_lock(tox);
+    const uint16_t num_nodes = onion_get_path_node_count(tox->m->onion_c);
+    tox_unlock(tox);
+
+    return num_nodes;
+}
+
+bool tox_onion_get_path_node_stats(const Tox *tox, uint16_t index, Tox_Onion_Path_Node_Stats *stats)
+{
+    assert(tox != nullptr);
+    assert(stats != nullptr);
+
+    Node_format node;
+    Onion_Path_Node_Stats node_stats;
+
+    tox_lock(tox);
+    const bool ok = onion_get_path_node_stats(tox->m->onion_c, index, &node, &node_stats);
+    tox_unlock(tox);
+
+    if (!ok) {
+        return false;
+    }
+
+    memcpy(stats->public_key, node.public_key, TOX_PUBLIC_KEY_SIZE);
+    stats->successes = node_stats.successes;
+    stats->failures = node_stats.failures;
+    stats->rtt = node_stats.rtt;
+    return true;
+}
+
+bool tox_friend_get_coalesce_stats(const Tox *tox, uint32_t friend_number, Tox_Coalesce_Stats *stats)
+{
+    assert(tox != nullptr);
+    assert(stats != nullptr);
+
+    uint32_t sent;
+    uint32_t received;
+
+    tox_lock(tox);
+    const bool ok = m_get_coalesced_packets(tox->m, friend_number, &sent, &received);
+    tox_unlock(tox);
+
+    if (!ok) {
+        return false;
+    }
+
+    stats->coalesced_packets_sent = sent;
+    stats->coalesced_packets_received = received;
+    return true;
+}
+
 size_t tox_group_peer_get_ip_address_size(const Tox *tox, uint32_t group_number, uint32_t peer_id,
         Tox_Err_Group_Peer_Query *error)
 {
@@ -226,3 +319,64 @@ bool tox_group_peer_get_ip_address(const Tox *tox, uint32_t group_number, uint32
     SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_PEER_QUERY_OK);
     return true;
 }
+
+struct Tox_Relay_Share {
+    const Memory *mem;
+    TCP_Onion_Share *onion_share;
+};
+
+Tox_Relay_Share *tox_relay_share_new(void)
+{
+    const Memory *mem = os_memory();
+
+    if (mem == nullptr) {
+        return nullptr;
+    }
+
+    Tox_Relay_Share *share = (Tox_Relay_Share *)mem_alloc(mem, sizeof(Tox_Relay_Share));
+
+    if (share == nullptr) {
+        return nullptr;
+    }
+
+    share->mem = mem;
+    share->onion_share = new_tcp_onion_share(mem);
+
+    if (share->onion_share == nullptr) {
+        mem_delete(mem, share);
+        return nullptr;
+    }
+
+    return share;
+}
+
+void tox_relay_share_kill(Tox_Relay_Share *share)
+{
+    if (share == nullptr) {
+        return;
+    }
+
+    kill_tcp_onion_share(share->onion_share);
+    mem_delete(share->mem, share);
+}
+
+bool tox_relay_share_join(Tox *tox, Tox_Relay_Share *share)
+{
+    assert(tox != nullptr);
+    assert(share != nullptr);
+
+    tox_lock(tox);
+    const bool ret = tcp_onion_share_join(nc_get_tcp_c(tox->m->net_crypto), share->onion_share);
+    tox_unlock(tox);
+
+    return ret;
+}
+
+void tox_relay_share_leave(Tox *tox)
+{
+    assert(tox != nullptr);
+
+    tox_lock(tox);
+    tcp_onion_share_leave(nc_get_tcp_c(tox->m->net_crypto));
+    tox_unlock(tox);
+}
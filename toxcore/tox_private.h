@@ -169,6 +169,119 @@ uint16_t tox_dht_get_num_closelist(const Tox *tox);
  */
 uint16_t tox_dht_get_num_closelist_announce_capable(const Tox *tox);
 
+/*******************************************************************************
+ *
+ * :: Friend connection timing.
+ *
+ ******************************************************************************/
+
+/**
+ * Called once each time a friend becomes reachable over UDP after having
+ * been offline, with how long each step of getting there took.
+ *
+ * Every step is given in milliseconds since the friend was added or last went
+ * offline. A step that didn't happen during this connection attempt, e.g.
+ * because the friend was found through LAN discovery, is UINT32_MAX.
+ *
+ * @param dht_pk_ms When we learned the friend's DHT public key, usually
+ *   through the onion. 0 if we still knew it from before.
+ * @param dht_info_ms When DHT nodes started telling us the address they see
+ *   the friend at.
+ * @param udp_ms When the friend's DHT first reached us directly, i.e. when
+ *   the hole through any NATs was punched.
+ * @param connected_ms When the connection to the friend became UDP.
+ */
+typedef void tox_friend_connection_timing_cb(Tox *tox, uint32_t friend_number, uint32_t dht_pk_ms,
+        uint32_t dht_info_ms, uint32_t udp_ms, uint32_t connected_ms, void *user_data);
+
+/**
+ * Set the callback for the timing of connections to friends. Pass NULL to
+ * unset.
+ */
+void tox_callback_friend_connection_timing(Tox *tox, tox_friend_connection_timing_cb *callback);
+
+/*******************************************************************************
+ *
+ * :: Onion path health.
+ *
+ ******************************************************************************/
+
+/**
+ * Number of onion paths kept for announcing ourselves, and as many again for
+ * searching for friends.
+ */
+uint32_t tox_onion_path_count(void);
+
+typedef struct Tox_Onion_Path_Stats {
+    /** Announce requests sent over the path since it was created. */
+    uint32_t requests;
+    /** Announce responses received over the path since it was created. */
+    uint32_t responses;
+    /** Smoothed announce round trip time in milliseconds, 0 if unknown. */
+    uint32_t rtt;
+    /** Seconds since the path was created. */
+    uint64_t age;
+} Tox_Onion_Path_Stats;
+
+/**
+ * Get the health of an onion path.
+ *
+ * @param friends false for the paths used to announce ourselves, true for the
+ *   paths used to search for friends.
+ * @param path_index Index of the path, less than tox_onion_path_count().
+ *
+ * @return true on success, false if there is no such path yet.
+ */
+bool tox_onion_get_path_stats(const Tox *tox, bool friends, uint32_t path_index, Tox_Onion_Path_Stats *stats);
+
+/**
+ * Number of nodes that onion paths are currently built from.
+ */
+uint16_t tox_onion_get_num_path_nodes(const Tox *tox);
+
+typedef struct Tox_Onion_Path_Node_Stats {
+    /** DHT public key of the node. */
+    uint8_t public_key[TOX_PUBLIC_KEY_SIZE];
+    /** Announce responses received over paths through the node. */
+    uint32_t successes;
+    /** Paths through the node that were dropped for not getting responses. */
+    uint32_t failures;
+    /** Smoothed round trip time of paths through the node in milliseconds, 0 if unknown. */
+    uint32_t rtt;
+} Tox_Onion_Path_Node_Stats;
+
+/**
+ * Get the health of a node onion paths are built from. Paths are more likely to
+ * go through nodes that answer reliably and quickly.
+ *
+ * @param index Index of the node, less than tox_onion_get_num_path_nodes().
+ *
+ * @return true on success, false if the index is out of range.
+ */
+bool tox_onion_get_path_node_stats(const Tox *tox, uint16_t index, Tox_Onion_Path_Node_Stats *stats);
+
+/*******************************************************************************
+ *
+ * :: Message coalescing.
+ *
+ ******************************************************************************/
+
+typedef struct Tox_Coalesce_Stats {
+    /** Packets sent to the friend that carried more than one message or other small packet. */
+    uint32_t coalesced_packets_sent;
+    /** Packets received from the friend that carried several small packets. */
+    uint32_t coalesced_packets_received;
+} Tox_Coalesce_Stats;
+
+/**
+ * Get how often small packets to and from a friend were sent together, see
+ * `experimental_coalesce_messages`. Both counts stay 0 unless we and the
+ * friend have the option enabled.
+ *
+ * @return true on success, false if the friend doesn't exist.
+ */
+bool tox_friend_get_coalesce_stats(const Tox *tox, uint32_t friend_number, Tox_Coalesce_Stats *stats);
+
 /*******************************************************************************
  *
  * :: DHT groupchat queries.
@@ -215,6 +328,204 @@ size_t tox_group_peer_get_ip_address_size(const Tox *tox, uint32_t group_number,
 bool tox_group_peer_get_ip_address(const Tox *tox, uint32_t group_number, uint32_t peer_id, uint8_t *ip_addr,
                                    Tox_Err_Group_Peer_Query *error);
 
+/*******************************************************************************
+ *
+ * :: Pull mode file sending.
+ *
+ ******************************************************************************/
+
+/**
+ * Called to read a chunk of an outgoing file transfer in pull mode straight
+ * into the packet that will carry it, see `tox_file_set_pull`.
+ *
+ * @param position The file position of the chunk.
+ * @param data Buffer to read the chunk into.
+ * @param length The number of bytes to read. 0 only for empty files.
+ *
+ * @return the number of bytes read. This must be `length`, except at the end
+ *   of a file of unknown size (UINT64_MAX), where fewer bytes end the
+ *   transfer. Return -1 on error, which cancels the transfer.
+ */
+typedef int64_t tox_file_read_chunk_cb(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
+                                       uint8_t *data, size_t length, void *user_data);
+
+/**
+ * Set the callback for reading file chunks of transfers in pull mode. Pass
+ * NULL to unset, which makes all transfers fall back to chunk requests.
+ */
+void tox_callback_file_read_chunk(Tox *tox, tox_file_read_chunk_cb *callback);
+
+typedef enum Tox_Err_File_Set_Pull {
+    /**
+     * The function returned successfully.
+     */
+    TOX_ERR_FILE_SET_PULL_OK,
+
+    /**
+     * The friend_number passed did not designate a valid friend.
+     */
+    TOX_ERR_FILE_SET_PULL_FRIEND_NOT_FOUND,
+
+    /**
+     * No outgoing file transfer with the given file number was found for the
+     * given friend.
+     */
+    TOX_ERR_FILE_SET_PULL_NOT_FOUND,
+} Tox_Err_File_Set_Pull;
+
+/**
+ * Switch an outgoing file transfer between pull mode and chunk requests.
+ *
+ * In pull mode, toxcore calls the `file_read_chunk` callback whenever it has
+ * room to send the next chunk, and the chunk is read directly into the send
+ * queue. There are no `file_chunk_request` events for the data and no
+ * `tox_file_send_chunk` calls, saving a callback and two copies per chunk.
+ * The end of the transfer is still reported with a `file_chunk_request` of
+ * length 0. If reading fails, the transfer is cancelled and a
+ * `file_recv_control` event with TOX_FILE_CONTROL_CANCEL is sent.
+ *
+ * Chunks that were requested but not sent yet when switching are read or
+ * requested again.
+ *
+ * @return true on success.
+ */
+bool tox_file_set_pull(Tox *tox, uint32_t friend_number, uint32_t file_number, bool pull,
+                       Tox_Err_File_Set_Pull *error);
+
+typedef enum Tox_Err_File_Set_Recv_Buffer {
+    /**
+     * The function returned successfully.
+     */
+    TOX_ERR_FILE_SET_RECV_BUFFER_OK,
+
+    /**
+     * The friend_number passed did not designate a valid friend.
+     */
+    TOX_ERR_FILE_SET_RECV_BUFFER_FRIEND_NOT_FOUND,
+
+    /**
+     * No incoming file transfer with the given file number was found for the
+     * given friend.
+     */
+    TOX_ERR_FILE_SET_RECV_BUFFER_NOT_FOUND,
+
+    /**
+     * The buffer size is larger than TOX_FILE_RECV_BUFFER_MAX_SIZE.
+     */
+    TOX_ERR_FILE_SET_RECV_BUFFER_TOO_LARGE,
+} Tox_Err_File_Set_Recv_Buffer;
+
+/**
+ * Largest buffer size for `tox_file_set_recv_buffer`.
+ */
+#define TOX_FILE_RECV_BUFFER_MAX_SIZE (1024 * 1024)
+
+uint32_t tox_file_recv_buffer_max_size(void);
+
+/**
+ * Batch the chunks of an incoming file transfer into larger pieces.
+ *
+ * Contiguous chunks are collected in a buffer of up to `size` bytes and
+ * reported together in one `file_recv_chunk` event. This happens when the
+ * buffer is full, at the end of each `tox_iterate`, and before the transfer
+ * ends, also when the friend goes offline. Clients that write to disk can
+ * then write e.g. 64 KiB at a time instead of a packet's worth.
+ *
+ * A size of 0, the default, reports every chunk as it arrives. Best called
+ * from the `file_recv` callback, before resuming the transfer.
+ *
+ * @return true on success.
+ */
+bool tox_file_set_recv_buffer(Tox *tox, uint32_t friend_number, uint32_t file_number, uint32_t size,
+                              Tox_Err_File_Set_Recv_Buffer *error);
+
+/*******************************************************************************
+ *
+ * :: Bulk friend import.
+ *
+ ******************************************************************************/
+
+typedef enum Tox_Err_Friend_Add_Bulk {
+
+    /**
+     * The function returned successfully. This doesn't mean every friend was
+     * added; see the per-key statuses for that.
+     */
+    TOX_ERR_FRIEND_ADD_BULK_OK,
+
+    /**
+     * One of the arguments to the function was NULL when it was not expected.
+     */
+    TOX_ERR_FRIEND_ADD_BULK_NULL,
+
+} Tox_Err_Friend_Add_Bulk;
+
+/**
+ * @brief Add many friends without sending friend requests.
+ *
+ * Does what calling `tox_friend_add_norequest` for each key in order would do,
+ * but reserves room for all the friends up front and takes the Tox lock only
+ * once, which makes provisioning an account with tens of thousands of friends
+ * much faster. Like `tox_friend_add_norequest`, this doesn't send anything;
+ * the friends are looked up on the network over the next iterations.
+ *
+ * @param public_keys `count` public keys of TOX_PUBLIC_KEY_SIZE bytes each.
+ * @param count Number of public keys.
+ * @param friend_numbers Array of `count` entries that receives each friend's
+ *   number, or UINT32_MAX if adding that key failed. May be NULL.
+ * @param statuses Array of `count` entries that receives the error code
+ *   `tox_friend_add_norequest` would have set for each key. May be NULL.
+ *
+ * @return the number of friends added.
+ */
+uint32_t tox_friend_add_norequest_bulk(Tox *tox, const uint8_t *public_keys, uint32_t count,
+                                       Tox_Friend_Number *friend_numbers, Tox_Err_Friend_Add *statuses,
+                                       Tox_Err_Friend_Add_Bulk *error);
+
+/*******************************************************************************
+ *
+ * :: Shared TCP onion relays.
+ *
+ ******************************************************************************/
+
+/**
+ * A group of Tox instances in one process that carry each other's onion
+ * traffic over a single set of TCP relay connections.
+ *
+ * Without a share, every instance that cannot use UDP keeps 3 TCP relay
+ * connections open for onion announces and friend searches. In a share, only
+ * one member needs to; the other members send their onion requests through
+ * that member's relays. Friend connections still use each instance's own
+ * relays, because relays route by the public key a connection authenticated
+ * with.
+ *
+ * All instances in a share must be iterated from the same thread.
+ */
+typedef struct Tox_Relay_Share Tox_Relay_Share;
+
+/**
+ * Create an empty relay share. Returns NULL on allocation failure.
+ */
+Tox_Relay_Share *tox_relay_share_new(void);
+
+/**
+ * Destroy a relay share. Instances still in it are detached first.
+ */
+void tox_relay_share_kill(Tox_Relay_Share *share);
+
+/**
+ * Add the Tox instance to the share. An instance can be in at most one share.
+ * It leaves the share automatically when it is killed.
+ *
+ * @return true on success.
+ */
+bool tox_relay_share_join(Tox *tox, Tox_Relay_Share *share);
+
+/**
+ * Remove the Tox instance from its share, if it is in one.
+ */
+void tox_relay_share_leave(Tox *tox);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -13,6 +13,7 @@
 #include "mono_time.h"
 #include "tox.h"
 #include "tox_private.h"
+#include "tox_threads.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -23,6 +24,8 @@ struct Tox {
     Mono_Time *mono_time;
     Tox_System sys;
     pthread_mutex_t *mutex;
+    /* Non-null exactly when `mutex` is. Getters that read from it don't take the lock. */
+    Tox_Threads *threads;
 
     tox_log_cb *log_callback;
     tox_self_connection_status_cb *self_connection_status_callback;
@@ -30,12 +33,14 @@ struct Tox {
     tox_friend_status_message_cb *friend_status_message_callback;
     tox_friend_status_cb *friend_status_callback;
     tox_friend_connection_status_cb *friend_connection_status_callback;
+    tox_friend_connection_timing_cb *friend_connection_timing_callback;
     tox_friend_typing_cb *friend_typing_callback;
     tox_friend_read_receipt_cb *friend_read_receipt_callback;
     tox_friend_request_cb *friend_request_callback;
     tox_friend_message_cb *friend_message_callback;
     tox_file_recv_control_cb *file_recv_control_callback;
     tox_file_chunk_request_cb *file_chunk_request_callback;
+    tox_file_read_chunk_cb *file_read_chunk_callback;
     tox_file_recv_cb *file_recv_callback;
     tox_file_recv_chunk_cb *file_recv_chunk_callback;
     tox_conference_invite_cb *conference_invite_callback;
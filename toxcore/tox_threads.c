@@ -0,0 +1,477 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+#include "tox_threads.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include "Messenger.h"
+#include "attributes.h"
+#include "ccompat.h"
+#include "mem.h"
+#include "net_crypto.h"
+#include "util.h"
+
+/** Maximum number of messages waiting for a thread that holds the Tox lock. */
+#define MAX_QUEUED_MESSAGES 256
+
+/** @brief The info of a friend as of the last tox_threads_publish. */
+typedef struct Friend_Snapshot {
+    bool exists;
+    bool online;
+    bool typing;
+    uint8_t user_status;
+    uint8_t connection_status;
+    uint16_t name_length;
+    uint16_t status_message_length;
+    uint8_t name[MAX_NAME_LENGTH];
+    uint8_t status_message[MAX_STATUSMESSAGE_LENGTH];
+} Friend_Snapshot;
+
+typedef struct Queued_Message {
+    struct Queued_Message *next;
+    uint32_t friend_number;
+    uint32_t message_id;
+    uint8_t type;
+    uint32_t length;
+    uint8_t *message;
+} Queued_Message;
+
+struct Tox_Threads {
+    const Memory *mem;
+
+    /* Friend info, written only with the Tox lock held. */
+    pthread_rwlock_t snapshot_lock;
+    Friend_Snapshot *friends;
+    uint32_t num_friends;
+    uint32_t friends_capacity;
+
+    /* Queued messages and message ids. Taken after the Tox lock and before
+     * snapshot_lock by threads that hold both. */
+    pthread_mutex_t queue_lock;
+    Queued_Message *queue_head;
+    Queued_Message *queue_tail;
+    uint32_t queue_size;
+    uint32_t *last_message_ids;  // per friend number, 0 before the first message
+    uint32_t num_message_ids;
+};
+
+Tox_Threads *tox_threads_new(const Memory *mem)
+{
+    Tox_Threads *threads = (Tox_Threads *)mem_alloc(mem, sizeof(Tox_Threads));
+
+    if (threads == nullptr) {
+        return nullptr;
+    }
+
+    threads->mem = mem;
+
+    if (pthread_rwlock_init(&threads->snapshot_lock, nullptr) != 0) {
+        mem_delete(mem, threads);
+        return nullptr;
+    }
+
+    if (pthread_mutex_init(&threads->queue_lock, nullptr) != 0) {
+        pthread_rwlock_destroy(&threads->snapshot_lock);
+        mem_delete(mem, threads);
+        return nullptr;
+    }
+
+    return threads;
+}
+
+non_null()
+static void queued_message_free(const Memory *mem, Queued_Message *msg)
+{
+    mem_delete(mem, msg->message);
+    mem_delete(mem, msg);
+}
+
+void tox_threads_free(Tox_Threads *threads)
+{
+    if (threads == nullptr) {
+        return;
+    }
+
+    while (threads->queue_head != nullptr) {
+        Queued_Message *const next = threads->queue_head->next;
+        queued_message_free(threads->mem, threads->queue_head);
+        threads->queue_head = next;
+    }
+
+    pthread_mutex_destroy(&threads->queue_lock);
+    pthread_rwlock_destroy(&threads->snapshot_lock);
+    mem_delete(threads->mem, threads->last_message_ids);
+    mem_delete(threads->mem, threads->friends);
+    mem_delete(threads->mem, threads);
+}
+
+non_null()
+static void snapshot_friend(Friend_Snapshot *snapshot, const Friend *f)
+{
+    snapshot->exists = true;
+    snapshot->online = f->status == FRIEND_ONLINE;
+    snapshot->typing = f->is_typing;
+    snapshot->user_status = f->userstatus < USERSTATUS_INVALID ? f->userstatus : USERSTATUS_NONE;
+    snapshot->connection_status = snapshot->online ? f->last_connection_udp_tcp : CONNECTION_NONE;
+    snapshot->name_length = f->name_length;
+    memcpy(snapshot->name, f->name, f->name_length);
+    snapshot->status_message_length = f->statusmessage_length;
+    memcpy(snapshot->status_message, f->statusmessage, f->statusmessage_length);
+}
+
+void tox_threads_publish(Tox_Threads *threads, Messenger *m)
+{
+    if (m->num_changed_friends == 0 && threads->num_friends == m->numfriends) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&threads->snapshot_lock);
+
+    if (m->numfriends > threads->friends_capacity) {
+        Friend_Snapshot *friends = (Friend_Snapshot *)mem_vrealloc(threads->mem, threads->friends, m->numfriends,
+                                   sizeof(Friend_Snapshot));
+
+        if (friends == nullptr) {
+            // Getters keep seeing the old info until the next try.
+            pthread_rwlock_unlock(&threads->snapshot_lock);
+            return;
+        }
+
+        memset(&friends[threads->friends_capacity], 0,
+               (m->numfriends - threads->friends_capacity) * sizeof(Friend_Snapshot));
+        threads->friends = friends;
+        threads->friends_capacity = m->numfriends;
+    }
+
+    // Friends added at the end of the list are among the changed ones, so
+    // only those need a look, however many friends there are.
+    for (uint32_t i = 0; i < m->num_changed_friends; ++i) {
+        const uint32_t friend_number = m->changed_friends[i];
+        Friend_Snapshot *const snapshot = &threads->friends[friend_number];
+        Friend *const f = &m->friendlist[friend_number];
+
+        f->info_changed = false;
+
+        if (f->status == NOFRIEND) {
+            snapshot->exists = false;
+        } else {
+            snapshot_friend(snapshot, f);
+        }
+    }
+
+    m->num_changed_friends = 0;
+
+    for (uint32_t i = m->numfriends; i < threads->num_friends; ++i) {
+        threads->friends[i].exists = false;
+    }
+
+    threads->num_friends = m->numfriends;
+
+    pthread_rwlock_unlock(&threads->snapshot_lock);
+}
+
+/** @brief Takes the snapshot lock for reading and finds a friend, which must be followed by an unlock. */
+non_null()
+static const Friend_Snapshot *snapshot_read(Tox_Threads *threads, uint32_t friend_number)
+{
+    pthread_rwlock_rdlock(&threads->snapshot_lock);
+
+    if (friend_number >= threads->num_friends || !threads->friends[friend_number].exists) {
+        return nullptr;
+    }
+
+    return &threads->friends[friend_number];
+}
+
+bool tox_threads_friend_exists(Tox_Threads *threads, uint32_t friend_number)
+{
+    const bool exists = snapshot_read(threads, friend_number) != nullptr;
+    pthread_rwlock_unlock(&threads->snapshot_lock);
+    return exists;
+}
+
+int tox_threads_friend_name(Tox_Threads *threads, uint32_t friend_number, uint8_t *name)
+{
+    const Friend_Snapshot *const snapshot = snapshot_read(threads, friend_number);
+    int ret = -1;
+
+    if (snapshot != nullptr) {
+        if (name != nullptr) {
+            memcpy(name, snapshot->name, snapshot->name_length);
+        }
+
+        ret = snapshot->name_length;
+    }
+
+    pthread_rwlock_unlock(&threads->snapshot_lock);
+    return ret;
+}
+
+int tox_threads_friend_status_message(Tox_Threads *threads, uint32_t friend_number, uint8_t *status_message)
+{
+    const Friend_Snapshot *const snapshot = snapshot_read(threads, friend_number);
+    int ret = -1;
+
+    if (snapshot != nullptr) {
+        if (status_message != nullptr) {
+            memcpy(status_message, snapshot->status_message, snapshot->status_message_length);
+        }
+
+        ret = snapshot->status_message_length;
+    }
+
+    pthread_rwlock_unlock(&threads->snapshot_lock);
+    return ret;
+}
+
+uint8_t tox_threads_friend_user_status(Tox_Threads *threads, uint32_t friend_number)
+{
+    const Friend_Snapshot *const snapshot = snapshot_read(threads, friend_number);
+    const uint8_t ret = snapshot != nullptr ? snapshot->user_status : USERSTATUS_INVALID;
+    pthread_rwlock_unlock(&threads->snapshot_lock);
+    return ret;
+}
+
+int tox_threads_friend_connection_status(Tox_Threads *threads, uint32_t friend_number)
+{
+    const Friend_Snapshot *const snapshot = snapshot_read(threads, friend_number);
+    const int ret = snapshot != nullptr ? snapshot->connection_status : -1;
+    pthread_rwlock_unlock(&threads->snapshot_lock);
+    return ret;
+}
+
+int tox_threads_friend_typing(Tox_Threads *threads, uint32_t friend_number)
+{
+    const Friend_Snapshot *const snapshot = snapshot_read(threads, friend_number);
+    int ret = -1;
+
+    if (snapshot != nullptr) {
+        ret = snapshot->typing ? 1 : 0;
+    }
+
+    pthread_rwlock_unlock(&threads->snapshot_lock);
+    return ret;
+}
+
+/** @brief Makes sure the friend number has a message id slot. Called with queue_lock held. */
+non_null()
+static bool message_ids_reserve(Tox_Threads *threads, uint32_t friend_number)
+{
+    if (friend_number < threads->num_message_ids) {
+        return true;
+    }
+
+    const uint32_t num = max_u32(friend_number + 1, threads->num_message_ids * 2);
+    uint32_t *ids = (uint32_t *)mem_vrealloc(threads->mem, threads->last_message_ids, num, sizeof(uint32_t));
+
+    if (ids == nullptr) {
+        return false;
+    }
+
+    memset(&ids[threads->num_message_ids], 0, (num - threads->num_message_ids) * sizeof(uint32_t));
+    threads->last_message_ids = ids;
+    threads->num_message_ids = num;
+    return true;
+}
+
+/** @brief Whether a message to the friend is queued before `end`. Called with queue_lock held. */
+nullable(1)
+static bool queued_before(const Queued_Message *msg, const Queued_Message *end, uint32_t friend_number)
+{
+    for (; msg != end; msg = msg->next) {
+        if (msg->friend_number == friend_number) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+non_null()
+static int queue_message(Tox_Threads *threads, uint32_t friend_number, uint8_t type, const uint8_t *message,
+                         uint32_t length, uint32_t *message_id)
+{
+    if (type > MESSAGE_ACTION) {
+        return -5;
+    }
+
+    const Friend_Snapshot *const snapshot = snapshot_read(threads, friend_number);
+    const bool exists = snapshot != nullptr;
+    const bool online = exists && snapshot->online;
+    pthread_rwlock_unlock(&threads->snapshot_lock);
+
+    if (!exists) {
+        return -1;
+    }
+
+    if (length >= MAX_CRYPTO_DATA_SIZE) {
+        return -2;
+    }
+
+    if (!online) {
+        return -3;
+    }
+
+    if (threads->queue_size >= MAX_QUEUED_MESSAGES || !message_ids_reserve(threads, friend_number)) {
+        return -4;
+    }
+
+    Queued_Message *const msg = (Queued_Message *)mem_alloc(threads->mem, sizeof(Queued_Message));
+
+    if (msg == nullptr) {
+        return -4;
+    }
+
+    msg->message = (uint8_t *)mem_balloc(threads->mem, length);
+
+    if (msg->message == nullptr) {
+        mem_delete(threads->mem, msg);
+        return -4;
+    }
+
+    memcpy(msg->message, message, length);
+    msg->length = length;
+    msg->type = type;
+    msg->friend_number = friend_number;
+    msg->message_id = ++threads->last_message_ids[friend_number];
+
+    if (threads->queue_tail == nullptr) {
+        threads->queue_head = msg;
+    } else {
+        threads->queue_tail->next = msg;
+    }
+
+    threads->queue_tail = msg;
+    ++threads->queue_size;
+
+    *message_id = msg->message_id;
+    return 0;
+}
+
+int tox_threads_queue_message(Tox_Threads *threads, uint32_t friend_number, uint8_t type, const uint8_t *message,
+                              uint32_t length, uint32_t *message_id)
+{
+    pthread_mutex_lock(&threads->queue_lock);
+    const int ret = queue_message(threads, friend_number, type, message, length, message_id);
+    pthread_mutex_unlock(&threads->queue_lock);
+    return ret;
+}
+
+/** @brief Decides whether a queued message is removed from the queue. */
+typedef bool queue_drop_cb(Tox_Threads *threads, const Queued_Message *msg, void *obj);
+
+/** @brief Removes the queued messages for which `drop` returns true, in order. Called with queue_lock held. */
+non_null()
+static void queue_filter(Tox_Threads *threads, queue_drop_cb *drop, void *obj)
+{
+    Queued_Message **pos = &threads->queue_head;
+    Queued_Message *last = nullptr;
+
+    while (*pos != nullptr) {
+        Queued_Message *const msg = *pos;
+
+        if (!drop(threads, msg, obj)) {
+            last = msg;
+            pos = &msg->next;
+            continue;
+        }
+
+        *pos = msg->next;
+        queued_message_free(threads->mem, msg);
+        --threads->queue_size;
+    }
+
+    threads->queue_tail = last;
+}
+
+/** @brief Sends a queued message unless it has to wait behind another one. Drops it if it is done. */
+non_null()
+static bool send_queued_message(Tox_Threads *threads, const Queued_Message *msg, void *obj)
+{
+    Messenger *const m = (Messenger *)obj;
+
+    // Messages to a friend whose send queue is full wait in order.
+    if (queued_before(threads->queue_head, msg, msg->friend_number)) {
+        return false;
+    }
+
+    // Other failures mean the friend went away, which loses the message like
+    // any other message that wasn't sent yet.
+    return m_send_message_with_id(m, msg->friend_number, msg->type, msg->message, msg->length, msg->message_id) != -4;
+}
+
+non_null()
+static bool same_friend(Tox_Threads *threads, const Queued_Message *msg, void *obj)
+{
+    return msg->friend_number == *(const uint32_t *)obj;
+}
+
+void tox_threads_send_queued(Tox_Threads *threads, Messenger *m)
+{
+    pthread_mutex_lock(&threads->queue_lock);
+    queue_filter(threads, send_queued_message, m);
+    pthread_mutex_unlock(&threads->queue_lock);
+}
+
+non_null()
+static int send_message(Tox_Threads *threads, Messenger *m, uint32_t friend_number, uint8_t type,
+                        const uint8_t *message, uint32_t length, uint32_t *message_id)
+{
+    queue_filter(threads, send_queued_message, m);
+
+    if (!m_friend_exists(m, friend_number)) {
+        return m_send_message_with_id(m, friend_number, type, message, length, 0);
+    }
+
+    if (!message_ids_reserve(threads, friend_number)) {
+        return -4;
+    }
+
+    if (queued_before(threads->queue_head, nullptr, friend_number)) {
+        // Still waiting for room in the friend's send queue, so this one would
+        // overtake them.
+        if (type > MESSAGE_ACTION) {
+            return -5;
+        }
+
+        if (length >= MAX_CRYPTO_DATA_SIZE) {
+            return -2;
+        }
+
+        return -4;
+    }
+
+    const uint32_t id = threads->last_message_ids[friend_number] + 1;
+    const int ret = m_send_message_with_id(m, friend_number, type, message, length, id);
+
+    if (ret == 0) {
+        threads->last_message_ids[friend_number] = id;
+        *message_id = id;
+    }
+
+    return ret;
+}
+
+int tox_threads_send_message(Tox_Threads *threads, Messenger *m, uint32_t friend_number, uint8_t type,
+                             const uint8_t *message, uint32_t length, uint32_t *message_id)
+{
+    pthread_mutex_lock(&threads->queue_lock);
+    const int ret = send_message(threads, m, friend_number, type, message, length, message_id);
+    pthread_mutex_unlock(&threads->queue_lock);
+    return ret;
+}
+
+void tox_threads_friend_reset(Tox_Threads *threads, uint32_t friend_number)
+{
+    pthread_mutex_lock(&threads->queue_lock);
+    queue_filter(threads, same_friend, &friend_number);
+
+    if (friend_number < threads->num_message_ids) {
+        threads->last_message_ids[friend_number] = 0;
+    }
+
+    pthread_mutex_unlock(&threads->queue_lock);
+}
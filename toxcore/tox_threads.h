@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2024 The TokTok team.
+ */
+
+/**
+ * State that lets threads use parts of the Tox API without waiting for the
+ * Tox lock, used with `experimental_thread_safety`.
+ *
+ * The thread holding the Tox lock (usually the one in tox_iterate) publishes
+ * copies of the friends' names, status messages, user statuses, typing and
+ * connection statuses whenever it releases the lock. Getters read those copies
+ * under a reader-writer lock instead of the Tox lock.
+ *
+ * Messages sent while another thread holds the Tox lock go into a queue with
+ * its own short-lived lock. They get their message ids right away and are
+ * sent in order when the thread holding the Tox lock releases it, or at the
+ * latest when the lock is released next.
+ */
+#ifndef C_TOXCORE_TOXCORE_TOX_THREADS_H
+#define C_TOXCORE_TOXCORE_TOX_THREADS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "Messenger.h"
+#include "attributes.h"
+#include "mem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Tox_Threads Tox_Threads;
+
+/**
+ * @brief Creates the state with no friends published.
+ * @return nullptr on allocation failure.
+ */
+non_null()
+Tox_Threads *tox_threads_new(const Memory *mem);
+
+/**
+ * @brief Frees the state and drops all queued messages.
+ * @param threads State to free or nullptr.
+ */
+nullable(1)
+void tox_threads_free(Tox_Threads *threads);
+
+/**
+ * @brief Publishes the info of all friends that changed since the last call.
+ *
+ * Must be called with the Tox lock held. Takes the changed friends from the
+ * Messenger, so the cost doesn't grow with the number of friends.
+ */
+non_null()
+void tox_threads_publish(Tox_Threads *threads, Messenger *m);
+
+/** @brief Whether the friend existed when friend info was last published. */
+non_null()
+bool tox_threads_friend_exists(Tox_Threads *threads, uint32_t friend_number);
+
+/**
+ * @brief Copies the published name of a friend.
+ *
+ * @param name Buffer of at least MAX_NAME_LENGTH bytes, or nullptr to only
+ *   get the length.
+ *
+ * @return the length of the name.
+ * @retval -1 if the friend doesn't exist.
+ */
+non_null(1) nullable(3)
+int tox_threads_friend_name(Tox_Threads *threads, uint32_t friend_number, uint8_t *name);
+
+/**
+ * @brief Copies the published status message of a friend.
+ *
+ * @param status_message Buffer of at least MAX_STATUSMESSAGE_LENGTH bytes, or
+ *   nullptr to only get the length.
+ *
+ * @return the length of the status message.
+ * @retval -1 if the friend doesn't exist.
+ */
+non_null(1) nullable(3)
+int tox_threads_friend_status_message(Tox_Threads *threads, uint32_t friend_number, uint8_t *status_message);
+
+/**
+ * @return the published user status of a friend, like m_get_userstatus.
+ * @retval USERSTATUS_INVALID if the friend doesn't exist.
+ */
+non_null()
+uint8_t tox_threads_friend_user_status(Tox_Threads *threads, uint32_t friend_number);
+
+/**
+ * @return the published connection status of a friend, like m_get_friend_connectionstatus.
+ * @retval -1 if the friend doesn't exist.
+ */
+non_null()
+int tox_threads_friend_connection_status(Tox_Threads *threads, uint32_t friend_number);
+
+/**
+ * @return 1 if the friend was typing when friend info was last published, 0 if not.
+ * @retval -1 if the friend doesn't exist.
+ */
+non_null()
+int tox_threads_friend_typing(Tox_Threads *threads, uint32_t friend_number);
+
+/**
+ * @brief Queues a message to be sent by the next thread that holds the Tox lock.
+ *
+ * For threads that don't hold the Tox lock. The friend's published info
+ * decides whether the message is accepted. A queued message is sent in
+ * tox_threads_send_queued, or dropped like any other unsent message if the
+ * friend went offline or was removed in the meantime.
+ *
+ * @return the same values as m_send_message_generic, with -4 meaning that the
+ *   queue is full.
+ */
+non_null(1, 4, 6)
+int tox_threads_queue_message(Tox_Threads *threads, uint32_t friend_number, uint8_t type, const uint8_t *message,
+                              uint32_t length, uint32_t *message_id);
+
+/**
+ * @brief Sends the queued messages, then sends a message right away.
+ *
+ * Must be called with the Tox lock held, instead of m_send_message_generic,
+ * so that the message gets its id in order with the queued ones.
+ *
+ * @return the same values as m_send_message_generic.
+ */
+non_null(1, 2, 5, 7)
+int tox_threads_send_message(Tox_Threads *threads, Messenger *m, uint32_t friend_number, uint8_t type,
+                             const uint8_t *message, uint32_t length, uint32_t *message_id);
+
+/**
+ * @brief Sends the queued messages.
+ *
+ * Must be called with the Tox lock held. Messages to friends whose send queue
+ * is full stay queued, in order, for the next call.
+ */
+non_null()
+void tox_threads_send_queued(Tox_Threads *threads, Messenger *m);
+
+/**
+ * @brief Forgets the queued messages and message ids of a friend number.
+ *
+ * Must be called with the Tox lock held whenever a friend is added, so that
+ * the new friend doesn't get messages queued for a removed friend that had
+ * the same number.
+ */
+non_null()
+void tox_threads_friend_reset(Tox_Threads *threads, uint32_t friend_number);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* C_TOXCORE_TOXCORE_TOX_THREADS_H */